@@ -0,0 +1,44 @@
+#include "CaptureSource.hpp"
+
+namespace CapUtils {
+
+    bool parseCaptureSourceType(const std::string& sourceName, CaptureSourceType& type) {
+        if (sourceName == "gdi") {
+            type = CaptureSourceType::GDI;
+        }
+        else if (sourceName == "synthetic") {
+            type = CaptureSourceType::SYNTHETIC;
+        }
+        else if (sourceName == "trace") {
+            type = CaptureSourceType::TRACE;
+        }
+        else if (sourceName == "x11") {
+            type = CaptureSourceType::X11;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    std::string getCaptureSourceTypeString(CaptureSourceType type) {
+        std::string result = "";
+        switch (type) {
+        case CaptureSourceType::GDI:
+            result = "GDI";
+            break;
+        case CaptureSourceType::SYNTHETIC:
+            result = "SYNTHETIC";
+            break;
+        case CaptureSourceType::TRACE:
+            result = "TRACE";
+            break;
+        case CaptureSourceType::X11:
+            result = "X11";
+            break;
+        default:
+            break;
+        }
+        return result;
+    }
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "FramePool.hpp"
+
+#include <string>
+
+namespace CapUtils {
+
+    /*
+    * Backends that can deliver frames to the screen recording thread
+    */
+    enum class CaptureSourceType {
+        GDI = 0,       // Desktop region grabbed through GDI BitBlt and GetDIBits
+        SYNTHETIC = 1, // Deterministic rendered scene, needs no display
+        TRACE = 2,     // Replay of a recorded capture trace
+        X11 = 3        // X11 root window grabbed through MIT-SHM, Linux only, recorded by X11Record
+    };
+
+    /**
+     * Helper function to parse capture source type from its config file name
+     *
+     * @param sourceName
+     *     One of "gdi", "synthetic", "trace" or "x11"
+     *
+     * @param type
+     *     Receives the parsed type
+     *
+     * @return  True if sourceName is a known capture source.
+     */
+    bool parseCaptureSourceType(const std::string& sourceName, CaptureSourceType& type);
+
+    /**
+     * Helper function to get capture source type in string format to be used for logging purposes
+     */
+    std::string getCaptureSourceTypeString(CaptureSourceType type);
+
+    /*
+    * Source of captured frames. Frames are grabbed into buffers of a FramePool created from the size, pixel format
+    * and row alignment reported by the source, so backends write their pixels straight into pooled memory.
+    * Besides pixels, a backend sets the capture timestamp and, if it knows them, the move and dirty rects since
+    * its previous frame. Grabbing happens on the screen recording thread only.
+    */
+    class CaptureSource {
+
+    public:
+        CaptureSource() = default;
+
+        virtual ~CaptureSource() = default;
+
+        /*
+        * @name Copy and move
+        *
+        * No copying and moving allowed. Backends hold handles of the system they capture from
+        */
+        CaptureSource(const CaptureSource&) = delete;
+        CaptureSource& operator=(const CaptureSource&) = delete;
+
+        CaptureSource(CaptureSource&&) = delete;
+        CaptureSource& operator=(CaptureSource&&) = delete;
+
+        /**
+         * Grab the next frame
+         *
+         * @param frame
+         *     Pooled frame buffer of getWidth() x getHeight() pixels in getPixelFormat() that receives the pixels,
+         *     the timestamp, the rect metadata and the cursor. Its sequence is set to the number of frames grabbed before.
+         *
+         * @return  False if no frame could be grabbed. Frame content is undefined in that case.
+         */
+        bool grab(FrameBuffer& frame) {
+            frame.rects.valid = false;
+            frame.rects.moveRects.clear();
+            frame.rects.dirtyRects.clear();
+            frame.cursor = FrameCursor();
+            if (!grabFrame(frame)) {
+                return false;
+            }
+            frame.sequence = grabbedFrameCount++;
+            return true;
+        }
+
+        virtual CaptureSourceType getType() const = 0;
+
+        virtual int getWidth() const = 0;
+
+        virtual int getHeight() const = 0;
+
+        virtual FramePixelFormat getPixelFormat() const = 0;
+
+        /*
+        * Row alignment in bytes the frame buffers need to have
+        */
+        virtual int getRowAlignment() const = 0;
+
+        /*
+        * True if grabs wait for frames to become due by themselves and are to be issued back to back,
+        * instead of being driven by the recording timer at the configured frame rate
+        */
+        virtual bool isSelfPaced() const {
+            return false;
+        }
+
+        /*
+        * Called when the recording timer changes the rate grabs are driven at. Sources stamping frames with the clock
+        * have nothing to do, sources deriving timestamps from the frame rate continue them at the new one
+        */
+        virtual void setFrameRate(int /*fps*/) {
+        }
+
+        /*
+        * Allocator of the pixel memory the frame pool has to use for this source. nullptr if heap memory will do
+        */
+        virtual FrameMemoryAllocator* getFrameAllocator() {
+            return nullptr;
+        }
+
+        /*
+        * True once the source has delivered its last frame. Live sources never run out of frames
+        */
+        virtual bool isExhausted() const {
+            return false;
+        }
+
+        int64_t getGrabbedFrameCount() const {
+            return grabbedFrameCount;
+        }
+
+    protected:
+
+        /**
+         * Backend specific grabbing. Rect metadata and cursor of frame are cleared and marked invalid on entry.
+         *
+         * @return  False if no frame could be grabbed.
+         */
+        virtual bool grabFrame(FrameBuffer& frame) = 0;
+
+    private:
+        int64_t grabbedFrameCount = 0; // Number of frames grabbed successfully
+    };
+}
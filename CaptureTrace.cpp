@@ -0,0 +1,485 @@
+#include "CaptureTrace.hpp"
+
+#include <cstring>
+#include <limits>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace CapUtils {
+
+    namespace {
+
+        constexpr std::size_t kMinZeroRun = 4; // Shorter runs of unchanged bytes are cheaper to keep in a literal
+        constexpr std::size_t kMoveRectBytes = 6 * sizeof(int32_t);
+        constexpr std::size_t kDirtyRectBytes = 4 * sizeof(int32_t);
+
+        static_assert(sizeof(CaptureTraceFileHeader) == 40, "Trace file header layout changed");
+        static_assert(sizeof(CaptureTraceFrameHeader) == 48, "Trace frame header layout changed");
+        static_assert(sizeof(CaptureTraceTileHeader) == 12, "Trace tile header layout changed");
+
+        void appendBytes(std::vector<uint8_t>& buffer, const void* data, std::size_t size) {
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            buffer.insert(buffer.end(), bytes, bytes + size);
+        }
+
+        void appendVarint(std::vector<uint8_t>& buffer, std::size_t value) {
+            while (value >= 0x80) {
+                buffer.push_back(static_cast<uint8_t>(value | 0x80));
+                value >>= 7;
+            }
+            buffer.push_back(static_cast<uint8_t>(value));
+        }
+
+        bool readVarint(const uint8_t*& data, const uint8_t* end, std::size_t& value) {
+            value = 0;
+            for (int shift = 0; shift < 35 && data < end; shift += 7) {
+                const uint8_t byte = *data++;
+                value |= static_cast<std::size_t>(byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /*
+        * Run length encode the XOR of a tile with its previous content. Zero bytes are unchanged ones.
+        */
+        void encodeXorRle(const uint8_t* delta, std::size_t size, std::vector<uint8_t>& buffer) {
+            std::size_t position = 0;
+            while (position < size) {
+                std::size_t literalStart = position;
+                while (literalStart < size && delta[literalStart] == 0) {
+                    ++literalStart;
+                }
+
+                // Literal ends at the first zero run worth a token of its own
+                std::size_t literalEnd = literalStart;
+                while (literalEnd < size) {
+                    if (delta[literalEnd] != 0) {
+                        ++literalEnd;
+                        continue;
+                    }
+                    std::size_t zeroEnd = literalEnd;
+                    while (zeroEnd < size && delta[zeroEnd] == 0) {
+                        ++zeroEnd;
+                    }
+                    if (zeroEnd - literalEnd >= kMinZeroRun || zeroEnd == size) {
+                        break;
+                    }
+                    literalEnd = zeroEnd;
+                }
+
+                appendVarint(buffer, literalStart - position);
+                appendVarint(buffer, literalEnd - literalStart);
+                appendBytes(buffer, delta + literalStart, literalEnd - literalStart);
+                position = literalEnd;
+            }
+        }
+
+        /*
+        * Apply a run length encoded XOR delta to the rows of a tile
+        */
+        bool decodeXorRle(const uint8_t* data, const uint8_t* end, uint8_t* tile, int stride, std::size_t tileRowBytes,
+                          std::size_t size) {
+            std::size_t position = 0;
+            while (data < end) {
+                std::size_t zeroRun = 0;
+                std::size_t literalLength = 0;
+                if (!readVarint(data, end, zeroRun) || !readVarint(data, end, literalLength) ||
+                    zeroRun > size - position || literalLength > size - position - zeroRun ||
+                    literalLength > static_cast<std::size_t>(end - data)) {
+                    return false;
+                }
+                position += zeroRun;
+                while (literalLength > 0) {
+                    const std::size_t row = position / tileRowBytes;
+                    const std::size_t column = position % tileRowBytes;
+                    const std::size_t chunk = (tileRowBytes - column < literalLength) ? tileRowBytes - column : literalLength;
+                    uint8_t* target = tile + row * stride + column;
+                    for (std::size_t i = 0; i < chunk; ++i) {
+                        target[i] ^= data[i];
+                    }
+                    data += chunk;
+                    position += chunk;
+                    literalLength -= chunk;
+                }
+            }
+            return true;
+        }
+
+        bool isInside(const FrameRect& rect, int width, int height) {
+            return rect.left >= 0 && rect.top >= 0 && rect.left <= rect.right && rect.top <= rect.bottom &&
+                   rect.right <= width && rect.bottom <= height;
+        }
+
+        bool areRectsInside(const FrameRectMetadata& rects, int width, int height) {
+            for (const auto& move : rects.moveRects) {
+                const FrameRect source = { move.sourceX, move.sourceY,
+                                           move.sourceX + (move.destination.right - move.destination.left),
+                                           move.sourceY + (move.destination.bottom - move.destination.top) };
+                if (!isInside(move.destination, width, height) || !isInside(source, width, height)) {
+                    return false;
+                }
+            }
+            for (const auto& dirty : rects.dirtyRects) {
+                if (!isInside(dirty, width, height)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    bool CaptureTraceWriter::open(const std::string& fileName, int width, int height, FramePixelFormat pixelFormat) {
+        close();
+        if (width <= 0 || height <= 0) {
+            return false;
+        }
+
+        traceFile.open(fileName, std::ios::binary | std::ios::trunc);
+        if (!traceFile.is_open()) {
+            return false;
+        }
+
+        fileHeader = CaptureTraceFileHeader();
+        fileHeader.width = width;
+        fileHeader.height = height;
+        fileHeader.pixelFormat = static_cast<int32_t>(pixelFormat);
+        bytesPerPixel = getBytesPerPixel(pixelFormat);
+        rowBytes = width * bytesPerPixel;
+        previousImage.assign(static_cast<std::size_t>(rowBytes) * height, 0);
+        frameCount = 0;
+
+        traceFile.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+        writtenBytes = sizeof(fileHeader);
+        if (!traceFile.good()) {
+            traceFile.close();
+            return false;
+        }
+        return true;
+    }
+
+    bool CaptureTraceWriter::writeFrame(const FrameBuffer& frame) {
+        if (!isOpen() || frame.width != fileHeader.width || frame.height != fileHeader.height ||
+            frame.pixelFormat != static_cast<FramePixelFormat>(fileHeader.pixelFormat)) {
+            return false;
+        }
+
+        CaptureTraceFrameHeader header;
+        header.timestamp = frame.timestamp;
+        header.sequence = frame.sequence;
+        recordBuffer.resize(sizeof(header));
+
+        if (frame.rects.valid && areRectsInside(frame.rects, frame.width, frame.height)) {
+            header.flags |= kCaptureTraceRectsValid;
+            header.moveCount = static_cast<uint32_t>(frame.rects.moveRects.size());
+            header.dirtyCount = static_cast<uint32_t>(frame.rects.dirtyRects.size());
+            for (const auto& move : frame.rects.moveRects) {
+                const int32_t values[6] = { move.sourceX, move.sourceY, move.destination.left, move.destination.top,
+                                            move.destination.right, move.destination.bottom };
+                appendBytes(recordBuffer, values, sizeof(values));
+            }
+            for (const auto& dirty : frame.rects.dirtyRects) {
+                const int32_t values[4] = { dirty.left, dirty.top, dirty.right, dirty.bottom };
+                appendBytes(recordBuffer, values, sizeof(values));
+            }
+        }
+
+        if (frame.cursor.valid) {
+            header.flags |= kCaptureTraceCursorValid | (frame.cursor.visible ? kCaptureTraceCursorVisible : 0);
+            header.cursorX = frame.cursor.x;
+            header.cursorY = frame.cursor.y;
+        }
+
+        const int tileSize = fileHeader.tileSize;
+        const int columns = (frame.width + tileSize - 1) / tileSize;
+        const int rows = (frame.height + tileSize - 1) / tileSize;
+        for (int tileRow = 0; tileRow < rows; ++tileRow) {
+            const int tileY = tileRow * tileSize;
+            const int tileHeight = (frame.height - tileY < tileSize) ? frame.height - tileY : tileSize;
+            for (int tileColumn = 0; tileColumn < columns; ++tileColumn) {
+                const int tileX = tileColumn * tileSize;
+                const int tileWidth = (frame.width - tileX < tileSize) ? frame.width - tileX : tileSize;
+                const std::size_t tileRowBytes = static_cast<std::size_t>(tileWidth) * bytesPerPixel;
+
+                bool changed = false;
+                for (int y = tileY; y < tileY + tileHeight && !changed; ++y) {
+                    const uint8_t* current = frame.data + static_cast<std::size_t>(y) * frame.stride + tileX * bytesPerPixel;
+                    const uint8_t* previous = previousImage.data() + static_cast<std::size_t>(y) * rowBytes + tileX * bytesPerPixel;
+                    changed = std::memcmp(current, previous, tileRowBytes) != 0;
+                }
+                if (changed) {
+                    appendTile(frame, tileRow * columns + tileColumn, tileX, tileY, tileWidth, tileHeight);
+                    ++header.tileCount;
+                }
+            }
+        }
+
+        if (recordBuffer.size() > std::numeric_limits<uint32_t>::max()) {
+            close();
+            return false;
+        }
+        header.recordSize = static_cast<uint32_t>(recordBuffer.size());
+        std::memcpy(recordBuffer.data(), &header, sizeof(header));
+
+        traceFile.write(reinterpret_cast<const char*>(recordBuffer.data()), static_cast<std::streamsize>(recordBuffer.size()));
+        if (!traceFile.good()) {
+            // Frames after a failed write could not be decoded, so the trace ends here
+            close();
+            return false;
+        }
+        writtenBytes += static_cast<int64_t>(recordBuffer.size());
+        ++frameCount;
+        return true;
+    }
+
+    void CaptureTraceWriter::appendTile(const FrameBuffer& frame, int tileIndex, int tileX, int tileY, int tileWidth, int tileHeight) {
+        const std::size_t tileRowBytes = static_cast<std::size_t>(tileWidth) * bytesPerPixel;
+        const std::size_t tileBytes = tileRowBytes * tileHeight;
+
+        // XOR with the previous content while moving the new content into previousImage
+        currentTile.resize(tileBytes);
+        for (int row = 0; row < tileHeight; ++row) {
+            const uint8_t* current = frame.data + static_cast<std::size_t>(tileY + row) * frame.stride + tileX * bytesPerPixel;
+            uint8_t* previous = previousImage.data() + static_cast<std::size_t>(tileY + row) * rowBytes + tileX * bytesPerPixel;
+            uint8_t* delta = currentTile.data() + row * tileRowBytes;
+            for (std::size_t i = 0; i < tileRowBytes; ++i) {
+                delta[i] = current[i] ^ previous[i];
+            }
+            std::memcpy(previous, current, tileRowBytes);
+        }
+
+        const std::size_t headerOffset = recordBuffer.size();
+        CaptureTraceTileHeader tileHeader;
+        tileHeader.tileIndex = static_cast<uint32_t>(tileIndex);
+        tileHeader.encoding = kCaptureTraceTileXorRle;
+        appendBytes(recordBuffer, &tileHeader, sizeof(tileHeader));
+        encodeXorRle(currentTile.data(), tileBytes, recordBuffer);
+
+        // Tiles that hardly compress, e.g. the ones of the first frame or of video, are stored as they are
+        if (recordBuffer.size() - headerOffset - sizeof(tileHeader) >= tileBytes) {
+            recordBuffer.resize(headerOffset + sizeof(tileHeader));
+            tileHeader.encoding = kCaptureTraceTileRaw;
+            for (int row = 0; row < tileHeight; ++row) {
+                appendBytes(recordBuffer, previousImage.data() + static_cast<std::size_t>(tileY + row) * rowBytes + tileX * bytesPerPixel,
+                            tileRowBytes);
+            }
+        }
+        tileHeader.payloadSize = static_cast<uint32_t>(recordBuffer.size() - headerOffset - sizeof(tileHeader));
+        std::memcpy(recordBuffer.data() + headerOffset, &tileHeader, sizeof(tileHeader));
+    }
+
+    void CaptureTraceWriter::close() {
+        if (!traceFile.is_open()) {
+            return;
+        }
+        fileHeader.frameCount = frameCount;
+        traceFile.seekp(0);
+        traceFile.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+        traceFile.close();
+    }
+
+    bool CaptureTraceReader::open(const std::string& fileName) {
+        close();
+
+#ifdef _WIN32
+        HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(CaptureTraceFileHeader))) {
+            CloseHandle(file);
+            return false;
+        }
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (view == nullptr) {
+            if (mapping) {
+                CloseHandle(mapping);
+            }
+            CloseHandle(file);
+            return false;
+        }
+        fileHandle = file;
+        mappingHandle = mapping;
+        mappedSize = static_cast<std::size_t>(fileSize.QuadPart);
+#else
+        const int file = ::open(fileName.c_str(), O_RDONLY);
+        if (file < 0) {
+            return false;
+        }
+        struct stat fileStat;
+        if (fstat(file, &fileStat) != 0 || fileStat.st_size < static_cast<off_t>(sizeof(CaptureTraceFileHeader))) {
+            ::close(file);
+            return false;
+        }
+        void* view = mmap(nullptr, static_cast<std::size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+        ::close(file);
+        if (view == MAP_FAILED) {
+            return false;
+        }
+        madvise(view, static_cast<std::size_t>(fileStat.st_size), MADV_SEQUENTIAL);
+        mappedSize = static_cast<std::size_t>(fileStat.st_size);
+#endif
+        mappedData = static_cast<const uint8_t*>(view);
+
+        std::memcpy(&fileHeader, mappedData, sizeof(fileHeader));
+        const CaptureTraceFileHeader expectedHeader;
+        const bool validHeader = std::memcmp(fileHeader.magic, expectedHeader.magic, sizeof(fileHeader.magic)) == 0 &&
+                                 fileHeader.version == kCaptureTraceVersion &&
+                                 fileHeader.headerSize >= sizeof(CaptureTraceFileHeader) && fileHeader.headerSize <= mappedSize &&
+                                 fileHeader.width > 0 && fileHeader.height > 0 && fileHeader.tileSize > 0 &&
+                                 (fileHeader.pixelFormat == static_cast<int32_t>(FramePixelFormat::BGR24) ||
+                                  fileHeader.pixelFormat == static_cast<int32_t>(FramePixelFormat::BGRA));
+        if (!validHeader) {
+            close();
+            return false;
+        }
+
+        indexRecords();
+        return true;
+    }
+
+    void CaptureTraceReader::indexRecords() {
+        recordOffsets.clear();
+        std::size_t offset = fileHeader.headerSize;
+        while (mappedSize - offset >= sizeof(CaptureTraceFrameHeader)) {
+            CaptureTraceFrameHeader header;
+            std::memcpy(&header, mappedData + offset, sizeof(header));
+            if (header.recordSize < sizeof(header) || header.recordSize > mappedSize - offset) {
+                break;
+            }
+            recordOffsets.push_back(offset);
+            offset += header.recordSize;
+            if (fileHeader.frameCount > 0 && static_cast<int64_t>(recordOffsets.size()) == fileHeader.frameCount) {
+                break;
+            }
+        }
+    }
+
+    void CaptureTraceReader::close() {
+        if (mappedData != nullptr) {
+#ifdef _WIN32
+            UnmapViewOfFile(mappedData);
+            CloseHandle(static_cast<HANDLE>(mappingHandle));
+            CloseHandle(static_cast<HANDLE>(fileHandle));
+#else
+            munmap(const_cast<uint8_t*>(mappedData), mappedSize);
+#endif
+        }
+        mappedData = nullptr;
+        mappedSize = 0;
+        fileHandle = nullptr;
+        mappingHandle = nullptr;
+        recordOffsets.clear();
+    }
+
+    int64_t CaptureTraceReader::getTimestamp(int64_t index) const {
+        if (index < 0 || index >= getFrameCount()) {
+            return 0;
+        }
+        CaptureTraceFrameHeader header;
+        std::memcpy(&header, mappedData + recordOffsets[static_cast<std::size_t>(index)], sizeof(header));
+        return header.timestamp;
+    }
+
+    bool CaptureTraceReader::readFrame(int64_t index, FrameBuffer& image) const {
+        if (index < 0 || index >= getFrameCount() || image.width != fileHeader.width || image.height != fileHeader.height ||
+            image.pixelFormat != getPixelFormat()) {
+            return false;
+        }
+
+        const uint8_t* data = mappedData + recordOffsets[static_cast<std::size_t>(index)];
+        CaptureTraceFrameHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        const uint8_t* end = data + header.recordSize;
+        data += sizeof(header);
+
+        const int bytesPerPixel = getBytesPerPixel(getPixelFormat());
+        if (index == 0) {
+            // First frame is a delta against black
+            for (int y = 0; y < image.height; ++y) {
+                std::memset(image.data + static_cast<std::size_t>(y) * image.stride, 0, static_cast<std::size_t>(image.width) * bytesPerPixel);
+            }
+        }
+
+        const std::size_t rectBytes = header.moveCount * kMoveRectBytes + header.dirtyCount * kDirtyRectBytes;
+        if (rectBytes > static_cast<std::size_t>(end - data)) {
+            return false;
+        }
+        image.rects.valid = (header.flags & kCaptureTraceRectsValid) != 0;
+        image.rects.moveRects.resize(header.moveCount);
+        image.rects.dirtyRects.resize(header.dirtyCount);
+        for (auto& move : image.rects.moveRects) {
+            int32_t values[6];
+            std::memcpy(values, data, sizeof(values));
+            data += sizeof(values);
+            move.sourceX = values[0];
+            move.sourceY = values[1];
+            move.destination = { values[2], values[3], values[4], values[5] };
+        }
+        for (auto& dirty : image.rects.dirtyRects) {
+            int32_t values[4];
+            std::memcpy(values, data, sizeof(values));
+            data += sizeof(values);
+            dirty = { values[0], values[1], values[2], values[3] };
+        }
+        if (!areRectsInside(image.rects, image.width, image.height)) {
+            return false;
+        }
+
+        image.cursor.valid = (header.flags & kCaptureTraceCursorValid) != 0;
+        image.cursor.visible = (header.flags & kCaptureTraceCursorVisible) != 0;
+        image.cursor.x = header.cursorX;
+        image.cursor.y = header.cursorY;
+        image.timestamp = header.timestamp;
+
+        const int tileSize = fileHeader.tileSize;
+        const int columns = (image.width + tileSize - 1) / tileSize;
+        const int rows = (image.height + tileSize - 1) / tileSize;
+        for (uint32_t i = 0; i < header.tileCount; ++i) {
+            CaptureTraceTileHeader tileHeader;
+            if (static_cast<std::size_t>(end - data) < sizeof(tileHeader)) {
+                return false;
+            }
+            std::memcpy(&tileHeader, data, sizeof(tileHeader));
+            data += sizeof(tileHeader);
+            if (tileHeader.tileIndex >= static_cast<uint32_t>(columns) * static_cast<uint32_t>(rows) ||
+                tileHeader.payloadSize > static_cast<std::size_t>(end - data)) {
+                return false;
+            }
+
+            const int tileX = static_cast<int>(tileHeader.tileIndex % columns) * tileSize;
+            const int tileY = static_cast<int>(tileHeader.tileIndex / columns) * tileSize;
+            const int tileWidth = (image.width - tileX < tileSize) ? image.width - tileX : tileSize;
+            const int tileHeight = (image.height - tileY < tileSize) ? image.height - tileY : tileSize;
+            const std::size_t tileRowBytes = static_cast<std::size_t>(tileWidth) * bytesPerPixel;
+            uint8_t* tile = image.data + static_cast<std::size_t>(tileY) * image.stride + static_cast<std::size_t>(tileX) * bytesPerPixel;
+
+            if (tileHeader.encoding == kCaptureTraceTileRaw) {
+                if (tileHeader.payloadSize != tileRowBytes * tileHeight) {
+                    return false;
+                }
+                for (int row = 0; row < tileHeight; ++row) {
+                    std::memcpy(tile + static_cast<std::size_t>(row) * image.stride, data + row * tileRowBytes, tileRowBytes);
+                }
+            }
+            else if (tileHeader.encoding != kCaptureTraceTileXorRle ||
+                     !decodeXorRle(data, data + tileHeader.payloadSize, tile, image.stride, tileRowBytes, tileRowBytes * tileHeight)) {
+                return false;
+            }
+            data += tileHeader.payloadSize;
+        }
+        return data == end;
+    }
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include "FramePool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace CapUtils {
+
+    constexpr uint32_t kCaptureTraceVersion = 1; // Bumped whenever the layout below changes
+    constexpr int kCaptureTraceTileSize = 64; // Edge in pixels of the tiles pixel deltas are stored for
+
+    /*
+    * A capture trace records what the capture layer saw, so that a session can be replayed bit for bit into
+    * the encode pipeline. All integers are little endian, which is what every supported target writes natively.
+    *
+    * The file starts with a CaptureTraceFileHeader, followed by one record per grabbed frame:
+    *   CaptureTraceFrameHeader
+    *   moveCount x FrameMoveRect, dirtyCount x FrameRect (six and four int32 each)
+    *   tileCount x (CaptureTraceTileHeader followed by payloadSize bytes)
+    *
+    * Pixels are stored as deltas against the previous record. Only tiles that changed are written, each either
+    * raw or as its XOR with the previous tile, run length encoded as pairs of varint zero run and varint literal
+    * length followed by the literal bytes. The first record is a delta against a black frame.
+    */
+    struct CaptureTraceFileHeader {
+        char magic[8] = { 'C', 'A', 'P', 'T', 'R', 'A', 'C', 'E' };
+        uint32_t version = kCaptureTraceVersion;
+        uint32_t headerSize = sizeof(CaptureTraceFileHeader); // Offset of the first frame record
+        int32_t width = 0; // Frame width in pixels
+        int32_t height = 0; // Frame height in pixels
+        int32_t pixelFormat = 0; // FramePixelFormat of the frames
+        int32_t tileSize = kCaptureTraceTileSize; // Tile edge in pixels
+        int64_t frameCount = 0; // Number of frame records. Zero if the writer did not close the trace
+    };
+
+    struct CaptureTraceFrameHeader {
+        uint32_t recordSize = 0; // Bytes of the whole record including this header
+        uint32_t flags = 0; // Combination of kCaptureTraceRectsValid, kCaptureTraceCursorValid and kCaptureTraceCursorVisible
+        int64_t timestamp = 0; // Capture time in microseconds
+        int64_t sequence = 0; // Sequence number of the frame at the capture source
+        int32_t cursorX = 0; // Cursor position in frame coordinates
+        int32_t cursorY = 0;
+        uint32_t moveCount = 0; // Number of move rects
+        uint32_t dirtyCount = 0; // Number of dirty rects
+        uint32_t tileCount = 0; // Number of changed tiles
+        uint32_t reserved = 0;
+    };
+
+    struct CaptureTraceTileHeader {
+        uint32_t tileIndex = 0; // Tile in row order
+        uint32_t encoding = 0; // One of kCaptureTraceTileRaw or kCaptureTraceTileXorRle
+        uint32_t payloadSize = 0; // Bytes following this header
+    };
+
+    constexpr uint32_t kCaptureTraceRectsValid = 1u << 0;
+    constexpr uint32_t kCaptureTraceCursorValid = 1u << 1;
+    constexpr uint32_t kCaptureTraceCursorVisible = 1u << 2;
+
+    constexpr uint32_t kCaptureTraceTileRaw = 0;
+    constexpr uint32_t kCaptureTraceTileXorRle = 1;
+
+    /*
+    * Writes grabbed frames to a capture trace. Keeps a copy of the last written frame to find the tiles that
+    * changed, so recording costs a compare of every frame plus the encoding of what changed on the calling thread.
+    * Grabbing threads record through a CaptureTraceRecorder instead, which runs the writer on a thread of its own.
+    */
+    class CaptureTraceWriter {
+
+    public:
+        CaptureTraceWriter() = default;
+
+        ~CaptureTraceWriter() {
+            close();
+        }
+
+        /*
+        * @name Copy and move
+        *
+        * No copying and moving allowed. Writer owns the open trace file
+        */
+        CaptureTraceWriter(const CaptureTraceWriter&) = delete;
+        CaptureTraceWriter& operator=(const CaptureTraceWriter&) = delete;
+
+        CaptureTraceWriter(CaptureTraceWriter&&) = delete;
+        CaptureTraceWriter& operator=(CaptureTraceWriter&&) = delete;
+
+        /**
+         * Create the trace file, replacing any existing one
+         *
+         * @param fileName
+         *     Path of the trace file
+         *
+         * @param width
+         *     Width of every frame to be written
+         *
+         * @param height
+         *     Height of every frame to be written
+         *
+         * @param pixelFormat
+         *     Pixel layout of every frame to be written
+         *
+         * @return  False if the file cannot be created or the frame size is invalid.
+         */
+        bool open(const std::string& fileName, int width, int height, FramePixelFormat pixelFormat);
+
+        /**
+         * Append a frame along with its timestamp, sequence, rects and cursor
+         *
+         * @param frame
+         *     Frame of the size and pixel format the trace was opened with. Rects are recorded as invalid if any
+         *     of them lies outside of the frame.
+         *
+         * @return  False if the trace is not open, the frame does not match it or writing failed.
+         */
+        bool writeFrame(const FrameBuffer& frame);
+
+        /*
+        * Store the frame count in the file header and close the file. Does nothing if the trace is not open.
+        */
+        void close();
+
+        bool isOpen() const {
+            return traceFile.is_open();
+        }
+
+        int64_t getFrameCount() const {
+            return frameCount;
+        }
+
+        /*
+        * Bytes written to the trace file so far
+        */
+        int64_t getWrittenBytes() const {
+            return writtenBytes;
+        }
+
+    private:
+
+        /**
+         * Internal helper function to append the delta of a changed tile to recordBuffer and store the tile
+         * in previousImage
+         */
+        void appendTile(const FrameBuffer& frame, int tileIndex, int tileX, int tileY, int tileWidth, int tileHeight);
+
+        std::ofstream traceFile;
+        CaptureTraceFileHeader fileHeader;
+        int rowBytes = 0; // Bytes of a tightly packed row
+        int bytesPerPixel = 0;
+        std::vector<uint8_t> previousImage; // Last written frame with tightly packed rows
+        std::vector<uint8_t> currentTile; // Scratch copy of a changed tile. Capacity is kept
+        std::vector<uint8_t> recordBuffer; // Record being assembled. Capacity is kept
+        int64_t frameCount = 0;
+        int64_t writtenBytes = 0;
+    };
+
+    /*
+    * Reads a capture trace through a read only memory mapping of the file. Tile payloads are decoded straight out
+    * of the mapping into the caller's frame, so no part of the trace is copied before it is applied.
+    */
+    class CaptureTraceReader {
+
+    public:
+        CaptureTraceReader() = default;
+
+        ~CaptureTraceReader() {
+            close();
+        }
+
+        /*
+        * @name Copy and move
+        *
+        * No copying and moving allowed. Reader owns the file mapping
+        */
+        CaptureTraceReader(const CaptureTraceReader&) = delete;
+        CaptureTraceReader& operator=(const CaptureTraceReader&) = delete;
+
+        CaptureTraceReader(CaptureTraceReader&&) = delete;
+        CaptureTraceReader& operator=(CaptureTraceReader&&) = delete;
+
+        /**
+         * Map a trace file and index its frame records. A trace that was not closed by its writer is read up to
+         * its last complete record.
+         *
+         * @param fileName
+         *     Path of the trace file
+         *
+         * @return  False if the file cannot be mapped or is not a trace of a supported version.
+         */
+        bool open(const std::string& fileName);
+
+        /*
+        * Unmap the trace. Does nothing if no trace is open.
+        */
+        void close();
+
+        int getWidth() const {
+            return fileHeader.width;
+        }
+
+        int getHeight() const {
+            return fileHeader.height;
+        }
+
+        FramePixelFormat getPixelFormat() const {
+            return static_cast<FramePixelFormat>(fileHeader.pixelFormat);
+        }
+
+        int64_t getFrameCount() const {
+            return static_cast<int64_t>(recordOffsets.size());
+        }
+
+        /**
+         * Get the capture timestamp of a frame without decoding it
+         */
+        int64_t getTimestamp(int64_t index) const;
+
+        /**
+         * Decode a frame on top of its predecessor
+         *
+         * @param index
+         *     Frame to be decoded
+         *
+         * @param image
+         *     Frame of the trace size and pixel format. Has to hold frame index - 1 unless index is zero.
+         *     Receives the pixels, timestamp, rects and cursor of frame index. Sequence is left alone.
+         *
+         * @return  False if the record is corrupt. Image content is undefined in that case.
+         */
+        bool readFrame(int64_t index, FrameBuffer& image) const;
+
+    private:
+
+        /**
+         * Internal helper function to walk the records and collect their offsets
+         */
+        void indexRecords();
+
+        const uint8_t* mappedData = nullptr; // Read only view of the whole file
+        std::size_t mappedSize = 0;
+        void* fileHandle = nullptr; // Platform handles kept alive while mapped
+        void* mappingHandle = nullptr;
+        CaptureTraceFileHeader fileHeader;
+        std::vector<std::size_t> recordOffsets; // Offset of every complete frame record
+    };
+}
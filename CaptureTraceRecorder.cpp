@@ -0,0 +1,115 @@
+#include "CaptureTraceRecorder.hpp"
+
+#include <chrono>
+#include <cstring>
+
+namespace CapUtils {
+
+    // Writer thread is woken up by every queued frame. The timeout only bounds the wait if it is idle
+    constexpr std::chrono::milliseconds kTraceWriterIdleWait(100);
+
+    bool CaptureTraceRecorder::open(const std::string& fileName, int frameWidth, int frameHeight, FramePixelFormat framePixelFormat) {
+        close();
+        if (!traceWriter.open(fileName, frameWidth, frameHeight, framePixelFormat)) {
+            return false;
+        }
+
+        width = frameWidth;
+        height = frameHeight;
+        pixelFormat = framePixelFormat;
+        framePool = std::make_unique<FramePool>(width, height, pixelFormat, 4, 1, kCaptureTraceQueueCapacity);
+        queuedFrames = std::make_unique<SPSCRingBuffer<FrameBuffer*>>(kCaptureTraceQueueCapacity);
+        droppedFrames = 0;
+        dropPending = false;
+        closing = false;
+        writeFailed = false;
+        writtenFrames = 0;
+        writtenBytes = traceWriter.getWrittenBytes();
+
+        writerThread = std::thread(&CaptureTraceRecorder::runWriter, this);
+        return true;
+    }
+
+    bool CaptureTraceRecorder::recordFrame(const FrameBuffer& frame) {
+        if (!isOpen() || writeFailed || frame.width != width || frame.height != height || frame.pixelFormat != pixelFormat) {
+            return false;
+        }
+
+        FrameBuffer* copy = framePool->acquire();
+        if (!copy) {
+            ++droppedFrames;
+            dropPending = true;
+            return true;
+        }
+
+        const std::size_t rowBytes = static_cast<std::size_t>(width) * getBytesPerPixel(pixelFormat);
+        for (int y = 0; y < height; ++y) {
+            std::memcpy(copy->data + static_cast<std::size_t>(y) * copy->stride,
+                        frame.data + static_cast<std::size_t>(y) * frame.stride, rowBytes);
+        }
+        copy->timestamp = frame.timestamp;
+        copy->sequence = frame.sequence;
+        copy->cursor = frame.cursor;
+        copy->rects.valid = frame.rects.valid && !dropPending;
+        copy->rects.moveRects.assign(frame.rects.moveRects.begin(), frame.rects.moveRects.end());
+        copy->rects.dirtyRects.assign(frame.rects.dirtyRects.begin(), frame.rects.dirtyRects.end());
+        dropPending = false;
+
+        // Every buffer of the pool fits into the ring, so the push cannot fail
+        queuedFrames->tryPush(copy);
+        {
+            std::lock_guard<std::mutex> lock(signalMutex);
+            signalled = true;
+        }
+        signalCondition.notify_one();
+        return true;
+    }
+
+    void CaptureTraceRecorder::close() {
+        if (!writerThread.joinable()) {
+            return;
+        }
+
+        closing = true;
+        {
+            std::lock_guard<std::mutex> lock(signalMutex);
+            signalled = true;
+        }
+        signalCondition.notify_one();
+        writerThread.join();
+
+        traceWriter.close();
+        writtenBytes = traceWriter.getWrittenBytes();
+        queuedFrames.reset();
+        framePool.reset();
+    }
+
+    void CaptureTraceRecorder::runWriter() {
+        while (true) {
+            // Closing has to be read before the ring. Once it is set, every frame there is to write is queued
+            const bool closed = closing;
+            FrameBuffer* frame = nullptr;
+            if (!queuedFrames->tryPop(frame)) {
+                if (closed) {
+                    break;
+                }
+                std::unique_lock<std::mutex> lock(signalMutex);
+                signalCondition.wait_for(lock, kTraceWriterIdleWait, [this]() { return signalled; });
+                signalled = false;
+                continue;
+            }
+
+            // A failed write closed the trace. Frames still queued are only handed back
+            if (!writeFailed) {
+                if (traceWriter.writeFrame(*frame)) {
+                    writtenFrames = traceWriter.getFrameCount();
+                    writtenBytes = traceWriter.getWrittenBytes();
+                }
+                else {
+                    writeFailed = true;
+                }
+            }
+            framePool->release(frame);
+        }
+    }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "CaptureTrace.hpp"
+#include "FramePool.hpp"
+#include "SPSCRingBuffer.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace CapUtils {
+
+    constexpr int kCaptureTraceQueueCapacity = 4; // Frames that can wait for the trace writer thread. Buffers are allocated as needed
+
+    /*
+    * Records grabbed frames to a capture trace on a writer thread of its own. The grabbing thread only copies
+    * each frame into a pooled buffer and queues it over an SPSC ring. Tile compare, delta encoding and file writes
+    * happen on the writer thread, away from the grab deadline.
+    * If the writer falls behind and all kCaptureTraceQueueCapacity buffers are in use, the grabbed frame is dropped
+    * from the trace and counted. The next recorded frame then has its rects marked invalid, as they describe the
+    * change from the dropped frame. Replay is still exact, since pixels are stored as deltas of recorded frames only.
+    * recordFrame is called by a single grabbing thread.
+    */
+    class CaptureTraceRecorder {
+
+    public:
+        CaptureTraceRecorder() = default;
+
+        ~CaptureTraceRecorder() {
+            close();
+        }
+
+        /*
+        * @name Copy and move
+        *
+        * No copying and moving allowed. The writer thread refers back to this object.
+        */
+        CaptureTraceRecorder(const CaptureTraceRecorder&) = delete;
+        CaptureTraceRecorder& operator=(const CaptureTraceRecorder&) = delete;
+
+        CaptureTraceRecorder(CaptureTraceRecorder&&) = delete;
+        CaptureTraceRecorder& operator=(CaptureTraceRecorder&&) = delete;
+
+        /**
+         * Create the trace file, replacing any existing one, and start the writer thread
+         *
+         * @param fileName
+         *     Path of the trace file
+         *
+         * @param width
+         *     Width of every frame to be recorded
+         *
+         * @param height
+         *     Height of every frame to be recorded
+         *
+         * @param pixelFormat
+         *     Pixel layout of every frame to be recorded
+         *
+         * @return  False if the file cannot be created or the frame size is invalid.
+         */
+        bool open(const std::string& fileName, int width, int height, FramePixelFormat pixelFormat);
+
+        /**
+         * Copy a frame along with its timestamp, sequence, rects and cursor and queue it for the writer thread
+         *
+         * @param frame
+         *     Frame of the size and pixel format the trace was opened with
+         *
+         * @return  False if the trace is not open, the frame does not match it or the writer thread failed to write.
+         *          A frame dropped because the writer is behind still returns true.
+         */
+        bool recordFrame(const FrameBuffer& frame);
+
+        /*
+        * Write every queued frame, stop the writer thread and close the trace. Does nothing if the trace is not open.
+        */
+        void close();
+
+        bool isOpen() const {
+            return writerThread.joinable();
+        }
+
+        /*
+        * Frames written to the trace so far
+        */
+        int64_t getFrameCount() const {
+            return writtenFrames.load(std::memory_order_relaxed);
+        }
+
+        /*
+        * Bytes written to the trace file so far
+        */
+        int64_t getWrittenBytes() const {
+            return writtenBytes.load(std::memory_order_relaxed);
+        }
+
+        /*
+        * Frames left out of the trace because the writer thread was behind
+        */
+        int64_t getDroppedFrames() const {
+            return droppedFrames;
+        }
+
+    private:
+
+        /*
+        * Writer thread function. Writes queued frames until the recorder is closed and the queue is empty.
+        */
+        void runWriter();
+
+        CaptureTraceWriter traceWriter; // Only touched by the writer thread while it runs
+        std::unique_ptr<FramePool> framePool; // Buffers holding copies of queued frames
+        std::unique_ptr<SPSCRingBuffer<FrameBuffer*>> queuedFrames; // Copies from grabbing thread to writer thread
+        int width = 0;
+        int height = 0;
+        FramePixelFormat pixelFormat = FramePixelFormat::BGR24;
+        int64_t droppedFrames = 0; // Only touched by the grabbing thread
+        bool dropPending = false; // A frame was dropped since the last queued one. Only touched by the grabbing thread
+
+        std::mutex signalMutex; // Mutex to guard signalled
+        std::condition_variable signalCondition; // Wakes up the writer thread when a frame is queued or the trace closes
+        bool signalled = false;
+        std::atomic<bool> closing{ false }; // No more frames will be queued
+        std::atomic<bool> writeFailed{ false }; // Writer thread could not write and stopped taking frames
+        std::atomic<int64_t> writtenFrames{ 0 };
+        std::atomic<int64_t> writtenBytes{ 0 };
+        std::thread writerThread;
+    };
+}
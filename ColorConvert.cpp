@@ -0,0 +1,277 @@
+#include "ColorConvert.hpp"
+#include "ColorConvertKernels.hpp"
+#include "WorkerPool.hpp"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CAPUTILS_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace CapUtils {
+
+    namespace {
+
+        inline uint8_t rgbToY(int r, int g, int b) {
+            return static_cast<uint8_t>((kYFromR * r + kYFromG * g + kYFromB * b + kYBias) >> 8);
+        }
+
+        inline uint8_t rgbToU(int r, int g, int b) {
+            return static_cast<uint8_t>((kUFromR * r + kUFromG * g + kUFromB * b + kChromaBias) >> 8);
+        }
+
+        inline uint8_t rgbToV(int r, int g, int b) {
+            return static_cast<uint8_t>((kVFromR * r + kVFromG * g + kVFromB * b + kChromaBias) >> 8);
+        }
+
+        /*
+        * Scalar reference kernel. Source pixels are stored as B, G, R followed by an ignored byte for BGRA.
+        */
+        template<int kBytesPerPixel, bool kInterleavedChroma>
+        void convertRowsScalar(const uint8_t* srcRow0, const uint8_t* srcRow1, int width,
+                               uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstU, uint8_t* dstV) {
+            for (int x = 0; x < width; x += 2) {
+                // Replicate last column for odd widths
+                const int x1 = (x + 1 < width) ? x + 1 : x;
+                const uint8_t* p00 = srcRow0 + x * kBytesPerPixel;
+                const uint8_t* p01 = srcRow0 + x1 * kBytesPerPixel;
+                const uint8_t* p10 = srcRow1 + x * kBytesPerPixel;
+                const uint8_t* p11 = srcRow1 + x1 * kBytesPerPixel;
+
+                dstY0[x] = rgbToY(p00[2], p00[1], p00[0]);
+                dstY1[x] = rgbToY(p10[2], p10[1], p10[0]);
+                if (x1 != x) {
+                    dstY0[x1] = rgbToY(p01[2], p01[1], p01[0]);
+                    dstY1[x1] = rgbToY(p11[2], p11[1], p11[0]);
+                }
+
+                const int b = (p00[0] + p01[0] + p10[0] + p11[0] + 2) >> 2;
+                const int g = (p00[1] + p01[1] + p10[1] + p11[1] + 2) >> 2;
+                const int r = (p00[2] + p01[2] + p10[2] + p11[2] + 2) >> 2;
+                if (kInterleavedChroma) {
+                    dstU[x] = rgbToU(r, g, b);
+                    dstU[x + 1] = rgbToV(r, g, b);
+                }
+                else {
+                    dstU[x / 2] = rgbToU(r, g, b);
+                    dstV[x / 2] = rgbToV(r, g, b);
+                }
+            }
+        }
+
+#ifdef CAPUTILS_X86
+        void cpuid(int leaf, int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+            int info[4] = { 0 };
+            __cpuidex(info, leaf, subleaf);
+            for (int i = 0; i < 4; ++i) {
+                regs[i] = static_cast<unsigned int>(info[i]);
+            }
+#else
+            __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+        }
+
+        uint64_t readExtendedControlRegister() {
+#if defined(_MSC_VER)
+            return _xgetbv(0);
+#else
+            uint32_t eax = 0;
+            uint32_t edx = 0;
+            __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+            return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+        }
+#endif
+
+        /*
+        * Detect the best instruction set usable on this CPU. AVX registers also need to be enabled by the OS.
+        */
+        ColorConvertIsa detectCpuColorConvertIsa() {
+            ColorConvertIsa isa = ColorConvertIsa::SCALAR;
+#ifdef CAPUTILS_X86
+            unsigned int regs[4] = { 0 };
+            cpuid(0, 0, regs);
+            const unsigned int maxLeaf = regs[0];
+            if (maxLeaf < 1) {
+                return isa;
+            }
+
+            cpuid(1, 0, regs);
+            const bool hasSSSE3 = (regs[2] & (1u << 9)) != 0;
+            const bool hasSSE41 = (regs[2] & (1u << 19)) != 0;
+            const bool hasOSXSave = (regs[2] & (1u << 27)) != 0;
+            const bool hasAVX = (regs[2] & (1u << 28)) != 0;
+            if (!hasSSSE3 || !hasSSE41) {
+                return isa;
+            }
+            isa = ColorConvertIsa::SSE41;
+
+            if (!hasOSXSave || !hasAVX || maxLeaf < 7) {
+                return isa;
+            }
+            const uint64_t enabledStates = readExtendedControlRegister();
+            // XMM and YMM state
+            if ((enabledStates & 0x6) != 0x6) {
+                return isa;
+            }
+
+            cpuid(7, 0, regs);
+            if ((regs[1] & (1u << 5)) == 0) {
+                return isa;
+            }
+            isa = ColorConvertIsa::AVX2;
+
+            // Opmask, upper ZMM and high ZMM state along with AVX-512F and AVX-512BW
+            const bool hasAVX512 = ((enabledStates & 0xE6) == 0xE6) && (regs[1] & (1u << 16)) != 0 &&
+                                   (regs[1] & (1u << 30)) != 0;
+            if (hasAVX512) {
+                isa = ColorConvertIsa::AVX512;
+            }
+#endif
+            return isa;
+        }
+
+        const ColorConvertKernelTable* getKernelTable(ColorConvertIsa isa) {
+            switch (isa) {
+            case ColorConvertIsa::AVX512:
+                return getAVX512ColorConvertKernels();
+            case ColorConvertIsa::AVX2:
+                return getAVX2ColorConvertKernels();
+            case ColorConvertIsa::SSE41:
+                return getSSE41ColorConvertKernels();
+            default:
+                return getScalarColorConvertKernels();
+            }
+        }
+
+        /*
+        * Resolve the kernel table to be used for the requested instruction set, stepping down until one is available
+        */
+        const ColorConvertKernelTable& resolveKernels(ColorConvertIsa isa) {
+            const ColorConvertIsa supportedIsa = getSupportedColorConvertIsa();
+            int level = static_cast<int>((isa > supportedIsa) ? supportedIsa : isa);
+            for (; level > 0; --level) {
+                const ColorConvertKernelTable* table = getKernelTable(static_cast<ColorConvertIsa>(level));
+                if (table != nullptr) {
+                    return *table;
+                }
+            }
+            return *getScalarColorConvertKernels();
+        }
+
+        /*
+        * Walk rows [rowBegin, rowEnd) of the frame two at a time and hand each row pair to the kernel.
+        * rowBegin must be even.
+        */
+        void convertFrameRows(ColorConvertRowsFn convertRows, const FrameBuffer& frame, int rowBegin, int rowEnd,
+                              uint8_t* dstY, int strideY, uint8_t* dstU, int strideU, uint8_t* dstV, int strideV) {
+            for (int y = rowBegin; y < rowEnd; y += 2) {
+                // Replicate last row for odd heights
+                const int y1 = (y + 1 < frame.height) ? y + 1 : y;
+                convertRows(frame.data + static_cast<std::size_t>(y) * frame.stride,
+                            frame.data + static_cast<std::size_t>(y1) * frame.stride, frame.width,
+                            dstY + static_cast<std::size_t>(y) * strideY, dstY + static_cast<std::size_t>(y1) * strideY,
+                            dstU + static_cast<std::size_t>(y / 2) * strideU,
+                            dstV ? dstV + static_cast<std::size_t>(y / 2) * strideV : nullptr);
+            }
+        }
+
+        /*
+        * Split the frame into bands of whole chroma rows, one per pool thread, and convert them in parallel
+        */
+        void convertFrameInBands(ColorConvertRowsFn convertRows, const FrameBuffer& frame, WorkerPool& workerPool,
+                                 uint8_t* dstY, int strideY, uint8_t* dstU, int strideU, uint8_t* dstV, int strideV) {
+            const int chromaRows = (frame.height + 1) / 2;
+            const int bandCount = (workerPool.getThreadCount() < chromaRows) ? workerPool.getThreadCount() : chromaRows;
+
+            workerPool.run(bandCount, [&](int band) {
+                const int rowBegin = 2 * (band * chromaRows / bandCount);
+                const int rowEnd = 2 * ((band + 1) * chromaRows / bandCount);
+                convertFrameRows(convertRows, frame, rowBegin, (rowEnd < frame.height) ? rowEnd : frame.height,
+                                 dstY, strideY, dstU, strideU, dstV, strideV);
+            });
+        }
+
+        ColorConvertRowsFn selectI420Kernel(const FrameBuffer& frame, ColorConvertIsa isa) {
+            const ColorConvertKernelTable& kernels = resolveKernels(isa);
+            return (frame.pixelFormat == FramePixelFormat::BGRA) ? kernels.bgraToI420 : kernels.bgr24ToI420;
+        }
+
+        ColorConvertRowsFn selectNV12Kernel(const FrameBuffer& frame, ColorConvertIsa isa) {
+            const ColorConvertKernelTable& kernels = resolveKernels(isa);
+            return (frame.pixelFormat == FramePixelFormat::BGRA) ? kernels.bgraToNV12 : kernels.bgr24ToNV12;
+        }
+    }
+
+    const ColorConvertKernelTable* getScalarColorConvertKernels() {
+        static const ColorConvertKernelTable table = {
+            convertRowsScalar<4, false>,
+            convertRowsScalar<4, true>,
+            convertRowsScalar<3, false>,
+            convertRowsScalar<3, true>
+        };
+        return &table;
+    }
+
+    const ColorConvertKernelTable& getSupportedColorConvertKernels() {
+        return resolveKernels(getSupportedColorConvertIsa());
+    }
+
+    std::string getColorConvertIsaString(ColorConvertIsa isa) {
+        std::string result = "";
+        switch (isa) {
+        case ColorConvertIsa::SCALAR:
+            result = "SCALAR";
+            break;
+        case ColorConvertIsa::SSE41:
+            result = "SSE41";
+            break;
+        case ColorConvertIsa::AVX2:
+            result = "AVX2";
+            break;
+        case ColorConvertIsa::AVX512:
+            result = "AVX512";
+            break;
+        default:
+            break;
+        }
+        return result;
+    }
+
+    ColorConvertIsa getSupportedColorConvertIsa() {
+        static const ColorConvertIsa supportedIsa = detectCpuColorConvertIsa();
+        return supportedIsa;
+    }
+
+    void convertFrameToI420(const FrameBuffer& frame, uint8_t* const dst[3], const int dstStride[3]) {
+        convertFrameToI420(frame, dst, dstStride, getSupportedColorConvertIsa());
+    }
+
+    void convertFrameToNV12(const FrameBuffer& frame, uint8_t* const dst[2], const int dstStride[2]) {
+        convertFrameToNV12(frame, dst, dstStride, getSupportedColorConvertIsa());
+    }
+
+    void convertFrameToI420(const FrameBuffer& frame, uint8_t* const dst[3], const int dstStride[3], WorkerPool& workerPool) {
+        convertFrameInBands(selectI420Kernel(frame, getSupportedColorConvertIsa()), frame, workerPool,
+                            dst[0], dstStride[0], dst[1], dstStride[1], dst[2], dstStride[2]);
+    }
+
+    void convertFrameToNV12(const FrameBuffer& frame, uint8_t* const dst[2], const int dstStride[2], WorkerPool& workerPool) {
+        convertFrameInBands(selectNV12Kernel(frame, getSupportedColorConvertIsa()), frame, workerPool,
+                            dst[0], dstStride[0], dst[1], dstStride[1], nullptr, 0);
+    }
+
+    void convertFrameToI420(const FrameBuffer& frame, uint8_t* const dst[3], const int dstStride[3], ColorConvertIsa isa) {
+        convertFrameRows(selectI420Kernel(frame, isa), frame, 0, frame.height,
+                         dst[0], dstStride[0], dst[1], dstStride[1], dst[2], dstStride[2]);
+    }
+
+    void convertFrameToNV12(const FrameBuffer& frame, uint8_t* const dst[2], const int dstStride[2], ColorConvertIsa isa) {
+        convertFrameRows(selectNV12Kernel(frame, isa), frame, 0, frame.height,
+                         dst[0], dstStride[0], dst[1], dstStride[1], nullptr, 0);
+    }
+}
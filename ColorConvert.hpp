@@ -0,0 +1,77 @@
+#pragma once
+
+#include "FramePool.hpp"
+
+#include <cstdint>
+#include <string>
+
+namespace CapUtils {
+
+    class WorkerPool;
+
+    /*
+    * Instruction set used by color conversion kernels. Values are ordered, a higher value implies all lower ones.
+    */
+    enum class ColorConvertIsa {
+        SCALAR = 0, // Portable fixed point reference implementation
+        SSE41 = 1,  // 128 bit kernels
+        AVX2 = 2,   // 256 bit kernels
+        AVX512 = 3  // 512 bit kernels. Requires AVX-512F and AVX-512BW
+    };
+
+    /**
+     * Helper function to get color conversion instruction set in string format to be used for logging purposes
+     */
+    std::string getColorConvertIsaString(ColorConvertIsa isa);
+
+    /**
+     * Get the best instruction set supported by both this build and the CPU it is running on.
+     * CPU features are detected once and cached.
+     */
+    ColorConvertIsa getSupportedColorConvertIsa();
+
+    /**
+     * Convert a BGRA or BGR24 frame into planar YUV 4:2:0 (I420) using BT.601 limited range coefficients.
+     * Chroma is taken from the average of each 2x2 pixel block. Odd widths and heights replicate the last column or row.
+     * Every instruction set produces bit exact results, so kernels can be switched at any time.
+     *
+     * @param frame
+     *     Source frame. Width and height of the destination must match.
+     *
+     * @param dst
+     *     Y, U and V plane pointers, e.g. AVFrame::data
+     *
+     * @param dstStride
+     *     Y, U and V plane strides in bytes, e.g. AVFrame::linesize
+     */
+    void convertFrameToI420(const FrameBuffer& frame, uint8_t* const dst[3], const int dstStride[3]);
+
+    /**
+     * Convert a BGRA or BGR24 frame into semi-planar YUV 4:2:0 (NV12) with interleaved UV samples.
+     * Same coefficients and chroma siting as convertFrameToI420.
+     *
+     * @param frame
+     *     Source frame. Width and height of the destination must match.
+     *
+     * @param dst
+     *     Y and UV plane pointers
+     *
+     * @param dstStride
+     *     Y and UV plane strides in bytes
+     */
+    void convertFrameToNV12(const FrameBuffer& frame, uint8_t* const dst[2], const int dstStride[2]);
+
+    /*
+    * Overloads that split the frame into one horizontal band per thread of workerPool and convert the bands in
+    * parallel. Bands start on even rows, so every chroma row is written by exactly one thread.
+    */
+    void convertFrameToI420(const FrameBuffer& frame, uint8_t* const dst[3], const int dstStride[3], WorkerPool& workerPool);
+    void convertFrameToNV12(const FrameBuffer& frame, uint8_t* const dst[2], const int dstStride[2], WorkerPool& workerPool);
+
+    /*
+    * Overloads that force a given instruction set. An unsupported instruction set falls back to the best supported
+    * lower one. Meant for comparing kernels against each other.
+    */
+    void convertFrameToI420(const FrameBuffer& frame, uint8_t* const dst[3], const int dstStride[3], ColorConvertIsa isa);
+    void convertFrameToNV12(const FrameBuffer& frame, uint8_t* const dst[2], const int dstStride[2], ColorConvertIsa isa);
+}
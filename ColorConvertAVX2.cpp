@@ -0,0 +1,161 @@
+#include "ColorConvertKernels.hpp"
+
+// This file must be compiled with AVX2 enabled (/arch:AVX2), otherwise the kernels are left out of the build
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+namespace CapUtils {
+
+    namespace {
+
+        constexpr int kPixelsPerIteration = 32;
+
+        inline __m256i coefficientPair(int low, int high) {
+            return _mm256_set1_epi32(static_cast<int>((static_cast<uint32_t>(high) << 16) | static_cast<uint16_t>(low)));
+        }
+
+        /*
+        * Load 8 pixels as 32 bit B, G, R, X values. BGR24 loads read 4 bytes past the 24 they use.
+        */
+        template<int kBytesPerPixel>
+        __m256i load8Pixels(const uint8_t* src);
+
+        template<>
+        inline __m256i load8Pixels<4>(const uint8_t* src) {
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+        }
+
+        template<>
+        inline __m256i load8Pixels<3>(const uint8_t* src) {
+            const __m256i expandBGR = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                                       0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+            const __m256i pixels = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 12)), 1);
+            return _mm256_shuffle_epi8(pixels, expandBGR);
+        }
+
+        /*
+        * Weighted sum of B, R (16 bit lanes of blueRed) and G (low 16 bit lane of greenAlpha) per 32 bit pixel
+        */
+        inline __m256i weightPixels(__m256i blueRed, __m256i greenAlpha, int fromB, int fromG, int fromR, int bias) {
+            const __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(blueRed, coefficientPair(fromB, fromR)),
+                                                 _mm256_madd_epi16(greenAlpha, coefficientPair(fromG, 0)));
+            return _mm256_srli_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(bias)), 8);
+        }
+
+        /*
+        * Average each horizontal pixel pair of two row sums into the even 32 bit lanes
+        */
+        inline __m256i averagePixelPairs(__m256i rowSum) {
+            const __m256i pairSum = _mm256_add_epi16(rowSum, _mm256_srli_epi64(rowSum, 32));
+            return _mm256_srli_epi16(_mm256_add_epi16(pairSum, _mm256_set1_epi16(2)), 2);
+        }
+
+        /*
+        * Gather the even 32 bit lanes of two vectors into one, keeping their order
+        */
+        inline __m256i packEvenLanes(__m256i first, __m256i second) {
+            const __m256i evenLanesFirst = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+            return _mm256_inserti128_si256(_mm256_permutevar8x32_epi32(first, evenLanesFirst),
+                                           _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(second, evenLanesFirst)), 1);
+        }
+
+        /*
+        * Saturating pack of two vectors of 32 bit values into one vector of 16 bit values, keeping their order.
+        * The pack instruction works per 128 bit lane, so the 64 bit blocks are put back in order afterwards.
+        */
+        inline __m256i packOrdered32(__m256i first, __m256i second) {
+            return _mm256_permute4x64_epi64(_mm256_packus_epi32(first, second), _MM_SHUFFLE(3, 1, 2, 0));
+        }
+
+        inline __m256i packOrdered16(__m256i first, __m256i second) {
+            return _mm256_permute4x64_epi64(_mm256_packus_epi16(first, second), _MM_SHUFFLE(3, 1, 2, 0));
+        }
+
+        template<int kBytesPerPixel, bool kInterleavedChroma>
+        ColorConvertRowsFn getScalarTailKernel() {
+            const ColorConvertKernelTable* scalar = getScalarColorConvertKernels();
+            if (kBytesPerPixel == 4) {
+                return kInterleavedChroma ? scalar->bgraToNV12 : scalar->bgraToI420;
+            }
+            return kInterleavedChroma ? scalar->bgr24ToNV12 : scalar->bgr24ToI420;
+        }
+
+        template<int kBytesPerPixel, bool kInterleavedChroma>
+        void convertRowsAVX2(const uint8_t* srcRow0, const uint8_t* srcRow1, int width,
+                             uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstU, uint8_t* dstV) {
+            const __m256i lowByteMask = _mm256_set1_epi32(0x00FF00FF);
+            // Keep the over-reading BGR24 loads inside the row
+            const int simdWidth = (kBytesPerPixel == 3) ? width - 2 : width;
+
+            int x = 0;
+            for (; x + kPixelsPerIteration <= simdWidth; x += kPixelsPerIteration) {
+                __m256i luma0[4];
+                __m256i luma1[4];
+                __m256i chromaU[4];
+                __m256i chromaV[4];
+
+                for (int i = 0; i < 4; ++i) {
+                    const __m256i pixels0 = load8Pixels<kBytesPerPixel>(srcRow0 + (x + 8 * i) * kBytesPerPixel);
+                    const __m256i pixels1 = load8Pixels<kBytesPerPixel>(srcRow1 + (x + 8 * i) * kBytesPerPixel);
+                    const __m256i blueRed0 = _mm256_and_si256(pixels0, lowByteMask);
+                    const __m256i greenAlpha0 = _mm256_srli_epi16(pixels0, 8);
+                    const __m256i blueRed1 = _mm256_and_si256(pixels1, lowByteMask);
+                    const __m256i greenAlpha1 = _mm256_srli_epi16(pixels1, 8);
+
+                    luma0[i] = weightPixels(blueRed0, greenAlpha0, kYFromB, kYFromG, kYFromR, kYBias);
+                    luma1[i] = weightPixels(blueRed1, greenAlpha1, kYFromB, kYFromG, kYFromR, kYBias);
+
+                    const __m256i blueRed = averagePixelPairs(_mm256_add_epi16(blueRed0, blueRed1));
+                    const __m256i greenAlpha = averagePixelPairs(_mm256_add_epi16(greenAlpha0, greenAlpha1));
+                    chromaU[i] = weightPixels(blueRed, greenAlpha, kUFromB, kUFromG, kUFromR, kChromaBias);
+                    chromaV[i] = weightPixels(blueRed, greenAlpha, kVFromB, kVFromG, kVFromR, kChromaBias);
+                }
+
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dstY0 + x),
+                                    packOrdered16(packOrdered32(luma0[0], luma0[1]), packOrdered32(luma0[2], luma0[3])));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dstY1 + x),
+                                    packOrdered16(packOrdered32(luma1[0], luma1[1]), packOrdered32(luma1[2], luma1[3])));
+
+                const __m256i u = packOrdered32(packEvenLanes(chromaU[0], chromaU[1]), packEvenLanes(chromaU[2], chromaU[3]));
+                const __m256i v = packOrdered32(packEvenLanes(chromaV[0], chromaV[1]), packEvenLanes(chromaV[2], chromaV[3]));
+                if (kInterleavedChroma) {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dstU + x), _mm256_or_si256(u, _mm256_slli_epi16(v, 8)));
+                }
+                else {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dstU + x / 2), _mm256_castsi256_si128(packOrdered16(u, u)));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dstV + x / 2), _mm256_castsi256_si128(packOrdered16(v, v)));
+                }
+            }
+
+            if (x < width) {
+                getScalarTailKernel<kBytesPerPixel, kInterleavedChroma>()(
+                    srcRow0 + x * kBytesPerPixel, srcRow1 + x * kBytesPerPixel, width - x, dstY0 + x, dstY1 + x,
+                    kInterleavedChroma ? dstU + x : dstU + x / 2, kInterleavedChroma ? dstV : dstV + x / 2);
+            }
+        }
+    }
+
+    const ColorConvertKernelTable* getAVX2ColorConvertKernels() {
+        static const ColorConvertKernelTable table = {
+            convertRowsAVX2<4, false>,
+            convertRowsAVX2<4, true>,
+            convertRowsAVX2<3, false>,
+            convertRowsAVX2<3, true>
+        };
+        return &table;
+    }
+}
+
+#else
+
+namespace CapUtils {
+
+    const ColorConvertKernelTable* getAVX2ColorConvertKernels() {
+        return nullptr;
+    }
+}
+
+#endif
@@ -0,0 +1,135 @@
+#include "ColorConvertKernels.hpp"
+
+// This file must be compiled with AVX-512 enabled (/arch:AVX512), otherwise the kernels are left out of the build
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+
+#include <immintrin.h>
+
+namespace CapUtils {
+
+    namespace {
+
+        constexpr int kPixelsPerIteration = 32;
+
+        inline __m512i coefficientPair(int low, int high) {
+            return _mm512_set1_epi32(static_cast<int>((static_cast<uint32_t>(high) << 16) | static_cast<uint16_t>(low)));
+        }
+
+        /*
+        * Load 16 pixels as 32 bit B, G, R, X values. BGR24 loads read 4 bytes past the 48 they use.
+        */
+        template<int kBytesPerPixel>
+        __m512i load16Pixels(const uint8_t* src);
+
+        template<>
+        inline __m512i load16Pixels<4>(const uint8_t* src) {
+            return _mm512_loadu_si512(src);
+        }
+
+        template<>
+        inline __m512i load16Pixels<3>(const uint8_t* src) {
+            // Byte indices 0, 1, 2, -1, 3, 4, 5, -1, ... repeated for every 128 bit lane
+            const __m512i expandBGR = _mm512_setr4_epi32(static_cast<int>(0xFF020100), static_cast<int>(0xFF050403),
+                                                         static_cast<int>(0xFF080706), static_cast<int>(0xFF0B0A09));
+            __m512i pixels = _mm512_castsi128_si512(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+            pixels = _mm512_inserti32x4(pixels, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 12)), 1);
+            pixels = _mm512_inserti32x4(pixels, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 24)), 2);
+            pixels = _mm512_inserti32x4(pixels, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 36)), 3);
+            return _mm512_shuffle_epi8(pixels, expandBGR);
+        }
+
+        /*
+        * Weighted sum of B, R (16 bit lanes of blueRed) and G (low 16 bit lane of greenAlpha) per 32 bit pixel
+        */
+        inline __m512i weightPixels(__m512i blueRed, __m512i greenAlpha, int fromB, int fromG, int fromR, int bias) {
+            const __m512i sum = _mm512_add_epi32(_mm512_madd_epi16(blueRed, coefficientPair(fromB, fromR)),
+                                                 _mm512_madd_epi16(greenAlpha, coefficientPair(fromG, 0)));
+            return _mm512_srli_epi32(_mm512_add_epi32(sum, _mm512_set1_epi32(bias)), 8);
+        }
+
+        /*
+        * Average each horizontal pixel pair of two row sums into the even 32 bit lanes
+        */
+        inline __m512i averagePixelPairs(__m512i rowSum) {
+            const __m512i pairSum = _mm512_add_epi16(rowSum, _mm512_srli_epi64(rowSum, 32));
+            return _mm512_srli_epi16(_mm512_add_epi16(pairSum, _mm512_set1_epi16(2)), 2);
+        }
+
+        template<int kBytesPerPixel, bool kInterleavedChroma>
+        ColorConvertRowsFn getScalarTailKernel() {
+            const ColorConvertKernelTable* scalar = getScalarColorConvertKernels();
+            if (kBytesPerPixel == 4) {
+                return kInterleavedChroma ? scalar->bgraToNV12 : scalar->bgraToI420;
+            }
+            return kInterleavedChroma ? scalar->bgr24ToNV12 : scalar->bgr24ToI420;
+        }
+
+        template<int kBytesPerPixel, bool kInterleavedChroma>
+        void convertRowsAVX512(const uint8_t* srcRow0, const uint8_t* srcRow1, int width,
+                               uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstU, uint8_t* dstV) {
+            const __m512i lowByteMask = _mm512_set1_epi32(0x00FF00FF);
+            // Keep the over-reading BGR24 loads inside the row
+            const int simdWidth = (kBytesPerPixel == 3) ? width - 2 : width;
+
+            int x = 0;
+            for (; x + kPixelsPerIteration <= simdWidth; x += kPixelsPerIteration) {
+                for (int i = 0; i < 2; ++i) {
+                    const int pixelX = x + 16 * i;
+                    const __m512i pixels0 = load16Pixels<kBytesPerPixel>(srcRow0 + pixelX * kBytesPerPixel);
+                    const __m512i pixels1 = load16Pixels<kBytesPerPixel>(srcRow1 + pixelX * kBytesPerPixel);
+                    const __m512i blueRed0 = _mm512_and_si512(pixels0, lowByteMask);
+                    const __m512i greenAlpha0 = _mm512_srli_epi16(pixels0, 8);
+                    const __m512i blueRed1 = _mm512_and_si512(pixels1, lowByteMask);
+                    const __m512i greenAlpha1 = _mm512_srli_epi16(pixels1, 8);
+
+                    // Every 32 bit lane holds a value below 256, so truncating to bytes keeps pixel order for free
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dstY0 + pixelX),
+                                     _mm512_cvtepi32_epi8(weightPixels(blueRed0, greenAlpha0, kYFromB, kYFromG, kYFromR, kYBias)));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dstY1 + pixelX),
+                                     _mm512_cvtepi32_epi8(weightPixels(blueRed1, greenAlpha1, kYFromB, kYFromG, kYFromR, kYBias)));
+
+                    // Chroma values sit in the low half of each 64 bit lane
+                    const __m512i blueRed = averagePixelPairs(_mm512_add_epi16(blueRed0, blueRed1));
+                    const __m512i greenAlpha = averagePixelPairs(_mm512_add_epi16(greenAlpha0, greenAlpha1));
+                    const __m512i u = weightPixels(blueRed, greenAlpha, kUFromB, kUFromG, kUFromR, kChromaBias);
+                    const __m512i v = weightPixels(blueRed, greenAlpha, kVFromB, kVFromG, kVFromR, kChromaBias);
+                    if (kInterleavedChroma) {
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(dstU + pixelX),
+                                         _mm512_cvtepi64_epi16(_mm512_or_si512(u, _mm512_slli_epi32(v, 8))));
+                    }
+                    else {
+                        _mm_storel_epi64(reinterpret_cast<__m128i*>(dstU + pixelX / 2), _mm512_cvtepi64_epi8(u));
+                        _mm_storel_epi64(reinterpret_cast<__m128i*>(dstV + pixelX / 2), _mm512_cvtepi64_epi8(v));
+                    }
+                }
+            }
+
+            if (x < width) {
+                getScalarTailKernel<kBytesPerPixel, kInterleavedChroma>()(
+                    srcRow0 + x * kBytesPerPixel, srcRow1 + x * kBytesPerPixel, width - x, dstY0 + x, dstY1 + x,
+                    kInterleavedChroma ? dstU + x : dstU + x / 2, kInterleavedChroma ? dstV : dstV + x / 2);
+            }
+        }
+    }
+
+    const ColorConvertKernelTable* getAVX512ColorConvertKernels() {
+        static const ColorConvertKernelTable table = {
+            convertRowsAVX512<4, false>,
+            convertRowsAVX512<4, true>,
+            convertRowsAVX512<3, false>,
+            convertRowsAVX512<3, true>
+        };
+        return &table;
+    }
+}
+
+#else
+
+namespace CapUtils {
+
+    const ColorConvertKernelTable* getAVX512ColorConvertKernels() {
+        return nullptr;
+    }
+}
+
+#endif
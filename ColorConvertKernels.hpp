@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+namespace CapUtils {
+
+    /*
+    * BT.601 limited range RGB to YUV coefficients in 8 bit fixed point.
+    * All kernels must use exactly these values and rounding so that every instruction set is bit exact with the
+    * scalar reference.
+    */
+    constexpr int kYFromR = 66;
+    constexpr int kYFromG = 129;
+    constexpr int kYFromB = 25;
+    constexpr int kUFromR = -38;
+    constexpr int kUFromG = -74;
+    constexpr int kUFromB = 112;
+    constexpr int kVFromR = 112;
+    constexpr int kVFromG = -94;
+    constexpr int kVFromB = -18;
+
+    constexpr int kYBias = (16 << 8) + 128; // Luma offset of 16 plus rounding
+    constexpr int kChromaBias = (128 << 8) + 128; // Chroma offset of 128 plus rounding. Keeps every sum positive
+
+    /*
+    * Kernel converting two source rows into two luma rows and one chroma row.
+    * Width may be odd. For NV12, dstU receives interleaved UV samples and dstV is ignored.
+    * For the last row of an odd height frame, both source rows and both luma rows may be the same.
+    */
+    using ColorConvertRowsFn = void(*)(const uint8_t* srcRow0, const uint8_t* srcRow1, int width,
+                                       uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstU, uint8_t* dstV);
+
+    /*
+    * Set of row kernels implemented for one instruction set
+    */
+    struct ColorConvertKernelTable {
+        ColorConvertRowsFn bgraToI420 = nullptr;
+        ColorConvertRowsFn bgraToNV12 = nullptr;
+        ColorConvertRowsFn bgr24ToI420 = nullptr;
+        ColorConvertRowsFn bgr24ToNV12 = nullptr;
+    };
+
+    /*
+    * Kernel tables for each instruction set. SIMD tables return nullptr if the kernels are not part of this build.
+    * SIMD kernels hand the last few pixels of a row over to the scalar kernels.
+    */
+    const ColorConvertKernelTable* getScalarColorConvertKernels();
+    const ColorConvertKernelTable* getSSE41ColorConvertKernels();
+    const ColorConvertKernelTable* getAVX2ColorConvertKernels();
+    const ColorConvertKernelTable* getAVX512ColorConvertKernels();
+
+    /**
+     * Get the kernel table of the best instruction set supported by this build and CPU
+     */
+    const ColorConvertKernelTable& getSupportedColorConvertKernels();
+}
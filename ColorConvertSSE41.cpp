@@ -0,0 +1,144 @@
+#include "ColorConvertKernels.hpp"
+
+// Built for every x86 MSVC target. Other compilers need this file to be compiled with SSE4.1 enabled
+#if defined(__SSE4_1__) || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+
+#include <immintrin.h>
+
+namespace CapUtils {
+
+    namespace {
+
+        constexpr int kPixelsPerIteration = 16;
+
+        inline __m128i coefficientPair(int low, int high) {
+            return _mm_set1_epi32(static_cast<int>((static_cast<uint32_t>(high) << 16) | static_cast<uint16_t>(low)));
+        }
+
+        /*
+        * Load 4 pixels as 32 bit B, G, R, X values. BGR24 loads read 4 bytes past the 12 they use.
+        */
+        template<int kBytesPerPixel>
+        __m128i load4Pixels(const uint8_t* src);
+
+        template<>
+        inline __m128i load4Pixels<4>(const uint8_t* src) {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        }
+
+        template<>
+        inline __m128i load4Pixels<3>(const uint8_t* src) {
+            const __m128i expandBGR = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+            return _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), expandBGR);
+        }
+
+        /*
+        * Weighted sum of B, R (16 bit lanes of blueRed) and G (low 16 bit lane of greenAlpha) per 32 bit pixel
+        */
+        inline __m128i weightPixels(__m128i blueRed, __m128i greenAlpha, int fromB, int fromG, int fromR, int bias) {
+            const __m128i sum = _mm_add_epi32(_mm_madd_epi16(blueRed, coefficientPair(fromB, fromR)),
+                                              _mm_madd_epi16(greenAlpha, coefficientPair(fromG, 0)));
+            return _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(bias)), 8);
+        }
+
+        /*
+        * Average each horizontal pixel pair of two row sums into the even 32 bit lanes
+        */
+        inline __m128i averagePixelPairs(__m128i rowSum) {
+            const __m128i pairSum = _mm_add_epi16(rowSum, _mm_srli_epi64(rowSum, 32));
+            return _mm_srli_epi16(_mm_add_epi16(pairSum, _mm_set1_epi16(2)), 2);
+        }
+
+        /*
+        * Gather the even 32 bit lanes of two vectors into one
+        */
+        inline __m128i packEvenLanes(__m128i first, __m128i second) {
+            return _mm_unpacklo_epi64(_mm_shuffle_epi32(first, _MM_SHUFFLE(3, 1, 2, 0)),
+                                      _mm_shuffle_epi32(second, _MM_SHUFFLE(3, 1, 2, 0)));
+        }
+
+        template<int kBytesPerPixel, bool kInterleavedChroma>
+        ColorConvertRowsFn getScalarTailKernel() {
+            const ColorConvertKernelTable* scalar = getScalarColorConvertKernels();
+            if (kBytesPerPixel == 4) {
+                return kInterleavedChroma ? scalar->bgraToNV12 : scalar->bgraToI420;
+            }
+            return kInterleavedChroma ? scalar->bgr24ToNV12 : scalar->bgr24ToI420;
+        }
+
+        template<int kBytesPerPixel, bool kInterleavedChroma>
+        void convertRowsSSE41(const uint8_t* srcRow0, const uint8_t* srcRow1, int width,
+                              uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstU, uint8_t* dstV) {
+            const __m128i lowByteMask = _mm_set1_epi32(0x00FF00FF);
+            // Keep the over-reading BGR24 loads inside the row
+            const int simdWidth = (kBytesPerPixel == 3) ? width - 2 : width;
+
+            int x = 0;
+            for (; x + kPixelsPerIteration <= simdWidth; x += kPixelsPerIteration) {
+                __m128i luma0[4];
+                __m128i luma1[4];
+                __m128i chromaU[4];
+                __m128i chromaV[4];
+
+                for (int i = 0; i < 4; ++i) {
+                    const __m128i pixels0 = load4Pixels<kBytesPerPixel>(srcRow0 + (x + 4 * i) * kBytesPerPixel);
+                    const __m128i pixels1 = load4Pixels<kBytesPerPixel>(srcRow1 + (x + 4 * i) * kBytesPerPixel);
+                    const __m128i blueRed0 = _mm_and_si128(pixels0, lowByteMask);
+                    const __m128i greenAlpha0 = _mm_srli_epi16(pixels0, 8);
+                    const __m128i blueRed1 = _mm_and_si128(pixels1, lowByteMask);
+                    const __m128i greenAlpha1 = _mm_srli_epi16(pixels1, 8);
+
+                    luma0[i] = weightPixels(blueRed0, greenAlpha0, kYFromB, kYFromG, kYFromR, kYBias);
+                    luma1[i] = weightPixels(blueRed1, greenAlpha1, kYFromB, kYFromG, kYFromR, kYBias);
+
+                    const __m128i blueRed = averagePixelPairs(_mm_add_epi16(blueRed0, blueRed1));
+                    const __m128i greenAlpha = averagePixelPairs(_mm_add_epi16(greenAlpha0, greenAlpha1));
+                    chromaU[i] = weightPixels(blueRed, greenAlpha, kUFromB, kUFromG, kUFromR, kChromaBias);
+                    chromaV[i] = weightPixels(blueRed, greenAlpha, kVFromB, kVFromG, kVFromR, kChromaBias);
+                }
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dstY0 + x),
+                                 _mm_packus_epi16(_mm_packus_epi32(luma0[0], luma0[1]), _mm_packus_epi32(luma0[2], luma0[3])));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dstY1 + x),
+                                 _mm_packus_epi16(_mm_packus_epi32(luma1[0], luma1[1]), _mm_packus_epi32(luma1[2], luma1[3])));
+
+                const __m128i u = _mm_packus_epi32(packEvenLanes(chromaU[0], chromaU[1]), packEvenLanes(chromaU[2], chromaU[3]));
+                const __m128i v = _mm_packus_epi32(packEvenLanes(chromaV[0], chromaV[1]), packEvenLanes(chromaV[2], chromaV[3]));
+                if (kInterleavedChroma) {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dstU + x), _mm_or_si128(u, _mm_slli_epi16(v, 8)));
+                }
+                else {
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(dstU + x / 2), _mm_packus_epi16(u, u));
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(dstV + x / 2), _mm_packus_epi16(v, v));
+                }
+            }
+
+            if (x < width) {
+                getScalarTailKernel<kBytesPerPixel, kInterleavedChroma>()(
+                    srcRow0 + x * kBytesPerPixel, srcRow1 + x * kBytesPerPixel, width - x, dstY0 + x, dstY1 + x,
+                    kInterleavedChroma ? dstU + x : dstU + x / 2, kInterleavedChroma ? dstV : dstV + x / 2);
+            }
+        }
+    }
+
+    const ColorConvertKernelTable* getSSE41ColorConvertKernels() {
+        static const ColorConvertKernelTable table = {
+            convertRowsSSE41<4, false>,
+            convertRowsSSE41<4, true>,
+            convertRowsSSE41<3, false>,
+            convertRowsSSE41<3, true>
+        };
+        return &table;
+    }
+}
+
+#else
+
+namespace CapUtils {
+
+    const ColorConvertKernelTable* getSSE41ColorConvertKernels() {
+        return nullptr;
+    }
+}
+
+#endif
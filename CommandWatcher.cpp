@@ -0,0 +1,338 @@
+#include "CommandWatcher.hpp"
+#include "LogUtil.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <wchar.h>
+#elif defined(__linux__)
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace LogUtils;
+
+namespace CapUtils {
+
+    namespace {
+
+        constexpr char kMarkerPrefix[] = "Marker:";
+        constexpr std::size_t kMarkerPrefixLength = sizeof(kMarkerPrefix) - 1;
+
+        /*
+        * Strip leading and trailing blanks, including the carriage return of files written on Windows
+        */
+        std::string trimLine(const std::string& line) {
+            const std::size_t first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos) {
+                return std::string();
+            }
+            return line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+        }
+
+#ifdef _WIN32
+        std::wstring toWideString(const std::string& text) {
+            const int length = MultiByteToWideChar(CP_ACP, 0, text.c_str(), -1, NULL, 0);
+            if (length <= 0) {
+                return std::wstring();
+            }
+            std::wstring wideText(static_cast<std::size_t>(length), L'\0');
+            MultiByteToWideChar(CP_ACP, 0, text.c_str(), -1, &wideText[0], length);
+            wideText.resize(static_cast<std::size_t>(length) - 1);
+            return wideText;
+        }
+#endif
+    }
+
+    bool parseRecordingCommand(const std::string& line, RecordingCommand& command) {
+        command = RecordingCommand();
+        command.line = line;
+
+        // Sequence number is optional, so old single command files still parse
+        std::size_t digits = 0;
+        while (digits < line.size() && line[digits] >= '0' && line[digits] <= '9') {
+            ++digits;
+        }
+        std::string text = line;
+        if (digits > 0 && digits < line.size() && line[digits] == ' ') {
+            command.sequence = std::strtoull(line.substr(0, digits).c_str(), nullptr, 10);
+            text = trimLine(line.substr(digits + 1));
+        }
+
+        if (text == "StartRec") {
+            command.type = RecordingCommandType::START_REC;
+        }
+        else if (text == "StopRec") {
+            command.type = RecordingCommandType::STOP_REC;
+        }
+        else if (text == "Pause") {
+            command.type = RecordingCommandType::PAUSE;
+        }
+        else if (text == "Resume") {
+            command.type = RecordingCommandType::RESUME;
+        }
+        else if (text.compare(0, kMarkerPrefixLength, kMarkerPrefix) == 0) {
+            command.type = RecordingCommandType::MARKER;
+            command.label = text.substr(kMarkerPrefixLength);
+        }
+        return command.type != RecordingCommandType::UNKNOWN_COMMAND;
+    }
+
+    std::string getRecordingCommandTypeString(RecordingCommandType type) {
+        std::string result = "";
+        switch (type) {
+        case RecordingCommandType::START_REC:
+            result = "START_REC";
+            break;
+        case RecordingCommandType::STOP_REC:
+            result = "STOP_REC";
+            break;
+        case RecordingCommandType::PAUSE:
+            result = "PAUSE";
+            break;
+        case RecordingCommandType::RESUME:
+            result = "RESUME";
+            break;
+        case RecordingCommandType::MARKER:
+            result = "MARKER";
+            break;
+        default:
+            result = "UNKNOWN_COMMAND";
+            break;
+        }
+        return result;
+    }
+
+#ifdef _WIN32
+    struct CommandWatcher::PlatformWatch {
+        HANDLE directory = INVALID_HANDLE_VALUE;
+        OVERLAPPED overlapped = {};
+        std::vector<DWORD> buffer = std::vector<DWORD>(4096); // FILE_NOTIFY_INFORMATION entries need DWORD alignment
+        std::wstring fileName;
+        bool readIssued = false;
+
+        ~PlatformWatch() {
+            // Pending read writes into buffer until it is cancelled, so it has to finish before buffer goes away
+            if (readIssued) {
+                DWORD bytes = 0;
+                CancelIoEx(directory, &overlapped);
+                GetOverlappedResult(directory, &overlapped, &bytes, TRUE);
+            }
+            if (directory != INVALID_HANDLE_VALUE) {
+                CloseHandle(directory);
+            }
+            if (overlapped.hEvent != NULL) {
+                CloseHandle(overlapped.hEvent);
+            }
+        }
+
+        bool issueRead() {
+            ResetEvent(overlapped.hEvent);
+            readIssued = ReadDirectoryChangesW(directory, buffer.data(), static_cast<DWORD>(buffer.size() * sizeof(DWORD)), FALSE,
+                                               FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE,
+                                               NULL, &overlapped, NULL) != FALSE;
+            return readIssued;
+        }
+    };
+#elif defined(__linux__)
+    struct CommandWatcher::PlatformWatch {
+        int inotifyFd = -1;
+
+        ~PlatformWatch() {
+            if (inotifyFd >= 0) {
+                close(inotifyFd);
+            }
+        }
+    };
+#else
+    struct CommandWatcher::PlatformWatch {
+    };
+#endif
+
+    CommandWatcher::CommandWatcher() = default;
+
+    CommandWatcher::~CommandWatcher() = default;
+
+    bool CommandWatcher::open(const std::string& commandFileName) {
+        filePath = commandFileName;
+        platformWatch.reset();
+        readPending = true;
+
+        const std::size_t separator = commandFileName.find_last_of("\\/");
+        const std::string directory = (separator == std::string::npos) ? "." :
+                                      ((separator == 0) ? commandFileName.substr(0, 1) : commandFileName.substr(0, separator));
+        fileName = (separator == std::string::npos) ? commandFileName : commandFileName.substr(separator + 1);
+
+#ifdef _WIN32
+        auto watch = std::make_unique<PlatformWatch>();
+        watch->fileName = toWideString(fileName);
+        watch->directory = CreateFileW(toWideString(directory).c_str(), FILE_LIST_DIRECTORY,
+                                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                                       FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+        if (watch->directory == INVALID_HANDLE_VALUE) {
+            ALOG(ERR, "Failed to open command file directory", NVV(directory, directory), NVV(errorCode, GetLastError()));
+            return false;
+        }
+        watch->overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+        if (watch->overlapped.hEvent == NULL || !watch->issueRead()) {
+            ALOG(ERR, "ReadDirectoryChangesW failed!", NVV(errorCode, GetLastError()));
+            return false;
+        }
+        platformWatch = std::move(watch);
+        return true;
+#elif defined(__linux__)
+        auto watch = std::make_unique<PlatformWatch>();
+        watch->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (watch->inotifyFd < 0) {
+            ALOG(ERR, "inotify_init1 failed!", NVV(errorCode, errno));
+            return false;
+        }
+        // Writers replacing the file by renaming a new one over it are seen through IN_MOVED_TO
+        if (inotify_add_watch(watch->inotifyFd, directory.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO) < 0) {
+            ALOG(ERR, "Failed to watch command file directory", NVV(directory, directory), NVV(errorCode, errno));
+            return false;
+        }
+        platformWatch = std::move(watch);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    std::vector<RecordingCommand> CommandWatcher::waitForCommands(std::chrono::milliseconds timeout) {
+        std::vector<RecordingCommand> commands;
+        if (readPending || waitForChange(timeout)) {
+            readPending = false;
+            readCommands(commands);
+        }
+        return commands;
+    }
+
+    bool CommandWatcher::waitForChange(std::chrono::milliseconds timeout) {
+        if (!platformWatch) {
+            const auto pollInterval = std::chrono::milliseconds(kCommandPollIntervalInMs);
+            std::this_thread::sleep_for((timeout < pollInterval) ? timeout : pollInterval);
+            return true;
+        }
+
+        // Changes of other files in the directory wake the watcher up as well, so it waits again until the deadline
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (true) {
+            const auto timeLeft = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            const long long timeLeftInMs = (timeLeft.count() > 0) ? timeLeft.count() : 0;
+            bool changed = false;
+#ifdef _WIN32
+            PlatformWatch& watch = *platformWatch;
+            if (WaitForSingleObject(watch.overlapped.hEvent, static_cast<DWORD>(timeLeftInMs)) != WAIT_OBJECT_0) {
+                return false;
+            }
+
+            DWORD bytes = 0;
+            watch.readIssued = false;
+            if (!GetOverlappedResult(watch.directory, &watch.overlapped, &bytes, FALSE)) {
+                changed = true;
+            }
+            else if (bytes == 0) {
+                // Buffer overflowed and the changes were dropped, so any of them could have been to the command file
+                changed = true;
+            }
+            else {
+                const BYTE* entry = reinterpret_cast<const BYTE*>(watch.buffer.data());
+                while (true) {
+                    const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(entry);
+                    const std::wstring entryName(info->FileName, info->FileNameLength / sizeof(WCHAR));
+                    changed = changed || _wcsicmp(entryName.c_str(), watch.fileName.c_str()) == 0;
+                    if (info->NextEntryOffset == 0) {
+                        break;
+                    }
+                    entry += info->NextEntryOffset;
+                }
+            }
+
+            // Rearmed before the file is read, so a command written meanwhile is not missed
+            if (!watch.issueRead()) {
+                ALOG(ERR, "ReadDirectoryChangesW failed, polling command file", NVV(errorCode, GetLastError()));
+                platformWatch.reset();
+                return true;
+            }
+#elif defined(__linux__)
+            pollfd pollFd = { platformWatch->inotifyFd, POLLIN, 0 };
+            const int ready = poll(&pollFd, 1, static_cast<int>(timeLeftInMs));
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ready <= 0) {
+                return false;
+            }
+
+            alignas(inotify_event) char buffer[4096];
+            ssize_t length = 0;
+            while ((length = read(platformWatch->inotifyFd, buffer, sizeof(buffer))) > 0) {
+                for (char* entry = buffer; entry < buffer + length; ) {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>(entry);
+                    // Queue overflow dropped events, so any of them could have been to the command file
+                    changed = changed || (event->mask & IN_Q_OVERFLOW) != 0 || (event->len > 0 && fileName == event->name);
+                    entry += sizeof(inotify_event) + event->len;
+                }
+            }
+#endif
+            if (changed) {
+                return true;
+            }
+            if (timeLeftInMs == 0) {
+                return false;
+            }
+        }
+    }
+
+    void CommandWatcher::readCommands(std::vector<RecordingCommand>& commands) {
+        std::ifstream commandFile(filePath, std::ios::binary);
+        if (!commandFile.is_open()) {
+            return;
+        }
+        const std::string content((std::istreambuf_iterator<char>(commandFile)), std::istreambuf_iterator<char>());
+        commandFile.close();
+
+        std::size_t lineStart = 0;
+        while (lineStart < content.size()) {
+            const std::size_t lineEnd = content.find('\n', lineStart);
+            const bool complete = (lineEnd != std::string::npos);
+            const std::string line = trimLine(content.substr(lineStart, (complete ? lineEnd : content.size()) - lineStart));
+            lineStart = complete ? lineEnd + 1 : content.size();
+            if (line.empty()) {
+                continue;
+            }
+
+            // Last line may still be written. It is read again on the next change. Only the fixed keywords are
+            // taken without a newline, a marker label could still grow
+            RecordingCommand command;
+            const bool known = parseRecordingCommand(line, command);
+            if (!complete && (!known || command.type == RecordingCommandType::MARKER)) {
+                break;
+            }
+
+            if (command.sequence == 0) {
+                if (line != lastUnsequencedLine) {
+                    lastUnsequencedLine = line;
+                    commands.push_back(command);
+                }
+                continue;
+            }
+            if (command.sequence <= lastSequence) {
+                continue;
+            }
+            if (lastSequence != 0 && command.sequence != lastSequence + 1) {
+                ALOG(WARNING, "Commands were overwritten before they could be read", NVV(lastSequence, lastSequence),
+                     NVV(sequence, command.sequence));
+            }
+            lastSequence = command.sequence;
+            commands.push_back(command);
+        }
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace CapUtils {
+
+    constexpr int kCommandPollIntervalInMs = 100; // Poll interval of the command file where it cannot be watched
+
+    /*
+    * Commands that can be written to the command file
+    */
+    enum class RecordingCommandType {
+        UNKNOWN_COMMAND = 0,
+        START_REC = 1, // "StartRec" starts the recording session
+        STOP_REC = 2,  // "StopRec" stops grabbing, encodes what was grabbed and ends the session
+        PAUSE = 3,     // "Pause" stops grabbing until resumed. The last frame lasts until then
+        RESUME = 4,    // "Resume" grabs again after a pause
+        MARKER = 5     // "Marker:<label>" logs label along with the time it was received at
+    };
+
+    /*
+    * Datastructure to hold a single command read from the command file
+    */
+    struct RecordingCommand {
+        RecordingCommandType type = RecordingCommandType::UNKNOWN_COMMAND;
+        uint64_t sequence = 0; // Sequence number of the command. Zero for commands written without one
+        std::string label; // Label of a marker
+        std::string line; // Line the command was read from, for logging
+    };
+
+    /**
+     * Helper function to parse a line of the command file
+     *
+     * @param line
+     *     Command, optionally preceded by its sequence number and a space, e.g. "7 Marker:intro" or "StartRec"
+     *
+     * @param command
+     *     Receives the parsed command. Its type is UNKNOWN_COMMAND if the command is not known
+     *
+     * @return  True if line holds a known command.
+     */
+    bool parseRecordingCommand(const std::string& line, RecordingCommand& command);
+
+    /**
+     * Helper function to get command type in string format to be used for logging purposes
+     */
+    std::string getRecordingCommandTypeString(RecordingCommandType type);
+
+    /*
+    * Watcher of the command file the controlling app writes commands to. Instead of polling the modification time,
+    * it sleeps on file system change notifications of the directory holding the file: inotify on Linux,
+    * ReadDirectoryChangesW on Windows. A write to the file wakes it up right away and it reads the commands.
+    * Elsewhere, or if the directory cannot be watched, the file is read every kCommandPollIntervalInMs instead.
+    *
+    * Commands are lines of the form "<sequence> <command>" with increasing sequence numbers. The writer appends them
+    * or rewrites the file with the latest ones, and every command with a higher sequence number than the last one
+    * taken is returned once, in order, however many were written between two reads. Every line has to end with a
+    * newline. Only for StartRec, StopRec, Pause and Resume a last line without one is taken as well, so writers of a
+    * single keyword keep working. Marker lines are never taken before their newline, as the label could still grow.
+    * Lines without a sequence number keep the old protocol of a single command overwriting the file. Such a line is
+    * taken whenever it differs from the one taken before, so rewriting or touching the file with the same command
+    * for keepalives does not repeat it.
+    * Not thread safe. Used by the command processing thread only.
+    */
+    class CommandWatcher {
+
+    public:
+        CommandWatcher();
+
+        ~CommandWatcher();
+
+        /*
+        * @name Copy and move
+        *
+        * No copying and moving allowed. The watcher owns the notification handle of the system.
+        */
+        CommandWatcher(const CommandWatcher&) = delete;
+        CommandWatcher& operator=(const CommandWatcher&) = delete;
+
+        CommandWatcher(CommandWatcher&&) = delete;
+        CommandWatcher& operator=(CommandWatcher&&) = delete;
+
+        /**
+         * Start watching a command file. Commands already in the file are returned by the first waitForCommands.
+         *
+         * @param commandFileName
+         *     Command file to watch. The file does not need to exist yet, its directory does
+         *
+         * @return  False if change notifications are not available. Commands are then polled for.
+         */
+        bool open(const std::string& commandFileName);
+
+        /**
+         * Wait until the command file changes or timeout passed and read the commands that were not taken before
+         *
+         * @return  New commands in the order they were written. Empty if there are none.
+         */
+        std::vector<RecordingCommand> waitForCommands(std::chrono::milliseconds timeout);
+
+        /**
+         * Get the sequence number of the last command taken. Zero if none had one
+         */
+        uint64_t getLastSequence() const {
+            return lastSequence;
+        }
+
+    private:
+
+        /*
+        * Notification handles of the platform. Defined along with the platform specific code
+        */
+        struct PlatformWatch;
+
+        /**
+         * Internal helper function to block until the command file changes or timeout passed
+         *
+         * @return  True if the command file may have changed.
+         */
+        bool waitForChange(std::chrono::milliseconds timeout);
+
+        /**
+         * Internal helper function to read the command file and collect the commands that were not taken before
+         */
+        void readCommands(std::vector<RecordingCommand>& commands);
+
+        std::string filePath;
+        std::string fileName; // Name of the file within its directory, as reported by change notifications
+        std::unique_ptr<PlatformWatch> platformWatch; // nullptr while the file is polled
+        bool readPending = false; // File content was not read since open
+        uint64_t lastSequence = 0;
+        std::string lastUnsequencedLine; // Last command taken that came without a sequence number
+    };
+}
@@ -18,6 +18,8 @@
 
 #include "PixelShader.h"
 #include "VertexShader.h"
+#include "LatencyHistogram.hpp"
+#include <atomic>
 #include <sstream>
 #include <iomanip>
 
@@ -32,27 +34,33 @@ extern HRESULT FrameInfoExpectedErrors[];
 extern HRESULT AcquireFrameExpectedError[];
 extern HRESULT EnumOutputsExpectedErrors[];
 
+//
+// Frame timing of the duplication threads. Each thread records into histograms of its own DUPLICATIONMANAGER and
+// merges them in here when it exits, so the counters below are safe to update from several threads at once
+//
 struct TimedCaptureProfiling {
     int captureDurationInSeconds = 10;
     int framesPerSecond = 30;
     int desiredFrequency = 1000 / framesPerSecond;
     double actualFrequency = 0.0;
     double processingLoss = 0.0;
-    int numberOfFrames = -1;
-    int lastTick = 0;
-    int currentTick = 0;
-    int sumOfTickDifferences = 0;
-    int numZeroTicks = 0;
+    std::atomic<int> numberOfFrames{ 0 };
+    CapUtils::LatencyHistogram frameIntervals; // Microseconds from one AcquireNextFrame call of a thread to its next
+    CapUtils::LatencyHistogram acquireLatencies; // Microseconds spent within AcquireNextFrame
 
     std::wstring dumpInfo() {
+        const CapUtils::LatencySummary intervals = frameIntervals.getSummary();
+        const CapUtils::LatencySummary acquires = acquireLatencies.getSummary();
         std::wstringstream ss(std::stringstream::in | std::stringstream::out);
         ss << "Capture duration: " << captureDurationInSeconds << " Seconds\n";
         ss << "Frames per second: " << framesPerSecond << "\n";
         ss << "Desired frequency: " << desiredFrequency << " Ms\n";
         ss << "Actual frequency: " << std::setprecision(5) << actualFrequency << " Ms" << " (Average)\n";
-        ss << "Number of ticks: " << (numberOfFrames - numZeroTicks) << "\n";
-        //ss << "Number of zero ticks: " << numZeroTicks << "\n";
-        ss << "Total screen processing time: " << std::setprecision(5) << (double) sumOfTickDifferences / 1000 << "\n";
+        ss << "Number of ticks: " << intervals.count << "\n";
+        ss << "Frame interval p50/p99/p99.9/max: " << intervals.p50InUs << "/" << intervals.p99InUs << "/"
+           << intervals.p999InUs << "/" << intervals.maxInUs << " Us\n";
+        ss << "AcquireNextFrame p50/p99/p99.9/max: " << acquires.p50InUs << "/" << acquires.p99InUs << "/"
+           << acquires.p999InUs << "/" << acquires.maxInUs << " Us\n";
         //ss << "Processing loss: " << std::setprecision(3) << processingLoss << "%\n";
         return ss.str();
     }
@@ -0,0 +1,193 @@
+#include "CpuCompositor.hpp"
+#include "ColorConvert.hpp"
+
+#include <cstddef>
+#include <cstring>
+
+namespace CapUtils {
+
+    namespace {
+
+        constexpr int kBytesPerPixel = 4; // Desktop duplication always delivers BGRA
+        constexpr int kRotateBlockSize = 16; // 16 x 16 pixels of source and destination stay within L1 while rotating
+
+        inline bool isInside(const FrameRect& rect, int width, int height) {
+            return rect.left >= 0 && rect.top >= 0 && rect.right <= width && rect.bottom <= height &&
+                   rect.left <= rect.right && rect.top <= rect.bottom;
+        }
+
+        inline uint8_t* pixelAt(FrameBuffer& frame, int x, int y) {
+            return frame.data + static_cast<std::size_t>(y) * frame.stride + static_cast<std::size_t>(x) * kBytesPerPixel;
+        }
+
+        inline const uint8_t* pixelAt(const FrameBuffer& frame, int x, int y) {
+            return frame.data + static_cast<std::size_t>(y) * frame.stride + static_cast<std::size_t>(x) * kBytesPerPixel;
+        }
+
+        inline bool fitsInto(const FrameBuffer& image, SurfaceRotation rotation, const FrameBuffer& surface,
+                             int originX, int originY) {
+            const bool swapsAxes = rotation == SurfaceRotation::ROTATE90 || rotation == SurfaceRotation::ROTATE270;
+            const int desktopWidth = swapsAxes ? image.height : image.width;
+            const int desktopHeight = swapsAxes ? image.width : image.height;
+            return originX >= 0 && originY >= 0 && originX + desktopWidth <= surface.width &&
+                   originY + desktopHeight <= surface.height;
+        }
+
+        /*
+        * Walks the block in tiles, so neither side is read or written with a large stride for long
+        */
+        void rotateBlitScalar(const uint8_t* src, std::ptrdiff_t srcStepX, std::ptrdiff_t srcStepY,
+                              uint8_t* dst, int dstStride, int width, int height) {
+            for (int tileY = 0; tileY < height; tileY += kRotateBlockSize) {
+                const int tileBottom = (tileY + kRotateBlockSize < height) ? tileY + kRotateBlockSize : height;
+                for (int tileX = 0; tileX < width; tileX += kRotateBlockSize) {
+                    const int tileRight = (tileX + kRotateBlockSize < width) ? tileX + kRotateBlockSize : width;
+                    for (int y = tileY; y < tileBottom; ++y) {
+                        uint8_t* dstRow = dst + static_cast<std::ptrdiff_t>(y) * dstStride;
+                        const uint8_t* srcPixel = src + y * srcStepY + tileX * srcStepX;
+                        for (int x = tileX; x < tileRight; ++x, srcPixel += srcStepX) {
+                            std::memcpy(dstRow + x * kBytesPerPixel, srcPixel, kBytesPerPixel);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    RotateBlitFn getScalarRotateBlitFn() {
+        return rotateBlitScalar;
+    }
+
+    RotateBlitFn getSupportedRotateBlitFn() {
+        static const RotateBlitFn rotateBlit =
+            (getSupportedColorConvertIsa() >= ColorConvertIsa::AVX2 && getAVX2RotateBlitFn() != nullptr) ?
+            getAVX2RotateBlitFn() : getScalarRotateBlitFn();
+        return rotateBlit;
+    }
+
+    FrameRect rotateToDesktop(const FrameRect& rect, SurfaceRotation rotation, int imageWidth, int imageHeight) {
+        switch (rotation) {
+        case SurfaceRotation::ROTATE90:
+            return { imageHeight - rect.bottom, rect.left, imageHeight - rect.top, rect.right };
+        case SurfaceRotation::ROTATE180:
+            return { imageWidth - rect.right, imageHeight - rect.bottom, imageWidth - rect.left, imageHeight - rect.top };
+        case SurfaceRotation::ROTATE270:
+            return { rect.top, imageWidth - rect.right, rect.bottom, imageWidth - rect.left };
+        case SurfaceRotation::IDENTITY:
+        default:
+            return rect;
+        }
+    }
+
+    bool CpuCompositor::compose(const FrameBuffer& image, SurfaceRotation rotation,
+                                const FrameMoveRect* moveRects, int moveCount, const FrameRect* dirtyRects, int dirtyCount,
+                                FrameBuffer& surface, int originX, int originY) const {
+        if (image.pixelFormat != FramePixelFormat::BGRA || surface.pixelFormat != FramePixelFormat::BGRA) {
+            return false;
+        }
+
+        if (!fitsInto(image, rotation, surface, originX, originY)) {
+            return false;
+        }
+
+        // Check everything upfront, so a bad rect never leaves the surface half updated
+        for (int i = 0; i < moveCount; ++i) {
+            const FrameRect& destination = moveRects[i].destination;
+            const FrameRect source = { moveRects[i].sourceX, moveRects[i].sourceY,
+                                       moveRects[i].sourceX + destination.right - destination.left,
+                                       moveRects[i].sourceY + destination.bottom - destination.top };
+            if (!isInside(destination, image.width, image.height) || !isInside(source, image.width, image.height)) {
+                return false;
+            }
+        }
+        for (int i = 0; i < dirtyCount; ++i) {
+            if (!isInside(dirtyRects[i], image.width, image.height)) {
+                return false;
+            }
+        }
+
+        // Moves only translate, so once both rects are rotated they are a plain block move within the desktop
+        for (int i = 0; i < moveCount; ++i) {
+            const FrameRect& destination = moveRects[i].destination;
+            const FrameRect source = { moveRects[i].sourceX, moveRects[i].sourceY,
+                                       moveRects[i].sourceX + destination.right - destination.left,
+                                       moveRects[i].sourceY + destination.bottom - destination.top };
+            const FrameRect desktopSource = rotateToDesktop(source, rotation, image.width, image.height);
+            const FrameRect desktopDestination = rotateToDesktop(destination, rotation, image.width, image.height);
+            moveBlock(surface, originX + desktopSource.left, originY + desktopSource.top,
+                      originX + desktopDestination.left, originY + desktopDestination.top,
+                      desktopDestination.right - desktopDestination.left, desktopDestination.bottom - desktopDestination.top);
+        }
+
+        for (int i = 0; i < dirtyCount; ++i) {
+            copyRotated(image, dirtyRects[i], rotation, surface, originX, originY);
+        }
+        return true;
+    }
+
+    void CpuCompositor::copyRotated(const FrameBuffer& image, const FrameRect& rect, SurfaceRotation rotation,
+                                    FrameBuffer& surface, int originX, int originY) {
+        const FrameRect desktopRect = rotateToDesktop(rect, rotation, image.width, image.height);
+        const int width = desktopRect.right - desktopRect.left;
+        const int height = desktopRect.bottom - desktopRect.top;
+        if (width <= 0 || height <= 0) {
+            return;
+        }
+
+        uint8_t* dst = pixelAt(surface, originX + desktopRect.left, originY + desktopRect.top);
+        const std::ptrdiff_t imageStride = image.stride;
+        const RotateBlitFn rotateBlit = getSupportedRotateBlitFn();
+
+        // Source pixel of the top left destination pixel and the source steps for one destination pixel right and down
+        switch (rotation) {
+        case SurfaceRotation::ROTATE90:
+            rotateBlit(pixelAt(image, desktopRect.top, image.height - 1 - desktopRect.left), -imageStride, kBytesPerPixel,
+                        dst, surface.stride, width, height);
+            break;
+        case SurfaceRotation::ROTATE180:
+            rotateBlit(pixelAt(image, image.width - 1 - desktopRect.left, image.height - 1 - desktopRect.top),
+                        -kBytesPerPixel, -imageStride, dst, surface.stride, width, height);
+            break;
+        case SurfaceRotation::ROTATE270:
+            rotateBlit(pixelAt(image, image.width - 1 - desktopRect.top, desktopRect.left), imageStride, -kBytesPerPixel,
+                        dst, surface.stride, width, height);
+            break;
+        case SurfaceRotation::IDENTITY:
+        default:
+            // Plain row copies, memcpy already runs at full vector width
+            for (int y = 0; y < height; ++y) {
+                std::memcpy(dst + static_cast<std::size_t>(y) * surface.stride, pixelAt(image, rect.left, rect.top + y),
+                            static_cast<std::size_t>(width) * kBytesPerPixel);
+            }
+            break;
+        }
+    }
+
+    bool CpuCompositor::rotateImage(const FrameBuffer& image, SurfaceRotation rotation, FrameBuffer& surface) {
+        if (image.pixelFormat != FramePixelFormat::BGRA || surface.pixelFormat != FramePixelFormat::BGRA ||
+            !fitsInto(image, rotation, surface, 0, 0)) {
+            return false;
+        }
+        copyRotated(image, { 0, 0, image.width, image.height }, rotation, surface, 0, 0);
+        return true;
+    }
+
+    void CpuCompositor::moveBlock(FrameBuffer& surface, int srcX, int srcY, int dstX, int dstY, int width, int height) {
+        if (width <= 0 || height <= 0) {
+            return;
+        }
+
+        // Rows are walked away from the destination, memmove takes care of overlap within a row
+        const std::size_t rowBytes = static_cast<std::size_t>(width) * kBytesPerPixel;
+        if (dstY > srcY) {
+            for (int row = height - 1; row >= 0; --row) {
+                std::memmove(pixelAt(surface, dstX, dstY + row), pixelAt(surface, srcX, srcY + row), rowBytes);
+            }
+        }
+        else {
+            for (int row = 0; row < height; ++row) {
+                std::memmove(pixelAt(surface, dstX, dstY + row), pixelAt(surface, srcX, srcY + row), rowBytes);
+            }
+        }
+    }
+}
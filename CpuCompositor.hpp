@@ -0,0 +1,126 @@
+#pragma once
+
+#include "FramePool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace CapUtils {
+
+    /*
+    * Rotation of a desktop against the image delivered by desktop duplication. Same meaning as DXGI_MODE_ROTATION,
+    * the delivered image is never rotated and rects of its metadata are in image coordinates.
+    */
+    enum class SurfaceRotation {
+        IDENTITY = 0,  // Image shows the desktop as is
+        ROTATE90 = 1,  // Desktop is the image rotated by 90 degrees clockwise
+        ROTATE180 = 2, // Desktop is the image rotated by 180 degrees
+        ROTATE270 = 3  // Desktop is the image rotated by 270 degrees clockwise
+    };
+
+    /**
+     * Helper function to map a rect of the delivered image into desktop coordinates.
+     * Shared by the GPU and CPU compositors, so both agree on the geometry.
+     *
+     * @param rect
+     *     Rect in image coordinates
+     *
+     * @param rotation
+     *     Rotation of the desktop
+     *
+     * @param imageWidth
+     *     Width of the delivered image. Height of the desktop for 90 and 270 degrees.
+     *
+     * @param imageHeight
+     *     Height of the delivered image. Width of the desktop for 90 and 270 degrees.
+     *
+     * @return  Rect in desktop coordinates covering exactly the pixels of rect.
+     */
+    FrameRect rotateToDesktop(const FrameRect& rect, SurfaceRotation rotation, int imageWidth, int imageHeight);
+
+    /*
+    * Kernel filling a width x height block of 32 bit pixels at dst. The pixel for dst (x, y) is read at
+    * src + x * srcStepX + y * srcStepY, which covers every rotation and mirroring of a rect.
+    * SIMD kernels speed up transposes (srcStepY of plus or minus 4 bytes) and mirrored rows (srcStepX of -4 bytes)
+    * and hand every other layout, as well as partial tiles, over to the scalar kernel.
+    */
+    using RotateBlitFn = void(*)(const uint8_t* src, std::ptrdiff_t srcStepX, std::ptrdiff_t srcStepY,
+                                 uint8_t* dst, int dstStride, int width, int height);
+
+    /*
+    * Blit kernels for each instruction set. SIMD kernels return nullptr if they are not part of this build.
+    */
+    RotateBlitFn getScalarRotateBlitFn();
+    RotateBlitFn getAVX2RotateBlitFn();
+
+    /**
+     * Get the blit kernel of the best instruction set supported by this build and CPU
+     */
+    RotateBlitFn getSupportedRotateBlitFn();
+
+    /*
+    * Portable compositor that replays move and dirty rects of desktop duplication onto a BGRA surface in system
+    * memory, for every desktop rotation. Moves are applied first as overlap safe row moves within the surface,
+    * then dirty rects are copied from the delivered image, rotated as needed.
+    * The result is bit exact with the GPU compositor of DISPLAYMANAGER, which makes it usable to validate its
+    * geometry anywhere and as a fallback when the GPU cannot composite.
+    */
+    class CpuCompositor {
+
+    public:
+        /**
+         * Apply the moves and dirty rects of one frame
+         *
+         * @param image
+         *     BGRA image delivered with the rects. Source of every dirty rect.
+         *
+         * @param rotation
+         *     Rotation of the desktop against image
+         *
+         * @param moveRects
+         *     Moves in image coordinates, applied in order. May be nullptr if moveCount is 0.
+         *
+         * @param moveCount
+         *     Number of entries in moveRects
+         *
+         * @param dirtyRects
+         *     Dirty rects in image coordinates. May be nullptr if dirtyCount is 0.
+         *
+         * @param dirtyCount
+         *     Number of entries in dirtyRects
+         *
+         * @param surface
+         *     BGRA surface holding the desktop as of the previous frame
+         *
+         * @param originX
+         *     Left edge of the desktop within surface
+         *
+         * @param originY
+         *     Top edge of the desktop within surface
+         *
+         * @return  False if a rect lies outside the image or the rotated image does not fit into surface at origin.
+         *          Nothing is written in that case.
+         */
+        bool compose(const FrameBuffer& image, SurfaceRotation rotation,
+                     const FrameMoveRect* moveRects, int moveCount, const FrameRect* dirtyRects, int dirtyCount,
+                     FrameBuffer& surface, int originX, int originY) const;
+
+        /**
+         * Copy a rect of image into surface, rotated into desktop coordinates
+         */
+        static void copyRotated(const FrameBuffer& image, const FrameRect& rect, SurfaceRotation rotation,
+                                FrameBuffer& surface, int originX, int originY);
+
+        /**
+         * Copy all of image into surface at the top left corner, turning a rotated desktop upright in a single pass
+         *
+         * @return  False if image or surface is not BGRA or the rotated image does not fit into surface.
+         */
+        static bool rotateImage(const FrameBuffer& image, SurfaceRotation rotation, FrameBuffer& surface);
+
+        /**
+         * Move a block of pixels within surface. Overlapping source and destination are handled.
+         */
+        static void moveBlock(FrameBuffer& surface, int srcX, int srcY, int dstX, int dstY, int width, int height);
+    };
+}
@@ -0,0 +1,150 @@
+#include "CpuCompositor.hpp"
+
+// This file must be compiled with AVX2 enabled (/arch:AVX2), otherwise the kernel is left out of the build
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+namespace CapUtils {
+
+    namespace {
+
+        constexpr int kBytesPerPixel = 4;
+        constexpr int kRegisterTile = 8; // 8 x 8 pixels, one 256 bit register per row
+        constexpr int kCacheBlock = 64; // Tiles are walked in 64 x 64 blocks, so every cache line loaded is used completely
+
+        inline __m256i loadPixels(const uint8_t* src) {
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+        }
+
+        /*
+        * Load 8 pixels ending at last, reversed, so the pixel at last comes first
+        */
+        inline __m256i loadReversedPixels(const uint8_t* last) {
+            const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+            return _mm256_permutevar8x32_epi32(loadPixels(last - (kRegisterTile - 1) * kBytesPerPixel), reverse);
+        }
+
+        inline void transpose8x8(__m256i rows[kRegisterTile]) {
+            const __m256i t0 = _mm256_unpacklo_epi32(rows[0], rows[1]);
+            const __m256i t1 = _mm256_unpackhi_epi32(rows[0], rows[1]);
+            const __m256i t2 = _mm256_unpacklo_epi32(rows[2], rows[3]);
+            const __m256i t3 = _mm256_unpackhi_epi32(rows[2], rows[3]);
+            const __m256i t4 = _mm256_unpacklo_epi32(rows[4], rows[5]);
+            const __m256i t5 = _mm256_unpackhi_epi32(rows[4], rows[5]);
+            const __m256i t6 = _mm256_unpacklo_epi32(rows[6], rows[7]);
+            const __m256i t7 = _mm256_unpackhi_epi32(rows[6], rows[7]);
+
+            const __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+            const __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+            const __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+            const __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+            const __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+            const __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+            const __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+            const __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+            rows[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+            rows[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+            rows[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+            rows[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+            rows[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+            rows[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+            rows[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+            rows[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+        }
+
+        /*
+        * Rotation by 90 or 270 degrees. Source step X crosses rows of the source, so the 8 destination pixels of a
+        * register tile column are contiguous in one source row. Loading 8 source rows and transposing them
+        * gives 8 destination rows.
+        */
+        void transposeBlit(const uint8_t* src, std::ptrdiff_t srcStepX, std::ptrdiff_t srcStepY,
+                           uint8_t* dst, int dstStride, int width, int height) {
+            const bool reversed = srcStepY < 0;
+            __m256i rows[kRegisterTile];
+
+            for (int blockY = 0; blockY < height; blockY += kCacheBlock) {
+                const int blockBottom = (blockY + kCacheBlock < height) ? blockY + kCacheBlock : height;
+                for (int blockX = 0; blockX < width; blockX += kCacheBlock) {
+                    const int blockRight = (blockX + kCacheBlock < width) ? blockX + kCacheBlock : width;
+
+                    for (int tileY = blockY; tileY < blockBottom; tileY += kRegisterTile) {
+                        for (int tileX = blockX; tileX < blockRight; tileX += kRegisterTile) {
+                            const uint8_t* tileSrc = src + tileX * srcStepX + tileY * srcStepY;
+                            for (int i = 0; i < kRegisterTile; ++i) {
+                                rows[i] = reversed ? loadReversedPixels(tileSrc + i * srcStepX) : loadPixels(tileSrc + i * srcStepX);
+                            }
+
+                            transpose8x8(rows);
+
+                            uint8_t* tileDst = dst + static_cast<std::ptrdiff_t>(tileY) * dstStride + tileX * kBytesPerPixel;
+                            for (int i = 0; i < kRegisterTile; ++i) {
+                                _mm256_storeu_si256(reinterpret_cast<__m256i*>(tileDst + static_cast<std::ptrdiff_t>(i) * dstStride), rows[i]);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        /*
+        * Rotation by 180 degrees. Every destination row is a source row read backwards.
+        */
+        void mirrorBlit(const uint8_t* src, std::ptrdiff_t srcStepY, uint8_t* dst, int dstStride, int width, int height) {
+            for (int y = 0; y < height; ++y) {
+                const uint8_t* srcRow = src + y * srcStepY;
+                uint8_t* dstRow = dst + static_cast<std::ptrdiff_t>(y) * dstStride;
+                for (int x = 0; x < width; x += kRegisterTile) {
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dstRow + x * kBytesPerPixel),
+                                        loadReversedPixels(srcRow - x * kBytesPerPixel));
+                }
+            }
+        }
+
+        void rotateBlitAVX2(const uint8_t* src, std::ptrdiff_t srcStepX, std::ptrdiff_t srcStepY,
+                            uint8_t* dst, int dstStride, int width, int height) {
+            const RotateBlitFn rotateBlitScalar = getScalarRotateBlitFn();
+            const bool transposes = srcStepY == kBytesPerPixel || srcStepY == -kBytesPerPixel;
+            const bool mirrors = srcStepX == -kBytesPerPixel;
+            if (!transposes && !mirrors) {
+                rotateBlitScalar(src, srcStepX, srcStepY, dst, dstStride, width, height);
+                return;
+            }
+
+            // Whole register tiles with SIMD, the right and bottom edges with the scalar kernel
+            const int simdWidth = width & ~(kRegisterTile - 1);
+            const int simdHeight = transposes ? height & ~(kRegisterTile - 1) : height;
+            if (transposes) {
+                transposeBlit(src, srcStepX, srcStepY, dst, dstStride, simdWidth, simdHeight);
+            }
+            else {
+                mirrorBlit(src, srcStepY, dst, dstStride, simdWidth, simdHeight);
+            }
+
+            if (simdWidth < width) {
+                rotateBlitScalar(src + simdWidth * srcStepX, srcStepX, srcStepY, dst + simdWidth * kBytesPerPixel,
+                                 dstStride, width - simdWidth, height);
+            }
+            if (simdHeight < height) {
+                rotateBlitScalar(src + simdHeight * srcStepY, srcStepX, srcStepY,
+                                 dst + static_cast<std::ptrdiff_t>(simdHeight) * dstStride, dstStride, simdWidth, height - simdHeight);
+            }
+        }
+    }
+
+    RotateBlitFn getAVX2RotateBlitFn() {
+        return rotateBlitAVX2;
+    }
+}
+
+#else
+
+namespace CapUtils {
+
+    RotateBlitFn getAVX2RotateBlitFn() {
+        return nullptr;
+    }
+}
+
+#endif
@@ -0,0 +1,191 @@
+#include "DeadlineScheduler.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#else
+#include <time.h>
+#endif
+
+namespace CapUtils {
+
+    namespace {
+
+        constexpr int64_t kNanosecondsPerSecond = 1000 * 1000 * 1000;
+    }
+
+    bool parseMissedTickPolicy(const std::string& policyName, MissedTickPolicy& policy) {
+        if (policyName == "catchup") {
+            policy = MissedTickPolicy::CATCH_UP;
+        }
+        else if (policyName == "skip") {
+            policy = MissedTickPolicy::SKIP;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    std::string getMissedTickPolicyString(MissedTickPolicy policy) {
+        std::string result = "";
+        switch (policy) {
+        case MissedTickPolicy::CATCH_UP:
+            result = "CATCH_UP";
+            break;
+        case MissedTickPolicy::SKIP:
+            result = "SKIP";
+            break;
+        default:
+            break;
+        }
+        return result;
+    }
+
+    DeadlineScheduler::DeadlineScheduler(int ticksPerSecond, MissedTickPolicy policy) :
+        ticksPerSecond((ticksPerSecond < 1) ? 1 : ((ticksPerSecond > 1000) ? 1000 : ticksPerSecond)),
+        missedTickPolicy(policy) {
+#ifdef _WIN32
+        // Regular waitable timers expire on the system tick of up to 15.6 ms. Older systems only have those
+        waitableTimer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+        if (waitableTimer == nullptr) {
+            waitableTimer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+        }
+#endif
+        start();
+    }
+
+    DeadlineScheduler::~DeadlineScheduler() {
+#ifdef _WIN32
+        if (waitableTimer != nullptr) {
+            CloseHandle(waitableTimer);
+        }
+#endif
+    }
+
+    void DeadlineScheduler::start() {
+        startTimePoint = std::chrono::steady_clock::now();
+        nextTick = 0;
+        anchorTick = 0;
+        anchorDeadline = 0;
+        tickCount = 0;
+        missedTickCount = 0;
+        skippedTickCount = 0;
+        latenessSum = 0.0;
+        latenessSquareSum = 0.0;
+        maxLateness = 0;
+    }
+
+    void DeadlineScheduler::waitForNextTick() const {
+        sleepUntil(getDeadline(nextTick));
+    }
+
+    uint64_t DeadlineScheduler::takeTick() {
+        const int64_t elapsed = getElapsed();
+        uint64_t tick = nextTick;
+
+        // Deadline of the following tick passed as well, so at least one tick came too late
+        if (elapsed >= getDeadline(tick + 1)) {
+            ++missedTickCount;
+            if (missedTickPolicy == MissedTickPolicy::SKIP) {
+                const uint64_t dueTick = getTicksWithin(std::chrono::nanoseconds(elapsed)) - 1;
+                skippedTickCount += dueTick - tick;
+                tick = dueTick;
+            }
+        }
+        nextTick = tick + 1;
+
+        const int64_t lateness = (elapsed > getDeadline(tick)) ? elapsed - getDeadline(tick) : 0;
+        ++tickCount;
+        latenessSum += static_cast<double>(lateness);
+        latenessSquareSum += static_cast<double>(lateness) * static_cast<double>(lateness);
+        maxLateness = (lateness > maxLateness) ? lateness : maxLateness;
+        return tick;
+    }
+
+    std::chrono::nanoseconds DeadlineScheduler::getTimeUntilNextTick() const {
+        const int64_t timeLeft = getDeadline(nextTick) - getElapsed();
+        return std::chrono::nanoseconds((timeLeft > 0) ? timeLeft : 0);
+    }
+
+    uint64_t DeadlineScheduler::getTicksWithin(std::chrono::nanoseconds duration) const {
+        if (duration.count() < anchorDeadline) {
+            return anchorTick;
+        }
+        // Tick anchorTick + N is within duration while N * kNanosecondsPerSecond <= (duration - anchorDeadline) * ticksPerSecond
+        const uint64_t nanoseconds = static_cast<uint64_t>(duration.count() - anchorDeadline);
+        const uint64_t seconds = nanoseconds / kNanosecondsPerSecond;
+        const uint64_t remainder = nanoseconds % kNanosecondsPerSecond;
+        return anchorTick + seconds * ticksPerSecond + (remainder * ticksPerSecond) / kNanosecondsPerSecond + 1;
+    }
+
+    void DeadlineScheduler::setTicksPerSecond(int newTicksPerSecond) {
+        anchorDeadline = getDeadline(nextTick);
+        anchorTick = nextTick;
+        ticksPerSecond = (newTicksPerSecond < 1) ? 1 : ((newTicksPerSecond > 1000) ? 1000 : newTicksPerSecond);
+    }
+
+    TickJitterStats DeadlineScheduler::getJitterStats() const {
+        TickJitterStats stats;
+        stats.ticks = tickCount;
+        stats.missedTicks = missedTickCount;
+        stats.skippedTicks = skippedTickCount;
+        if (tickCount > 0) {
+            const double mean = latenessSum / static_cast<double>(tickCount);
+            const double variance = latenessSquareSum / static_cast<double>(tickCount) - mean * mean;
+            stats.meanLatenessInUs = static_cast<int64_t>(mean / 1000.0);
+            stats.stdDevLatenessInUs = static_cast<int64_t>(((variance > 0.0) ? std::sqrt(variance) : 0.0) / 1000.0);
+            stats.maxLatenessInUs = maxLateness / 1000;
+        }
+        return stats;
+    }
+
+    int64_t DeadlineScheduler::getDeadline(uint64_t tick) const {
+        // Split into whole seconds, so the product cannot overflow however long the schedule runs.
+        // Ticks are only ever asked for from the anchor on, earlier ones were taken at an earlier rate
+        const uint64_t ticksSinceAnchor = (tick > anchorTick) ? tick - anchorTick : 0;
+        const uint64_t seconds = ticksSinceAnchor / ticksPerSecond;
+        const uint64_t remainder = ticksSinceAnchor % ticksPerSecond;
+        return anchorDeadline + static_cast<int64_t>(seconds * kNanosecondsPerSecond + (remainder * kNanosecondsPerSecond) / ticksPerSecond);
+    }
+
+    int64_t DeadlineScheduler::getElapsed() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTimePoint).count();
+    }
+
+    void DeadlineScheduler::sleepUntil(int64_t deadline) const {
+#ifdef _WIN32
+        // Waitable timers take relative due times in 100 ns units. A wakeup short of the deadline waits again
+        int64_t timeLeft = deadline - getElapsed();
+        while (waitableTimer != nullptr && timeLeft > 0) {
+            LARGE_INTEGER dueTime;
+            dueTime.QuadPart = -((timeLeft + 99) / 100);
+            if (!SetWaitableTimer(waitableTimer, &dueTime, 0, NULL, NULL, FALSE) ||
+                WaitForSingleObject(waitableTimer, INFINITE) != WAIT_OBJECT_0) {
+                break;
+            }
+            timeLeft = deadline - getElapsed();
+        }
+#else
+        // steady_clock is CLOCK_MONOTONIC, so the deadline can be slept until as an absolute time of that clock
+        const int64_t wakeTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            startTimePoint.time_since_epoch()).count() + deadline;
+        timespec wakeSpec;
+        wakeSpec.tv_sec = static_cast<time_t>(wakeTime / kNanosecondsPerSecond);
+        wakeSpec.tv_nsec = static_cast<long>(wakeTime % kNanosecondsPerSecond);
+        int err = 0;
+        while ((err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeSpec, nullptr)) == EINTR) {
+        }
+        if (err == 0) {
+            return;
+        }
+#endif
+        std::this_thread::sleep_until(startTimePoint + std::chrono::nanoseconds(deadline));
+    }
+}
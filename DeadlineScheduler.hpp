@@ -0,0 +1,167 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace CapUtils {
+
+    /*
+    * What a scheduler does with ticks whose deadline passed before they could be taken
+    */
+    enum class MissedTickPolicy {
+        CATCH_UP = 0, // Missed ticks are taken back to back until the schedule is met again. No tick is lost
+        SKIP = 1      // Missed ticks are dropped and ticking resumes with the next deadline still ahead
+    };
+
+    /**
+     * Helper function to parse missed tick policy from its config file name
+     *
+     * @param policyName
+     *     Either "catchup" or "skip"
+     *
+     * @param policy
+     *     Receives the parsed policy
+     *
+     * @return  True if policyName is a known policy.
+     */
+    bool parseMissedTickPolicy(const std::string& policyName, MissedTickPolicy& policy);
+
+    /**
+     * Helper function to get missed tick policy in string format to be used for logging purposes
+     */
+    std::string getMissedTickPolicyString(MissedTickPolicy policy);
+
+    /*
+    * Datastructure to hold the timing statistics of a scheduler. Lateness is how long after its deadline a tick
+    * was taken.
+    */
+    struct TickJitterStats {
+        uint64_t ticks = 0; // Ticks taken
+        uint64_t missedTicks = 0; // Ticks taken after the deadline of the tick following them
+        uint64_t skippedTicks = 0; // Ticks dropped by MissedTickPolicy::SKIP
+        int64_t meanLatenessInUs = 0;
+        int64_t stdDevLatenessInUs = 0;
+        int64_t maxLatenessInUs = 0;
+    };
+
+    /*
+    * Scheduler of periodic ticks at absolute deadlines. Deadline N lies exactly N / ticksPerSecond seconds after the
+    * start in nanoseconds, so neither rounding of the period nor the time spent between ticks accumulates.
+    * On Linux ticks are waited for with clock_nanosleep(TIMER_ABSTIME) on the monotonic clock, on Windows with a
+    * high resolution waitable timer. Ticks can also be driven by an external timer through takeTick.
+    * The rate can change while ticking. The schedule is then anchored at the next deadline and continues from there
+    * at the new rate, so deadlines stay absolute and tick indexes keep counting.
+    * Not thread safe. Ticks have to be taken one at a time, statistics read once ticking stopped.
+    */
+    class DeadlineScheduler {
+
+    public:
+        /**
+         * DeadlineScheduler constructor
+         *
+         * @param ticksPerSecond
+         *     Tick rate. Values outside 1 - 1000 are clamped
+         *
+         * @param policy
+         *     What to do with ticks that were missed
+         */
+        DeadlineScheduler(int ticksPerSecond, MissedTickPolicy policy);
+
+        ~DeadlineScheduler();
+
+        /*
+        * @name Copy and move
+        *
+        * No copying and moving allowed. The waitable timer handle is owned by the scheduler.
+        */
+        DeadlineScheduler(const DeadlineScheduler&) = delete;
+        DeadlineScheduler& operator=(const DeadlineScheduler&) = delete;
+
+        DeadlineScheduler(DeadlineScheduler&&) = delete;
+        DeadlineScheduler& operator=(DeadlineScheduler&&) = delete;
+
+        /**
+         * Anchor the schedule at the current time and clear the statistics. The first tick is due right away.
+         */
+        void start();
+
+        /**
+         * Sleep until the next tick is due. Returns right away if it is due already
+         */
+        void waitForNextTick() const;
+
+        /**
+         * Take the next tick now, whether it is due or not, and apply the missed tick policy
+         *
+         * @return  Index of the tick taken, counted from zero at start.
+         */
+        uint64_t takeTick();
+
+        /**
+         * Get the time left until the next tick is due. Zero if it is due already.
+         */
+        std::chrono::nanoseconds getTimeUntilNextTick() const;
+
+        /**
+         * Get the number of ticks due within duration from the start, i.e. the index of the first tick after it.
+         * Ticks are counted at the current rate from the last rate change, durations before it count no further
+         */
+        uint64_t getTicksWithin(std::chrono::nanoseconds duration) const;
+
+        TickJitterStats getJitterStats() const;
+
+        int getTicksPerSecond() const {
+            return ticksPerSecond;
+        }
+
+        /**
+         * Change the tick rate. The next tick stays due when it was, the ones after it follow at the new rate
+         *
+         * @param newTicksPerSecond
+         *     Tick rate. Values outside 1 - 1000 are clamped
+         */
+        void setTicksPerSecond(int newTicksPerSecond);
+
+        MissedTickPolicy getMissedTickPolicy() const {
+            return missedTickPolicy;
+        }
+
+        void setMissedTickPolicy(MissedTickPolicy policy) {
+            missedTickPolicy = policy;
+        }
+
+    private:
+
+        /**
+         * Internal helper function to get deadline of a tick in nanoseconds since the start
+         */
+        int64_t getDeadline(uint64_t tick) const;
+
+        /**
+         * Internal helper function to get the current time in nanoseconds since the start
+         */
+        int64_t getElapsed() const;
+
+        /**
+         * Internal helper function to block until elapsed time reaches deadline
+         */
+        void sleepUntil(int64_t deadline) const;
+
+        int ticksPerSecond = 30;
+        MissedTickPolicy missedTickPolicy = MissedTickPolicy::CATCH_UP;
+        std::chrono::steady_clock::time_point startTimePoint; // Time of tick zero
+        uint64_t nextTick = 0; // Index of the tick to be taken next
+        uint64_t anchorTick = 0; // Tick the current rate applies from
+        int64_t anchorDeadline = 0; // Deadline of anchorTick in nanoseconds since the start
+        void* waitableTimer = nullptr; // High resolution waitable timer on Windows. nullptr falls back to sleep_until
+
+        // Running sums of the lateness of taken ticks, in nanoseconds
+        uint64_t tickCount = 0;
+        uint64_t missedTickCount = 0;
+        uint64_t skippedTickCount = 0;
+        double latenessSum = 0.0;
+        double latenessSquareSum = 0.0;
+        int64_t maxLateness = 0;
+    };
+}
@@ -42,6 +42,8 @@ void performTimedCatureSession(int duration, const HWND& windowHandle, std::prom
 // Globals
 //
 OUTPUTMANAGER OutMgr;
+std::string TraceFileName; // Base name of capture traces recorded by duplication threads. Empty if not recording
+std::atomic<int> TraceSessionCount = 0; // Number of duplication threads that started recording a trace
 
 // Below are lists of errors expect from Dxgi API calls when a transition event like mode change, PnpStop, PnpStart
 // desktop switch, TDR or session disconnect/reconnect. In all these cases we want the application to clean up the threads that process
@@ -410,9 +412,10 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
     timedCapture = true;
     Sleep(150);
 
-    int actualNumberOfTicks = timedCaptureProfiling.numberOfFrames - timedCaptureProfiling.numZeroTicks;
+    const CapUtils::LatencySummary FrameIntervals = timedCaptureProfiling.frameIntervals.getSummary();
+    int actualNumberOfTicks = static_cast<int>(FrameIntervals.count);
 
-    timedCaptureProfiling.actualFrequency = (double)timedCaptureProfiling.sumOfTickDifferences / actualNumberOfTicks;
+    timedCaptureProfiling.actualFrequency = (double)FrameIntervals.meanInUs / 1000;
 
     timedCaptureProfiling.processingLoss = (double)100 * actualNumberOfTicks * (timedCaptureProfiling.actualFrequency - timedCaptureProfiling.desiredFrequency) / (timedCaptureProfiling.captureDurationInSeconds * 1000);
 
@@ -436,7 +439,7 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
 //
 void ShowHelp()
 {
-    DisplayMsg(L"The following optional parameters can be used -\n  /output [all | n]\t\tto duplicate all outputs or the nth output\n  /?\t\t\tto display this help section",
+    DisplayMsg(L"The following optional parameters can be used -\n  /output [all | n]\t\tto duplicate all outputs or the nth output\n  /trace file\t\tto record capture traces of output n to file.n.k\n  /?\t\t\tto display this help section",
                L"Proper usage", S_OK);
 }
 
@@ -468,6 +471,17 @@ bool ProcessCmdline(_Out_ INT* Output)
             }
             continue;
         }
+        else if ((strcmp(__argv[i], "-trace") == 0) ||
+                 (strcmp(__argv[i], "/trace") == 0))
+        {
+            if (++i >= static_cast<UINT>(__argc))
+            {
+                return false;
+            }
+
+            TraceFileName = __argv[i];
+            continue;
+        }
         else
         {
             return false;
@@ -575,6 +589,11 @@ DWORD WINAPI DDProc(_In_ void* Param)
     FRAME_DATA CurrentData;
 
     DispMgr.setupFFMPEGBasedScreenEncode(3240, 2160, 30, 5, "out", "fullcase.m3u8");
+    if (!TraceFileName.empty())
+    {
+        // Duplication threads are restarted on desktop transitions, so each one records a trace of its own
+        DispMgr.StartTraceRecording(TraceFileName + "." + std::to_string(TData->Output) + "." + std::to_string(TraceSessionCount++));
+    }
 
     while ((WaitForSingleObjectEx(TData->TerminateThreadsEvent, 0, FALSE) == WAIT_TIMEOUT))
     {
@@ -593,7 +612,8 @@ DWORD WINAPI DDProc(_In_ void* Param)
             // Check for timeout
             if (TimeOut)
             {
-                // No new frame at the moment
+                // No new frame at the moment, desktop is static
+                DispMgr.ProcessIdle();
                 continue;
             }
         }
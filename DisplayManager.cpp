@@ -7,6 +7,12 @@
 
 #include "DisplayManager.h"
 #include "LogUtil.hpp"
+#include "ColorConvert.hpp"
+#include "CpuCompositor.hpp"
+#include "../include/rapidjson/document.h"
+
+#include <fstream>
+#include <sstream>
 
 using namespace DirectX;
 using namespace LogUtils;
@@ -17,6 +23,7 @@ using namespace LogUtils;
 DISPLAYMANAGER::DISPLAYMANAGER() : m_Device(nullptr),
                                    m_DeviceContext(nullptr),
                                    m_MoveSurf(nullptr),
+                                   m_StagingSurf(nullptr),
                                    m_VertexShader(nullptr),
                                    m_PixelShader(nullptr),
                                    m_InputLayout(nullptr),
@@ -28,12 +35,20 @@ DISPLAYMANAGER::DISPLAYMANAGER() : m_Device(nullptr),
 }
 
 //
-// Destructor calls CleanRefs to destroy everything
+// Destructor flushes the encoder and calls CleanRefs to destroy everything
 //
 DISPLAYMANAGER::~DISPLAYMANAGER()
 {
+    flushEncoder();
     CleanRefs();
 
+    if (traceRecorder)
+    {
+        traceRecorder->close();
+        ALOG(INFO, "Capture trace written:", NVV(traceFrames, traceRecorder->getFrameCount()),
+             NVV(traceBytes, traceRecorder->getWrittenBytes()), NVV(traceDroppedFrames, traceRecorder->getDroppedFrames()));
+    }
+
     if (m_DirtyVertexBufferAlloc)
     {
         delete [] m_DirtyVertexBufferAlloc;
@@ -83,11 +98,24 @@ DUPL_RETURN DISPLAYMANAGER::ProcessFrame(_In_ FRAME_DATA* Data, _Inout_ ID3D11Te
             }
         }
 
-        if (Data->DirtyCount)
+        // DXGI reports lots of small overlapping dirty rects. Copy, draw and convert a few tile aligned ones instead
+        coalesceDirtyRects(reinterpret_cast<RECT*>(Data->MetaData + (Data->MoveCount * sizeof(DXGI_OUTDUPL_MOVE_RECT))), Data->DirtyCount, Desc.Width, Desc.Height);
+        UINT DirtyCount = static_cast<UINT>(coalescedDirtyRects.size());
+
+        if (DirtyCount)
         {
-            Ret = CopyDirty(Data->Frame, SharedSurf, reinterpret_cast<RECT*>(Data->MetaData + (Data->MoveCount * sizeof(DXGI_OUTDUPL_MOVE_RECT))), Data->DirtyCount, OffsetX, OffsetY, DeskDesc);
+            Ret = CopyDirty(Data->Frame, SharedSurf, coalescedDirtyRects.data(), DirtyCount, OffsetX, OffsetY, DeskDesc);
+            if (Ret != DUPL_RETURN_SUCCESS)
+            {
+                return Ret;
+            }
         }
-        performCopying(SharedSurf);
+        Ret = performCopying(SharedSurf, Data, coalescedDirtyRects.data(), DirtyCount, OffsetX, OffsetY, DeskDesc);
+    }
+    else
+    {
+        // Only the mouse moved, desktop image is the same as before
+        ProcessIdle();
     }
 
     return Ret;
@@ -102,71 +130,57 @@ ID3D11Device* DISPLAYMANAGER::GetDevice()
 }
 
 //
-// Set appropriate source and destination rects for move rects
+// Map a DXGI rotation onto the rotation used by the compositors, UNSPECIFIED is treated as IDENTITY
 //
-void DISPLAYMANAGER::SetMoveRect(_Out_ RECT* SrcRect, _Out_ RECT* DestRect, _In_ DXGI_OUTPUT_DESC* DeskDesc, _In_ DXGI_OUTDUPL_MOVE_RECT* MoveRect, INT TexWidth, INT TexHeight)
+bool DISPLAYMANAGER::toSurfaceRotation(DXGI_MODE_ROTATION Rotation, _Out_ SurfaceRotation* Result)
 {
-    switch (DeskDesc->Rotation)
+    switch (Rotation)
     {
         case DXGI_MODE_ROTATION_UNSPECIFIED:
         case DXGI_MODE_ROTATION_IDENTITY:
-        {
-            SrcRect->left = MoveRect->SourcePoint.x;
-            SrcRect->top = MoveRect->SourcePoint.y;
-            SrcRect->right = MoveRect->SourcePoint.x + MoveRect->DestinationRect.right - MoveRect->DestinationRect.left;
-            SrcRect->bottom = MoveRect->SourcePoint.y + MoveRect->DestinationRect.bottom - MoveRect->DestinationRect.top;
-
-            *DestRect = MoveRect->DestinationRect;
-            break;
-        }
+            *Result = SurfaceRotation::IDENTITY;
+            return true;
         case DXGI_MODE_ROTATION_ROTATE90:
-        {
-            SrcRect->left = TexHeight - (MoveRect->SourcePoint.y + MoveRect->DestinationRect.bottom - MoveRect->DestinationRect.top);
-            SrcRect->top = MoveRect->SourcePoint.x;
-            SrcRect->right = TexHeight - MoveRect->SourcePoint.y;
-            SrcRect->bottom = MoveRect->SourcePoint.x + MoveRect->DestinationRect.right - MoveRect->DestinationRect.left;
-
-            DestRect->left = TexHeight - MoveRect->DestinationRect.bottom;
-            DestRect->top = MoveRect->DestinationRect.left;
-            DestRect->right = TexHeight - MoveRect->DestinationRect.top;
-            DestRect->bottom = MoveRect->DestinationRect.right;
-            break;
-        }
+            *Result = SurfaceRotation::ROTATE90;
+            return true;
         case DXGI_MODE_ROTATION_ROTATE180:
-        {
-            SrcRect->left = TexWidth - (MoveRect->SourcePoint.x + MoveRect->DestinationRect.right - MoveRect->DestinationRect.left);
-            SrcRect->top = TexHeight - (MoveRect->SourcePoint.y + MoveRect->DestinationRect.bottom - MoveRect->DestinationRect.top);
-            SrcRect->right = TexWidth - MoveRect->SourcePoint.x;
-            SrcRect->bottom = TexHeight - MoveRect->SourcePoint.y;
-
-            DestRect->left = TexWidth - MoveRect->DestinationRect.right;
-            DestRect->top = TexHeight - MoveRect->DestinationRect.bottom;
-            DestRect->right = TexWidth - MoveRect->DestinationRect.left;
-            DestRect->bottom =  TexHeight - MoveRect->DestinationRect.top;
-            break;
-        }
+            *Result = SurfaceRotation::ROTATE180;
+            return true;
         case DXGI_MODE_ROTATION_ROTATE270:
-        {
-            SrcRect->left = MoveRect->SourcePoint.x;
-            SrcRect->top = TexWidth - (MoveRect->SourcePoint.x + MoveRect->DestinationRect.right - MoveRect->DestinationRect.left);
-            SrcRect->right = MoveRect->SourcePoint.y + MoveRect->DestinationRect.bottom - MoveRect->DestinationRect.top;
-            SrcRect->bottom = TexWidth - MoveRect->SourcePoint.x;
-
-            DestRect->left = MoveRect->DestinationRect.top;
-            DestRect->top = TexWidth - MoveRect->DestinationRect.right;
-            DestRect->right = MoveRect->DestinationRect.bottom;
-            DestRect->bottom =  TexWidth - MoveRect->DestinationRect.left;
-            break;
-        }
+            *Result = SurfaceRotation::ROTATE270;
+            return true;
         default:
-        {
-            RtlZeroMemory(DestRect, sizeof(RECT));
-            RtlZeroMemory(SrcRect, sizeof(RECT));
-            break;
-        }
+            *Result = SurfaceRotation::IDENTITY;
+            return false;
     }
 }
 
+//
+// Set appropriate source and destination rects for move rects
+//
+void DISPLAYMANAGER::SetMoveRect(_Out_ RECT* SrcRect, _Out_ RECT* DestRect, _In_ DXGI_OUTPUT_DESC* DeskDesc, _In_ DXGI_OUTDUPL_MOVE_RECT* MoveRect, INT TexWidth, INT TexHeight)
+{
+    SurfaceRotation Rotation;
+    if (!toSurfaceRotation(DeskDesc->Rotation, &Rotation))
+    {
+        RtlZeroMemory(DestRect, sizeof(RECT));
+        RtlZeroMemory(SrcRect, sizeof(RECT));
+        return;
+    }
+
+    // Moves only translate, so source and destination are rotated like any other rect of the frame
+    const FrameRect Source = { MoveRect->SourcePoint.x, MoveRect->SourcePoint.y,
+                               MoveRect->SourcePoint.x + MoveRect->DestinationRect.right - MoveRect->DestinationRect.left,
+                               MoveRect->SourcePoint.y + MoveRect->DestinationRect.bottom - MoveRect->DestinationRect.top };
+    const FrameRect Destination = { MoveRect->DestinationRect.left, MoveRect->DestinationRect.top,
+                                    MoveRect->DestinationRect.right, MoveRect->DestinationRect.bottom };
+
+    const FrameRect RotatedSource = rotateToDesktop(Source, Rotation, TexWidth, TexHeight);
+    const FrameRect RotatedDestination = rotateToDesktop(Destination, Rotation, TexWidth, TexHeight);
+    *SrcRect = { RotatedSource.left, RotatedSource.top, RotatedSource.right, RotatedSource.bottom };
+    *DestRect = { RotatedDestination.left, RotatedDestination.top, RotatedDestination.right, RotatedDestination.bottom };
+}
+
 //
 // Copy move rectangles
 //
@@ -232,22 +246,18 @@ void DISPLAYMANAGER::SetDirtyVert(_Out_writes_(NUMVERTICES) VERTEX* Vertices, _I
     INT CenterX = FullDesc->Width / 2;
     INT CenterY = FullDesc->Height / 2;
 
-    INT Width = DeskDesc->DesktopCoordinates.right - DeskDesc->DesktopCoordinates.left;
-    INT Height = DeskDesc->DesktopCoordinates.bottom - DeskDesc->DesktopCoordinates.top;
-
-    // Rotation compensated destination rect
-    RECT DestDirty = *Dirty;
+    // Rotation compensated destination rect, the desktop is as wide as the frame is high for 90 and 270 degrees
+    SurfaceRotation Rotation;
+    toSurfaceRotation(DeskDesc->Rotation, &Rotation);
+    const FrameRect RotatedDirty = rotateToDesktop({ Dirty->left, Dirty->top, Dirty->right, Dirty->bottom }, Rotation,
+                                                   static_cast<int>(ThisDesc->Width), static_cast<int>(ThisDesc->Height));
+    RECT DestDirty = { RotatedDirty.left, RotatedDirty.top, RotatedDirty.right, RotatedDirty.bottom };
 
     // Set appropriate coordinates compensated for rotation
     switch (DeskDesc->Rotation)
     {
         case DXGI_MODE_ROTATION_ROTATE90:
         {
-            DestDirty.left = Width - Dirty->bottom;
-            DestDirty.top = Dirty->left;
-            DestDirty.right = Width - Dirty->top;
-            DestDirty.bottom = Dirty->right;
-
             Vertices[0].TexCoord = XMFLOAT2(Dirty->right / static_cast<FLOAT>(ThisDesc->Width), Dirty->bottom / static_cast<FLOAT>(ThisDesc->Height));
             Vertices[1].TexCoord = XMFLOAT2(Dirty->left / static_cast<FLOAT>(ThisDesc->Width), Dirty->bottom / static_cast<FLOAT>(ThisDesc->Height));
             Vertices[2].TexCoord = XMFLOAT2(Dirty->right / static_cast<FLOAT>(ThisDesc->Width), Dirty->top / static_cast<FLOAT>(ThisDesc->Height));
@@ -256,11 +266,6 @@ void DISPLAYMANAGER::SetDirtyVert(_Out_writes_(NUMVERTICES) VERTEX* Vertices, _I
         }
         case DXGI_MODE_ROTATION_ROTATE180:
         {
-            DestDirty.left = Width - Dirty->right;
-            DestDirty.top = Height - Dirty->bottom;
-            DestDirty.right = Width - Dirty->left;
-            DestDirty.bottom = Height - Dirty->top;
-
             Vertices[0].TexCoord = XMFLOAT2(Dirty->right / static_cast<FLOAT>(ThisDesc->Width), Dirty->top / static_cast<FLOAT>(ThisDesc->Height));
             Vertices[1].TexCoord = XMFLOAT2(Dirty->right / static_cast<FLOAT>(ThisDesc->Width), Dirty->bottom / static_cast<FLOAT>(ThisDesc->Height));
             Vertices[2].TexCoord = XMFLOAT2(Dirty->left / static_cast<FLOAT>(ThisDesc->Width), Dirty->top / static_cast<FLOAT>(ThisDesc->Height));
@@ -269,11 +274,6 @@ void DISPLAYMANAGER::SetDirtyVert(_Out_writes_(NUMVERTICES) VERTEX* Vertices, _I
         }
         case DXGI_MODE_ROTATION_ROTATE270:
         {
-            DestDirty.left = Dirty->top;
-            DestDirty.top = Height - Dirty->right;
-            DestDirty.right = Dirty->bottom;
-            DestDirty.bottom = Height - Dirty->left;
-
             Vertices[0].TexCoord = XMFLOAT2(Dirty->left / static_cast<FLOAT>(ThisDesc->Width), Dirty->top / static_cast<FLOAT>(ThisDesc->Height));
             Vertices[1].TexCoord = XMFLOAT2(Dirty->right / static_cast<FLOAT>(ThisDesc->Width), Dirty->top / static_cast<FLOAT>(ThisDesc->Height));
             Vertices[2].TexCoord = XMFLOAT2(Dirty->left / static_cast<FLOAT>(ThisDesc->Width), Dirty->bottom / static_cast<FLOAT>(ThisDesc->Height));
@@ -450,6 +450,12 @@ void DISPLAYMANAGER::CleanRefs()
         m_MoveSurf = nullptr;
     }
 
+    if (m_StagingSurf)
+    {
+        m_StagingSurf->Release();
+        m_StagingSurf = nullptr;
+    }
+
     if (m_VertexShader)
     {
         m_VertexShader->Release();
@@ -481,22 +487,28 @@ void DISPLAYMANAGER::CleanRefs()
     }
 }
 
-DUPL_RETURN DISPLAYMANAGER::performCopying(ID3D11Texture2D* SharedSurf) {
-    // QI for IDXGISurface
-    D3D11_TEXTURE2D_DESC FullDesc;
-    SharedSurf->GetDesc(&FullDesc);
-
-    D3D11_BOX Box;
+//
+// Create or resize the CPU readable staging texture that the shared surface is copied into
+//
+DUPL_RETURN DISPLAYMANAGER::prepareStagingSurface(_In_ D3D11_TEXTURE2D_DESC* FullDesc, _Out_ bool* Recreated)
+{
+    *Recreated = false;
+    if (m_StagingSurf)
+    {
+        D3D11_TEXTURE2D_DESC StagingDesc;
+        m_StagingSurf->GetDesc(&StagingDesc);
+        if (StagingDesc.Width == FullDesc->Width && StagingDesc.Height == FullDesc->Height)
+        {
+            return DUPL_RETURN_SUCCESS;
+        }
 
-    Box.left = 0;
-    Box.top = 0;
-    Box.right = FullDesc.Width;
-    Box.bottom = FullDesc.Height;
+        m_StagingSurf->Release();
+        m_StagingSurf = nullptr;
+    }
 
-    // Staging buffer/texture
     D3D11_TEXTURE2D_DESC CopyBufferDesc;
-    CopyBufferDesc.Width = FullDesc.Width;
-    CopyBufferDesc.Height = FullDesc.Height;
+    CopyBufferDesc.Width = FullDesc->Width;
+    CopyBufferDesc.Height = FullDesc->Height;
     CopyBufferDesc.MipLevels = 1;
     CopyBufferDesc.ArraySize = 1;
     CopyBufferDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
@@ -507,70 +519,248 @@ DUPL_RETURN DISPLAYMANAGER::performCopying(ID3D11Texture2D* SharedSurf) {
     CopyBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
     CopyBufferDesc.MiscFlags = 0;
 
-    ID3D11Texture2D* CopyBuffer = nullptr;
-    HRESULT hr = m_Device->CreateTexture2D(&CopyBufferDesc, nullptr, &CopyBuffer);
+    HRESULT hr = m_Device->CreateTexture2D(&CopyBufferDesc, nullptr, &m_StagingSurf);
     if (FAILED(hr))
     {
-        return ProcessFailure(m_Device, L"Failed creating staging texture for pointer", L"Error", hr, SystemTransitionsExpectedErrors);
+        return ProcessFailure(m_Device, L"Failed creating staging texture for desktop", L"Error", hr, SystemTransitionsExpectedErrors);
     }
+    *Recreated = true;
 
-    // Copy needed part of desktop image
-    m_DeviceContext->CopySubresourceRegion(CopyBuffer, 0, 0, 0, 0, SharedSurf, 0, &Box);
+    return DUPL_RETURN_SUCCESS;
+}
 
-    //m_DeviceContext->CopySubresourceRegion(m_StagingTexture, 0, 0, 0, 0, m_SharedSurf, 0, &Box);
+//
+// Coalesce dirty rects of the frame into tile aligned rects within the frame texture.
+// The acquired frame holds the complete desktop image, so copying a bit more than what is dirty is harmless
+//
+void DISPLAYMANAGER::coalesceDirtyRects(_In_reads_(DirtyCount) RECT* DirtyBuffer, UINT DirtyCount, UINT FrameWidth, UINT FrameHeight)
+{
+    frameDirtyRects.clear();
+    for (UINT i = 0; i < DirtyCount; ++i)
+    {
+        frameDirtyRects.push_back({ DirtyBuffer[i].left, DirtyBuffer[i].top, DirtyBuffer[i].right, DirtyBuffer[i].bottom });
+    }
 
-//    if (resourceStaging != nullptr && resourceShared != nullptr) {
-//        m_DeviceContext->CopyResource(resourceStaging, resourceShared);
-//    }
+    const std::vector<FrameRect>& Coalesced = dirtyRectCoalescer.coalesce(frameDirtyRects.data(), static_cast<int>(frameDirtyRects.size()),
+                                                                         static_cast<int>(FrameWidth), static_cast<int>(FrameHeight));
+    coalescedDirtyRects.clear();
+    for (const auto& Rect : Coalesced)
+    {
+        coalescedDirtyRects.push_back({ Rect.left, Rect.top, Rect.right, Rect.bottom });
+    }
+}
 
-    IDXGISurface* CopySurface = nullptr;
-    hr = CopyBuffer->QueryInterface(__uuidof(IDXGISurface), (void**)&CopySurface);
-    CopyBuffer->Release();
-    CopyBuffer = nullptr;
+//
+// Translate dirty and move rects of the frame into shared surface coordinates.
+// Returns false if the rects cannot be used, e.g. for rotated desktops, so the whole surface has to be refreshed
+//
+bool DISPLAYMANAGER::collectChangedRects(_In_ FRAME_DATA* Data, _In_reads_(DirtyCount) RECT* DirtyBuffer, UINT DirtyCount, INT OffsetX, INT OffsetY, _In_ DXGI_OUTPUT_DESC* DeskDesc, _In_ D3D11_TEXTURE2D_DESC* FullDesc)
+{
+    changedDirtyRects.clear();
+    changedMoveRects.clear();
 
-    // New desktop buffer
-    BYTE* InitBuffer;
-    DWORD CopyBufferSize = FullDesc.Width * FullDesc.Height * BPP;
-    InitBuffer = new (std::nothrow) BYTE[CopyBufferSize];
-    if (!(InitBuffer))
+    if (DeskDesc->Rotation != DXGI_MODE_ROTATION_UNSPECIFIED && DeskDesc->Rotation != DXGI_MODE_ROTATION_IDENTITY)
     {
-        return ProcessFailure(nullptr, L"Failed to allocate memory for new desktop shape buffer.", L"Error", E_OUTOFMEMORY);
+        return false;
+    }
+
+    const INT ShiftX = DeskDesc->DesktopCoordinates.left - OffsetX;
+    const INT ShiftY = DeskDesc->DesktopCoordinates.top - OffsetY;
+    const INT SurfWidth = static_cast<INT>(FullDesc->Width);
+    const INT SurfHeight = static_cast<INT>(FullDesc->Height);
+
+    // With more than one output on the shared surface, other outputs change it without rects of this frame
+    if (DeskDesc->DesktopCoordinates.right - DeskDesc->DesktopCoordinates.left != SurfWidth ||
+        DeskDesc->DesktopCoordinates.bottom - DeskDesc->DesktopCoordinates.top != SurfHeight)
+    {
+        return false;
+    }
+
+    DXGI_OUTDUPL_MOVE_RECT* MoveBuffer = reinterpret_cast<DXGI_OUTDUPL_MOVE_RECT*>(Data->MetaData);
+    for (UINT i = 0; i < Data->MoveCount; ++i)
+    {
+        FrameMoveRect Move;
+        Move.sourceX = MoveBuffer[i].SourcePoint.x + ShiftX;
+        Move.sourceY = MoveBuffer[i].SourcePoint.y + ShiftY;
+        Move.destination = { MoveBuffer[i].DestinationRect.left + ShiftX, MoveBuffer[i].DestinationRect.top + ShiftY,
+                             MoveBuffer[i].DestinationRect.right + ShiftX, MoveBuffer[i].DestinationRect.bottom + ShiftY };
+        changedMoveRects.push_back(Move);
+    }
+
+    for (UINT i = 0; i < DirtyCount; ++i)
+    {
+        changedDirtyRects.push_back({ DirtyBuffer[i].left + ShiftX, DirtyBuffer[i].top + ShiftY,
+                                      DirtyBuffer[i].right + ShiftX, DirtyBuffer[i].bottom + ShiftY });
+    }
+
+    // Every rect has to lie within the shared surface to be copied into the staging texture
+    const auto InsideSurface = [&](const FrameRect& Rect) {
+        return Rect.left >= 0 && Rect.top >= 0 && Rect.right <= SurfWidth && Rect.bottom <= SurfHeight;
+    };
+    for (const auto& Move : changedMoveRects)
+    {
+        if (!InsideSurface(Move.destination))
+        {
+            return false;
+        }
+    }
+    for (const auto& Dirty : changedDirtyRects)
+    {
+        if (!InsideSurface(Dirty))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+DUPL_RETURN DISPLAYMANAGER::performCopying(ID3D11Texture2D* SharedSurf, _In_ FRAME_DATA* Data, _In_reads_(DirtyCount) RECT* DirtyBuffer, UINT DirtyCount, INT OffsetX, INT OffsetY, _In_ DXGI_OUTPUT_DESC* DeskDesc) {
+    D3D11_TEXTURE2D_DESC FullDesc;
+    SharedSurf->GetDesc(&FullDesc);
+
+    // Staging texture is kept across frames and only recreated when the desktop size changes
+    bool StagingRecreated = false;
+    DUPL_RETURN Ret = prepareStagingSurface(&FullDesc, &StagingRecreated);
+    if (Ret != DUPL_RETURN_SUCCESS)
+    {
+        return Ret;
+    }
+
+    // A fresh staging texture holds no picture yet, so it has to be filled completely once
+    bool HasChangedRects = collectChangedRects(Data, DirtyBuffer, DirtyCount, OffsetX, OffsetY, DeskDesc, &FullDesc) && !StagingRecreated;
+    if (!HasChangedRects)
+    {
+        incrementalConverter.invalidate();
+    }
+
+    D3D11_BOX Box;
+    Box.front = 0;
+    Box.back = 1;
+
+    if (HasChangedRects)
+    {
+        // Staging texture still holds the previous picture, only copy what changed
+        const auto CopyRect = [&](const FrameRect& Rect) {
+            Box.left = Rect.left;
+            Box.top = Rect.top;
+            Box.right = Rect.right;
+            Box.bottom = Rect.bottom;
+            m_DeviceContext->CopySubresourceRegion(m_StagingSurf, 0, Rect.left, Rect.top, 0, SharedSurf, 0, &Box);
+        };
+        for (const auto& Move : changedMoveRects)
+        {
+            CopyRect(Move.destination);
+        }
+        for (const auto& Dirty : changedDirtyRects)
+        {
+            CopyRect(Dirty);
+        }
+    }
+    else
+    {
+        Box.left = 0;
+        Box.top = 0;
+        Box.right = FullDesc.Width;
+        Box.bottom = FullDesc.Height;
+
+        // Copy needed part of desktop image
+        m_DeviceContext->CopySubresourceRegion(m_StagingSurf, 0, 0, 0, 0, SharedSurf, 0, &Box);
     }
 
     // Map pixels
-    DXGI_MAPPED_RECT MappedSurface;
-    hr = CopySurface->Map(&MappedSurface, DXGI_MAP_READ);
+    D3D11_MAPPED_SUBRESOURCE MappedSurface;
+    HRESULT hr = m_DeviceContext->Map(m_StagingSurf, 0, D3D11_MAP_READ, 0, &MappedSurface);
     if (FAILED(hr))
     {
-        CopySurface->Release();
-        CopySurface = nullptr;
         return ProcessFailure(m_Device, L"Failed to map surface for desktop", L"Error", hr, SystemTransitionsExpectedErrors);
     }
 
-    UINT* InitBuffer32 = reinterpret_cast<UINT*>(InitBuffer);
-    UINT* Desktop32 = reinterpret_cast<UINT*>(MappedSurface.pBits);
-    UINT  DesktopPitchInPixels = MappedSurface.Pitch / sizeof(UINT);
+    // Convert straight out of the mapped surface using its own row pitch. Desktop area beyond
+    // the encoder resolution is cut off
+    FrameBuffer DesktopFrame;
+    DesktopFrame.data = static_cast<uint8_t*>(MappedSurface.pData);
+    DesktopFrame.width = min(static_cast<int>(FullDesc.Width), ffScreenSessionInfo.outputAVCodecContext->width);
+    DesktopFrame.height = min(static_cast<int>(FullDesc.Height), ffScreenSessionInfo.outputAVCodecContext->height);
+    DesktopFrame.stride = static_cast<int>(MappedSurface.RowPitch);
+    DesktopFrame.size = static_cast<std::size_t>(MappedSurface.RowPitch) * FullDesc.Height;
+    DesktopFrame.pixelFormat = FramePixelFormat::BGRA;
 
-    memcpy(InitBuffer32, Desktop32, CopyBufferSize);
+    // Frames only arrive when the desktop changed, so each one is stamped with the time it was presented
+    DesktopFrame.timestamp = Data->FrameInfo.LastPresentTime.QuadPart ? qpcToMicroseconds(Data->FrameInfo.LastPresentTime.QuadPart) : getCurrentTime();
+
+    convertFrame(DesktopFrame, HasChangedRects);
+
+    if (!traceFileName.empty())
+    {
+        recordTraceFrame(&DesktopFrame, Data, HasChangedRects);
+    }
 
     // Done with resource
-    hr = CopySurface->Unmap();
-    CopySurface->Release();
-    CopySurface = nullptr;
-    if (FAILED(hr))
+    m_DeviceContext->Unmap(m_StagingSurf, 0);
+
+    addFrame(DesktopFrame.timestamp);
+
+    return DUPL_RETURN_SUCCESS;
+}
+
+//
+// Record every following frame into a capture trace. The trace is created along with the first frame
+//
+void DISPLAYMANAGER::StartTraceRecording(_In_ const std::string& FileName)
+{
+    traceFileName = FileName;
+    traceRecorder.reset();
+}
+
+//
+// Append the mapped desktop frame to the capture trace along with its rects and the cursor
+//
+void DISPLAYMANAGER::recordTraceFrame(_Inout_ FrameBuffer* DesktopFrame, _In_ FRAME_DATA* Data, bool HasChangedRects)
+{
+    // Cursor position is only reported along with frames the mouse changed
+    if (Data->FrameInfo.LastMouseUpdateTime.QuadPart != 0)
     {
-        return ProcessFailure(m_Device, L"Failed to unmap surface for desktop", L"Error", hr, SystemTransitionsExpectedErrors);
+        traceCursor.valid = true;
+        traceCursor.visible = Data->FrameInfo.PointerPosition.Visible != FALSE;
+        traceCursor.x = Data->FrameInfo.PointerPosition.Position.x;
+        traceCursor.y = Data->FrameInfo.PointerPosition.Position.y;
     }
 
-    addFrame(InitBuffer32);
+    if (!traceRecorder)
+    {
+        traceRecorder = std::make_unique<CaptureTraceRecorder>();
+        if (!traceRecorder->open(traceFileName, DesktopFrame->width, DesktopFrame->height, DesktopFrame->pixelFormat))
+        {
+            ALOG(ERR, "Failed to create capture trace", NVV(traceFile, traceFileName));
+            traceRecorder.reset();
+            traceFileName.clear();
+            return;
+        }
+        traceSequence = 0;
+    }
 
-    if (InitBuffer)
+    // Rects describe the change since the previous frame processed here, which is the previous record of the trace
+    DesktopFrame->sequence = traceSequence++;
+    DesktopFrame->rects.valid = HasChangedRects;
+    DesktopFrame->rects.moveRects.clear();
+    DesktopFrame->rects.dirtyRects.clear();
+    if (HasChangedRects)
     {
-        delete[] InitBuffer;
-        InitBuffer = nullptr;
+        DesktopFrame->rects.moveRects = changedMoveRects;
+        DesktopFrame->rects.dirtyRects = changedDirtyRects;
     }
+    DesktopFrame->cursor = traceCursor;
 
-    return DUPL_RETURN_SUCCESS;
+    // Desktop size changes end the trace, its frames all have the same size. The mapped surface is copied before
+    // it is unmapped, encoding and writing the record happens on the writer thread of the recorder
+    if (!traceRecorder->recordFrame(*DesktopFrame))
+    {
+        ALOG(ERR, "Failed to write capture trace, trace recording stopped", NVV(traceFrames, traceRecorder->getFrameCount()),
+             NVV(traceDroppedFrames, traceRecorder->getDroppedFrames()));
+        traceRecorder.reset();
+        traceFileName.clear();
+    }
 }
 
 void DISPLAYMANAGER::setupFFMPEGBasedScreenEncode(int width, int height, int fps,
@@ -599,21 +789,53 @@ void DISPLAYMANAGER::setupFFMPEGBasedScreenEncode(int width, int height, int fps
     outputFilePath = outDirPath;
     playListFileName = masterPlaylistFile;
 
+    readEncoderConfig();
     setupFFSessionInfo();
 }
 
+//
+// Reads the optional Encoder parameters of the config file, as the ScreenCapture recorder does. Defaults stay if there are none
+//
+void DISPLAYMANAGER::readEncoderConfig()
+{
+    std::ifstream configFileStream(configFile);
+    if (!configFileStream.is_open())
+    {
+        ALOG(INFO, "No config file, using default encoders", NVV(EncoderChain, getEncoderBackendChainString(encoderChain)));
+        return;
+    }
+    std::stringstream jsonContent;
+    jsonContent << configFileStream.rdbuf();
+
+    rapidjson::Document doc;
+    doc.Parse(jsonContent.str().c_str());
+    if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("ScreenRecord") || !doc["ScreenRecord"].HasMember("Encoder"))
+    {
+        return;
+    }
+
+    const auto& encoder = doc["ScreenRecord"]["Encoder"];
+    if (encoder.HasMember("chain") && !parseEncoderBackendChain(encoder["chain"].GetString(), encoderChain))
+    {
+        if (encoderChain.empty())
+        {
+            encoderChain = getDefaultEncoderBackendChain();
+        }
+        ALOG(WARNING, "Unknown encoder in chain, using", NVV(EncoderChain, getEncoderBackendChainString(encoderChain)));
+    }
+    if (encoder.HasMember("threads"))
+    {
+        encoderThreads = std::atoi(encoder["threads"].GetString());
+    }
+}
+
 bool DISPLAYMANAGER::setupFFSessionInfo() {
     // String concat for sequence name, output file name and path
     std::string outputFile = outputFilePath + "\\" + playListFileName;
     std::string seq = "fsequence%d.ts";
     std::string path = outputFilePath + "\\" + seq;
 
-    int err = av_hwdevice_ctx_create(&ffScreenSessionInfo.hardwareEncodeDeviceContext, AV_HWDEVICE_TYPE_CUDA, NULL, NULL, 0);
-
-    if (err < 0) {
-        ALOG(ERR, "Failed to initialize CUDA frame context.", NV(err));
-        return false;
-    }
+    int err = 0;
 
     if (!(ffScreenSessionInfo.oformat = av_guess_format(NULL, outputFile.c_str(), NULL)))
     {
@@ -627,9 +849,19 @@ bool DISPLAYMANAGER::setupFFSessionInfo() {
         return false;
     }
 
-    if (!(ffScreenSessionInfo.codec = avcodec_find_encoder_by_name(CUDA_ENCODER)))
+    // Desktop pixels are converted to NV12. Backends of the chain that do not accept it, e.g. libx265, are skipped
+    EncoderSettings Settings;
+    Settings.width = screenCaptureParams.resoutionWidth;
+    Settings.height = screenCaptureParams.resoutionHeight;
+    Settings.fps = ffScreenSessionInfo.fps;
+    Settings.crf = ffScreenSessionInfo.crf;
+    Settings.outputBitrateInMB = ffScreenSessionInfo.outputBitrateInMB;
+    Settings.threadCount = encoderThreads;
+    Settings.softwareFormat = AV_PIX_FMT_NV12;
+
+    if (!openEncoderBackend(ffScreenSessionInfo, encoderChain, Settings))
     {
-        ALOG(ERR, "Failed to find encoder");
+        ALOG(ERR, "Failed to open any encoder", NVV(EncoderChain, getEncoderBackendChainString(encoderChain)));
         return false;
     }
 
@@ -639,61 +871,18 @@ bool DISPLAYMANAGER::setupFFSessionInfo() {
         return false;
     }
 
-    if (!(ffScreenSessionInfo.outputAVCodecContext = avcodec_alloc_context3(ffScreenSessionInfo.codec)))
-    {
-        ALOG(ERR, "Failed to allocate codec context");
-        return false;
-    }
-
     if (!(ffScreenSessionInfo.inputAVCodecContext = av_d3d11va_alloc_context2()))
     {
         ALOG(ERR, "Failed to allocate D3D11 codec context");
         return false;
     }
 
-    ffScreenSessionInfo.outputAVCodecContext->width = screenCaptureParams.resoutionWidth;
-    ffScreenSessionInfo.outputAVCodecContext->height = screenCaptureParams.resoutionHeight;
-    ffScreenSessionInfo.outputAVCodecContext->time_base = { 1, ffScreenSessionInfo.fps };
-    ffScreenSessionInfo.outputAVCodecContext->framerate = { ffScreenSessionInfo.fps, 1 };
-    ffScreenSessionInfo.outputAVCodecContext->sample_aspect_ratio = { 1, 1 };
-    ffScreenSessionInfo.outputAVCodecContext->pix_fmt = AV_PIX_FMT_CUDA;
-    ffScreenSessionInfo.outputAVCodecContext->max_b_frames = 0;
-    ffScreenSessionInfo.outputAVCodecContext->gop_size = 12;
-
-    ffScreenSessionInfo.outVideoStream->codecpar->codec_id = ffScreenSessionInfo.oformat->video_codec;
-    ffScreenSessionInfo.outVideoStream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-    ffScreenSessionInfo.outVideoStream->codecpar->width = screenCaptureParams.resoutionWidth;
-    ffScreenSessionInfo.outVideoStream->codecpar->height = screenCaptureParams.resoutionHeight;
-    ffScreenSessionInfo.outVideoStream->codecpar->format = AV_PIX_FMT_CUDA;
-    ffScreenSessionInfo.outVideoStream->time_base = { 1, ffScreenSessionInfo.fps };
-
-    if (ffScreenSessionInfo.outputBitrateInMB != 0) {
-        ALOG(INFO, "Setting output bitrate to ", NVV(outputBitrateInMB, ffScreenSessionInfo.outputBitrateInMB), " Mbps");
-        ffScreenSessionInfo.outVideoStream->codecpar->bit_rate = ffScreenSessionInfo.outputBitrateInMB * 1000 * 1000;
-    }
-
-    avcodec_parameters_to_context(ffScreenSessionInfo.outputAVCodecContext, ffScreenSessionInfo.outVideoStream->codecpar);
-
-    // Can change the value of preset to slow, fast or ultrafast
-    if (ffScreenSessionInfo.outVideoStream->codecpar->codec_id == AV_CODEC_ID_H264)
-    {
-        av_opt_set(ffScreenSessionInfo.outputAVCodecContext, "preset", "ultrafast", 0);
-        av_opt_set(ffScreenSessionInfo.outputAVCodecContext, "crf", std::to_string(ffScreenSessionInfo.crf).c_str(), AV_OPT_SEARCH_CHILDREN);
-    }
-
-    avcodec_parameters_from_context(ffScreenSessionInfo.outVideoStream->codecpar, ffScreenSessionInfo.outputAVCodecContext);
-
-    // Set hardware context for encoder's AVCodecContext
-    if ((err = setHardwareFrameContext()) < 0) {
-        ALOG(ERR, "Failed to set hardware frame context.");
-        return false;
-    }
-
-    if ((err = avcodec_open2(ffScreenSessionInfo.outputAVCodecContext, ffScreenSessionInfo.codec, NULL)) < 0)
+    if ((err = avcodec_parameters_from_context(ffScreenSessionInfo.outVideoStream->codecpar, ffScreenSessionInfo.outputAVCodecContext)) < 0)
     {
-        ALOG(ERR, "Failed to open codec");
+        ALOG(ERR, "Failed to copy encoder parameters to stream", NV(err));
         return false;
     }
+    ffScreenSessionInfo.outVideoStream->time_base = { 1, ffScreenSessionInfo.fps };
 
     // HLS parameters that define the segment duration, sequence name, start index of filename and playlist type
     av_dict_set(&ffScreenSessionInfo.avDict, "hls_time", std::to_string(segmentDuration).c_str(), 0);
@@ -720,23 +909,37 @@ bool DISPLAYMANAGER::setupFFSessionInfo() {
     av_dump_format(ffScreenSessionInfo.ofctx, 0, outputFile.c_str(), 1);
     ffScreenSessionInfo.time_counter = 0;
 
-    // Setup hardware video frame
-    ffScreenSessionInfo.hardwareOutputVideoFrame = av_frame_alloc();
-
-    if ((err = av_hwframe_get_buffer(ffScreenSessionInfo.outputAVCodecContext->hw_frames_ctx, ffScreenSessionInfo.hardwareOutputVideoFrame, 0)) < 0) {
-        ALOG(ERR, "Failed to get hardware frame buffer", NV(err));
+    // Setup NV12 software frame that desktop pixels are converted into
+    ffScreenSessionInfo.softwareVideoFrame = av_frame_alloc();
+    if (!ffScreenSessionInfo.softwareVideoFrame)
+    {
+        ALOG(ERR, "Failed to allocate software frame");
         return false;
     }
-    if (!ffScreenSessionInfo.outputAVCodecContext->hw_frames_ctx) {
-        err = AVERROR(ENOMEM);
+    ffScreenSessionInfo.softwareVideoFrame->format = AV_PIX_FMT_NV12;
+    ffScreenSessionInfo.softwareVideoFrame->width = ffScreenSessionInfo.outputAVCodecContext->width;
+    ffScreenSessionInfo.softwareVideoFrame->height = ffScreenSessionInfo.outputAVCodecContext->height;
+
+    if ((err = av_frame_get_buffer(ffScreenSessionInfo.softwareVideoFrame, 0)) < 0)
+    {
+        ALOG(ERR, "Failed to allocate picture", NV(err));
         return false;
     }
 
-    // Convert from RGB to YUV
-    ffScreenSessionInfo.swsCtx = sws_getContext(ffScreenSessionInfo.outputAVCodecContext->width, ffScreenSessionInfo.outputAVCodecContext->height,
-        AV_PIX_FMT_BGR24, ffScreenSessionInfo.outputAVCodecContext->width,
-        ffScreenSessionInfo.outputAVCodecContext->height, AV_PIX_FMT_YUV420P,
-        SWS_X, 0, 0, 0);
+    // Start from a black picture in case the desktop is smaller than the encoder resolution
+    memset(ffScreenSessionInfo.softwareVideoFrame->data[0], 16,
+           static_cast<size_t>(ffScreenSessionInfo.softwareVideoFrame->linesize[0]) * ffScreenSessionInfo.softwareVideoFrame->height);
+    memset(ffScreenSessionInfo.softwareVideoFrame->data[1], 128,
+           static_cast<size_t>(ffScreenSessionInfo.softwareVideoFrame->linesize[1]) * ((ffScreenSessionInfo.softwareVideoFrame->height + 1) / 2));
+
+    // Hardware video frame gets a new surface from the frames context for every encoded frame.
+    // Software encoders are sent the NV12 frame itself
+    ffScreenSessionInfo.hardwareOutputVideoFrame = av_frame_alloc();
+    if (!ffScreenSessionInfo.hardwareOutputVideoFrame)
+    {
+        ALOG(ERR, "Failed to allocate hardware frame");
+        return false;
+    }
 
     // Log all FFMPEG paramters that we use for screen capture encoding
     {
@@ -745,7 +948,8 @@ bool DISPLAYMANAGER::setupFFSessionInfo() {
             NVV(OutputBitrateInMB, ffScreenSessionInfo.outputBitrateInMB) + " " +
             NVV(SegmentDuration, segmentDuration) + " " +
             NVV(PlayListFileName, playListFileName) + " " +
-            NVV(Encoder, CUDA_ENCODER);
+            NVV(Encoder, getEncoderBackendString(ffScreenSessionInfo.encoderBackend)) + " " +
+            NVV(ColorConvertIsa, getColorConvertIsaString(getSupportedColorConvertIsa()));
 
         ALOG(INFO, "FFMPEG params:", ffMPEGParamsToBeLogged);
     }
@@ -753,72 +957,149 @@ bool DISPLAYMANAGER::setupFFSessionInfo() {
     return true;
 }
 
-int DISPLAYMANAGER::setHardwareFrameContext() {
-    AVBufferRef* hardwareOutputFramesRef;
-    AVHWFramesContext* framesOutputContext = NULL;
-    int err = 0;
+void DISPLAYMANAGER::convertFrame(const FrameBuffer& frame, bool HasChangedRects) {
+    // Software frame keeps the previous picture, so only the changed area needs to be converted.
+    // A software encoder may still reference it, in which case the picture is copied into a buffer of its own first
+    int err;
+    if (!ffScreenSessionInfo.outputAVCodecContext->hw_frames_ctx &&
+        (err = av_frame_make_writable(ffScreenSessionInfo.softwareVideoFrame)) < 0) {
+        ALOG(ERR, "Failed to make software frame writable", NV(err));
+        return;
+    }
 
-    // Setup output context for NVIDIA
-    if (!(hardwareOutputFramesRef = av_hwframe_ctx_alloc(ffScreenSessionInfo.hardwareEncodeDeviceContext))) {
-        ALOG(ERR, "Failed to create CUDA frame context.");
-        return -1;
+    if (HasChangedRects) {
+        incrementalConverter.updateNV12(frame, changedMoveRects.data(), static_cast<int>(changedMoveRects.size()),
+                                        changedDirtyRects.data(), static_cast<int>(changedDirtyRects.size()),
+                                        ffScreenSessionInfo.softwareVideoFrame->data, ffScreenSessionInfo.softwareVideoFrame->linesize);
+    }
+    else {
+        incrementalConverter.updateNV12(frame, nullptr, 0, nullptr, 0,
+                                        ffScreenSessionInfo.softwareVideoFrame->data, ffScreenSessionInfo.softwareVideoFrame->linesize);
     }
+}
 
-    framesOutputContext = (AVHWFramesContext*)(hardwareOutputFramesRef->data);
-    framesOutputContext->format = AV_PIX_FMT_CUDA;
-    framesOutputContext->sw_format = AV_PIX_FMT_YUV420P;
-    framesOutputContext->width = screenCaptureParams.resoutionWidth;
-    framesOutputContext->height = screenCaptureParams.resoutionHeight;
-    framesOutputContext->initial_pool_size = 20;
+//
+// Encode the last picture again once the desktop has been static for too long. Encoded frames of a static desktop
+// are cheap, and they keep segments being cut and the stream live for players
+//
+void DISPLAYMANAGER::ProcessIdle()
+{
+    if (ffScreenSessionInfo.frameCounter == 0 || maxStaticFrameInterval <= 0)
+    {
+        return;
+    }
 
-    if ((err = av_hwframe_ctx_init(hardwareOutputFramesRef)) < 0) {
-        ALOG(ERR, "Failed to initialize CUDA frame context.", NV(err));
-        av_buffer_unref(&hardwareOutputFramesRef);
-        return err;
+    const int64_t Now = getCurrentTime();
+    if (Now - lastEncodedFrameTime >= maxStaticFrameInterval)
+    {
+        addFrame(Now);
     }
-    ffScreenSessionInfo.outputAVCodecContext->hw_frames_ctx = av_buffer_ref(hardwareOutputFramesRef);
-    if (!ffScreenSessionInfo.outputAVCodecContext->hw_frames_ctx)
-        err = AVERROR(ENOMEM);
+}
 
-    av_buffer_unref(&hardwareOutputFramesRef);
+int64_t DISPLAYMANAGER::qpcToMicroseconds(LONGLONG Counter)
+{
+    static const LONGLONG Frequency = []() {
+        LARGE_INTEGER Value;
+        QueryPerformanceFrequency(&Value);
+        return Value.QuadPart;
+    }();
+    return av_rescale(Counter, 1000000, Frequency);
+}
 
-    return err;
+int64_t DISPLAYMANAGER::getCurrentTime()
+{
+    LARGE_INTEGER Counter;
+    QueryPerformanceCounter(&Counter);
+    return qpcToMicroseconds(Counter.QuadPart);
 }
 
-void DISPLAYMANAGER::addFrame(UINT* data) {
+void DISPLAYMANAGER::addFrame(int64_t Timestamp) {
     int err;
 
-    int inLinesize[1] = { 3 * ffScreenSessionInfo.outputAVCodecContext->width };
+    // Software encoders take the converted frame as it is
+    AVFrame* EncodedFrame = ffScreenSessionInfo.softwareVideoFrame;
+    if (ffScreenSessionInfo.outputAVCodecContext->hw_frames_ctx)
+    {
+        // Upload converted frame into a fresh hardware surface, encoder may still hold the previous one
+        EncodedFrame = ffScreenSessionInfo.hardwareOutputVideoFrame;
+        av_frame_unref(EncodedFrame);
+        if ((err = av_hwframe_get_buffer(ffScreenSessionInfo.outputAVCodecContext->hw_frames_ctx, EncodedFrame, 0)) < 0) {
+            ALOG(ERR, "Failed to get hardware frame buffer", NV(err));
+            return;
+        }
 
-    // Scale function to use uint8 data and line it up with frame context
-    sws_scale(ffScreenSessionInfo.swsCtx, (const uint8_t* const*)&data, inLinesize, 0,
-        ffScreenSessionInfo.outputAVCodecContext->height, ffScreenSessionInfo.softwareVideoFrame->data,
-        ffScreenSessionInfo.softwareVideoFrame->linesize);
+        if ((err = av_hwframe_transfer_data(EncodedFrame, ffScreenSessionInfo.softwareVideoFrame, 0)) < 0) {
+            ALOG(ERR, "Failed to transfer hardware frame buffer", NV(err));
+            return;
+        }
+    }
 
-    int64_t currTimestamp = (90000 * ffScreenSessionInfo.frameCounter) / ffScreenSessionInfo.fps;
+    // Timestamps count from the first frame in encoder time base
+    if (ffScreenSessionInfo.frameCounter == 0)
+    {
+        firstFrameTime = Timestamp;
+        const AVRational TimeBase = ffScreenSessionInfo.outputAVCodecContext->time_base;
+        presentationClock.reset(TimeBase.num, TimeBase.den);
+    }
     ffScreenSessionInfo.frameCounter++;
+    lastEncodedFrameTime = Timestamp;
 
-    ffScreenSessionInfo.hardwareOutputVideoFrame->pts = currTimestamp;
+    EncodedFrame->pts = presentationClock.stamp(Timestamp - firstFrameTime);
 
-    if ((err = avcodec_send_frame(ffScreenSessionInfo.outputAVCodecContext, ffScreenSessionInfo.hardwareOutputVideoFrame)) < 0)
+    if ((err = avcodec_send_frame(ffScreenSessionInfo.outputAVCodecContext, EncodedFrame)) < 0)
     {
         ALOG(ERR, "Failed to send frame", NV(err));
         return;
     }
 
+    receivePackets();
+}
+
+//
+// Mux every packet the encoder has ready. Encoders hold back frames, so a sent frame can yield no packet or several
+//
+void DISPLAYMANAGER::receivePackets()
+{
+    int err;
     AVPacket pkt;
     av_init_packet(&pkt);
+    pkt.data = nullptr;
+    pkt.size = 0;
 
-    pkt.stream_index = ffScreenSessionInfo.outVideoStream->index;
-
-    if (avcodec_receive_packet(ffScreenSessionInfo.outputAVCodecContext, &pkt) == 0)
+    while ((err = avcodec_receive_packet(ffScreenSessionInfo.outputAVCodecContext, &pkt)) == 0)
     {
+        // Timestamps count encoder ticks, the muxer expects them in the time base of the stream
+        av_packet_rescale_ts(&pkt, ffScreenSessionInfo.outputAVCodecContext->time_base, ffScreenSessionInfo.outVideoStream->time_base);
+        pkt.stream_index = ffScreenSessionInfo.outVideoStream->index;
         if ((err = av_interleaved_write_frame(ffScreenSessionInfo.ofctx, &pkt)) < 0)
         {
             ALOG(ERR, "Failed to mux packet", NV(err));
-            av_packet_unref(&pkt);
-            return;
         }
         av_packet_unref(&pkt);
     }
+
+    if (err != AVERROR(EAGAIN) && err != AVERROR_EOF)
+    {
+        ALOG(ERR, "Failed to receive packet", NV(err));
+    }
+}
+
+//
+// Drain the encoder once the session ends, so the frames it still holds, the last one included, make it into the output
+//
+void DISPLAYMANAGER::flushEncoder()
+{
+    if (!ffScreenSessionInfo.outputAVCodecContext || ffScreenSessionInfo.frameCounter == 0)
+    {
+        return;
+    }
+
+    int err;
+    if ((err = avcodec_send_frame(ffScreenSessionInfo.outputAVCodecContext, nullptr)) < 0)
+    {
+        ALOG(ERR, "Failed to flush encoder", NV(err));
+        return;
+    }
+
+    receivePackets();
 }
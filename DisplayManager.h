@@ -9,6 +9,10 @@
 #define _DISPLAYMANAGER_H_
 
 #include "ScreenCaptureImpl.hpp"
+#include "IncrementalConvert.hpp"
+#include "RectCoalescer.hpp"
+#include "CpuCompositor.hpp"
+#include "FrameTiming.hpp"
 #include "CommonTypes.h"
 
 using namespace CapUtils;
@@ -25,16 +29,28 @@ class DISPLAYMANAGER
         ID3D11Device* GetDevice();
         DUPL_RETURN ProcessFrame(_In_ FRAME_DATA* Data, _Inout_ ID3D11Texture2D* SharedSurf, INT OffsetX, INT OffsetY, _In_ DXGI_OUTPUT_DESC* DeskDesc);
         void CleanRefs();
+        void ProcessIdle();
 
         void setupFFMPEGBasedScreenEncode(int width, int height, int fps, int segmentDurationInSeconds,
                                             std::string outDirPath, std::string masterPlaylistFile);
+        void StartTraceRecording(_In_ const std::string& FileName);
 
     private:
         bool setupFFSessionInfo();
-        int setHardwareFrameContext();
+        void readEncoderConfig();
 
-        void addFrame(UINT* data);
-        DUPL_RETURN performCopying(ID3D11Texture2D* SharedSurf);
+        void convertFrame(const FrameBuffer& frame, bool HasChangedRects);
+        void addFrame(int64_t Timestamp);
+        void receivePackets();
+        void flushEncoder();
+        void recordTraceFrame(_Inout_ FrameBuffer* DesktopFrame, _In_ FRAME_DATA* Data, bool HasChangedRects);
+        static int64_t qpcToMicroseconds(LONGLONG Counter);
+        static int64_t getCurrentTime();
+        static bool toSurfaceRotation(DXGI_MODE_ROTATION Rotation, _Out_ SurfaceRotation* Result);
+        void coalesceDirtyRects(_In_reads_(DirtyCount) RECT* DirtyBuffer, UINT DirtyCount, UINT FrameWidth, UINT FrameHeight);
+        bool collectChangedRects(_In_ FRAME_DATA* Data, _In_reads_(DirtyCount) RECT* DirtyBuffer, UINT DirtyCount, INT OffsetX, INT OffsetY, _In_ DXGI_OUTPUT_DESC* DeskDesc, _In_ D3D11_TEXTURE2D_DESC* FullDesc);
+        DUPL_RETURN prepareStagingSurface(_In_ D3D11_TEXTURE2D_DESC* FullDesc, _Out_ bool* Recreated);
+        DUPL_RETURN performCopying(ID3D11Texture2D* SharedSurf, _In_ FRAME_DATA* Data, _In_reads_(DirtyCount) RECT* DirtyBuffer, UINT DirtyCount, INT OffsetX, INT OffsetY, _In_ DXGI_OUTPUT_DESC* DeskDesc);
 
     // methods
         DUPL_RETURN CopyDirty(_In_ ID3D11Texture2D* SrcSurface, _Inout_ ID3D11Texture2D* SharedSurf, _In_reads_(DirtyCount) RECT* DirtyBuffer, UINT DirtyCount, INT OffsetX, INT OffsetY, _In_ DXGI_OUTPUT_DESC* DeskDesc);
@@ -46,6 +62,7 @@ class DISPLAYMANAGER
         ID3D11Device* m_Device;
         ID3D11DeviceContext* m_DeviceContext;
         ID3D11Texture2D* m_MoveSurf;
+        ID3D11Texture2D* m_StagingSurf;
         ID3D11VertexShader* m_VertexShader;
         ID3D11PixelShader* m_PixelShader;
         ID3D11InputLayout* m_InputLayout;
@@ -54,14 +71,32 @@ class DISPLAYMANAGER
         BYTE* m_DirtyVertexBufferAlloc;
         UINT m_DirtyVertexBufferAllocSize;
 
+        IncrementalFrameConverter incrementalConverter; // Keeps the NV12 software frame up to date from dirty and move rects
+        RectCoalescer dirtyRectCoalescer; // Merges dirty rects of a frame into tile aligned rects
+        std::vector<FrameRect> frameDirtyRects; // Dirty rects of the current frame as reported by DXGI
+        std::vector<RECT> coalescedDirtyRects; // Coalesced dirty rects of the current frame in frame texture coordinates
+        std::vector<FrameRect> changedDirtyRects; // Dirty rects of the current frame in shared surface coordinates
+        std::vector<FrameMoveRect> changedMoveRects; // Move rects of the current frame in shared surface coordinates
+
+        std::string traceFileName; // Capture trace that processed frames are recorded to. Empty if not recording
+        std::unique_ptr<CaptureTraceRecorder> traceRecorder; // Created along with the first recorded frame, writes on a thread of its own
+        FrameCursor traceCursor; // Last cursor state reported by desktop duplication
+        int64_t traceSequence = 0; // Number of frames recorded to the trace
+
         FFScreenSessionInfo ffScreenSessionInfo; // FMMPEG session info object to be used to output segmented streams.
         ScreenCaptureParams screenCaptureParams;
-        std::string configFile;  // Config JSON file that defines screen capture parameters
+        std::string configFile = "config.json";  // Config JSON file that defines screen capture parameters, read for its Encoder parameters
+        std::vector<EncoderBackend> encoderChain = getDefaultEncoderBackendChain(); // Encoders tried in order until one opens
+        int encoderThreads = 0; // Threads of software encoders. Zero lets the encoder decide
         std::string playListFileName; // Playlist file to be written for playback
         std::string outputFilePath; // Output file path where segmented tarnsport streams should go
         int segmentDuration = 10; // Video segment duration that each transport stream should correspond to
         int srcheight = 0; // Source screen region height
         int srcwidth = 0;  // Source screen region width
+        int64_t firstFrameTime = 0; // Presentation time of the first encoded frame in microseconds
+        PresentationClock presentationClock; // Stamps encoded frames in encoder time base, counting from firstFrameTime
+        int64_t lastEncodedFrameTime = 0; // Presentation time of the last encoded frame in microseconds
+        int64_t maxStaticFrameInterval = kDefaultMaxStaticFrameIntervalInMs * 1000; // Longest gap in microseconds between encoded frames of a static desktop
 };
 
 #endif
\ No newline at end of file
@@ -10,6 +10,10 @@
 
 using namespace LogUtils;
 
+// Frame timing of a duplication thread is handed over to the process wide profiling every this many frames,
+// so reports see it while the thread runs
+constexpr int kProfilingMergeFrameCount = 30;
+
 //
 // Constructor sets up references / variables
 //
@@ -28,6 +32,9 @@ DUPLICATIONMANAGER::DUPLICATIONMANAGER() : m_DeskDupl(nullptr),
 //
 DUPLICATIONMANAGER::~DUPLICATIONMANAGER()
 {
+    // Hand the frame timing not merged yet over to the process wide profiling
+    MergeProfiling();
+
     if (m_DeskDupl)
     {
         m_DeskDupl->Release();
@@ -197,6 +204,16 @@ DUPL_RETURN DUPLICATIONMANAGER::GetMouse(_Inout_ PTR_INFO* PtrInfo, _In_ DXGI_OU
     return DUPL_RETURN_SUCCESS;
 }
 
+//
+// Move frame timing recorded by this thread into the process wide profiling, leaving the histograms of this thread empty
+//
+void DUPLICATIONMANAGER::MergeProfiling()
+{
+    timedCaptureProfiling.frameIntervals.drain(m_FrameIntervals);
+    timedCaptureProfiling.acquireLatencies.drain(m_AcquireLatencies);
+    m_FramesSinceMerge = 0;
+}
+
 //
 // Get next frame and write it into Data
 //
@@ -207,17 +224,18 @@ DUPL_RETURN DUPLICATIONMANAGER::GetFrame(_Out_ FRAME_DATA* Data, _Out_ bool* Tim
     DXGI_OUTDUPL_FRAME_INFO FrameInfo;
 
     timedCaptureProfiling.numberOfFrames++;
-    timedCaptureProfiling.currentTick = GetTickCount();
+    const auto AcquireStartTime = std::chrono::steady_clock::now();
 
     HRESULT hr = m_DeskDupl->AcquireNextFrame(timedCaptureProfiling.desiredFrequency, &FrameInfo, &DesktopResource);
-    DWORD tickDifference = timedCaptureProfiling.currentTick - timedCaptureProfiling.lastTick;
-    if (timedCaptureProfiling.lastTick != 0) {
-        timedCaptureProfiling.sumOfTickDifferences += tickDifference;
-        if (tickDifference == 0) {
-            timedCaptureProfiling.numZeroTicks++;
-        }
+    m_AcquireLatencies.recordSince(AcquireStartTime);
+    if (m_LastAcquireTime.time_since_epoch().count() != 0) {
+        m_FrameIntervals.record(std::chrono::duration_cast<std::chrono::microseconds>(AcquireStartTime - m_LastAcquireTime).count());
+    }
+    m_LastAcquireTime = AcquireStartTime;
+    if (++m_FramesSinceMerge == kProfilingMergeFrameCount)
+    {
+        MergeProfiling();
     }
-    timedCaptureProfiling.lastTick = timedCaptureProfiling.currentTick;
 
     if (hr == DXGI_ERROR_WAIT_TIMEOUT)
     {
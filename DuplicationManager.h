@@ -25,6 +25,7 @@ class DUPLICATIONMANAGER
         void GetOutputDesc(_Out_ DXGI_OUTPUT_DESC* DescPtr);
 
     private:
+        void MergeProfiling();
 
     // vars
         IDXGIOutputDuplication* m_DeskDupl;
@@ -34,6 +35,10 @@ class DUPLICATIONMANAGER
         UINT m_OutputNumber;
         DXGI_OUTPUT_DESC m_OutputDesc;
         ID3D11Device* m_Device;
+        std::chrono::steady_clock::time_point m_LastAcquireTime;
+        CapUtils::LatencyHistogram m_FrameIntervals;
+        CapUtils::LatencyHistogram m_AcquireLatencies;
+        int m_FramesSinceMerge = 0; // Frames whose timing was recorded since the last merge into timedCaptureProfiling
 };
 
 #endif
\ No newline at end of file
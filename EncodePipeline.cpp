@@ -0,0 +1,678 @@
+#include "EncodePipeline.hpp"
+#include "ColorConvert.hpp"
+#include "LogUtil.hpp"
+
+using namespace LogUtils;
+
+namespace CapUtils {
+
+    // Every shell is either waiting in a ring or held by one of the two stages around it
+    constexpr std::size_t kPipelineShellCount = kPipelineStageQueueCapacity + 2;
+
+    // Stages are woken up by their neighbours. The timeout only bounds the wait if a stage is idle
+    constexpr std::chrono::milliseconds kStageIdleWait(100);
+
+    // Packet shells of an encoder instance. A whole chunk can be encoded while the mux stage is busy with older chunks
+    constexpr std::size_t kWorkerPacketCount = kEncoderGopSize + 2;
+
+    // Frames queued in front of an encoder instance. The encoder copies or references what it holds back, so a frame
+    // it took goes back right away and needs no shell of its own
+    constexpr std::size_t kWorkerFrameCount = kPipelineStageQueueCapacity;
+
+    EncodePipeline::EncodePipeline(FFScreenSessionInfo& sessionInfo, SPSCRingBuffer<FrameBuffer*>& captureRing,
+                                   StageSignal& captureSlotSignal, FramePool& framePool, int convertThreads,
+                                   FrameScaler* frameScaler, bool detectChanges, int64_t maxStaticFrameIntervalInMs,
+                                   int parallelEncoders) :
+        ffScreenSessionInfo(sessionInfo),
+        screenFrameRing(captureRing),
+        screenFrameSlotSignal(captureSlotSignal),
+        screenFramePool(framePool),
+        convertWorkerPool(convertThreads),
+        screenFrameScaler(frameScaler),
+        staticFrameFilter(maxStaticFrameIntervalInMs * 1000),
+        shellCount(kPipelineShellCount + ((parallelEncoders > 1) ? static_cast<std::size_t>(parallelEncoders) * kWorkerFrameCount : 0)),
+        convertedFrames(shellCount),
+        freeSoftwareFrames(shellCount),
+        uploadedFrames(shellCount),
+        freeHardwareFrames(shellCount),
+        encodedPackets(kPipelineShellCount),
+        freePackets(kPipelineShellCount) {
+        if (detectChanges) {
+            changeDetector = std::make_unique<TileChangeDetector>();
+        }
+        for (int i = 0; parallelEncoders > 1 && i < parallelEncoders; ++i) {
+            encoderWorkers.push_back(std::make_unique<EncoderWorker>(kWorkerFrameCount, shellCount, kWorkerPacketCount + 1));
+        }
+    }
+
+    EncodePipeline::~EncodePipeline() {
+        finish();
+
+        for (auto& frame : softwareFrames) {
+            av_frame_free(&frame);
+        }
+        for (auto& frame : hardwareFrames) {
+            av_frame_free(&frame);
+        }
+        for (auto& packet : packets) {
+            av_packet_free(&packet);
+        }
+        for (auto& worker : encoderWorkers) {
+            for (auto& packet : worker->packets) {
+                av_packet_free(&packet);
+            }
+            if (worker->codecContext != ffScreenSessionInfo.outputAVCodecContext) {
+                avcodec_free_context(&worker->codecContext);
+            }
+        }
+    }
+
+    bool EncodePipeline::start() {
+        const AVCodecContext* codecContext = ffScreenSessionInfo.outputAVCodecContext;
+        int err = 0;
+
+        hardwareUpload = codecContext->hw_frames_ctx != nullptr;
+        presentationClock.reset(codecContext->time_base.num, codecContext->time_base.den);
+
+        for (std::size_t i = 0; i < shellCount; ++i) {
+            AVFrame* softwareFrame = av_frame_alloc();
+            AVFrame* hardwareFrame = av_frame_alloc();
+            AVPacket* packet = (i < kPipelineShellCount) ? av_packet_alloc() : nullptr;
+            if (softwareFrame) {
+                softwareFrames.push_back(softwareFrame);
+            }
+            if (hardwareFrame) {
+                hardwareFrames.push_back(hardwareFrame);
+            }
+            if (packet) {
+                packets.push_back(packet);
+                freePackets.tryPush(packet);
+            }
+            if (!softwareFrame || !hardwareFrame || (!packet && i < kPipelineShellCount)) {
+                ALOG(ERR, "Failed to allocate pipeline frames");
+                return false;
+            }
+
+            softwareFrame->format = AV_PIX_FMT_YUV420P;
+            softwareFrame->width = codecContext->width;
+            softwareFrame->height = codecContext->height;
+            if ((err = av_frame_get_buffer(softwareFrame, 0)) < 0) {
+                ALOG(ERR, "Failed to allocate picture", NV(err));
+                return false;
+            }
+
+            freeSoftwareFrames.tryPush(softwareFrame);
+            freeHardwareFrames.tryPush(hardwareFrame);
+        }
+
+        for (auto& worker : encoderWorkers) {
+            for (std::size_t i = 0; i < kWorkerPacketCount; ++i) {
+                AVPacket* packet = av_packet_alloc();
+                if (!packet) {
+                    ALOG(ERR, "Failed to allocate pipeline packets");
+                    return false;
+                }
+                worker->packets.push_back(packet);
+                worker->freePackets.tryPush(packet);
+            }
+
+            // First instance takes the session encoder, which is not used otherwise in this mode. The others are opened
+            // once for the session. An instance that cannot be opened fails the session instead of losing its chunks
+            worker->codecContext = (worker == encoderWorkers.front()) ? ffScreenSessionInfo.outputAVCodecContext :
+                                                                        openEncoderInstance(ffScreenSessionInfo);
+            if (!worker->codecContext) {
+                ALOG(ERR, "Failed to open parallel encoders", NVV(ParallelEncoders, encoderWorkers.size()));
+                return false;
+            }
+        }
+
+        convertThread = std::thread(&EncodePipeline::runConvertStage, this);
+        uploadThread = std::thread(&EncodePipeline::runUploadStage, this);
+        if (encoderWorkers.empty()) {
+            encodeThread = std::thread(&EncodePipeline::runEncodeStage, this);
+            muxThread = std::thread(&EncodePipeline::runMuxStage, this);
+        }
+        else {
+            for (auto& worker : encoderWorkers) {
+                worker->thread = std::thread(&EncodePipeline::runEncoderWorker, this, std::ref(*worker));
+            }
+            encodeThread = std::thread(&EncodePipeline::runDispatchStage, this);
+            muxThread = std::thread(&EncodePipeline::runOrderedMuxStage, this);
+        }
+
+        return true;
+    }
+
+    void EncodePipeline::finish() {
+        inputClosed = true;
+        convertSignal.notify();
+
+        for (auto* stageThread : { &convertThread, &uploadThread, &encodeThread }) {
+            if (stageThread->joinable()) {
+                stageThread->join();
+            }
+        }
+        for (auto& worker : encoderWorkers) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+        }
+        if (muxThread.joinable()) {
+            muxThread.join();
+        }
+    }
+
+    PipelineOccupancy EncodePipeline::getOccupancy() const {
+        PipelineOccupancy occupancy;
+        occupancy.captureQueue = screenFrameRing.size();
+        occupancy.convertQueue = convertedFrames.size();
+        occupancy.uploadQueue = uploadedFrames.size();
+        occupancy.muxQueue = encodedPackets.size();
+        for (const auto& worker : encoderWorkers) {
+            occupancy.muxQueue += worker->encodedPackets.size();
+        }
+        occupancy.peakCaptureQueue = peakCaptureQueue.load(std::memory_order_relaxed);
+        occupancy.peakConvertQueue = peakConvertQueue.load(std::memory_order_relaxed);
+        occupancy.peakUploadQueue = peakUploadQueue.load(std::memory_order_relaxed);
+        occupancy.peakMuxQueue = peakMuxQueue.load(std::memory_order_relaxed);
+        return occupancy;
+    }
+
+    void EncodePipeline::recordGrab(std::chrono::steady_clock::time_point grabStartTime) {
+        grabLatency.recordSince(grabStartTime);
+        if (lastGrabStartTime.time_since_epoch().count() != 0) {
+            grabInterval.record(std::chrono::duration_cast<std::chrono::microseconds>(grabStartTime - lastGrabStartTime).count());
+        }
+        lastGrabStartTime = grabStartTime;
+    }
+
+    PipelineLatencyStats EncodePipeline::getLatencyStats() const {
+        PipelineLatencyStats stats;
+        stats.grab = grabLatency.getSummary();
+        stats.convert = convertLatency.getSummary();
+        stats.upload = uploadLatency.getSummary();
+        stats.mux = muxLatency.getSummary();
+        stats.grabInterval = grabInterval.getSummary();
+        stats.muxInterval = muxInterval.getSummary();
+
+        LatencyHistogram mergedEncodeLatency;
+        mergedEncodeLatency.merge(encodeLatency);
+        for (const auto& worker : encoderWorkers) {
+            mergedEncodeLatency.merge(worker->encodeLatency);
+        }
+        stats.encode = mergedEncodeLatency.getSummary();
+        return stats;
+    }
+
+    FrameChangeStats EncodePipeline::getChangeStats() const {
+        FrameChangeStats stats;
+        stats.detectedFrames = detectedFrameCount.load(std::memory_order_relaxed);
+        stats.unchangedFrames = unchangedFrameCount.load(std::memory_order_relaxed);
+        stats.detectedTiles = detectedTileCount.load(std::memory_order_relaxed);
+        stats.dirtyTiles = dirtyTileCount.load(std::memory_order_relaxed);
+        stats.skippedFrames = skippedFrameCount.load(std::memory_order_relaxed);
+        stats.rectFrames = rectFrameCount.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    void EncodePipeline::detectFrameChanges(FrameBuffer& frame) {
+        // Rects of the capture source are exact and cost nothing, but only describe the change since the frame
+        // grabbed right before. Once a frame in between got dropped, hashing has to take over
+        const bool useRects = frame.rects.valid && frame.sequence == lastDetectedSequence + 1;
+        lastDetectedSequence = frame.sequence;
+
+        const int dirtyTiles = useRects ? changeDetector->markRects(frame) : changeDetector->detect(frame, convertWorkerPool);
+        if (useRects) {
+            rectFrameCount.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        detectedFrameCount.fetch_add(1, std::memory_order_relaxed);
+        detectedTileCount.fetch_add(static_cast<int64_t>(frame.changes.columns) * frame.changes.rows, std::memory_order_relaxed);
+        dirtyTileCount.fetch_add(dirtyTiles, std::memory_order_relaxed);
+        if (frame.changes.unchanged) {
+            unchangedFrameCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void EncodePipeline::convertFrame(const FrameBuffer& frame, AVFrame* softwareFrame) {
+        // Convert BGR pixels straight into the planes of the YUV frame, one horizontal band per worker
+        if (!screenFrameScaler) {
+            convertFrameToI420(frame, softwareFrame->data, softwareFrame->linesize, convertWorkerPool);
+        }
+        else if (!screenFrameScaler->convertToI420(frame, softwareFrame->data, softwareFrame->linesize, convertWorkerPool)) {
+            ALOG(ERR, "Grabbed frame does not hold the region to be scaled", NV(frame.width), NV(frame.height));
+        }
+
+        // Set presentation timestamp from the time the frame was grabbed
+        softwareFrame->pts = presentationClock.stamp(frame.timestamp);
+    }
+
+    void EncodePipeline::runConvertStage() {
+        AVFrame* softwareFrame = nullptr;
+        int err = 0;
+
+        while (true) {
+            if (!softwareFrame && !freeSoftwareFrames.tryPop(softwareFrame)) {
+                convertSignal.waitFor(kStageIdleWait);
+                continue;
+            }
+
+            updatePeak(peakCaptureQueue, screenFrameRing.size());
+
+            const auto convertStartTime = std::chrono::steady_clock::now();
+            FrameBuffer* frame = nullptr;
+            if (screenFrameRing.tryPop(frame)) {
+                screenFrameSlotSignal.notify();
+                if (changeDetector) {
+                    detectFrameChanges(*frame);
+                }
+                FrameBuffer* supersededFrame = nullptr;
+                const bool skipped = staticFrameFilter.skip(frame, supersededFrame);
+                if (supersededFrame) {
+                    screenFramePool.release(supersededFrame);
+                }
+                if (skipped) {
+                    skippedFrameCount.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+            }
+            else if (inputClosed && screenFrameRing.empty()) {
+                if (!staticFrameFilter.hasHeldFrame()) {
+                    break;
+                }
+                // Close with the last skipped frame, so the final picture lasts until recording stopped
+                frame = staticFrameFilter.takeHeldFrame();
+            }
+            else {
+                convertSignal.waitFor(kStageIdleWait);
+                continue;
+            }
+
+            // Software encoders may still reference the buffers of a frame they were sent, those get replaced
+            // instead of overwritten
+            if (!hardwareUpload && (err = av_frame_make_writable(softwareFrame)) < 0) {
+                ALOG(ERR, "Failed to make software frame writable", NV(err));
+            }
+
+            convertFrame(*frame, softwareFrame);
+            screenFramePool.release(frame);
+            convertLatency.recordSince(convertStartTime);
+
+            convertedFrames.tryPush(softwareFrame);
+            softwareFrame = nullptr;
+            uploadSignal.notify();
+        }
+
+        if (softwareFrame) {
+            freeSoftwareFrames.tryPush(softwareFrame);
+        }
+        convertDone = true;
+        uploadSignal.notify();
+    }
+
+    void EncodePipeline::runUploadStage() {
+        AVFrame* hardwareFrame = nullptr;
+        int err = 0;
+
+        while (true) {
+            if (!hardwareFrame && !freeHardwareFrames.tryPop(hardwareFrame)) {
+                uploadSignal.waitFor(kStageIdleWait);
+                continue;
+            }
+
+            updatePeak(peakConvertQueue, convertedFrames.size());
+
+            AVFrame* softwareFrame = nullptr;
+            if (!convertedFrames.tryPop(softwareFrame)) {
+                if (convertDone && convertedFrames.empty()) {
+                    break;
+                }
+                uploadSignal.waitFor(kStageIdleWait);
+                continue;
+            }
+
+            // Software encoders take converted frames as they are. The encode stage hands them back to conversion
+            if (!hardwareUpload) {
+                uploadedFrames.tryPush(softwareFrame);
+                encodeSignal.notify();
+                continue;
+            }
+
+            const auto uploadStartTime = std::chrono::steady_clock::now();
+            bool uploaded = false;
+            if ((err = av_hwframe_get_buffer(ffScreenSessionInfo.outputAVCodecContext->hw_frames_ctx, hardwareFrame, 0)) < 0) {
+                ALOG(ERR, "Failed to get hardware frame buffer", NV(err));
+            }
+            else if ((err = av_hwframe_transfer_data(hardwareFrame, softwareFrame, 0)) < 0) {
+                ALOG(ERR, "Failed to transfer hardware frame buffer", NV(err));
+                av_frame_unref(hardwareFrame);
+            }
+            else {
+                hardwareFrame->pts = softwareFrame->pts;
+                uploaded = true;
+                uploadLatency.recordSince(uploadStartTime);
+            }
+
+            freeSoftwareFrames.tryPush(softwareFrame);
+            convertSignal.notify();
+
+            if (uploaded) {
+                uploadedFrames.tryPush(hardwareFrame);
+                hardwareFrame = nullptr;
+                encodeSignal.notify();
+            }
+        }
+
+        if (hardwareFrame) {
+            freeHardwareFrames.tryPush(hardwareFrame);
+        }
+        uploadDone = true;
+        encodeSignal.notify();
+    }
+
+    void EncodePipeline::runEncodeStage() {
+        AVPacket* packet = nullptr;
+        int err = 0;
+
+        while (true) {
+            updatePeak(peakUploadQueue, uploadedFrames.size());
+
+            AVFrame* frame = nullptr;
+            if (!uploadedFrames.tryPop(frame)) {
+                if (uploadDone && uploadedFrames.empty()) {
+                    break;
+                }
+                encodeSignal.waitFor(kStageIdleWait);
+                continue;
+            }
+
+            const auto encodeStartTime = std::chrono::steady_clock::now();
+            err = avcodec_send_frame(ffScreenSessionInfo.outputAVCodecContext, frame);
+            releaseSentFrame(frame);
+
+            if (err < 0) {
+                ALOG(ERR, "Failed to send frame", NV(err));
+                continue;
+            }
+
+            receivePackets(ffScreenSessionInfo.outputAVCodecContext, freePackets, encodedPackets, encodeSignal, packet);
+            encodeLatency.recordSince(encodeStartTime);
+        }
+
+        // Frames still held by the encoder, the last one grabbed before stop included, come out once it is flushed
+        if ((err = avcodec_send_frame(ffScreenSessionInfo.outputAVCodecContext, nullptr)) < 0) {
+            ALOG(ERR, "Failed to flush encoder", NV(err));
+        }
+        else {
+            receivePackets(ffScreenSessionInfo.outputAVCodecContext, freePackets, encodedPackets, encodeSignal, packet);
+        }
+
+        if (packet) {
+            freePackets.tryPush(packet);
+        }
+        encodeDone = true;
+        muxSignal.notify();
+    }
+
+    void EncodePipeline::releaseSentFrame(AVFrame* frame) {
+        // Encoder holds its own reference, so the frame can go back right away
+        if (hardwareUpload) {
+            av_frame_unref(frame);
+            freeHardwareFrames.tryPush(frame);
+            uploadSignal.notify();
+        }
+        else {
+            freeSoftwareFrames.tryPush(frame);
+            convertSignal.notify();
+        }
+    }
+
+    void EncodePipeline::receivePackets(AVCodecContext* codecContext, SPSCRingBuffer<AVPacket*>& freeShells,
+                                        SPSCRingBuffer<AVPacket*>& packetRing, StageSignal& signal, AVPacket*& packet) {
+        while (true) {
+            if (!packet && !freeShells.tryPop(packet)) {
+                // Every packet shell is waiting for the mux stage
+                signal.waitFor(kStageIdleWait);
+                continue;
+            }
+
+            const int err = avcodec_receive_packet(codecContext, packet);
+            if (err == AVERROR(EAGAIN) || err == AVERROR_EOF) {
+                return;
+            }
+            if (err < 0) {
+                ALOG(ERR, "Failed to receive packet", NV(err));
+                return;
+            }
+
+            packet->stream_index = ffScreenSessionInfo.outVideoStream->index;
+            packetRing.tryPush(packet);
+            packet = nullptr;
+            muxSignal.notify();
+        }
+    }
+
+    void EncodePipeline::reclaimSentFrames() {
+        for (auto& worker : encoderWorkers) {
+            AVFrame* frame = nullptr;
+            while (worker->sentFrames.tryPop(frame)) {
+                releaseSentFrame(frame);
+            }
+        }
+    }
+
+    void EncodePipeline::runDispatchStage() {
+        const std::size_t workerCount = encoderWorkers.size();
+        AVFrame* frame = nullptr;
+        std::size_t chunk = 0; // Chunk the next frame belongs to. Chunk N goes to instance N modulo instance count
+        int chunkFrameCount = 0; // Frames of the current chunk handed out so far
+        bool chunkComplete = false; // Current chunk has all its frames, but its end was not handed out yet
+
+        while (true) {
+            reclaimSentFrames();
+            updatePeak(peakUploadQueue, uploadedFrames.size());
+
+            EncoderWorker& worker = *encoderWorkers[chunk % workerCount];
+            if (chunkComplete) {
+                if (!worker.inputFrames.tryPush(nullptr)) {
+                    encodeSignal.waitFor(kStageIdleWait);
+                    continue;
+                }
+                worker.signal.notify();
+                chunkComplete = false;
+                chunkFrameCount = 0;
+                ++chunk;
+                continue;
+            }
+
+            if (!frame && !uploadedFrames.tryPop(frame)) {
+                if (uploadDone && uploadedFrames.empty()) {
+                    if (chunkFrameCount == 0) {
+                        break;
+                    }
+                    // Last chunk ends with the last frame, however short it is
+                    chunkComplete = true;
+                    continue;
+                }
+                encodeSignal.waitFor(kStageIdleWait);
+                continue;
+            }
+
+            // An instance still busy with its previous chunk holds back every chunk after this one
+            if (!worker.inputFrames.tryPush(frame)) {
+                encodeSignal.waitFor(kStageIdleWait);
+                continue;
+            }
+            worker.signal.notify();
+            frame = nullptr;
+            chunkComplete = ++chunkFrameCount == kEncoderGopSize;
+        }
+
+        dispatchDone = true;
+        for (auto& worker : encoderWorkers) {
+            worker->signal.notify();
+        }
+    }
+
+    void EncodePipeline::runEncoderWorker(EncoderWorker& worker) {
+        AVPacket* packet = nullptr;
+        int err = 0;
+
+        while (true) {
+            AVFrame* frame = nullptr;
+            if (!worker.inputFrames.tryPop(frame)) {
+                if (dispatchDone && worker.inputFrames.empty()) {
+                    break;
+                }
+                worker.signal.waitFor(kStageIdleWait);
+                continue;
+            }
+
+            if (!frame) {
+                // Chunk is complete. It ends as soon as the encoder gave back a packet for each of its frames
+                endChunks(worker, worker.chunks.completeChunk());
+                encodeSignal.notify();
+                continue;
+            }
+
+            // Shells are reused, so frames within a chunk have to drop the keyframe request of an earlier chunk start
+            frame->pict_type = worker.chunks.startFrame(frame->pts) ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+
+            const auto encodeStartTime = std::chrono::steady_clock::now();
+            err = avcodec_send_frame(worker.codecContext, frame);
+
+            worker.sentFrames.tryPush(frame);
+            encodeSignal.notify();
+
+            if (err < 0) {
+                ALOG(ERR, "Failed to send frame", NV(err));
+                continue;
+            }
+
+            worker.chunks.frameSent();
+            receiveChunkPackets(worker, packet);
+            worker.encodeLatency.recordSince(encodeStartTime);
+        }
+
+        // Encoder is flushed once at the end of the session, which completes the chunks still open
+        if ((err = avcodec_send_frame(worker.codecContext, nullptr)) < 0) {
+            ALOG(ERR, "Failed to flush encoder", NV(err));
+        }
+        else {
+            receiveChunkPackets(worker, packet);
+        }
+        endChunks(worker, worker.chunks.endAll());
+
+        if (packet) {
+            worker.freePackets.tryPush(packet);
+        }
+        worker.done = true;
+        muxSignal.notify();
+    }
+
+    void EncodePipeline::receiveChunkPackets(EncoderWorker& worker, AVPacket*& packet) {
+        while (true) {
+            if (!packet && !worker.freePackets.tryPop(packet)) {
+                // Every packet shell is waiting for the mux stage
+                worker.signal.waitFor(kStageIdleWait);
+                continue;
+            }
+
+            const int err = avcodec_receive_packet(worker.codecContext, packet);
+            if (err == AVERROR(EAGAIN) || err == AVERROR_EOF) {
+                return;
+            }
+            if (err < 0) {
+                ALOG(ERR, "Failed to receive packet", NV(err));
+                return;
+            }
+
+            // Encoders may drop frames, then the keyframe of the next chunk is what ends the chunk before it
+            endChunks(worker, worker.chunks.endChunksBefore(packet->pts));
+
+            packet->stream_index = ffScreenSessionInfo.outVideoStream->index;
+            worker.encodedPackets.tryPush(packet);
+            packet = nullptr;
+            muxSignal.notify();
+
+            endChunks(worker, worker.chunks.packetHandedOn());
+        }
+    }
+
+    void EncodePipeline::endChunks(EncoderWorker& worker, int chunkCount) {
+        for (int i = 0; i < chunkCount; ++i) {
+            while (!worker.encodedPackets.tryPush(nullptr)) {
+                worker.signal.waitFor(kStageIdleWait);
+            }
+            muxSignal.notify();
+        }
+    }
+
+    void EncodePipeline::writePacket(AVPacket* packet) {
+        const auto muxStartTime = std::chrono::steady_clock::now();
+        int err = 0;
+        // Timestamps count encoder ticks, the muxer expects them in the time base of the stream. Encoder instances
+        // are opened with the same parameters as the session encoder, so they share its time base
+        av_packet_rescale_ts(packet, ffScreenSessionInfo.outputAVCodecContext->time_base, ffScreenSessionInfo.outVideoStream->time_base);
+        if ((err = av_interleaved_write_frame(ffScreenSessionInfo.ofctx, packet)) < 0) {
+            ALOG(ERR, "Failed to mux packet", NV(err));
+        }
+        av_packet_unref(packet);
+
+        muxLatency.recordSince(muxStartTime);
+        if (lastMuxTime.time_since_epoch().count() != 0) {
+            muxInterval.record(std::chrono::duration_cast<std::chrono::microseconds>(muxStartTime - lastMuxTime).count());
+        }
+        lastMuxTime = muxStartTime;
+    }
+
+    void EncodePipeline::runMuxStage() {
+        while (true) {
+            updatePeak(peakMuxQueue, encodedPackets.size());
+
+            AVPacket* packet = nullptr;
+            if (!encodedPackets.tryPop(packet)) {
+                if (encodeDone && encodedPackets.empty()) {
+                    break;
+                }
+                muxSignal.waitFor(kStageIdleWait);
+                continue;
+            }
+
+            writePacket(packet);
+
+            freePackets.tryPush(packet);
+            encodeSignal.notify();
+        }
+    }
+
+    void EncodePipeline::runOrderedMuxStage() {
+        const std::size_t workerCount = encoderWorkers.size();
+        std::size_t chunk = 0; // Chunk whose packets are muxed next
+
+        while (true) {
+            EncoderWorker& worker = *encoderWorkers[chunk % workerCount];
+            updatePeak(peakMuxQueue, worker.encodedPackets.size());
+
+            // Done has to be read before the ring. An instance that is done pushed every packet it ever will
+            const bool workerDone = worker.done;
+            AVPacket* packet = nullptr;
+            if (!worker.encodedPackets.tryPop(packet)) {
+                if (workerDone) {
+                    break;
+                }
+                muxSignal.waitFor(kStageIdleWait);
+                continue;
+            }
+
+            if (packet) {
+                writePacket(packet);
+                worker.freePackets.tryPush(packet);
+            }
+            else {
+                ++chunk;
+            }
+            worker.signal.notify();
+        }
+    }
+}
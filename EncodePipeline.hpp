@@ -0,0 +1,335 @@
+#pragma once
+
+#include "ScreenCaptureImpl.hpp"
+#include "EncoderChunkTracker.hpp"
+#include "FrameTiming.hpp"
+#include "LatencyHistogram.hpp"
+#include "StageSignal.hpp"
+#include "TileHash.hpp"
+#include "WorkerPool.hpp"
+
+#include <chrono>
+#include <memory>
+
+namespace CapUtils {
+
+    constexpr int kPipelineStageQueueCapacity = 4; // Number of frames or packets that can wait between two stages
+
+    /*
+    * Datastructure to hold the number of entries waiting in front of each pipeline stage.
+    * Peak values are the highest occupancy seen since the pipeline was started.
+    */
+    struct PipelineOccupancy {
+        std::size_t captureQueue = 0; // Grabbed frames waiting for color conversion
+        std::size_t convertQueue = 0; // Converted frames waiting for hardware upload
+        std::size_t uploadQueue = 0; // Uploaded frames waiting for the encoder
+        std::size_t muxQueue = 0; // Encoded packets waiting for the muxer
+
+        std::size_t peakCaptureQueue = 0;
+        std::size_t peakConvertQueue = 0;
+        std::size_t peakUploadQueue = 0;
+        std::size_t peakMuxQueue = 0;
+    };
+
+    /*
+    * Datastructure to hold change detection totals of all frames converted since the pipeline was started
+    */
+    struct FrameChangeStats {
+        int64_t detectedFrames = 0; // Frames that went through change detection
+        int64_t unchangedFrames = 0; // Frames equal to the frame before them
+        int64_t detectedTiles = 0; // Tiles hashed over all frames
+        int64_t dirtyTiles = 0; // Tiles that differed from the frame before
+        int64_t skippedFrames = 0; // Unchanged frames that were neither converted nor encoded
+        int64_t rectFrames = 0; // Frames whose changes came from rects of the capture source instead of hashing
+    };
+
+    /*
+    * Datastructure to hold the latency distributions of all frames since the pipeline was started. Latencies are
+    * the time a stage spent on one frame or packet, intervals the time from one grabbed frame or muxed packet to the next.
+    */
+    struct PipelineLatencyStats {
+        LatencySummary grab;
+        LatencySummary convert; // Change detection and color conversion of frames that were not skipped
+        LatencySummary upload;
+        LatencySummary encode; // Sending a frame and receiving the packets it completed, over all encoder instances
+        LatencySummary mux;
+        LatencySummary grabInterval;
+        LatencySummary muxInterval;
+    };
+
+    /*
+    * Encoder instance of the parallel encode mode. The first instance encodes with the session encoder, the others
+    * with encoders opened alike. Each stays open for the whole session and every chunk of frames it is handed starts
+    * with a forced IDR frame, so the chunk does not depend on chunks of other instances.
+    */
+    struct EncoderWorker {
+        EncoderWorker(std::size_t queueCapacity, std::size_t frameCapacity, std::size_t packetCapacity) :
+            inputFrames(queueCapacity),
+            sentFrames(frameCapacity),
+            encodedPackets(packetCapacity),
+            freePackets(packetCapacity) {
+        }
+
+        AVCodecContext* codecContext = nullptr; // Encoder of this instance. Set by start, owned by the session for the first instance
+        SPSCRingBuffer<AVFrame*> inputFrames; // Frames from encode stage, nullptr after the last frame of a chunk
+        SPSCRingBuffer<AVFrame*> sentFrames; // Frames handed back to encode stage once the encoder took them
+        SPSCRingBuffer<AVPacket*> encodedPackets; // Packets to mux stage, nullptr after the last packet of a chunk
+        SPSCRingBuffer<AVPacket*> freePackets; // Packet shells handed back from mux stage
+        std::vector<AVPacket*> packets; // Every packet shell owned by this instance
+        EncoderChunkTracker chunks; // Chunks whose end is still to be handed on. Instance thread only
+        LatencyHistogram encodeLatency;
+        StageSignal signal;
+        std::atomic<bool> done{ false }; // Every packet of this instance is in encodedPackets
+        std::thread thread;
+    };
+
+    /*
+    * Staged encoder that turns grabbed screen frames into segmented transport streams.
+    * Color conversion, hardware upload, encoding and muxing each run on a dedicated thread and are connected
+    * through bounded SPSC rings, so frame N+1 can be converted while frame N is encoded and frame N-1 is muxed.
+    * Software encoders skip the upload, converted frames pass straight through to the encode stage.
+    * Throughput is therefore limited by the slowest stage instead of the sum of all stages.
+    * Frames and packets circulate between stages as preallocated shells and are never allocated per frame.
+    *
+    * With more than one encoder, the encode stage hands whole GOPs to the encoder instances in turns and the mux stage
+    * takes their packets back in GOP order. Each instance only has a few frames queued in front of its encoder, so an
+    * instance that falls behind holds back the encode stage like any other slow stage.
+    */
+    class EncodePipeline {
+
+    public:
+        /**
+         * EncodePipeline constructor. FFMPEG session must be fully set up before the pipeline is started.
+         *
+         * @param sessionInfo
+         *     FFMPEG session used for conversion, encoding and muxing.
+         *
+         * @param captureRing
+         *     Ring through which the screen recording thread queues grabbed frames.
+         *
+         * @param captureSlotSignal
+         *     Notified after each frame taken out of captureRing, for a screen recording thread waiting for a free slot.
+         *
+         * @param framePool
+         *     Pool that grabbed frames are returned to once they are converted.
+         *
+         * @param convertThreads
+         *     Number of threads sharing the color conversion of a frame, including the conversion stage thread.
+         *
+         * @param frameScaler
+         *     Fused scale and color conversion used when grabbed frames differ from the encoder resolution.
+         *     nullptr if grabbed frames already match. Must outlive the pipeline.
+         *
+         * @param detectChanges
+         *     Hash the tiles of every grabbed frame before conversion and record what changed since the frame before
+         *     in the change map of the frame. Frames carrying rects of the capture source are mapped from these instead.
+         *
+         * @param maxStaticFrameIntervalInMs
+         *     Unchanged frames are skipped unless this much time passed since the last encoded frame. Output is
+         *     variable frame rate, each encoded picture simply lasts until the next one. Zero encodes every frame.
+         *     Holds one extra frame of the pool while frames are skipped.
+         *
+         * @param parallelEncoders
+         *     Number of encoder instances encoding GOPs in parallel. One encodes every frame with the session encoder.
+         */
+        EncodePipeline(FFScreenSessionInfo& sessionInfo, SPSCRingBuffer<FrameBuffer*>& captureRing, StageSignal& captureSlotSignal,
+                       FramePool& framePool, int convertThreads, FrameScaler* frameScaler, bool detectChanges,
+                       int64_t maxStaticFrameIntervalInMs, int parallelEncoders);
+
+        ~EncodePipeline();
+
+        /*
+        * @name Copy and move
+        *
+        * No copying and moving allowed. Stage threads refer back to this object.
+        */
+        EncodePipeline(const EncodePipeline&) = delete;
+        EncodePipeline& operator=(const EncodePipeline&) = delete;
+
+        EncodePipeline(EncodePipeline&&) = delete;
+        EncodePipeline& operator=(EncodePipeline&&) = delete;
+
+        /**
+         * Allocate frame and packet shells and start all stage threads
+         *
+         * @return  True if all shells could be allocated and every encoder instance opened.
+         */
+        bool start();
+
+        /**
+         * Wake up conversion stage after a frame is pushed into the capture ring
+         */
+        void notifyFrameQueued() {
+            convertSignal.notify();
+        }
+
+        /**
+         * Record latency of a successful grab and the interval since the previous one. Called by the capture thread only
+         *
+         * @param grabStartTime
+         *     Time the grab was started at
+         */
+        void recordGrab(std::chrono::steady_clock::time_point grabStartTime);
+
+        /**
+         * Signal that no more frames will be queued, let every stage drain, flush the encoder and join the stage threads.
+         * Safe to be called more than once.
+         */
+        void finish();
+
+        /**
+         * Get current and peak number of entries waiting in front of each stage
+         */
+        PipelineOccupancy getOccupancy() const;
+
+        /**
+         * Get change detection totals. All zero if change detection is disabled.
+         */
+        FrameChangeStats getChangeStats() const;
+
+        /**
+         * Get latency distributions of every stage, merged from the histograms of the threads recording them
+         */
+        PipelineLatencyStats getLatencyStats() const;
+
+    private:
+
+        /*
+        * Stage thread functions. Each one consumes its input ring until the upstream stage is done.
+        */
+        void runConvertStage();
+        void runUploadStage();
+        void runEncodeStage();
+        void runMuxStage();
+
+        /*
+        * Stage thread functions of the parallel encode mode. The dispatch stage takes the place of the encode stage
+        * and the ordered mux stage the place of the mux stage.
+        */
+        void runDispatchStage();
+        void runEncoderWorker(EncoderWorker& worker);
+        void runOrderedMuxStage();
+
+        /**
+         * Internal helper function to convert a grabbed BGR frame into a YUV 4:2:0 software frame, scaling it if needed,
+         * and stamp its presentation timestamp from the capture time.
+         */
+        void convertFrame(const FrameBuffer& frame, AVFrame* softwareFrame);
+
+        /**
+         * Internal helper function to hand every packet an encoder has ready to the mux stage. Encoders hold back
+         * frames, so a sent frame can yield no packet or several. Waits on signal if it runs out of shells.
+         *
+         * @param packet
+         *     Packet shell to receive into. Popped from freeShells if nullptr, nullptr again once handed over
+         */
+        void receivePackets(AVCodecContext* codecContext, SPSCRingBuffer<AVPacket*>& freeShells,
+                            SPSCRingBuffer<AVPacket*>& packetRing, StageSignal& signal, AVPacket*& packet);
+
+        /**
+         * Internal helper function of the encoder instances to hand every packet their encoder has ready to the mux stage,
+         * along with the end of each chunk the packets complete
+         */
+        void receiveChunkPackets(EncoderWorker& worker, AVPacket*& packet);
+
+        /**
+         * Internal helper function of the encoder instances to hand the ends of their oldest open chunks to the mux stage
+         */
+        void endChunks(EncoderWorker& worker, int chunkCount);
+
+        /**
+         * Internal helper function of the mux stages to write a packet to the output and unref it
+         */
+        void writePacket(AVPacket* packet);
+
+        /**
+         * Internal helper function to give a frame the encoder took back to the stage it came from
+         */
+        void releaseSentFrame(AVFrame* frame);
+
+        /**
+         * Internal helper function of the dispatch stage to release every frame the encoder instances took
+         */
+        void reclaimSentFrames();
+
+        /**
+         * Internal helper function to fill in the change map of a grabbed frame and update the change totals.
+         * Runs on the conversion stage, which sees exactly the frames that get encoded, in order.
+         */
+        void detectFrameChanges(FrameBuffer& frame);
+
+        /**
+         * Internal helper function to raise a peak occupancy value. Each peak has a single writer.
+         */
+        static void updatePeak(std::atomic<std::size_t>& peak, std::size_t value) {
+            if (value > peak.load(std::memory_order_relaxed)) {
+                peak.store(value, std::memory_order_relaxed);
+            }
+        }
+
+        FFScreenSessionInfo& ffScreenSessionInfo; // FFMPEG session shared by all stages. Each member is used by one stage only
+        SPSCRingBuffer<FrameBuffer*>& screenFrameRing; // Grabbed frames from screen recording thread
+        StageSignal& screenFrameSlotSignal; // Wakes up the screen recording thread when a slot of screenFrameRing got free
+        FramePool& screenFramePool; // Pool that grabbed frames go back to after conversion
+        WorkerPool convertWorkerPool; // Threads that convert horizontal bands of a frame in parallel
+        FrameScaler* screenFrameScaler; // Scales grabbed frames to the encoder resolution while converting. May be nullptr
+        std::unique_ptr<TileChangeDetector> changeDetector; // Finds changed tiles of grabbed frames. nullptr if disabled
+        int64_t lastDetectedSequence = -1; // Capture sequence of the last frame that went through change detection
+        StaticFrameFilter staticFrameFilter; // Skips and holds back unchanged frames. Only touched by the conversion stage
+        PresentationClock presentationClock; // Stamps converted frames in encoder time base. Only touched by the conversion stage
+
+        const std::size_t shellCount; // Number of frame shells of each kind, including the ones queued for encoder instances
+
+        SPSCRingBuffer<AVFrame*> convertedFrames; // Software frames from conversion stage to upload stage
+        SPSCRingBuffer<AVFrame*> freeSoftwareFrames; // Software frames handed back to conversion stage by upload or, without upload, encode stage
+        SPSCRingBuffer<AVFrame*> uploadedFrames; // Hardware frames, or software frames without upload, from upload stage to encode stage
+        SPSCRingBuffer<AVFrame*> freeHardwareFrames; // Hardware frame shells handed back from encode stage to upload stage
+        SPSCRingBuffer<AVPacket*> encodedPackets; // Packets from encode stage to mux stage
+        SPSCRingBuffer<AVPacket*> freePackets; // Packet shells handed back from mux stage to encode stage
+
+        std::vector<AVFrame*> softwareFrames; // Every software frame owned by this pipeline
+        std::vector<AVFrame*> hardwareFrames; // Every hardware frame shell owned by this pipeline
+        std::vector<AVPacket*> packets; // Every packet shell owned by this pipeline
+        bool hardwareUpload = true; // Encoder takes hardware frames, so converted frames are uploaded first. Set by start
+        std::vector<std::unique_ptr<EncoderWorker>> encoderWorkers; // Parallel encoder instances. Empty with a single encoder
+
+        StageSignal convertSignal;
+        StageSignal uploadSignal;
+        StageSignal encodeSignal;
+        StageSignal muxSignal;
+
+        std::atomic<bool> inputClosed{ false }; // No more frames will be pushed into the capture ring
+        std::atomic<bool> convertDone{ false };
+        std::atomic<bool> uploadDone{ false };
+        std::atomic<bool> encodeDone{ false };
+        std::atomic<bool> dispatchDone{ false }; // Every chunk has been handed to the encoder instances
+
+        std::atomic<std::size_t> peakCaptureQueue{ 0 };
+        std::atomic<std::size_t> peakConvertQueue{ 0 };
+        std::atomic<std::size_t> peakUploadQueue{ 0 };
+        std::atomic<std::size_t> peakMuxQueue{ 0 };
+
+        std::atomic<int64_t> detectedFrameCount{ 0 };
+        std::atomic<int64_t> unchangedFrameCount{ 0 };
+        std::atomic<int64_t> detectedTileCount{ 0 };
+        std::atomic<int64_t> dirtyTileCount{ 0 };
+        std::atomic<int64_t> skippedFrameCount{ 0 };
+        std::atomic<int64_t> rectFrameCount{ 0 };
+
+        // Every histogram is recorded by the single thread running its stage. Encoder instances have their own
+        LatencyHistogram grabLatency;
+        LatencyHistogram grabInterval;
+        LatencyHistogram convertLatency;
+        LatencyHistogram uploadLatency;
+        LatencyHistogram encodeLatency;
+        LatencyHistogram muxLatency;
+        LatencyHistogram muxInterval;
+        std::chrono::steady_clock::time_point lastGrabStartTime; // Start of the previous grab. Only touched by the capture thread
+        std::chrono::steady_clock::time_point lastMuxTime; // Time the previous packet was muxed. Only touched by the mux thread
+
+        std::thread convertThread;
+        std::thread uploadThread;
+        std::thread encodeThread;
+        std::thread muxThread;
+    };
+}
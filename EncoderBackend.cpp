@@ -0,0 +1,325 @@
+#include "EncoderBackend.hpp"
+#include "ScreenCaptureImpl.hpp"
+#include "LogUtil.hpp"
+
+#include <algorithm>
+
+extern "C"
+{
+    #include <libavutil/pixdesc.h>
+}
+
+using namespace LogUtils;
+
+namespace CapUtils {
+
+    namespace {
+
+        constexpr int kHardwareFramePoolSize = 20; // Surfaces preallocated for frames uploaded to the GPU
+
+        // Bits per pixel targeted by backends without a constant quality mode when no bitrate is given.
+        // About 6 Mbps at 1080p and 30 fps, plenty for screen content
+        constexpr double kDefaultBitsPerPixel = 0.1;
+
+        const char* getEncoderName(EncoderBackend backend) {
+            switch (backend) {
+            case EncoderBackend::NVENC:
+                return "h264_nvenc";
+            case EncoderBackend::LIBX264:
+                return "libx264";
+            case EncoderBackend::LIBX265:
+                return "libx265";
+            case EncoderBackend::LIBOPENH264:
+                return "libopenh264";
+            default:
+                return "";
+            }
+        }
+
+        bool acceptsPixelFormat(const AVCodec* codec, AVPixelFormat format) {
+            if (codec->pix_fmts == nullptr) {
+                return true;
+            }
+            for (const AVPixelFormat* codecFormat = codec->pix_fmts; *codecFormat != AV_PIX_FMT_NONE; ++codecFormat) {
+                if (*codecFormat == format) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        int setHardwareFrameContext(FFScreenSessionInfo& sessionInfo, const EncoderSettings& settings) {
+            AVBufferRef* hardwareFramesRef;
+            AVHWFramesContext* framesContext = NULL;
+            int err = 0;
+
+            if (!(hardwareFramesRef = av_hwframe_ctx_alloc(sessionInfo.hardwareEncodeDeviceContext))) {
+                ALOG(ERR, "Failed to create CUDA frame context.");
+                return -1;
+            }
+
+            framesContext = (AVHWFramesContext*)(hardwareFramesRef->data);
+            framesContext->format = AV_PIX_FMT_CUDA;
+            framesContext->sw_format = settings.softwareFormat;
+            framesContext->width = settings.width;
+            framesContext->height = settings.height;
+            framesContext->initial_pool_size = kHardwareFramePoolSize;
+
+            if ((err = av_hwframe_ctx_init(hardwareFramesRef)) < 0) {
+                ALOG(ERR, "Failed to initialize CUDA frame context.", NV(err));
+                av_buffer_unref(&hardwareFramesRef);
+                return err;
+            }
+            sessionInfo.outputAVCodecContext->hw_frames_ctx = av_buffer_ref(hardwareFramesRef);
+            if (!sessionInfo.outputAVCodecContext->hw_frames_ctx)
+                err = AVERROR(ENOMEM);
+
+            av_buffer_unref(&hardwareFramesRef);
+            return err;
+        }
+
+        void setBackendOptions(EncoderBackend backend, AVCodecContext* codecContext, const EncoderSettings& settings) {
+            const std::string crf = std::to_string(settings.crf);
+            const bool constantQuality = settings.outputBitrateInMB == 0;
+
+            switch (backend) {
+            case EncoderBackend::NVENC:
+                // Fastest preset tuned for low latency. Constant quality is a quality target of variable bitrate
+                av_opt_set(codecContext, "preset", "p1", AV_OPT_SEARCH_CHILDREN);
+                av_opt_set(codecContext, "tune", "ll", AV_OPT_SEARCH_CHILDREN);
+                if (constantQuality) {
+                    av_opt_set(codecContext, "rc", "vbr", AV_OPT_SEARCH_CHILDREN);
+                    av_opt_set(codecContext, "cq", crf.c_str(), AV_OPT_SEARCH_CHILDREN);
+                }
+                break;
+            case EncoderBackend::LIBX264:
+                // Zero latency tuning threads by slices instead of frames, so each sent frame comes back as a packet
+                // right away. veryfast keeps 1080p screen content well above 30 fps on four cores
+                av_opt_set(codecContext, "preset", "veryfast", AV_OPT_SEARCH_CHILDREN);
+                av_opt_set(codecContext, "tune", "zerolatency", AV_OPT_SEARCH_CHILDREN);
+                // Keyframes requested by parallel encoder instances start their chunk, so they have to be IDR frames
+                av_opt_set(codecContext, "forced-idr", "1", AV_OPT_SEARCH_CHILDREN);
+                if (constantQuality) {
+                    av_opt_set(codecContext, "crf", crf.c_str(), AV_OPT_SEARCH_CHILDREN);
+                }
+                codecContext->thread_count = settings.threadCount;
+                break;
+            case EncoderBackend::LIBX265:
+                // HEVC costs several times the cycles of H.264, so only ultrafast keeps up in real time
+                av_opt_set(codecContext, "preset", "ultrafast", AV_OPT_SEARCH_CHILDREN);
+                av_opt_set(codecContext, "tune", "zerolatency", AV_OPT_SEARCH_CHILDREN);
+                av_opt_set(codecContext, "forced-idr", "1", AV_OPT_SEARCH_CHILDREN);
+                if (constantQuality) {
+                    av_opt_set(codecContext, "crf", crf.c_str(), AV_OPT_SEARCH_CHILDREN);
+                }
+                if (settings.threadCount > 0) {
+                    av_opt_set(codecContext, "x265-params", ("pools=" + std::to_string(settings.threadCount)).c_str(),
+                               AV_OPT_SEARCH_CHILDREN);
+                }
+                break;
+            case EncoderBackend::LIBOPENH264:
+                // There is no constant rate factor, quality mode still needs a bitrate to aim at
+                av_opt_set(codecContext, "rc_mode", "quality", AV_OPT_SEARCH_CHILDREN);
+                if (constantQuality) {
+                    codecContext->bit_rate = static_cast<int64_t>(kDefaultBitsPerPixel * settings.width * settings.height * settings.fps);
+                }
+                codecContext->thread_count = settings.threadCount;
+                break;
+            default:
+                break;
+            }
+        }
+
+        /*
+        * Apply settings to a codec context that is about to be opened with backend
+        */
+        void setCodecParameters(EncoderBackend backend, AVCodecContext* codecContext, const EncoderSettings& settings) {
+            codecContext->width = settings.width;
+            codecContext->height = settings.height;
+            codecContext->time_base = { 1, settings.fps };
+            codecContext->framerate = { settings.fps, 1 };
+            codecContext->sample_aspect_ratio = { 1, 1 };
+            codecContext->pix_fmt = isHardwareEncoderBackend(backend) ? AV_PIX_FMT_CUDA : settings.softwareFormat;
+            codecContext->max_b_frames = 0;
+            codecContext->gop_size = kEncoderGopSize;
+            if (settings.outputBitrateInMB != 0) {
+                codecContext->bit_rate = static_cast<int64_t>(settings.outputBitrateInMB) * 1000 * 1000;
+            }
+
+            setBackendOptions(backend, codecContext, settings);
+        }
+
+        /*
+        * Free whatever a failed attempt to open a backend left behind
+        */
+        void releaseBackend(FFScreenSessionInfo& sessionInfo) {
+            avcodec_free_context(&sessionInfo.outputAVCodecContext);
+            av_buffer_unref(&sessionInfo.hardwareEncodeDeviceContext);
+            sessionInfo.codec = nullptr;
+        }
+
+        bool tryOpenBackend(FFScreenSessionInfo& sessionInfo, EncoderBackend backend, const EncoderSettings& settings) {
+            const char* encoderName = getEncoderName(backend);
+            const bool hardware = isHardwareEncoderBackend(backend);
+            int err = 0;
+
+            if (!(sessionInfo.codec = avcodec_find_encoder_by_name(encoderName))) {
+                ALOG(WARNING, "Encoder is not part of this FFMPEG build", NVV(Encoder, encoderName));
+                return false;
+            }
+
+            if (!hardware && !acceptsPixelFormat(sessionInfo.codec, settings.softwareFormat)) {
+                ALOG(WARNING, "Encoder does not accept converted frames", NVV(Encoder, encoderName),
+                     NVV(PixelFormat, av_get_pix_fmt_name(settings.softwareFormat)));
+                return false;
+            }
+
+            if (hardware &&
+                (err = av_hwdevice_ctx_create(&sessionInfo.hardwareEncodeDeviceContext, AV_HWDEVICE_TYPE_CUDA, NULL, NULL, 0)) < 0) {
+                ALOG(WARNING, "Failed to initialize CUDA device context.", NVV(Encoder, encoderName), NV(err));
+                return false;
+            }
+
+            if (!(sessionInfo.outputAVCodecContext = avcodec_alloc_context3(sessionInfo.codec))) {
+                ALOG(ERR, "Failed to allocate codec context", NVV(Encoder, encoderName));
+                return false;
+            }
+
+            AVCodecContext* codecContext = sessionInfo.outputAVCodecContext;
+            setCodecParameters(backend, codecContext, settings);
+
+            // Set hardware context for encoder's AVCodecContext
+            if (hardware && (err = setHardwareFrameContext(sessionInfo, settings)) < 0) {
+                ALOG(WARNING, "Failed to set hardware frame context.", NVV(Encoder, encoderName), NV(err));
+                return false;
+            }
+
+            if ((err = avcodec_open2(codecContext, sessionInfo.codec, NULL)) < 0) {
+                ALOG(WARNING, "Failed to open codec", NVV(Encoder, encoderName), NV(err));
+                return false;
+            }
+
+            sessionInfo.encoderBackend = backend;
+            sessionInfo.encoderSettings = settings;
+            return true;
+        }
+    }
+
+    bool parseEncoderBackend(const std::string& backendName, EncoderBackend& backend) {
+        if (backendName == "nvenc") {
+            backend = EncoderBackend::NVENC;
+        }
+        else if (backendName == "libx264") {
+            backend = EncoderBackend::LIBX264;
+        }
+        else if (backendName == "libx265") {
+            backend = EncoderBackend::LIBX265;
+        }
+        else if (backendName == "libopenh264") {
+            backend = EncoderBackend::LIBOPENH264;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    bool parseEncoderBackendChain(const std::string& chainNames, std::vector<EncoderBackend>& chain) {
+        bool allKnown = true;
+        chain.clear();
+
+        std::size_t start = 0;
+        while (start <= chainNames.size()) {
+            std::size_t end = chainNames.find(',', start);
+            end = (end == std::string::npos) ? chainNames.size() : end;
+
+            const std::size_t first = chainNames.find_first_not_of(" \t", start);
+            if (first < end) {
+                const std::size_t last = chainNames.find_last_not_of(" \t", end - 1);
+                EncoderBackend backend;
+                if (!parseEncoderBackend(chainNames.substr(first, last - first + 1), backend)) {
+                    allKnown = false;
+                }
+                else if (std::find(chain.begin(), chain.end(), backend) == chain.end()) {
+                    chain.push_back(backend);
+                }
+            }
+            start = end + 1;
+        }
+        return allKnown && !chain.empty();
+    }
+
+    std::string getEncoderBackendString(EncoderBackend backend) {
+        std::string result = "";
+        switch (backend) {
+        case EncoderBackend::NVENC:
+            result = "NVENC";
+            break;
+        case EncoderBackend::LIBX264:
+            result = "LIBX264";
+            break;
+        case EncoderBackend::LIBX265:
+            result = "LIBX265";
+            break;
+        case EncoderBackend::LIBOPENH264:
+            result = "LIBOPENH264";
+            break;
+        default:
+            break;
+        }
+        return result;
+    }
+
+    std::string getEncoderBackendChainString(const std::vector<EncoderBackend>& chain) {
+        std::string result = "";
+        for (EncoderBackend backend : chain) {
+            result += (result.empty() ? "" : ",") + getEncoderBackendString(backend);
+        }
+        return result;
+    }
+
+    std::vector<EncoderBackend> getDefaultEncoderBackendChain() {
+        return { EncoderBackend::NVENC, EncoderBackend::LIBX264, EncoderBackend::LIBOPENH264, EncoderBackend::LIBX265 };
+    }
+
+    bool isHardwareEncoderBackend(EncoderBackend backend) {
+        return backend == EncoderBackend::NVENC;
+    }
+
+    bool openEncoderBackend(FFScreenSessionInfo& sessionInfo, const std::vector<EncoderBackend>& chain,
+                            const EncoderSettings& settings) {
+        for (EncoderBackend backend : chain) {
+            if (tryOpenBackend(sessionInfo, backend, settings)) {
+                return true;
+            }
+            releaseBackend(sessionInfo);
+        }
+        return false;
+    }
+
+    AVCodecContext* openEncoderInstance(const FFScreenSessionInfo& sessionInfo) {
+        AVCodecContext* codecContext = nullptr;
+        int err = 0;
+
+        if (!sessionInfo.codec || !sessionInfo.outputAVCodecContext ||
+            !(codecContext = avcodec_alloc_context3(sessionInfo.codec))) {
+            return nullptr;
+        }
+
+        setCodecParameters(sessionInfo.encoderBackend, codecContext, sessionInfo.encoderSettings);
+
+        // Frames are uploaded into surfaces of the session encoder, so every instance has to take the same ones
+        if (sessionInfo.outputAVCodecContext->hw_frames_ctx &&
+            !(codecContext->hw_frames_ctx = av_buffer_ref(sessionInfo.outputAVCodecContext->hw_frames_ctx))) {
+            avcodec_free_context(&codecContext);
+            return nullptr;
+        }
+
+        if ((err = avcodec_open2(codecContext, sessionInfo.codec, NULL)) < 0) {
+            ALOG(ERR, "Failed to open encoder instance", NVV(Encoder, getEncoderBackendString(sessionInfo.encoderBackend)), NV(err));
+            avcodec_free_context(&codecContext);
+            return nullptr;
+        }
+        return codecContext;
+    }
+}
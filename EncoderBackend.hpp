@@ -0,0 +1,108 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+extern "C"
+{
+    #include <libavutil/pixfmt.h>
+}
+
+struct AVCodecContext;
+
+namespace CapUtils {
+
+    struct FFScreenSessionInfo;
+
+    constexpr int kEncoderGopSize = 12; // Frames from one keyframe to the next
+
+    /*
+    * Video encoders that an FFMPEG session can be opened with
+    */
+    enum class EncoderBackend {
+        NVENC = 0,      // NVIDIA hardware H.264 encoder fed with frames uploaded into CUDA surfaces
+        LIBX264 = 1,    // Software H.264 encoder
+        LIBX265 = 2,    // Software HEVC encoder
+        LIBOPENH264 = 3 // Software H.264 encoder of Cisco, available where libx264 is not licensed
+    };
+
+    /**
+     * Helper function to parse encoder backend from its config file name
+     *
+     * @param backendName
+     *     One of "nvenc", "libx264", "libx265" or "libopenh264"
+     *
+     * @param backend
+     *     Receives the parsed backend
+     *
+     * @return  True if backendName is a known encoder backend.
+     */
+    bool parseEncoderBackend(const std::string& backendName, EncoderBackend& backend);
+
+    /**
+     * Helper function to parse a comma separated list of encoder backends, e.g. "nvenc,libx264"
+     *
+     * @param chainNames
+     *     Backend names in the order they should be tried. Blanks around names are ignored
+     *
+     * @param chain
+     *     Receives the known backends in the given order. Duplicates are dropped
+     *
+     * @return  False if any name is unknown or no backend is left. Known backends are still returned.
+     */
+    bool parseEncoderBackendChain(const std::string& chainNames, std::vector<EncoderBackend>& chain);
+
+    /**
+     * Helper function to get encoder backend in string format to be used for logging purposes
+     */
+    std::string getEncoderBackendString(EncoderBackend backend);
+
+    /**
+     * Helper function to get a comma separated list of encoder backends to be used for logging purposes
+     */
+    std::string getEncoderBackendChainString(const std::vector<EncoderBackend>& chain);
+
+    /**
+     * Get the default chain: NVENC first, then the software encoders from fastest to slowest
+     */
+    std::vector<EncoderBackend> getDefaultEncoderBackendChain();
+
+    /**
+     * Check whether frames of an encoder backend have to be uploaded to the GPU before encoding
+     */
+    bool isHardwareEncoderBackend(EncoderBackend backend);
+
+    /*
+    * Datastructure to hold the encoder parameters that do not depend on the backend
+    */
+    struct EncoderSettings {
+        int width = 0; // Encoded picture width
+        int height = 0; // Encoded picture height
+        int fps = 30;
+        int crf = 23; // Constant rate factor used unless a bitrate is given. Mapped to the closest setting of each backend
+        int outputBitrateInMB = 0; // Target bitrate in Mbps. Zero encodes at constant quality
+        int threadCount = 0; // Threads of software encoders. Zero lets the encoder pick from the available cores
+        AVPixelFormat softwareFormat = AV_PIX_FMT_YUV420P; // Format of converted frames. Uploaded as is by hardware backends
+    };
+
+    /**
+     * Open the first encoder backend of chain that is available and accepts settings. Backends that fail are
+     * logged and fully released before the next one is tried.
+     *
+     * On success codec, outputAVCodecContext, encoderBackend and encoderSettings of sessionInfo are set. For hardware backends
+     * hardwareEncodeDeviceContext and the hw_frames_ctx of outputAVCodecContext are set as well, software backends
+     * leave hw_frames_ctx empty and take frames of settings.softwareFormat directly.
+     *
+     * @return  False if no backend of chain could be opened.
+     */
+    bool openEncoderBackend(FFScreenSessionInfo& sessionInfo, const std::vector<EncoderBackend>& chain,
+                            const EncoderSettings& settings);
+
+    /**
+     * Open one more encoder with the backend and settings sessionInfo was opened with. Hardware encoders share the
+     * frames context of the session encoder, so frames uploaded for it can be sent to any instance.
+     *
+     * @return  Opened codec context to be freed with avcodec_free_context, or nullptr if it cannot be opened.
+     */
+    AVCodecContext* openEncoderInstance(const FFScreenSessionInfo& sessionInfo);
+}
@@ -0,0 +1,63 @@
+#include "EncoderChunkTracker.hpp"
+
+namespace CapUtils {
+
+    bool EncoderChunkTracker::startFrame(int64_t timestamp) {
+        if (!chunkStarting) {
+            return false;
+        }
+        EncoderChunk chunk;
+        chunk.firstTimestamp = timestamp;
+        openChunks.push_back(chunk);
+        chunkStarting = false;
+        return true;
+    }
+
+    void EncoderChunkTracker::frameSent() {
+        if (!openChunks.empty()) {
+            ++openChunks.back().pendingPackets;
+        }
+    }
+
+    int EncoderChunkTracker::completeChunk() {
+        chunkStarting = true;
+        if (openChunks.empty()) {
+            return 0;
+        }
+        openChunks.back().complete = true;
+        return endFinishedChunks();
+    }
+
+    int EncoderChunkTracker::endChunksBefore(int64_t packetTimestamp) {
+        int endedChunks = 0;
+        while (openChunks.size() > 1 && packetTimestamp >= openChunks[1].firstTimestamp) {
+            openChunks.pop_front();
+            ++endedChunks;
+        }
+        return endedChunks;
+    }
+
+    int EncoderChunkTracker::packetHandedOn() {
+        if (openChunks.empty()) {
+            return 0;
+        }
+        EncoderChunk& chunk = openChunks.front();
+        chunk.pendingPackets = (chunk.pendingPackets > 0) ? chunk.pendingPackets - 1 : 0;
+        return endFinishedChunks();
+    }
+
+    int EncoderChunkTracker::endAll() {
+        const int endedChunks = static_cast<int>(openChunks.size());
+        openChunks.clear();
+        return endedChunks;
+    }
+
+    int EncoderChunkTracker::endFinishedChunks() {
+        int endedChunks = 0;
+        while (!openChunks.empty() && openChunks.front().complete && openChunks.front().pendingPackets == 0) {
+            openChunks.pop_front();
+            ++endedChunks;
+        }
+        return endedChunks;
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+namespace CapUtils {
+
+    /*
+    * Chunk of frames an encoder instance was handed whose end was not handed on to the mux stage yet
+    */
+    struct EncoderChunk {
+        int64_t firstTimestamp = 0; // Presentation timestamp of the keyframe the chunk starts with
+        int pendingPackets = 0; // Frames the encoder took whose packet did not come out yet
+        bool complete = false; // Every frame of the chunk was sent
+    };
+
+    /*
+    * Bookkeeping of the chunks of one encoder instance in parallel encode mode. The mux stage takes packets of
+    * chunk N from instance N modulo instance count until it reads the end of that chunk, so each instance has to
+    * hand on the end of each of its chunks after the last packet of it and before the first packet of the next one.
+    * A chunk ends once each of its frames came out as a packet, or at the latest with the keyframe of the next
+    * chunk, as encoders may drop frames. Methods return the number of chunk ends the caller has to hand on right
+    * away, oldest first. Used by the instance thread only.
+    */
+    class EncoderChunkTracker {
+
+    public:
+        /**
+         * Register a frame before it is sent to the encoder
+         *
+         * @param timestamp
+         *     Presentation timestamp of the frame
+         *
+         * @return  True if the frame starts a chunk and has to be encoded as IDR frame.
+         */
+        bool startFrame(int64_t timestamp);
+
+        /*
+        * Count a frame the encoder took, so a packet of it is waited for
+        */
+        void frameSent();
+
+        /**
+         * Mark the chunk of the frames started so far complete. The next frame starts a chunk.
+         *
+         * @return  Number of chunk ends to hand on, as the encoder may have given back every packet already.
+         */
+        int completeChunk();
+
+        /**
+         * Get the chunk ends due before a packet is handed on, as its timestamp reached the keyframe of a later chunk
+         *
+         * @return  Number of chunk ends to hand on before the packet.
+         */
+        int endChunksBefore(int64_t packetTimestamp);
+
+        /**
+         * Count a packet handed on for the oldest open chunk
+         *
+         * @return  Number of chunk ends to hand on after the packet.
+         */
+        int packetHandedOn();
+
+        /**
+         * End every open chunk, once the flushed encoder gave back its last packet
+         *
+         * @return  Number of chunk ends to hand on.
+         */
+        int endAll();
+
+        std::size_t getOpenChunkCount() const {
+            return openChunks.size();
+        }
+
+    private:
+
+        /**
+         * Internal helper function to end the oldest chunks for as long as those are complete and got a packet for
+         * each of their frames
+         */
+        int endFinishedChunks();
+
+        std::deque<EncoderChunk> openChunks; // Chunks whose end is still to be handed on, oldest first
+        bool chunkStarting = true; // Next frame starts a chunk
+    };
+}
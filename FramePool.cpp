@@ -0,0 +1,107 @@
+#include "FramePool.hpp"
+#include "LogUtil.hpp"
+#include "SPSCRingBuffer.hpp"
+
+#include <algorithm>
+#include <new>
+
+using namespace LogUtils;
+
+namespace CapUtils {
+
+    int getBytesPerPixel(FramePixelFormat pixelFormat) {
+        return (pixelFormat == FramePixelFormat::BGRA) ? 4 : 3;
+    }
+
+    FramePool::FramePool(int width, int height, FramePixelFormat pixelFormat, int strideAlignment,
+                         std::size_t initialCount, std::size_t maxCount, FrameMemoryAllocator* allocator) :
+        frameWidth(width),
+        frameHeight(height),
+        framePixelFormat(pixelFormat),
+        maxBufferCount(maxCount > initialCount ? maxCount : initialCount),
+        memoryAllocator(allocator) {
+        int alignment = (strideAlignment > 0) ? strideAlignment : 1;
+        int rowSize = width * getBytesPerPixel(pixelFormat);
+        frameStride = ((rowSize + alignment - 1) / alignment) * alignment;
+        bufferSize = static_cast<std::size_t>(frameStride) * height;
+
+        ownedBuffers.reserve(maxBufferCount);
+        freeBuffers.reserve(maxBufferCount);
+
+        std::lock_guard<std::mutex> lock(poolMutex);
+        for (std::size_t i = 0; i < initialCount; ++i) {
+            FrameBuffer* buffer = allocateBuffer();
+            if (buffer == nullptr) {
+                break;
+            }
+            freeBuffers.push_back(buffer);
+        }
+    }
+
+    FramePool::~FramePool() {
+        for (auto& buffer : ownedBuffers) {
+            if (memoryAllocator != nullptr) {
+                memoryAllocator->deallocate(buffer->data);
+            }
+            else {
+                ::operator delete[](buffer->data, std::align_val_t(kCacheLineSize));
+            }
+        }
+    }
+
+    FrameBuffer* FramePool::allocateBuffer() {
+        if (ownedBuffers.size() >= maxBufferCount) {
+            return nullptr;
+        }
+
+        auto buffer = std::make_unique<FrameBuffer>();
+        if (memoryAllocator != nullptr) {
+            buffer->data = memoryAllocator->allocate(bufferSize);
+        }
+        else {
+            buffer->data = static_cast<uint8_t*>(::operator new[](bufferSize, std::align_val_t(kCacheLineSize), std::nothrow));
+        }
+        if (buffer->data == nullptr) {
+            return nullptr;
+        }
+        buffer->width = frameWidth;
+        buffer->height = frameHeight;
+        buffer->stride = frameStride;
+        buffer->size = bufferSize;
+        buffer->pixelFormat = framePixelFormat;
+
+        ownedBuffers.push_back(std::move(buffer));
+        return ownedBuffers.back().get();
+    }
+
+    FrameBuffer* FramePool::acquire() {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        if (!freeBuffers.empty()) {
+            FrameBuffer* buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+            hitCount.fetch_add(1, std::memory_order_relaxed);
+            return buffer;
+        }
+
+        missCount.fetch_add(1, std::memory_order_relaxed);
+        return allocateBuffer();
+    }
+
+    void FramePool::release(FrameBuffer* buffer) {
+        if (buffer == nullptr) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(poolMutex);
+#ifndef NDEBUG
+        // A foreign or twice released buffer would be handed out to two owners at once
+        const bool owned = std::any_of(ownedBuffers.begin(), ownedBuffers.end(),
+                                       [buffer](const std::unique_ptr<FrameBuffer>& ownedBuffer) { return ownedBuffer.get() == buffer; });
+        const bool alreadyFree = std::find(freeBuffers.begin(), freeBuffers.end(), buffer) != freeBuffers.end();
+        if (!owned || alreadyFree) {
+            ALOG(ERR, "Frame buffer released to a pool that does not own it or twice!", NVV(owned, owned), NVV(alreadyFree, alreadyFree));
+            return;
+        }
+#endif
+        freeBuffers.push_back(buffer);
+    }
+}
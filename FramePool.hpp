@@ -0,0 +1,220 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace CapUtils {
+
+    /*
+    * Pixel layouts that can be held by a frame buffer
+    */
+    enum class FramePixelFormat {
+        BGR24 = 0, // 3 bytes per pixel as written by GDI for 24 bit DIBs
+        BGRA = 1   // 4 bytes per pixel as delivered by DXGI desktop duplication
+    };
+
+    /**
+     * Helper function to get number of bytes used by a single pixel of the given format
+     */
+    int getBytesPerPixel(FramePixelFormat pixelFormat);
+
+    /*
+    * Tiles of a frame that changed since the previous frame, as found by change detection.
+    * Capture paths without change detection leave detected false.
+    */
+    struct FrameChangeMap {
+        bool detected = false; // Change detection ran on this frame and the members below are valid
+        bool unchanged = false; // Every tile equals the previous frame
+        int tileSize = 0; // Tile edge in pixels
+        int columns = 0; // Tiles per row
+        int rows = 0; // Tile rows
+        int dirtyTileCount = 0; // Number of set entries in dirtyTiles
+        std::vector<uint8_t> dirtyTiles; // columns x rows entries in row order, set if the tile changed. Capacity is kept
+    };
+
+    /*
+    * Rectangle of a frame in pixels. Right and bottom are exclusive, same as a Win32 RECT.
+    */
+    struct FrameRect {
+        int left = 0;
+        int top = 0;
+        int right = 0;
+        int bottom = 0;
+    };
+
+    /*
+    * Block of pixels that moved within a frame, same as a DXGI_OUTDUPL_MOVE_RECT.
+    * Pixels of the previous frame at sourceX, sourceY now show up at destination.
+    */
+    struct FrameMoveRect {
+        int sourceX = 0;
+        int sourceY = 0;
+        FrameRect destination;
+    };
+
+    /*
+    * Move and dirty rects reported by the capture source along with a frame. They describe how to get from the
+    * frame grabbed right before it to this one: moves first, in order, then dirty rects copied from this frame.
+    * Sources without such metadata leave valid false.
+    */
+    struct FrameRectMetadata {
+        bool valid = false; // Capture source reported the rects below
+        std::vector<FrameMoveRect> moveRects; // Blocks moved since the previous frame. Capacity is kept
+        std::vector<FrameRect> dirtyRects; // Areas redrawn since the previous frame. Capacity is kept
+    };
+
+    /*
+    * Mouse cursor state at the time a frame was grabbed. Sources that do not track the cursor leave valid false.
+    */
+    struct FrameCursor {
+        bool valid = false; // Capture source reported the members below
+        bool visible = false; // Cursor is shown
+        int x = 0; // Position in frame coordinates
+        int y = 0;
+    };
+
+    /*
+    * Datastructure to hold a single captured frame. Pixel memory is owned by the FramePool that handed it out.
+    */
+    struct FrameBuffer {
+        uint8_t* data = nullptr; // First pixel of top row. Aligned to a cache line
+        int width = 0; // Width in pixels
+        int height = 0; // Height in pixels
+        int stride = 0; // Distance in bytes between two consecutive rows
+        std::size_t size = 0; // Total number of bytes available at data
+        FramePixelFormat pixelFormat = FramePixelFormat::BGR24; // Pixel layout of data
+        int64_t timestamp = 0; // Capture time in microseconds. Set by the capturing thread
+        int64_t sequence = 0; // Number of frames the capture source grabbed before this one
+        FrameRectMetadata rects; // Move and dirty rects since the previous grabbed frame. Set by the capture source
+        FrameCursor cursor; // Cursor state when the frame was grabbed. Set by the capture source
+        FrameChangeMap changes; // Changes since the previous frame. Set by the capturing thread
+    };
+
+    /*
+    * Source of the pixel memory of pooled frame buffers. Capture sources that need their frames in special memory,
+    * e.g. shared with a display server, provide one so that grabbing writes straight into pooled buffers.
+    */
+    class FrameMemoryAllocator {
+
+    public:
+        virtual ~FrameMemoryAllocator() = default;
+
+        /**
+         * Allocate pixel memory of a frame buffer
+         *
+         * @param size
+         *     Number of bytes needed
+         *
+         * @return  Memory aligned to at least a cache line, or nullptr if it cannot be allocated.
+         */
+        virtual uint8_t* allocate(std::size_t size) = 0;
+
+        /**
+         * Free memory obtained from allocate
+         */
+        virtual void deallocate(uint8_t* data) = 0;
+    };
+
+    /*
+    * Thread safe pool of equally sized frame buffers. Buffers are allocated once and recycled so that
+    * a recording in steady state does not hit the heap for pixel data.
+    */
+    class FramePool {
+
+    public:
+        /**
+         * FramePool constructor. Preallocates initialCount buffers.
+         *
+         * @param width
+         *     Width of every buffer in pixels.
+         *
+         * @param height
+         *     Height of every buffer in pixels.
+         *
+         * @param pixelFormat
+         *     Pixel layout that determines the bytes per pixel.
+         *
+         * @param strideAlignment
+         *     Row alignment in bytes. GDI requires DWORD aligned rows for DIBs, hence the default of 4.
+         *
+         * @param initialCount
+         *     Number of buffers to allocate upfront.
+         *
+         * @param maxCount
+         *     Upper limit of buffers this pool can ever own. Acquire fails once the limit is reached.
+         *
+         * @param allocator
+         *     Source of the pixel memory, called with the pool mutex held. Has to outlive the pool.
+         *     Pixel memory comes from the heap if nullptr.
+         */
+        FramePool(int width, int height, FramePixelFormat pixelFormat, int strideAlignment,
+                  std::size_t initialCount, std::size_t maxCount, FrameMemoryAllocator* allocator = nullptr);
+
+        ~FramePool();
+
+        /*
+        * @name Copy and move
+        *
+        * No copying and moving allowed. Handed out buffers refer back to this pool.
+        */
+        FramePool(const FramePool&) = delete;
+        FramePool& operator=(const FramePool&) = delete;
+
+        FramePool(FramePool&&) = delete;
+        FramePool& operator=(FramePool&&) = delete;
+
+        /**
+         * Get a buffer from the pool. A recycled buffer counts as a hit, anything else as a miss.
+         *
+         * @return  Frame buffer or nullptr if the pool is exhausted and cannot grow further.
+         */
+        FrameBuffer* acquire();
+
+        /**
+         * Return a buffer obtained from acquire back to the pool
+         *
+         * @param buffer
+         *     Buffer to be recycled. Ignored if nullptr. Debug builds also ignore and log buffers this pool does not
+         *     own or that were already released.
+         */
+        void release(FrameBuffer* buffer);
+
+        int64_t getHitCount() const {
+            return hitCount.load(std::memory_order_relaxed);
+        }
+
+        int64_t getMissCount() const {
+            return missCount.load(std::memory_order_relaxed);
+        }
+
+        std::size_t getBufferSize() const {
+            return bufferSize;
+        }
+
+    private:
+
+        /**
+         * Internal helper function to allocate a new cache line aligned buffer. Called with poolMutex held.
+         */
+        FrameBuffer* allocateBuffer();
+
+        int frameWidth = 0;
+        int frameHeight = 0;
+        int frameStride = 0;
+        std::size_t bufferSize = 0;
+        FramePixelFormat framePixelFormat = FramePixelFormat::BGR24;
+        std::size_t maxBufferCount = 0;
+        FrameMemoryAllocator* memoryAllocator = nullptr; // nullptr if pixel memory comes from the heap
+
+        std::mutex poolMutex; // Mutex to guard the lists below. Only held for a push or pop
+        std::vector<std::unique_ptr<FrameBuffer>> ownedBuffers; // Every buffer ever allocated by this pool
+        std::vector<FrameBuffer*> freeBuffers; // Buffers ready to be handed out. Capacity reserved upfront
+
+        std::atomic<int64_t> hitCount{ 0 }; // Number of acquires served by a recycled buffer
+        std::atomic<int64_t> missCount{ 0 }; // Number of acquires that had to allocate or failed
+    };
+}
@@ -0,0 +1,93 @@
+#include "FrameRateGovernor.hpp"
+
+namespace CapUtils {
+
+    FrameRateGovernor::FrameRateGovernor(int maxFramesPerSecond, std::chrono::milliseconds window, int raiseAfterWindows) :
+        windowDuration((window.count() > 0) ? window : std::chrono::milliseconds(1)),
+        headroomWindowsToRaise((raiseAfterWindows > 0) ? raiseAfterWindows : 1) {
+        const int maxRate = (maxFramesPerSecond > 0) ? maxFramesPerSecond : 1;
+        // Low configured rates have fewer distinct steps
+        rateSteps.push_back(maxRate);
+        for (int step : { maxRate * 2 / 3, maxRate / 2, maxRate / 3 }) {
+            if (step >= 1 && step < rateSteps.back()) {
+                rateSteps.push_back(step);
+            }
+        }
+    }
+
+    void FrameRateGovernor::start(std::chrono::steady_clock::time_point now) {
+        currentStep = 0;
+        headroomWindows = 0;
+        windowStartTime = now;
+        queueDepthSum = 0;
+        queueCapacitySum = 0;
+        windowStartDroppedFrames = 0;
+        previousStageTotals.clear();
+        pressure = FrameRatePressure();
+    }
+
+    void FrameRateGovernor::recordQueueDepth(std::size_t queuedFrames, std::size_t queueCapacity) {
+        queueDepthSum += queuedFrames;
+        queueCapacitySum += queueCapacity;
+    }
+
+    bool FrameRateGovernor::update(std::chrono::steady_clock::time_point now, int64_t droppedFrames,
+                                   const std::vector<GovernedStage>& stages) {
+        pressure = FrameRatePressure();
+        pressure.queueFill = (queueCapacitySum > 0) ? static_cast<double>(queueDepthSum) / static_cast<double>(queueCapacitySum) : 0.0;
+        pressure.droppedFrames = droppedFrames - windowStartDroppedFrames;
+
+        // Mean time per frame within the window, from the difference of the cumulative totals. The exact sums are
+        // subtracted, a total rebuilt from the truncated mean is off by up to the whole count in a long session
+        const double framePeriodInUs = 1000000.0 / getFramesPerSecond();
+        previousStageTotals.resize(stages.size());
+        for (std::size_t i = 0; i < stages.size(); ++i) {
+            StageTotals totals;
+            totals.count = stages[i].latency.count;
+            totals.totalInUs = stages[i].latency.totalInUs;
+
+            const StageTotals& previous = previousStageTotals[i];
+            if (totals.count > previous.count) {
+                const double timePerFrame = static_cast<double>(totals.totalInUs - previous.totalInUs) /
+                                            static_cast<double>(totals.count - previous.count);
+                const double load = timePerFrame / (stages[i].instances > 0 ? stages[i].instances : 1) / framePeriodInUs;
+                if (load > pressure.stageLoad) {
+                    pressure.stageLoad = load;
+                    pressure.busiestStage = stages[i].name;
+                }
+            }
+            previousStageTotals[i] = totals;
+        }
+
+        windowStartTime = now;
+        queueDepthSum = 0;
+        queueCapacitySum = 0;
+        windowStartDroppedFrames = droppedFrames;
+
+        const bool overloaded = pressure.droppedFrames > 0 || pressure.queueFill >= kGovernorOverloadQueueFill ||
+                                pressure.stageLoad >= kGovernorOverloadStageLoad;
+        if (overloaded) {
+            headroomWindows = 0;
+            if (currentStep + 1 < rateSteps.size()) {
+                ++currentStep;
+                return true;
+            }
+            return false;
+        }
+
+        if (currentStep == 0) {
+            return false;
+        }
+
+        // Busiest stage has to fit into the shorter period of the next higher rate with room to spare
+        const double loadAtHigherRate = pressure.stageLoad * rateSteps[currentStep - 1] / rateSteps[currentStep];
+        const bool headroom = pressure.queueFill < kGovernorHeadroomQueueFill && loadAtHigherRate < kGovernorHeadroomStageLoad;
+        headroomWindows = headroom ? headroomWindows + 1 : 0;
+        if (headroomWindows >= headroomWindowsToRaise) {
+            headroomWindows = 0;
+            --currentStep;
+            return true;
+        }
+        return false;
+    }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "LatencyHistogram.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace CapUtils {
+
+    constexpr double kGovernorOverloadStageLoad = 0.9; // Busiest stage needs this share of the frame period or more
+    constexpr double kGovernorOverloadQueueFill = 0.5; // Capture queue is this full on average or more
+    constexpr double kGovernorHeadroomStageLoad = 0.7; // Busiest stage would need less than this share at the next higher rate
+    constexpr double kGovernorHeadroomQueueFill = 0.25; // Capture queue is less full than this on average
+
+    /*
+    * Datastructure to hold the cumulative latency of a stage that limits the frame rate. Stages with several
+    * instances working on different frames at once keep up with that many times the rate.
+    */
+    struct GovernedStage {
+        const char* name = "";
+        LatencySummary latency;
+        int instances = 1;
+    };
+
+    /*
+    * Datastructure to hold the pressure on the pipeline seen over the last window of a FrameRateGovernor
+    */
+    struct FrameRatePressure {
+        double queueFill = 0.0; // Mean share of the capture queue that was filled when grabbing, 0 - 1
+        int64_t droppedFrames = 0; // Frames dropped within the window
+        double stageLoad = 0.0; // Time the busiest stage spent per frame as a share of the frame period
+        std::string busiestStage; // Name of the busiest stage. Empty if no stage processed a frame
+    };
+
+    /*
+    * Governor lowering the capture rate while the pipeline cannot keep up and raising it again once it can.
+    * Rates are steps of the configured rate: all of it, two thirds, a half and a third, i.e. 30, 20, 15 and 10 fps.
+    * Pressure is judged once per window from the fill of the capture queue, the frames dropped and the time the
+    * busiest stage spends per frame. An overloaded window drops one step right away. Raising takes several windows
+    * in a row with headroom at the next higher rate, and windows in between the two thresholds reset that count,
+    * so the rate does not flap around the capacity of the machine.
+    * Frame timestamps come from the capture time, so a rate change only spaces frames differently.
+    * Used by the screen recording thread only.
+    */
+    class FrameRateGovernor {
+
+    public:
+        /**
+         * FrameRateGovernor constructor
+         *
+         * @param maxFramesPerSecond
+         *     Configured frame rate, which is the first and highest step
+         *
+         * @param window
+         *     Time over which pressure is judged before each decision
+         *
+         * @param raiseAfterWindows
+         *     Windows with headroom in a row needed to go up one step. Values below 1 are raised to 1
+         */
+        FrameRateGovernor(int maxFramesPerSecond, std::chrono::milliseconds window, int raiseAfterWindows);
+
+        /**
+         * Start the first window at the highest rate
+         */
+        void start(std::chrono::steady_clock::time_point now);
+
+        /**
+         * Record the capture queue depth a grab saw
+         */
+        void recordQueueDepth(std::size_t queuedFrames, std::size_t queueCapacity);
+
+        /**
+         * True once the current window is over and update is due
+         */
+        bool isUpdateDue(std::chrono::steady_clock::time_point now) const {
+            return now - windowStartTime >= windowDuration;
+        }
+
+        /**
+         * Judge the window that just ended and start the next one
+         *
+         * @param droppedFrames
+         *     Frames dropped since recording started
+         *
+         * @param stages
+         *     Cumulative latencies of the stages that limit the rate, in the same order on every call
+         *
+         * @return  True if the rate changed.
+         */
+        bool update(std::chrono::steady_clock::time_point now, int64_t droppedFrames, const std::vector<GovernedStage>& stages);
+
+        int getFramesPerSecond() const {
+            return rateSteps[currentStep];
+        }
+
+        int getMaxFramesPerSecond() const {
+            return rateSteps.front();
+        }
+
+        /**
+         * Get the pressure the last update decided on
+         */
+        const FrameRatePressure& getPressure() const {
+            return pressure;
+        }
+
+    private:
+
+        /*
+        * Cumulative stage latency seen by the previous update, so each window only looks at its own frames
+        */
+        struct StageTotals {
+            uint64_t count = 0;
+            int64_t totalInUs = 0;
+        };
+
+        std::vector<int> rateSteps; // Frame rates from the highest down, without duplicates
+        std::size_t currentStep = 0;
+        std::chrono::milliseconds windowDuration;
+        int headroomWindowsToRaise = 5;
+        int headroomWindows = 0; // Windows with headroom in a row
+
+        std::chrono::steady_clock::time_point windowStartTime;
+        std::size_t queueDepthSum = 0; // Queued frames summed over the grabs of the window
+        std::size_t queueCapacitySum = 0; // Queue capacity summed over the grabs of the window
+        int64_t windowStartDroppedFrames = 0;
+        std::vector<StageTotals> previousStageTotals;
+        FrameRatePressure pressure;
+    };
+}
@@ -0,0 +1,246 @@
+#include "FrameScaler.hpp"
+#include "ColorConvertKernels.hpp"
+#include "WorkerPool.hpp"
+
+namespace CapUtils {
+
+    namespace {
+
+        constexpr int kScratchBytesPerPixel = 4; // Resampled rows are kept as BGRA so the fastest row kernels apply
+        constexpr int kMaxSourceBytesPerPixel = 4;
+        // Span reciprocals are 24 bit fixed point. Truncating them loses less than a step even for a 4K frame averaged
+        // into a single pixel, and the sum of a span times both reciprocals still fits into 64 bits
+        constexpr int kAreaReciprocalBits = 24;
+        constexpr uint64_t kAreaReciprocalOne = static_cast<uint64_t>(1) << kAreaReciprocalBits;
+        constexpr uint64_t kAreaRoundingBias = static_cast<uint64_t>(1) << (2 * kAreaReciprocalBits - 1);
+
+        /*
+        * Compute bilinear taps for every destination position. Pixel centers of source and destination are aligned,
+        * positions are kept in 16.16 fixed point and the weight is rounded down to 8 bits.
+        */
+        void computeBilinearTaps(int srcSize, int dstSize, std::vector<int>& start, std::vector<int>& end,
+                                 std::vector<int>& weight) {
+            start.resize(dstSize);
+            end.resize(dstSize);
+            weight.resize(dstSize);
+            for (int d = 0; d < dstSize; ++d) {
+                // (d + 0.5) * srcSize / dstSize - 0.5
+                int64_t position = ((2 * static_cast<int64_t>(d) + 1) * srcSize - dstSize) * 65536 / (2 * static_cast<int64_t>(dstSize));
+                position = (position < 0) ? 0 : position;
+                int tap = static_cast<int>(position >> 16);
+                int tapWeight = static_cast<int>((position >> 8) & 0xFF);
+                if (tap >= srcSize - 1) {
+                    tap = srcSize - 1;
+                    tapWeight = 0;
+                }
+                start[d] = tap;
+                end[d] = (tap + 1 < srcSize) ? tap + 1 : tap;
+                weight[d] = tapWeight;
+            }
+        }
+
+        /*
+        * Compute the source span covered by every destination position. Spans never overlap, so each source pixel
+        * contributes to exactly one destination pixel. When upscaling, spans are a single pixel wide.
+        */
+        void computeAreaSpans(int srcSize, int dstSize, std::vector<int>& start, std::vector<int>& end,
+                              std::vector<int>& reciprocal) {
+            start.resize(dstSize);
+            end.resize(dstSize);
+            reciprocal.resize(dstSize);
+            for (int d = 0; d < dstSize; ++d) {
+                const int spanStart = static_cast<int>(static_cast<int64_t>(d) * srcSize / dstSize);
+                const int spanEnd = static_cast<int>((static_cast<int64_t>(d) + 1) * srcSize / dstSize);
+                start[d] = spanStart;
+                end[d] = (spanEnd > spanStart) ? spanEnd : spanStart + 1;
+                reciprocal[d] = static_cast<int>(kAreaReciprocalOne / static_cast<uint64_t>(end[d] - spanStart));
+            }
+        }
+    }
+
+    bool parseScaleFilter(const std::string& filterName, ScaleFilter& filter) {
+        if (filterName == "bilinear") {
+            filter = ScaleFilter::BILINEAR;
+        }
+        else if (filterName == "area") {
+            filter = ScaleFilter::AREA;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    std::string getScaleFilterString(ScaleFilter filter) {
+        std::string result = "";
+        switch (filter) {
+        case ScaleFilter::BILINEAR:
+            result = "BILINEAR";
+            break;
+        case ScaleFilter::AREA:
+            result = "AREA";
+            break;
+        default:
+            break;
+        }
+        return result;
+    }
+
+    FrameScaler::FrameScaler(const FrameRegion& sourceRegion, int dstWidth, int dstHeight, ScaleFilter filter,
+                             int maxBandCount) :
+        region(sourceRegion),
+        width(dstWidth),
+        height(dstHeight),
+        scaleFilter(filter) {
+
+        if (scaleFilter == ScaleFilter::BILINEAR) {
+            computeBilinearTaps(region.width, width, columnStart, columnEnd, columnWeight);
+            computeBilinearTaps(region.height, height, rowStart, rowEnd, rowWeight);
+        }
+        else {
+            computeAreaSpans(region.width, width, columnStart, columnEnd, columnWeight);
+            computeAreaSpans(region.height, height, rowStart, rowEnd, rowWeight);
+        }
+
+        bandScratch.resize((maxBandCount > 1) ? maxBandCount : 1);
+        for (auto& scratch : bandScratch) {
+            scratch.rows.resize(2 * static_cast<std::size_t>(width) * kScratchBytesPerPixel);
+            scratch.verticalPass.resize(static_cast<std::size_t>(region.width) * kMaxSourceBytesPerPixel);
+        }
+    }
+
+    bool FrameScaler::convertToI420(const FrameBuffer& frame, uint8_t* const dst[3], const int dstStride[3],
+                                    WorkerPool& workerPool) {
+        return convertInBands(frame, false, dst[0], dstStride[0], dst[1], dstStride[1], dst[2], dstStride[2], workerPool);
+    }
+
+    bool FrameScaler::convertToNV12(const FrameBuffer& frame, uint8_t* const dst[2], const int dstStride[2],
+                                    WorkerPool& workerPool) {
+        return convertInBands(frame, true, dst[0], dstStride[0], dst[1], dstStride[1], nullptr, 0, workerPool);
+    }
+
+    bool FrameScaler::convertInBands(const FrameBuffer& frame, bool interleavedChroma, uint8_t* dstY, int strideY,
+                                     uint8_t* dstU, int strideU, uint8_t* dstV, int strideV, WorkerPool& workerPool) {
+        if (region.x < 0 || region.y < 0 || region.width <= 0 || region.height <= 0 || width <= 0 || height <= 0 ||
+            region.x + region.width > frame.width || region.y + region.height > frame.height) {
+            return false;
+        }
+
+        const ColorConvertKernelTable& kernels = getSupportedColorConvertKernels();
+        const ColorConvertRowsFn convertRows = interleavedChroma ? kernels.bgraToNV12 : kernels.bgraToI420;
+
+        const int chromaRows = (height + 1) / 2;
+        int bandCount = static_cast<int>(bandScratch.size());
+        bandCount = (workerPool.getThreadCount() < bandCount) ? workerPool.getThreadCount() : bandCount;
+        bandCount = (chromaRows < bandCount) ? chromaRows : bandCount;
+
+        workerPool.run(bandCount, [&](int band) {
+            BandScratch& scratch = bandScratch[band];
+            uint8_t* scratchRow0 = scratch.rows.data();
+            uint8_t* scratchRow1 = scratchRow0 + static_cast<std::size_t>(width) * kScratchBytesPerPixel;
+            uint32_t* verticalPass = scratch.verticalPass.data();
+
+            const int chromaBegin = band * chromaRows / bandCount;
+            const int chromaEnd = (band + 1) * chromaRows / bandCount;
+            for (int chromaRow = chromaBegin; chromaRow < chromaEnd; ++chromaRow) {
+                const int y0 = 2 * chromaRow;
+                // Replicate last row for odd heights
+                const int y1 = (y0 + 1 < height) ? y0 + 1 : y0;
+
+                resampleRow(frame, y0, scratchRow0, verticalPass);
+                if (y1 != y0) {
+                    resampleRow(frame, y1, scratchRow1, verticalPass);
+                }
+
+                convertRows(scratchRow0, (y1 != y0) ? scratchRow1 : scratchRow0, width,
+                            dstY + static_cast<std::size_t>(y0) * strideY, dstY + static_cast<std::size_t>(y1) * strideY,
+                            dstU + static_cast<std::size_t>(chromaRow) * strideU,
+                            dstV ? dstV + static_cast<std::size_t>(chromaRow) * strideV : nullptr);
+            }
+        });
+
+        return true;
+    }
+
+    void FrameScaler::resampleRow(const FrameBuffer& frame, int dstRow, uint8_t* dstRowPixels, uint32_t* verticalPass) const {
+        const bool isBGRA = (frame.pixelFormat == FramePixelFormat::BGRA);
+        if (scaleFilter == ScaleFilter::BILINEAR) {
+            isBGRA ? resampleRowBilinear<4>(frame, dstRow, dstRowPixels, verticalPass) :
+                     resampleRowBilinear<3>(frame, dstRow, dstRowPixels, verticalPass);
+        }
+        else {
+            isBGRA ? resampleRowArea<4>(frame, dstRow, dstRowPixels, verticalPass) :
+                     resampleRowArea<3>(frame, dstRow, dstRowPixels, verticalPass);
+        }
+    }
+
+    template<int kBytesPerPixel>
+    void FrameScaler::resampleRowBilinear(const FrameBuffer& frame, int dstRow, uint8_t* dstRowPixels,
+                                          uint32_t* verticalPass) const {
+        const uint8_t* regionOrigin = frame.data + static_cast<std::size_t>(region.y) * frame.stride +
+                                      static_cast<std::size_t>(region.x) * kBytesPerPixel;
+        const uint8_t* srcRow0 = regionOrigin + static_cast<std::size_t>(rowStart[dstRow]) * frame.stride;
+        const uint8_t* srcRow1 = regionOrigin + static_cast<std::size_t>(rowEnd[dstRow]) * frame.stride;
+        const uint32_t fy = static_cast<uint32_t>(rowWeight[dstRow]);
+
+        // Blend the two source rows first. Flat loop over all channels, so the compiler can vectorize it
+        const int rowBytes = region.width * kBytesPerPixel;
+        for (int i = 0; i < rowBytes; ++i) {
+            verticalPass[i] = srcRow0[i] * (256 - fy) + srcRow1[i] * fy;
+        }
+
+        for (int x = 0; x < width; ++x) {
+            const uint32_t* p0 = verticalPass + columnStart[x] * kBytesPerPixel;
+            const uint32_t* p1 = verticalPass + columnEnd[x] * kBytesPerPixel;
+            const uint32_t fx = static_cast<uint32_t>(columnWeight[x]);
+
+            uint8_t* out = dstRowPixels + x * kScratchBytesPerPixel;
+            out[0] = static_cast<uint8_t>((p0[0] * (256 - fx) + p1[0] * fx + 32768) >> 16);
+            out[1] = static_cast<uint8_t>((p0[1] * (256 - fx) + p1[1] * fx + 32768) >> 16);
+            out[2] = static_cast<uint8_t>((p0[2] * (256 - fx) + p1[2] * fx + 32768) >> 16);
+            out[3] = 0xFF;
+        }
+    }
+
+    template<int kBytesPerPixel>
+    void FrameScaler::resampleRowArea(const FrameBuffer& frame, int dstRow, uint8_t* dstRowPixels,
+                                      uint32_t* verticalPass) const {
+        const uint8_t* regionOrigin = frame.data + static_cast<std::size_t>(region.y) * frame.stride +
+                                      static_cast<std::size_t>(region.x) * kBytesPerPixel;
+        const int spanStart = rowStart[dstRow];
+        const int spanEnd = rowEnd[dstRow];
+
+        // Sum the covered source rows, reading every source pixel once. Alpha is summed along but never used
+        const int rowBytes = region.width * kBytesPerPixel;
+        const uint8_t* srcRow = regionOrigin + static_cast<std::size_t>(spanStart) * frame.stride;
+        for (int i = 0; i < rowBytes; ++i) {
+            verticalPass[i] = srcRow[i];
+        }
+        for (int sy = spanStart + 1; sy < spanEnd; ++sy) {
+            srcRow = regionOrigin + static_cast<std::size_t>(sy) * frame.stride;
+            for (int i = 0; i < rowBytes; ++i) {
+                verticalPass[i] += srcRow[i];
+            }
+        }
+
+        // Reciprocals of row and column spans in fixed point replace a division per channel
+        const uint64_t rowReciprocal = kAreaReciprocalOne / static_cast<uint64_t>(spanEnd - spanStart);
+        for (int x = 0; x < width; ++x) {
+            uint32_t b = 0;
+            uint32_t g = 0;
+            uint32_t r = 0;
+            for (int sx = columnStart[x]; sx < columnEnd[x]; ++sx) {
+                b += verticalPass[sx * kBytesPerPixel];
+                g += verticalPass[sx * kBytesPerPixel + 1];
+                r += verticalPass[sx * kBytesPerPixel + 2];
+            }
+
+            const uint64_t scale = rowReciprocal * static_cast<uint64_t>(columnWeight[x]);
+            uint8_t* out = dstRowPixels + x * kScratchBytesPerPixel;
+            out[0] = static_cast<uint8_t>((b * scale + kAreaRoundingBias) >> (2 * kAreaReciprocalBits));
+            out[1] = static_cast<uint8_t>((g * scale + kAreaRoundingBias) >> (2 * kAreaReciprocalBits));
+            out[2] = static_cast<uint8_t>((r * scale + kAreaRoundingBias) >> (2 * kAreaReciprocalBits));
+            out[3] = 0xFF;
+        }
+    }
+}
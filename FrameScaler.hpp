@@ -0,0 +1,165 @@
+#pragma once
+
+#include "FramePool.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace CapUtils {
+
+    class WorkerPool;
+
+    /*
+    * Resampling filter used by FrameScaler
+    */
+    enum class ScaleFilter {
+        BILINEAR = 0, // Interpolates between the four nearest source pixels. Sharp, but aliases when shrinking by more than 2x
+        AREA = 1      // Averages every source pixel covered by a destination pixel. Best suited for downscaling
+    };
+
+    /**
+     * Helper function to parse scale filter from its config file name
+     *
+     * @param filterName
+     *     One of "bilinear" or "area"
+     *
+     * @param filter
+     *     Receives the parsed filter
+     *
+     * @return  True if filterName is a known filter.
+     */
+    bool parseScaleFilter(const std::string& filterName, ScaleFilter& filter);
+
+    /**
+     * Helper function to get scale filter in string format to be used for logging purposes
+     */
+    std::string getScaleFilterString(ScaleFilter filter);
+
+    /*
+    * Rectangle of a source frame in pixels
+    */
+    struct FrameRegion {
+        int x = 0;
+        int y = 0;
+        int width = 0;
+        int height = 0;
+    };
+
+    /*
+    * Fused crop, resample and color conversion of a region of a BGRA or BGR24 frame into YUV 4:2:0.
+    * Destination rows are produced two at a time. Each row pair is resampled into a small BGRA scratch buffer that
+    * stays in cache and handed to the color conversion row kernels, so source pixels are read once and YUV planes are
+    * written once without a full size intermediate frame.
+    * Sampling positions are computed once at construction, hence one scaler serves a fixed geometry.
+    */
+    class FrameScaler {
+
+    public:
+        /**
+         * FrameScaler constructor
+         *
+         * @param sourceRegion
+         *     Region of every source frame to be scaled.
+         *
+         * @param dstWidth
+         *     Width of the destination planes in pixels.
+         *
+         * @param dstHeight
+         *     Height of the destination planes in pixels.
+         *
+         * @param filter
+         *     Resampling filter.
+         *
+         * @param maxBandCount
+         *     Largest number of bands a frame is split into, normally the thread count of the worker pool.
+         *     Scratch rows are allocated upfront for every band.
+         */
+        FrameScaler(const FrameRegion& sourceRegion, int dstWidth, int dstHeight, ScaleFilter filter, int maxBandCount);
+
+        /*
+        * @name Copy and move
+        *
+        * No copying allowed. Scratch rows are reused for every frame.
+        */
+        FrameScaler(const FrameScaler&) = delete;
+        FrameScaler& operator=(const FrameScaler&) = delete;
+
+        /**
+         * Scale source region of frame into planar YUV 4:2:0 (I420), one horizontal band per worker
+         *
+         * @param frame
+         *     Source frame holding the configured region
+         *
+         * @param dst
+         *     Y, U and V plane pointers, e.g. AVFrame::data
+         *
+         * @param dstStride
+         *     Y, U and V plane strides in bytes, e.g. AVFrame::linesize
+         *
+         * @param workerPool
+         *     Threads sharing the work
+         *
+         * @return  False if the configured region does not fit into frame. Destination is left untouched.
+         */
+        bool convertToI420(const FrameBuffer& frame, uint8_t* const dst[3], const int dstStride[3], WorkerPool& workerPool);
+
+        /**
+         * Scale source region of frame into semi-planar YUV 4:2:0 (NV12). Same as convertToI420 otherwise.
+         */
+        bool convertToNV12(const FrameBuffer& frame, uint8_t* const dst[2], const int dstStride[2], WorkerPool& workerPool);
+
+        const FrameRegion& getSourceRegion() const {
+            return region;
+        }
+
+        ScaleFilter getFilter() const {
+            return scaleFilter;
+        }
+
+    private:
+
+        /*
+        * Per band scratch memory
+        */
+        struct BandScratch {
+            std::vector<uint8_t> rows; // Two resampled BGRA destination rows
+            std::vector<uint32_t> verticalPass; // Source row after filtering vertically, one value per source byte
+        };
+
+        /**
+         * Internal helper function to validate frame against the configured region, split the destination into bands
+         * and run the NV12 or I420 row kernel over every band
+         */
+        bool convertInBands(const FrameBuffer& frame, bool interleavedChroma, uint8_t* dstY, int strideY,
+                            uint8_t* dstU, int strideU, uint8_t* dstV, int strideV, WorkerPool& workerPool);
+
+        /**
+         * Internal helper functions to resample destination row dstRow of the region into BGRA pixels at dstRowPixels
+         */
+        template<int kBytesPerPixel>
+        void resampleRowBilinear(const FrameBuffer& frame, int dstRow, uint8_t* dstRowPixels, uint32_t* verticalPass) const;
+
+        template<int kBytesPerPixel>
+        void resampleRowArea(const FrameBuffer& frame, int dstRow, uint8_t* dstRowPixels, uint32_t* verticalPass) const;
+
+        void resampleRow(const FrameBuffer& frame, int dstRow, uint8_t* dstRowPixels, uint32_t* verticalPass) const;
+
+        FrameRegion region;
+        int width = 0; // Destination width
+        int height = 0; // Destination height
+        ScaleFilter scaleFilter = ScaleFilter::AREA;
+
+        // Sampling positions relative to the region. For BILINEAR, start and end are the two taps and weight is the
+        // 8 bit weight of the end tap. For AREA, [start, end) bounds the covered source pixels and weight is the
+        // reciprocal of the span length in 24 bit fixed point.
+        std::vector<int> columnStart;
+        std::vector<int> columnEnd;
+        std::vector<int> columnWeight;
+        std::vector<int> rowStart;
+        std::vector<int> rowEnd;
+        std::vector<int> rowWeight;
+
+        std::vector<BandScratch> bandScratch;
+    };
+}
@@ -0,0 +1,53 @@
+#include "FrameTiming.hpp"
+
+namespace CapUtils {
+
+    StaticFrameFilter::StaticFrameFilter(int64_t maxStaticFrameInterval) :
+        maxInterval(maxStaticFrameInterval) {
+    }
+
+    bool StaticFrameFilter::skip(FrameBuffer* frame, FrameBuffer*& superseded) {
+        // A skipped frame shows the same picture as the last encoded one, so the newest of them supersedes the rest
+        superseded = heldFrame;
+        heldFrame = nullptr;
+
+        const bool skipFrame = maxInterval > 0 && frame->changes.detected && frame->changes.unchanged &&
+                               frame->timestamp - lastEncodedTimestamp < maxInterval;
+        if (!skipFrame) {
+            lastEncodedTimestamp = frame->timestamp;
+            return false;
+        }
+
+        heldFrame = frame;
+        return true;
+    }
+
+    FrameBuffer* StaticFrameFilter::takeHeldFrame() {
+        FrameBuffer* frame = heldFrame;
+        heldFrame = nullptr;
+        return frame;
+    }
+
+    void PresentationClock::reset(int numerator, int denominator) {
+        ticksPerUnit = (denominator > 0) ? denominator : 1;
+        microsecondsPerUnit = static_cast<int64_t>((numerator > 0) ? numerator : 1) * 1000000;
+        lastPresentationTimestamp = 0;
+        stamped = false;
+    }
+
+    int64_t PresentationClock::stamp(int64_t timestamp) {
+        // Rounded to nearest like av_rescale_q. Whole units first, so wall clock timestamps times a fine time base
+        // cannot overflow
+        const int64_t units = timestamp / microsecondsPerUnit;
+        const int64_t remainder = timestamp % microsecondsPerUnit;
+        int64_t presentationTimestamp = units * ticksPerUnit +
+                                        (remainder * ticksPerUnit + microsecondsPerUnit / 2) / microsecondsPerUnit;
+
+        if (stamped && presentationTimestamp <= lastPresentationTimestamp) {
+            presentationTimestamp = lastPresentationTimestamp + 1;
+        }
+        lastPresentationTimestamp = presentationTimestamp;
+        stamped = true;
+        return presentationTimestamp;
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "FramePool.hpp"
+
+#include <cstdint>
+
+namespace CapUtils {
+
+    /*
+    * Decides which grabbed frames of a static screen are encoded. A frame whose change detection found no change
+    * is skipped unless maxStaticFrameInterval passed since the last encoded frame, so a static screen still gets a
+    * frame at least that often. The newest skipped frame is held back, so the recording can be closed with it and
+    * its final picture lasts until recording stopped.
+    */
+    class StaticFrameFilter {
+
+    public:
+        /**
+         * StaticFrameFilter constructor
+         *
+         * @param maxStaticFrameInterval
+         *     Longest gap in microseconds between two encoded frames of a static screen. Zero encodes every frame.
+         */
+        explicit StaticFrameFilter(int64_t maxStaticFrameInterval);
+
+        /**
+         * Decide whether a grabbed frame is skipped
+         *
+         * @param frame
+         *     Frame in capture order, with its change map filled in
+         *
+         * @param superseded
+         *     Receives the frame held back so far if this call no longer needs it, else nullptr. The caller returns it
+         *     to its pool.
+         *
+         * @return  True if frame is skipped and now held back.
+         */
+        bool skip(FrameBuffer* frame, FrameBuffer*& superseded);
+
+        /**
+         * Take the frame held back after the last call to skip, e.g. to close the recording with it
+         *
+         * @return  Held frame or nullptr if the last frame offered was not skipped.
+         */
+        FrameBuffer* takeHeldFrame();
+
+        bool hasHeldFrame() const {
+            return heldFrame != nullptr;
+        }
+
+    private:
+        int64_t maxInterval = 0; // Longest gap in microseconds between two encoded frames of a static screen
+        int64_t lastEncodedTimestamp = 0; // Capture time of the last frame that was not skipped
+        FrameBuffer* heldFrame = nullptr; // Last skipped frame
+    };
+
+    /*
+    * Turns capture timestamps in microseconds into presentation timestamps of an encoder time base. Timestamps are
+    * rounded to the nearest tick, and frames grabbed within the same tick still get strictly increasing ones.
+    */
+    class PresentationClock {
+
+    public:
+        /**
+         * Set the encoder time base and start over
+         *
+         * @param numerator
+         *     Numerator of the time base in seconds, e.g. 1 of 1/30
+         *
+         * @param denominator
+         *     Denominator of the time base in seconds, e.g. 30 of 1/30
+         */
+        void reset(int numerator, int denominator);
+
+        /**
+         * Get the presentation timestamp of the next frame
+         *
+         * @param timestamp
+         *     Capture time of the frame in microseconds. Not negative.
+         *
+         * @return  Timestamp in the time base, greater than the one returned before.
+         */
+        int64_t stamp(int64_t timestamp);
+
+    private:
+        int64_t ticksPerUnit = 1; // Time base denominator
+        int64_t microsecondsPerUnit = 1000000; // Time base numerator times a million
+        int64_t lastPresentationTimestamp = 0;
+        bool stamped = false; // A timestamp was returned since the last reset
+    };
+}
@@ -0,0 +1,80 @@
+#include "GdiCaptureSource.hpp"
+
+extern "C"
+{
+    extern int64_t av_gettime(void);
+}
+
+namespace CapUtils {
+
+    GdiCaptureSource::GdiCaptureSource(int regionX, int regionY, int regionWidth, int regionHeight,
+                                       int grabWidth, int grabHeight) :
+        srcx(regionX),
+        srcy(regionY),
+        srcwidth(regionWidth),
+        srcheight(regionHeight),
+        grabwidth(grabWidth),
+        grabheight(grabHeight) {
+        // Initialize handles for device contexts used for screen capture
+        screenGDIInfoForCapture.hwndDesktop = GetDesktopWindow();
+        screenGDIInfoForCapture.hwindowDC = GetDC(screenGDIInfoForCapture.hwndDesktop);
+        screenGDIInfoForCapture.hwindowCompatibleDC = CreateCompatibleDC(screenGDIInfoForCapture.hwindowDC);
+        SetStretchBltMode(screenGDIInfoForCapture.hwindowCompatibleDC, COLORONCOLOR);
+        screenGDIInfoForCapture.bi.biSize = sizeof(BITMAPINFOHEADER);
+        screenGDIInfoForCapture.bi.biPlanes = 1;
+        screenGDIInfoForCapture.bi.biBitCount = 24;
+        screenGDIInfoForCapture.bi.biCompression = BI_RGB;
+        screenGDIInfoForCapture.bi.biSizeImage = 0;
+        screenGDIInfoForCapture.bi.biXPelsPerMeter = 0;
+        screenGDIInfoForCapture.bi.biYPelsPerMeter = 0;
+        screenGDIInfoForCapture.bi.biClrUsed = 0;
+        screenGDIInfoForCapture.bi.biClrImportant = 0;
+
+        // create a bitmap
+        screenGDIInfoForCapture.hbwindow = CreateCompatibleBitmap(screenGDIInfoForCapture.hwindowDC, grabwidth, grabheight);
+
+        screenGDIInfoForCapture.bi.biWidth = grabwidth;
+        screenGDIInfoForCapture.bi.biHeight = -grabheight;
+    }
+
+    GdiCaptureSource::~GdiCaptureSource() {
+        DeleteDC(screenGDIInfoForCapture.hwindowCompatibleDC);
+        ReleaseDC(screenGDIInfoForCapture.hwndDesktop, screenGDIInfoForCapture.hwindowDC);
+        DeleteObject(screenGDIInfoForCapture.hbwindow);
+    }
+
+    bool GdiCaptureSource::grabFrame(FrameBuffer& frame) {
+        //http://msdn.microsoft.com/en-us/library/windows/window/dd183402%28v=vs.85%29.aspx
+        // use the previously created device context with the bitmap
+        SelectObject(screenGDIInfoForCapture.hwindowCompatibleDC, screenGDIInfoForCapture.hbwindow);
+        // copy from the window device context to the bitmap device context
+        //change SRCCOPY to NOTSRCCOPY for wacky colors !
+
+        if (grabwidth != srcwidth || grabheight != srcheight) {
+            StretchBlt(screenGDIInfoForCapture.hwindowCompatibleDC, 0, 0, grabwidth, grabheight,
+                       screenGDIInfoForCapture.hwindowDC,
+                       srcx, srcy, srcwidth, srcheight, SRCCOPY);
+        }
+        else {
+            // Region is grabbed as is, scaling is left to the fused scale and color conversion
+            BitBlt(screenGDIInfoForCapture.hwindowCompatibleDC, 0, 0, grabwidth, grabheight,
+                   screenGDIInfoForCapture.hwindowDC, srcx, srcy, SRCCOPY);
+        }
+
+        //copy from hwindowCompatibleDC to hbwindow
+        const int copiedLines = GetDIBits(screenGDIInfoForCapture.hwindowCompatibleDC, screenGDIInfoForCapture.hbwindow, 0,
+                                          grabheight, frame.data,
+                                          (BITMAPINFO*)&screenGDIInfoForCapture.bi, DIB_RGB_COLORS);
+        frame.timestamp = av_gettime();
+
+        // Cursor is not part of the grabbed pixels, its position follows the scaling of the region
+        CURSORINFO cursorInfo = { sizeof(CURSORINFO) };
+        if (GetCursorInfo(&cursorInfo)) {
+            frame.cursor.valid = true;
+            frame.cursor.visible = (cursorInfo.flags & CURSOR_SHOWING) != 0;
+            frame.cursor.x = MulDiv(cursorInfo.ptScreenPos.x - srcx, grabwidth, srcwidth);
+            frame.cursor.y = MulDiv(cursorInfo.ptScreenPos.y - srcy, grabheight, srcheight);
+        }
+        return copiedLines != 0;
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "CaptureSource.hpp"
+
+#include <windows.h>
+
+namespace CapUtils {
+
+    /*
+    * Datastructure to hold handles and device context related to GDI for screen capture.
+    */
+    struct ScreenGDIInfoForCapture {
+        HWND hwndDesktop = nullptr;
+        HDC hwindowDC = nullptr;
+        HDC hwindowCompatibleDC = nullptr;
+        HBITMAP hbwindow = nullptr;
+        BITMAPINFOHEADER  bi;
+    };
+
+    /*
+    * Capture source grabbing a region of the desktop through GDI. Frames are 24 bit BGR with DWORD aligned rows,
+    * as written by GetDIBits. GDI reports no dirty or move rects, the cursor state is read along with every frame.
+    */
+    class GdiCaptureSource : public CaptureSource {
+
+    public:
+
+        /**
+         * GdiCaptureSource constructor. Acquires the desktop device context and a bitmap of the grab size
+         *
+         * @param regionX
+         *     Left edge of the desktop region to grab
+         *
+         * @param regionY
+         *     Top edge of the desktop region to grab
+         *
+         * @param regionWidth
+         *     Width of the desktop region to grab
+         *
+         * @param regionHeight
+         *     Height of the desktop region to grab
+         *
+         * @param grabWidth
+         *     Width of grabbed frames. GDI stretches the region if it differs from regionWidth
+         *
+         * @param grabHeight
+         *     Height of grabbed frames. GDI stretches the region if it differs from regionHeight
+         */
+        GdiCaptureSource(int regionX, int regionY, int regionWidth, int regionHeight, int grabWidth, int grabHeight);
+
+        ~GdiCaptureSource() override;
+
+        CaptureSourceType getType() const override {
+            return CaptureSourceType::GDI;
+        }
+
+        int getWidth() const override {
+            return grabwidth;
+        }
+
+        int getHeight() const override {
+            return grabheight;
+        }
+
+        FramePixelFormat getPixelFormat() const override {
+            return FramePixelFormat::BGR24;
+        }
+
+        int getRowAlignment() const override {
+            // GetDIBits writes 24 bit rows padded to a DWORD boundary
+            return sizeof(DWORD);
+        }
+
+    protected:
+
+        /**
+         * Grab desktop screen pixels into frame
+         */
+        bool grabFrame(FrameBuffer& frame) override;
+
+    private:
+        int srcx = 0; // Left edge of the grabbed desktop region
+        int srcy = 0; // Top edge of the grabbed desktop region
+        int srcwidth = 0; // Width of the grabbed desktop region
+        int srcheight = 0; // Height of the grabbed desktop region
+        int grabwidth = 0; // Width of grabbed frames
+        int grabheight = 0; // Height of grabbed frames
+        ScreenGDIInfoForCapture screenGDIInfoForCapture; // Structure to hold GDI related handles and device contexts.
+    };
+}
@@ -0,0 +1,223 @@
+#include "IncrementalConvert.hpp"
+#include "ColorConvert.hpp"
+
+#include <cstring>
+
+namespace CapUtils {
+
+    namespace {
+
+        inline int alignDown(int value) {
+            return value & ~1;
+        }
+
+        inline int alignUp(int value) {
+            return (value + 1) & ~1;
+        }
+
+        inline bool isEmpty(const FrameRect& rect) {
+            return rect.left >= rect.right || rect.top >= rect.bottom;
+        }
+
+        inline bool intersects(const FrameRect& a, const FrameRect& b) {
+            return a.left < b.right && b.left < a.right && a.top < b.bottom && b.top < a.bottom;
+        }
+
+        inline int64_t getArea(const FrameRect& rect) {
+            return static_cast<int64_t>(rect.right - rect.left) * (rect.bottom - rect.top);
+        }
+
+        /*
+        * Move a block of rowBytes x rowCount bytes within a plane. Rows are walked away from the destination,
+        * so overlapping source and destination blocks are moved correctly.
+        */
+        void movePlaneBlock(uint8_t* plane, int stride, int srcOffset, int srcRow, int dstOffset, int dstRow,
+                            int rowBytes, int rowCount) {
+            if (dstRow > srcRow) {
+                for (int row = rowCount - 1; row >= 0; --row) {
+                    std::memmove(plane + static_cast<std::size_t>(dstRow + row) * stride + dstOffset,
+                                 plane + static_cast<std::size_t>(srcRow + row) * stride + srcOffset, rowBytes);
+                }
+            }
+            else {
+                for (int row = 0; row < rowCount; ++row) {
+                    std::memmove(plane + static_cast<std::size_t>(dstRow + row) * stride + dstOffset,
+                                 plane + static_cast<std::size_t>(srcRow + row) * stride + srcOffset, rowBytes);
+                }
+            }
+        }
+    }
+
+    bool IncrementalFrameConverter::updateNV12(const FrameBuffer& frame, const FrameMoveRect* moveRects, int moveCount,
+                                               const FrameRect* dirtyRects, int dirtyCount,
+                                               uint8_t* const dst[2], const int dstStride[2]) {
+        YuvPlanes planes;
+        planes.y = dst[0];
+        planes.u = dst[1];
+        planes.strideY = dstStride[0];
+        planes.strideU = dstStride[1];
+        return update(frame, moveRects, moveCount, dirtyRects, dirtyCount, planes);
+    }
+
+    bool IncrementalFrameConverter::updateI420(const FrameBuffer& frame, const FrameMoveRect* moveRects, int moveCount,
+                                               const FrameRect* dirtyRects, int dirtyCount,
+                                               uint8_t* const dst[3], const int dstStride[3]) {
+        YuvPlanes planes;
+        planes.y = dst[0];
+        planes.u = dst[1];
+        planes.v = dst[2];
+        planes.strideY = dstStride[0];
+        planes.strideU = dstStride[1];
+        planes.strideV = dstStride[2];
+        return update(frame, moveRects, moveCount, dirtyRects, dirtyCount, planes);
+    }
+
+    bool IncrementalFrameConverter::update(const FrameBuffer& frame, const FrameMoveRect* moveRects, int moveCount,
+                                           const FrameRect* dirtyRects, int dirtyCount, const YuvPlanes& planes) {
+        if (frame.width != width || frame.height != height) {
+            width = frame.width;
+            height = frame.height;
+            valid = false;
+        }
+
+        const FrameRect wholeFrame = { 0, 0, width, height };
+        if (!valid || dirtyRects == nullptr || (moveRects == nullptr && moveCount > 0)) {
+            convertRect(frame, wholeFrame, planes);
+            valid = true;
+            return false;
+        }
+
+        pendingRects.clear();
+        movedRects.clear();
+
+        // Moves refer to the previous picture, so they go first and dirty rects are converted on top of them
+        for (int i = 0; i < moveCount; ++i) {
+            applyMove(moveRects[i], planes);
+        }
+
+        for (int i = 0; i < dirtyCount; ++i) {
+            FrameRect rect = dirtyRects[i];
+            if (alignToChromaBlocks(rect)) {
+                pendingRects.push_back(rect);
+            }
+        }
+
+        // Once the changed area adds up to the whole frame, a single pass over it is cheaper than many small ones
+        int64_t pendingArea = 0;
+        for (const auto& rect : pendingRects) {
+            pendingArea += getArea(rect);
+        }
+        if (pendingArea >= getArea(wholeFrame)) {
+            convertRect(frame, wholeFrame, planes);
+            return false;
+        }
+
+        for (const auto& rect : pendingRects) {
+            convertRect(frame, rect, planes);
+        }
+        return true;
+    }
+
+    void IncrementalFrameConverter::applyMove(const FrameMoveRect& move, const YuvPlanes& planes) {
+        const int shiftX = move.destination.left - move.sourceX;
+        const int shiftY = move.destination.top - move.sourceY;
+
+        FrameRect clipped = move.destination;
+        clipped.left = (clipped.left < 0) ? 0 : clipped.left;
+        clipped.top = (clipped.top < 0) ? 0 : clipped.top;
+        clipped.right = (clipped.right > width) ? width : clipped.right;
+        clipped.bottom = (clipped.bottom > height) ? height : clipped.bottom;
+
+        FrameRect destination = clipped;
+        if (!alignToChromaBlocks(destination)) {
+            return;
+        }
+        movedRects.push_back(destination);
+
+        // Only whole chroma blocks can be moved, so both shifts must be even. The moved source must also hold pixels
+        // of the previous picture, not ones already replaced by an earlier move whose edges are still pending.
+        bool movable = ((shiftX | shiftY) & 1) == 0;
+        const FrameRect source = { clipped.left - shiftX, clipped.top - shiftY, clipped.right - shiftX, clipped.bottom - shiftY };
+        if (source.left < 0 || source.top < 0 || source.right > width || source.bottom > height) {
+            movable = false;
+        }
+        for (std::size_t i = 0; movable && i + 1 < movedRects.size(); ++i) {
+            movable = !intersects(source, movedRects[i]);
+        }
+
+        // Inner part of the destination that covers whole chroma blocks only
+        const FrameRect inner = { alignUp(clipped.left), alignUp(clipped.top), alignDown(clipped.right), alignDown(clipped.bottom) };
+        if (!movable || isEmpty(inner)) {
+            pendingRects.push_back(destination);
+            return;
+        }
+
+        const int innerWidth = inner.right - inner.left;
+        const int innerHeight = inner.bottom - inner.top;
+        movePlaneBlock(planes.y, planes.strideY, inner.left - shiftX, inner.top - shiftY, inner.left, inner.top,
+                       innerWidth, innerHeight);
+        if (planes.v == nullptr) {
+            // Interleaved UV samples take two bytes for every two pixels
+            movePlaneBlock(planes.u, planes.strideU, inner.left - shiftX, (inner.top - shiftY) / 2, inner.left,
+                           inner.top / 2, innerWidth, innerHeight / 2);
+        }
+        else {
+            movePlaneBlock(planes.u, planes.strideU, (inner.left - shiftX) / 2, (inner.top - shiftY) / 2,
+                           inner.left / 2, inner.top / 2, innerWidth / 2, innerHeight / 2);
+            movePlaneBlock(planes.v, planes.strideV, (inner.left - shiftX) / 2, (inner.top - shiftY) / 2,
+                           inner.left / 2, inner.top / 2, innerWidth / 2, innerHeight / 2);
+        }
+        movedPixelCount += getArea(inner);
+
+        // Chroma blocks along the edges mix moved and unchanged pixels, so convert them from the new frame
+        const FrameRect edges[4] = {
+            { destination.left, destination.top, destination.right, inner.top },
+            { destination.left, inner.bottom, destination.right, destination.bottom },
+            { destination.left, inner.top, inner.left, inner.bottom },
+            { inner.right, inner.top, destination.right, inner.bottom }
+        };
+        for (const auto& edge : edges) {
+            if (!isEmpty(edge)) {
+                pendingRects.push_back(edge);
+            }
+        }
+    }
+
+    void IncrementalFrameConverter::convertRect(const FrameBuffer& frame, const FrameRect& rect, const YuvPlanes& planes) {
+        const int bytesPerPixel = getBytesPerPixel(frame.pixelFormat);
+
+        FrameBuffer rectFrame;
+        rectFrame.data = frame.data + static_cast<std::size_t>(rect.top) * frame.stride +
+                         static_cast<std::size_t>(rect.left) * bytesPerPixel;
+        rectFrame.width = rect.right - rect.left;
+        rectFrame.height = rect.bottom - rect.top;
+        rectFrame.stride = frame.stride;
+        rectFrame.size = frame.size - (rectFrame.data - frame.data);
+        rectFrame.pixelFormat = frame.pixelFormat;
+        rectFrame.timestamp = frame.timestamp;
+
+        uint8_t* y = planes.y + static_cast<std::size_t>(rect.top) * planes.strideY + rect.left;
+        uint8_t* u = planes.u + static_cast<std::size_t>(rect.top / 2) * planes.strideU;
+        if (planes.v == nullptr) {
+            uint8_t* dst[2] = { y, u + rect.left };
+            const int dstStride[2] = { planes.strideY, planes.strideU };
+            convertFrameToNV12(rectFrame, dst, dstStride);
+        }
+        else {
+            uint8_t* v = planes.v + static_cast<std::size_t>(rect.top / 2) * planes.strideV;
+            uint8_t* dst[3] = { y, u + rect.left / 2, v + rect.left / 2 };
+            const int dstStride[3] = { planes.strideY, planes.strideU, planes.strideV };
+            convertFrameToI420(rectFrame, dst, dstStride);
+        }
+        convertedPixelCount += getArea(rect);
+    }
+
+    bool IncrementalFrameConverter::alignToChromaBlocks(FrameRect& rect) const {
+        // Odd sized pictures end with half a chroma block
+        rect.left = (rect.left < 0) ? 0 : alignDown(rect.left);
+        rect.top = (rect.top < 0) ? 0 : alignDown(rect.top);
+        rect.right = (alignUp(rect.right) > width) ? width : alignUp(rect.right);
+        rect.bottom = (alignUp(rect.bottom) > height) ? height : alignUp(rect.bottom);
+        return !isEmpty(rect);
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "FramePool.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace CapUtils {
+
+    /*
+    * Keeps a persistent YUV 4:2:0 picture up to date from frames that come with dirty and move rects.
+    * Moves are applied to the YUV planes as block moves, dirty rects are converted from the new frame and everything
+    * else is left untouched. Conversion cost therefore scales with the changed area instead of the frame size.
+    * Rects are widened to whole 2x2 chroma blocks, so the planes stay bit exact with a full conversion of the frame.
+    * The first update and every update after invalidate convert the whole frame.
+    */
+    class IncrementalFrameConverter {
+
+    public:
+        /**
+         * Bring persistent semi-planar NV12 planes up to date with frame.
+         * Planes must be the same between calls and must not be written by anyone else, otherwise call invalidate.
+         *
+         * @param frame
+         *     New BGRA or BGR24 frame. Width and height of the planes must match.
+         *     A frame of a different size than the previous one is converted as a whole.
+         *
+         * @param moveRects
+         *     Moves since the previous frame, applied in order before dirty rects. May be nullptr if moveCount is 0.
+         *
+         * @param moveCount
+         *     Number of entries in moveRects
+         *
+         * @param dirtyRects
+         *     Rects whose pixels changed since the previous frame. nullptr if the frame came without metadata,
+         *     in which case the whole frame is converted.
+         *
+         * @param dirtyCount
+         *     Number of entries in dirtyRects
+         *
+         * @param dst
+         *     Y and UV plane pointers
+         *
+         * @param dstStride
+         *     Y and UV plane strides in bytes
+         *
+         * @return  True if only the changed area was updated, false if the whole frame was converted.
+         */
+        bool updateNV12(const FrameBuffer& frame, const FrameMoveRect* moveRects, int moveCount,
+                        const FrameRect* dirtyRects, int dirtyCount, uint8_t* const dst[2], const int dstStride[2]);
+
+        /**
+         * Bring persistent planar I420 planes up to date with frame. Same as updateNV12 otherwise.
+         */
+        bool updateI420(const FrameBuffer& frame, const FrameMoveRect* moveRects, int moveCount,
+                        const FrameRect* dirtyRects, int dirtyCount, uint8_t* const dst[3], const int dstStride[3]);
+
+        /*
+        * Forget the persistent picture, so the next update converts the whole frame
+        */
+        void invalidate() {
+            valid = false;
+        }
+
+        int64_t getConvertedPixelCount() const {
+            return convertedPixelCount;
+        }
+
+        int64_t getMovedPixelCount() const {
+            return movedPixelCount;
+        }
+
+    private:
+
+        /*
+        * Destination planes of a single update. For NV12, u holds interleaved UV samples and v is nullptr.
+        */
+        struct YuvPlanes {
+            uint8_t* y = nullptr;
+            uint8_t* u = nullptr;
+            uint8_t* v = nullptr;
+            int strideY = 0;
+            int strideU = 0;
+            int strideV = 0;
+        };
+
+        /**
+         * Internal helper function shared by NV12 and I420 updates
+         */
+        bool update(const FrameBuffer& frame, const FrameMoveRect* moveRects, int moveCount,
+                    const FrameRect* dirtyRects, int dirtyCount, const YuvPlanes& planes);
+
+        /**
+         * Internal helper function to apply a single move to the planes. Edges of the destination that do not cover
+         * whole chroma blocks, and moves that cannot be applied to the planes at all, are queued as dirty instead.
+         */
+        void applyMove(const FrameMoveRect& move, const YuvPlanes& planes);
+
+        /**
+         * Internal helper function to convert a rect of frame into the planes. Rect must start on even coordinates.
+         */
+        void convertRect(const FrameBuffer& frame, const FrameRect& rect, const YuvPlanes& planes);
+
+        /**
+         * Internal helper function to clip rect to the picture and widen it to whole chroma blocks
+         *
+         * @return  False if nothing of rect is left after clipping.
+         */
+        bool alignToChromaBlocks(FrameRect& rect) const;
+
+        int width = 0; // Width of the persistent picture
+        int height = 0; // Height of the persistent picture
+        bool valid = false; // Persistent planes hold a complete picture
+
+        std::vector<FrameRect> pendingRects; // Rects to be converted once all moves are applied. Reused between updates
+        std::vector<FrameRect> movedRects; // Destinations of moves applied in the current update
+
+        int64_t convertedPixelCount = 0; // Pixels converted from frames since construction
+        int64_t movedPixelCount = 0; // Pixels moved within the planes since construction
+    };
+}
@@ -0,0 +1,112 @@
+#include "LatencyHistogram.hpp"
+
+namespace CapUtils {
+
+    namespace {
+
+        constexpr int kSubBucketHalfCount = 1 << (kLatencySubBucketBits - 1);
+        constexpr uint64_t kSubBucketMask = (uint64_t(1) << kLatencySubBucketBits) - 1;
+        constexpr uint64_t kMaxRecordableValue = (uint64_t(1) << kLatencyMaxValueBits) - 1;
+
+        /*
+        * Raise target to value unless it is higher already
+        */
+        void updateMax(std::atomic<int64_t>& target, int64_t value) {
+            int64_t current = target.load(std::memory_order_relaxed);
+            while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+            }
+        }
+    }
+
+    void LatencyHistogram::record(int64_t valueInUs) {
+        const uint64_t value = (valueInUs > 0) ? static_cast<uint64_t>(valueInUs) : 0;
+        counts[getBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        totalCount.fetch_add(1, std::memory_order_relaxed);
+        totalValue.fetch_add(value, std::memory_order_relaxed);
+        updateMax(maxValue, static_cast<int64_t>(value));
+    }
+
+    void LatencyHistogram::merge(const LatencyHistogram& other) {
+        for (int i = 0; i < kLatencyBucketCount; ++i) {
+            const uint64_t count = other.counts[i].load(std::memory_order_relaxed);
+            if (count != 0) {
+                counts[i].fetch_add(count, std::memory_order_relaxed);
+            }
+        }
+        totalCount.fetch_add(other.totalCount.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        totalValue.fetch_add(other.totalValue.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        updateMax(maxValue, other.maxValue.load(std::memory_order_relaxed));
+    }
+
+    void LatencyHistogram::drain(LatencyHistogram& other) {
+        for (int i = 0; i < kLatencyBucketCount; ++i) {
+            const uint64_t count = other.counts[i].exchange(0, std::memory_order_relaxed);
+            if (count != 0) {
+                counts[i].fetch_add(count, std::memory_order_relaxed);
+            }
+        }
+        totalCount.fetch_add(other.totalCount.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+        totalValue.fetch_add(other.totalValue.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+        updateMax(maxValue, other.maxValue.exchange(0, std::memory_order_relaxed));
+    }
+
+    LatencySummary LatencyHistogram::getSummary() const {
+        LatencySummary summary;
+
+        // Buckets are read one by one while values keep coming in, so the total is taken from the buckets themselves
+        std::array<uint64_t, kLatencyBucketCount> snapshot;
+        for (int i = 0; i < kLatencyBucketCount; ++i) {
+            snapshot[i] = counts[i].load(std::memory_order_relaxed);
+            summary.count += snapshot[i];
+        }
+        if (summary.count == 0) {
+            return summary;
+        }
+
+        const uint64_t valueCount = totalCount.load(std::memory_order_relaxed);
+        summary.totalInUs = static_cast<int64_t>(totalValue.load(std::memory_order_relaxed));
+        summary.meanInUs = (valueCount > 0) ? summary.totalInUs / static_cast<int64_t>(valueCount) : 0;
+        summary.maxInUs = maxValue.load(std::memory_order_relaxed);
+
+        // Percentile P is the smallest value that at least P percent of all values are equal to or below
+        const uint64_t p50Rank = (summary.count * 500 + 999) / 1000;
+        const uint64_t p99Rank = (summary.count * 990 + 999) / 1000;
+        const uint64_t p999Rank = (summary.count * 999 + 999) / 1000;
+        uint64_t seen = 0;
+        for (int i = 0; i < kLatencyBucketCount; ++i) {
+            if (snapshot[i] == 0) {
+                continue;
+            }
+            const uint64_t previouslySeen = seen;
+            seen += snapshot[i];
+            const int64_t value = (getBucketValue(i) < summary.maxInUs) ? getBucketValue(i) : summary.maxInUs;
+            summary.p50InUs = (previouslySeen < p50Rank && seen >= p50Rank) ? value : summary.p50InUs;
+            summary.p99InUs = (previouslySeen < p99Rank && seen >= p99Rank) ? value : summary.p99InUs;
+            summary.p999InUs = (previouslySeen < p999Rank && seen >= p999Rank) ? value : summary.p999InUs;
+        }
+        return summary;
+    }
+
+    int LatencyHistogram::getBucketIndex(uint64_t value) {
+        value = (value < kMaxRecordableValue) ? value : kMaxRecordableValue;
+        if (value <= kSubBucketMask) {
+            return static_cast<int>(value);
+        }
+
+        // Drop the low bits below the 7 leading ones. Every further power of two adds half a bucket range
+        int shift = 0;
+        while ((value >> shift) > kSubBucketMask) {
+            ++shift;
+        }
+        return shift * kSubBucketHalfCount + static_cast<int>(value >> shift);
+    }
+
+    int64_t LatencyHistogram::getBucketValue(int index) {
+        if (index <= static_cast<int>(kSubBucketMask)) {
+            return index;
+        }
+        const int shift = (index >> (kLatencySubBucketBits - 1)) - 1;
+        const uint64_t subBucket = static_cast<uint64_t>(index - shift * kSubBucketHalfCount);
+        return static_cast<int64_t>(((subBucket + 1) << shift) - 1);
+    }
+}
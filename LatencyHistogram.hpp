@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace CapUtils {
+
+    constexpr int kLatencySubBucketBits = 7; // Values keep their 7 leading bits, i.e. are recorded within 1.6%
+    constexpr int kLatencyMaxValueBits = 36; // Values of 2^36 us, about 19 hours, and above land in the last bucket
+    constexpr int kLatencyBucketCount = (kLatencyMaxValueBits - kLatencySubBucketBits + 2) << (kLatencySubBucketBits - 1);
+
+    /*
+    * Datastructure to hold the distribution of the values recorded into a LatencyHistogram. Percentiles are the
+    * highest value of the bucket they fall into, so they are never below the true percentile.
+    */
+    struct LatencySummary {
+        uint64_t count = 0;
+        int64_t totalInUs = 0; // Exact sum of the values, for differences between two summaries of a histogram
+        int64_t meanInUs = 0;
+        int64_t p50InUs = 0;
+        int64_t p99InUs = 0;
+        int64_t p999InUs = 0;
+        int64_t maxInUs = 0;
+    };
+
+    /*
+    * HdrHistogram style histogram of latencies in microseconds. Buckets are linear within each power of two, so the
+    * relative error stays below 1.6% from one microsecond to many hours at a fixed 16 KB.
+    * Recording is lock free and may happen from any thread. Each recording thread still gets a histogram of its own,
+    * so threads do not fight over cache lines, and readers merge them into a fresh histogram whenever they report.
+    */
+    class LatencyHistogram {
+
+    public:
+        LatencyHistogram() = default;
+
+        /*
+        * @name Copy and move
+        *
+        * No copying and moving allowed. Recording threads refer to a histogram for their whole lifetime.
+        */
+        LatencyHistogram(const LatencyHistogram&) = delete;
+        LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+        LatencyHistogram(LatencyHistogram&&) = delete;
+        LatencyHistogram& operator=(LatencyHistogram&&) = delete;
+
+        /**
+         * Record a value. Negative values are recorded as zero
+         */
+        void record(int64_t valueInUs);
+
+        /**
+         * Record the time passed since startTime
+         */
+        void recordSince(std::chrono::steady_clock::time_point startTime) {
+            record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count());
+        }
+
+        /**
+         * Add every value recorded into other so far. Values other records meanwhile may or may not be included.
+         */
+        void merge(const LatencyHistogram& other);
+
+        /**
+         * Move every value recorded into other so far into this histogram, leaving other empty. Values other records
+         * meanwhile are either moved or stay in other, none is lost or counted twice.
+         */
+        void drain(LatencyHistogram& other);
+
+        /**
+         * Get count, mean, p50, p99, p99.9 and maximum of the values recorded so far
+         */
+        LatencySummary getSummary() const;
+
+    private:
+
+        /**
+         * Internal helper function to get the index of the bucket a value falls into
+         */
+        static int getBucketIndex(uint64_t value);
+
+        /**
+         * Internal helper function to get the highest value that falls into a bucket
+         */
+        static int64_t getBucketValue(int index);
+
+        std::array<std::atomic<uint64_t>, kLatencyBucketCount> counts{};
+        std::atomic<uint64_t> totalCount{ 0 };
+        std::atomic<uint64_t> totalValue{ 0 }; // Sum of all values, for the mean
+        std::atomic<int64_t> maxValue{ 0 };
+    };
+}
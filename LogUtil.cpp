@@ -2,14 +2,20 @@
 #include "LogUtil.hpp"
 #include "Version.h"
 
-#include <windows.h>
-#include <psapi.h>
 #include <chrono>
 #include <ctime>
 
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fstream>
+#endif
+
 namespace LogUtils {
 
     ALogger::ALogger(LogLevel loggerLevel, std::string outputFilePath) : logLevel(std::move(loggerLevel)) {
+#ifdef _WIN32
         char szPath[MAX_PATH];
         GetModuleBaseNameA(GetCurrentProcess(), GetModuleHandleA(NULL), szPath, MAX_PATH);
         std::string processName = szPath;
@@ -19,6 +25,13 @@ namespace LogUtils {
             outLogFile = std::make_unique<std::fstream>(logFileName, std::ios_base::app);
             *outLogFile << "VideoCaptureVersion=" << CAPTURE_VERSION << "\n";
         }
+#else
+        std::string processName;
+        std::getline(std::ifstream("/proc/self/comm"), processName);
+        logFileName = outputFilePath + "/" + processName + ".log";
+        outLogFile = std::make_unique<std::fstream>(logFileName, std::ios_base::app);
+        *outLogFile << "VideoCaptureVersion=" << CAPTURE_VERSION << "\n";
+#endif
     }
 
     ALogger::ALogger(std::string logFile, LogLevel loggerLevel) : logFileName(std::move(logFile)), logLevel(std::move(loggerLevel)) {
@@ -36,7 +49,11 @@ namespace LogUtils {
         auto timePoint = std::chrono::system_clock::now();
         std::time_t currentTime = std::chrono::system_clock::to_time_t(timePoint);
         struct tm newTimeInfo;
+#ifdef _WIN32
         localtime_s(&newTimeInfo, &currentTime);
+#else
+        localtime_r(&currentTime, &newTimeInfo);
+#endif
 
         char timeBuffer[128];
         size_t string_size = strftime(timeBuffer, sizeof(timeBuffer), LogUtils::LOGGER_TIME_FORMAT, &newTimeInfo);
@@ -52,7 +69,7 @@ namespace LogUtils {
 
     std::string getCurrentLogModuleFileName(std::string fileName) {
         std::string curfile = fileName;
-        auto pos = curfile.rfind('\\');
+        auto pos = curfile.find_last_of("\\/");
         if (pos != std::string::npos) {
             curfile = curfile.substr(pos + 1);
         }
@@ -0,0 +1,195 @@
+#include "RectCoalescer.hpp"
+
+#include <algorithm>
+
+namespace CapUtils {
+
+    namespace {
+
+        inline FrameRect getBoundingRect(const FrameRect& a, const FrameRect& b) {
+            return { std::min(a.left, b.left), std::min(a.top, b.top), std::max(a.right, b.right), std::max(a.bottom, b.bottom) };
+        }
+
+        inline bool contains(const FrameRect& outer, const FrameRect& inner) {
+            return outer.left <= inner.left && outer.top <= inner.top && outer.right >= inner.right && outer.bottom >= inner.bottom;
+        }
+
+        inline int64_t getArea(const FrameRect& rect) {
+            return static_cast<int64_t>(rect.right - rect.left) * (rect.bottom - rect.top);
+        }
+    }
+
+    RectCoalescer::RectCoalescer(int tileSize, const RectCostModel& costModel) :
+        tile((tileSize < 2) ? 2 : ((tileSize + 1) & ~1)),
+        cost(costModel) {
+    }
+
+    const std::vector<FrameRect>& RectCoalescer::coalesce(const FrameRect* rects, int rectCount, int frameWidth, int frameHeight) {
+        result.clear();
+        if (frameWidth <= 0 || frameHeight <= 0) {
+            return result;
+        }
+
+        width = frameWidth;
+        height = frameHeight;
+        columns = (width + tile - 1) / tile;
+        rows = (height + tile - 1) / tile;
+
+        markTiles(rects, rectCount);
+        extractRuns();
+        mergeByCost();
+        return result;
+    }
+
+    int64_t RectCoalescer::getCoveredArea() const {
+        int64_t area = 0;
+        for (const auto& rect : result) {
+            area += getArea(rect);
+        }
+        return area;
+    }
+
+    int64_t RectCoalescer::getCost() const {
+        int64_t totalCost = 0;
+        for (const auto& rect : result) {
+            totalCost += getRectCost(rect);
+        }
+        return totalCost;
+    }
+
+    void RectCoalescer::markTiles(const FrameRect* rects, int rectCount) {
+        tileMarks.assign(static_cast<std::size_t>(columns) * rows, 0);
+
+        for (int i = 0; i < rectCount; ++i) {
+            const int left = std::max(rects[i].left, 0);
+            const int top = std::max(rects[i].top, 0);
+            const int right = std::min(rects[i].right, width);
+            const int bottom = std::min(rects[i].bottom, height);
+            if (left >= right || top >= bottom) {
+                continue;
+            }
+
+            const int tileRight = (right - 1) / tile + 1;
+            const int tileBottom = (bottom - 1) / tile + 1;
+            for (int ty = top / tile; ty < tileBottom; ++ty) {
+                uint8_t* rowMarks = tileMarks.data() + static_cast<std::size_t>(ty) * columns;
+                std::fill(rowMarks + left / tile, rowMarks + tileRight, static_cast<uint8_t>(1));
+            }
+        }
+    }
+
+    void RectCoalescer::extractRuns() {
+        // Skipping a gap inside a tile row only pays off if the gap holds more pixels than a rect costs
+        const int64_t tileArea = static_cast<int64_t>(tile) * tile;
+        const int maxBridgedTiles = static_cast<int>(cost.rectOverheadInPixels / tileArea);
+
+        openRuns.clear();
+        for (int ty = 0; ty <= rows; ++ty) {
+            rowRuns.clear();
+            if (ty < rows) {
+                const uint8_t* rowMarks = tileMarks.data() + static_cast<std::size_t>(ty) * columns;
+                for (int tx = 0; tx < columns; ++tx) {
+                    if (!rowMarks[tx]) {
+                        continue;
+                    }
+                    int runEnd = tx + 1;
+                    while (runEnd < columns && rowMarks[runEnd]) {
+                        ++runEnd;
+                    }
+                    if (!rowRuns.empty() && tx - rowRuns.back().right <= maxBridgedTiles) {
+                        rowRuns.back().right = runEnd;
+                    }
+                    else {
+                        rowRuns.push_back({ tx, ty, runEnd, ty + 1 });
+                    }
+                    tx = runEnd;
+                }
+            }
+
+            // Both lists are sorted by left edge. Open runs continue if this row has a run with the same span,
+            // otherwise they are done and go to the result
+            nextRuns.clear();
+            std::size_t openIndex = 0;
+            std::size_t rowIndex = 0;
+            while (openIndex < openRuns.size() || rowIndex < rowRuns.size()) {
+                if (rowIndex == rowRuns.size() ||
+                    (openIndex < openRuns.size() && openRuns[openIndex].left < rowRuns[rowIndex].left)) {
+                    const FrameRect& run = openRuns[openIndex++];
+                    result.push_back(toPixels(run.left, run.top, run.right, run.bottom));
+                }
+                else if (openIndex == openRuns.size() || rowRuns[rowIndex].left < openRuns[openIndex].left) {
+                    nextRuns.push_back(rowRuns[rowIndex++]);
+                }
+                else if (openRuns[openIndex].right == rowRuns[rowIndex].right) {
+                    FrameRect run = openRuns[openIndex++];
+                    run.bottom = ty + 1;
+                    nextRuns.push_back(run);
+                    ++rowIndex;
+                }
+                else {
+                    const FrameRect& run = openRuns[openIndex++];
+                    result.push_back(toPixels(run.left, run.top, run.right, run.bottom));
+                    nextRuns.push_back(rowRuns[rowIndex++]);
+                }
+            }
+            openRuns.swap(nextRuns);
+        }
+    }
+
+    void RectCoalescer::mergeByCost() {
+        if (result.size() <= 1) {
+            return;
+        }
+
+        if (result.size() <= static_cast<std::size_t>(kMaxGreedyMergeRects)) {
+            while (result.size() > 1) {
+                int64_t bestSaving = -1;
+                std::size_t bestFirst = 0;
+                std::size_t bestSecond = 0;
+                for (std::size_t i = 0; i < result.size(); ++i) {
+                    for (std::size_t j = i + 1; j < result.size(); ++j) {
+                        const int64_t saving = getRectCost(result[i]) + getRectCost(result[j]) -
+                                               getRectCost(getBoundingRect(result[i], result[j]));
+                        if (saving > bestSaving) {
+                            bestSaving = saving;
+                            bestFirst = i;
+                            bestSecond = j;
+                        }
+                    }
+                }
+                if (bestSaving < 0) {
+                    break;
+                }
+
+                const FrameRect merged = getBoundingRect(result[bestFirst], result[bestSecond]);
+                result[bestFirst] = merged;
+
+                // The second rect and any other rect swallowed by the merged one are copied along with it
+                std::size_t kept = 0;
+                for (std::size_t i = 0; i < result.size(); ++i) {
+                    if (i == bestFirst || !contains(merged, result[i])) {
+                        result[kept++] = result[i];
+                    }
+                }
+                result.resize(kept);
+            }
+        }
+
+        // A single rect around everything may still beat the remaining set, e.g. for scattered small updates
+        FrameRect bounds = result.front();
+        for (const auto& rect : result) {
+            bounds = getBoundingRect(bounds, rect);
+        }
+        if (getRectCost(bounds) <= getCost()) {
+            result.assign(1, bounds);
+        }
+    }
+
+    FrameRect RectCoalescer::toPixels(int tileLeft, int tileTop, int tileRight, int tileBottom) const {
+        return { tileLeft * tile, tileTop * tile, std::min(tileRight * tile, width), std::min(tileBottom * tile, height) };
+    }
+
+    int64_t RectCoalescer::getRectCost(const FrameRect& rect) const {
+        return cost.rectOverheadInPixels + getArea(rect);
+    }
+}
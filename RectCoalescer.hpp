@@ -0,0 +1,118 @@
+#pragma once
+
+#include "FramePool.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace CapUtils {
+
+    constexpr int kDefaultCoalesceTileSize = 16; // Tile edge in pixels. Even, so tiles never split a 2x2 chroma block
+    constexpr int64_t kDefaultRectOverheadInPixels = 64 * 64; // Fixed cost of one more copy, draw or convert call
+    constexpr int kMaxGreedyMergeRects = 64; // Pairwise merging is quadratic, larger sets are only merged along rows
+
+    /*
+    * Cost model used to decide between many small rects and fewer larger ones.
+    * The cost of a rect is rectOverheadInPixels plus its area, so a merge pays off whenever the pixels it adds
+    * are fewer than the per rect overhead it saves.
+    */
+    struct RectCostModel {
+        int64_t rectOverheadInPixels = kDefaultRectOverheadInPixels;
+    };
+
+    /*
+    * Turns a set of possibly overlapping rects into a small set of disjoint, tile aligned rects covering all of them.
+    * Rects are clipped to the frame and snapped outwards to a tile grid. Covered tiles are then collected into
+    * horizontal runs, bridging gaps that are cheaper to copy than to skip, and runs with the same span in
+    * consecutive tile rows are stacked into one rect. Finally, rects are merged pairwise while the cost model
+    * says a single bounding rect is cheaper.
+    * Every rect of the result lies within the frame and its edges lie on the tile grid or on the frame edge.
+    * Rects are disjoint, except where a cost based merge found overlapping them cheaper than keeping them apart.
+    */
+    class RectCoalescer {
+
+    public:
+        /**
+         * RectCoalescer constructor
+         *
+         * @param tileSize
+         *     Tile edge in pixels. Values below 2 are raised to 2 and odd values are rounded up to keep chroma
+         *     blocks whole.
+         *
+         * @param costModel
+         *     Relative cost of one more rect against one more pixel
+         */
+        explicit RectCoalescer(int tileSize = kDefaultCoalesceTileSize, const RectCostModel& costModel = RectCostModel());
+
+        /**
+         * Coalesce rects of a frame
+         *
+         * @param rects
+         *     Rects to be covered. May overlap and may reach outside the frame.
+         *
+         * @param rectCount
+         *     Number of entries in rects
+         *
+         * @param frameWidth
+         *     Frame width in pixels that rects are clipped to
+         *
+         * @param frameHeight
+         *     Frame height in pixels that rects are clipped to
+         *
+         * @return  Coalesced rects. Valid until the next call.
+         */
+        const std::vector<FrameRect>& coalesce(const FrameRect* rects, int rectCount, int frameWidth, int frameHeight);
+
+        /**
+         * Get the total area of the last coalesced set in pixels
+         */
+        int64_t getCoveredArea() const;
+
+        /**
+         * Get the cost of the last coalesced set under the cost model
+         */
+        int64_t getCost() const;
+
+        int getTileSize() const {
+            return tile;
+        }
+
+    private:
+
+        /**
+         * Internal helper function to mark every tile touched by the clipped rects
+         */
+        void markTiles(const FrameRect* rects, int rectCount);
+
+        /**
+         * Internal helper function to collect marked tiles into runs and stack equal runs of consecutive tile rows
+         */
+        void extractRuns();
+
+        /**
+         * Internal helper function to merge rects pairwise while a bounding rect is cheaper than both rects
+         */
+        void mergeByCost();
+
+        /**
+         * Internal helper function to convert a rect in tile units into a pixel rect clipped to the frame
+         */
+        FrameRect toPixels(int tileLeft, int tileTop, int tileRight, int tileBottom) const;
+
+        int64_t getRectCost(const FrameRect& rect) const;
+
+        int tile = kDefaultCoalesceTileSize;
+        RectCostModel cost;
+
+        int width = 0; // Frame width of the current call
+        int height = 0; // Frame height of the current call
+        int columns = 0; // Tiles per row
+        int rows = 0; // Tile rows
+
+        std::vector<uint8_t> tileMarks; // One entry per tile, set if any rect touches the tile
+        std::vector<FrameRect> openRuns; // Runs of the previous tile row in tile units, still growing downwards
+        std::vector<FrameRect> rowRuns; // Runs of the current tile row in tile units
+        std::vector<FrameRect> nextRuns; // Open runs after the current tile row in tile units
+        std::vector<FrameRect> result; // Coalesced rects in pixels. Reused between calls
+    };
+}
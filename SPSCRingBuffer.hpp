@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+namespace CapUtils {
+
+    // Cache line size used to keep producer and consumer indices on separate lines
+    constexpr std::size_t kCacheLineSize = 64;
+
+    /*
+    * Fixed capacity single-producer/single-consumer ring buffer.
+    * Exactly one thread may push and exactly one other thread may pop. Head is only written by the producer and
+    * published with release semantics, tail is advanced with release semantics and observed with acquire semantics,
+    * so neither side ever takes a lock.
+    * The producer may additionally evict the oldest entry when the ring is full. Tail is therefore advanced by
+    * compare-and-swap, and indices are monotonically increasing 64 bit counters so that a stale tail can never
+    * be mistaken for a current one.
+    * Entries are expected to be small handles (e.g. pointers to pooled frames) so that push and pop are cheap.
+    */
+    template<typename T>
+    class SPSCRingBuffer {
+        static_assert(std::is_trivially_copyable<T>::value, "SPSCRingBuffer entries must be trivially copyable handles");
+
+    public:
+        /**
+         * SPSCRingBuffer constructor. All slots are allocated upfront, no allocation happens on push or pop.
+         *
+         * @param capacity
+         *     Maximum number of entries the ring can hold. Zero is promoted to one.
+         */
+        explicit SPSCRingBuffer(std::size_t capacity) :
+            slotCount(capacity > 0 ? capacity : 1),
+            slots(std::make_unique<std::atomic<T>[]>(slotCount)) {
+        }
+
+        /*
+        * @name Copy and move
+        *
+        * No copying and moving allowed. Indices are shared between two threads.
+        */
+        SPSCRingBuffer(const SPSCRingBuffer&) = delete;
+        SPSCRingBuffer& operator=(const SPSCRingBuffer&) = delete;
+
+        SPSCRingBuffer(SPSCRingBuffer&&) = delete;
+        SPSCRingBuffer& operator=(SPSCRingBuffer&&) = delete;
+
+        /**
+         * Push an entry into the ring. Must only be called from the producer thread.
+         *
+         * @param value
+         *     Entry to be pushed
+         *
+         * @return  True if entry is pushed; False if the ring is full.
+         */
+        bool tryPush(const T& value) {
+            const uint64_t currentHead = head.load(std::memory_order_relaxed);
+            if (currentHead - cachedTail >= slotCount) {
+                cachedTail = tail.load(std::memory_order_acquire);
+                if (currentHead - cachedTail >= slotCount) {
+                    return false;
+                }
+            }
+            slots[currentHead % slotCount].store(value, std::memory_order_relaxed);
+            head.store(currentHead + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * Pop the oldest entry from the ring. Must only be called from the consumer thread.
+         *
+         * @param value
+         *     Receives the popped entry
+         *
+         * @return  True if an entry is popped; False if the ring is empty.
+         */
+        bool tryPop(T& value) {
+            uint64_t currentTail = tail.load(std::memory_order_acquire);
+            while (true) {
+                // Evictions may move tail past the last observed head, hence the inequality
+                if (currentTail >= cachedHead) {
+                    cachedHead = head.load(std::memory_order_acquire);
+                    if (currentTail >= cachedHead) {
+                        return false;
+                    }
+                }
+                T entry = slots[currentTail % slotCount].load(std::memory_order_relaxed);
+                // Fails only if the producer evicted this entry meanwhile. currentTail is refreshed on failure
+                if (tail.compare_exchange_weak(currentTail, currentTail + 1, std::memory_order_acq_rel,
+                                               std::memory_order_acquire)) {
+                    value = entry;
+                    return true;
+                }
+            }
+        }
+
+        /**
+         * Remove the oldest entry from the ring to make room for a newer one.
+         * Must only be called from the producer thread.
+         *
+         * @param value
+         *     Receives the evicted entry. Ownership passes to the caller.
+         *
+         * @return  True if an entry is evicted; False if the consumer emptied the ring meanwhile.
+         */
+        bool tryEvict(T& value) {
+            const uint64_t currentHead = head.load(std::memory_order_relaxed);
+            uint64_t currentTail = tail.load(std::memory_order_acquire);
+            while (currentTail != currentHead) {
+                T entry = slots[currentTail % slotCount].load(std::memory_order_relaxed);
+                if (tail.compare_exchange_weak(currentTail, currentTail + 1, std::memory_order_acq_rel,
+                                               std::memory_order_acquire)) {
+                    cachedTail = currentTail + 1;
+                    value = entry;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Approximate number of entries in the ring. Exact when called from either owning thread while the
+         * other side is idle.
+         */
+        std::size_t size() const {
+            const uint64_t currentTail = tail.load(std::memory_order_acquire);
+            const uint64_t currentHead = head.load(std::memory_order_acquire);
+            return (currentHead > currentTail) ? static_cast<std::size_t>(currentHead - currentTail) : 0;
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+        bool full() const {
+            return size() >= slotCount;
+        }
+
+        std::size_t capacity() const {
+            return slotCount;
+        }
+
+    private:
+
+        const std::size_t slotCount; // Number of entries the ring can hold
+        std::unique_ptr<std::atomic<T>[]> slots; // Preallocated ring storage indexed by counter modulo slotCount
+
+        alignas(kCacheLineSize) std::atomic<uint64_t> head{ 0 }; // Number of entries ever pushed. Owned by producer
+        uint64_t cachedTail = 0; // Producer's last observed tail, avoids touching consumer's cache line on every push
+
+        alignas(kCacheLineSize) std::atomic<uint64_t> tail{ 0 }; // Number of entries ever popped or evicted
+        uint64_t cachedHead = 0; // Consumer's last observed head, avoids touching producer's cache line on every pop
+    };
+}
@@ -5,10 +5,16 @@
 
 #include <chrono>
 #include <fstream>
+#include <functional>
 #include <ctime>
 
 #include "LogUtil.hpp"
-#include "TimedMediaGrabber.hpp"
+#include "EncodePipeline.hpp"
+#include "ColorConvert.hpp"
+#include "CommandWatcher.hpp"
+#include "GdiCaptureSource.hpp"
+#include "SyntheticCaptureSource.hpp"
+#include "TraceCaptureSource.hpp"
 
 using namespace FileUtils;
 using namespace LogUtils;
@@ -68,30 +74,52 @@ namespace CapUtils {
         }
     }
 
-    ScreenCapture::Impl::Impl(std::string configFileName) : configFile(configFileName) {
-        // Initialize handles for device contexts used for screen capture
-        screenGDIInfoForCapture.hwndDesktop = GetDesktopWindow();
-        screenGDIInfoForCapture.hwindowDC = GetDC(screenGDIInfoForCapture.hwndDesktop);
-        screenGDIInfoForCapture.hwindowCompatibleDC = CreateCompatibleDC(screenGDIInfoForCapture.hwindowDC);
-        SetStretchBltMode(screenGDIInfoForCapture.hwindowCompatibleDC, COLORONCOLOR);
-        screenGDIInfoForCapture.bi.biSize = sizeof(BITMAPINFOHEADER);
-        screenGDIInfoForCapture.bi.biPlanes = 1;
-        screenGDIInfoForCapture.bi.biBitCount = 24;
-        screenGDIInfoForCapture.bi.biCompression = BI_RGB;
-        screenGDIInfoForCapture.bi.biSizeImage = 0;
-        screenGDIInfoForCapture.bi.biXPelsPerMeter = 0;
-        screenGDIInfoForCapture.bi.biYPelsPerMeter = 0;
-        screenGDIInfoForCapture.bi.biClrUsed = 0;
-        screenGDIInfoForCapture.bi.biClrImportant = 0;
+    bool parseFrameDropPolicy(const std::string& policyName, FrameDropPolicy& policy) {
+        if (policyName == "block") {
+            policy = FrameDropPolicy::BLOCK_PRODUCER;
+        }
+        else if (policyName == "dropOldest") {
+            policy = FrameDropPolicy::DROP_OLDEST;
+        }
+        else if (policyName == "dropNewest") {
+            policy = FrameDropPolicy::DROP_NEWEST;
+        }
+        else if (policyName == "keepEveryNth") {
+            policy = FrameDropPolicy::KEEP_EVERY_NTH;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
 
+    std::string getFrameDropPolicyString(FrameDropPolicy policy) {
+        std::string result = "";
+        switch (policy) {
+        case FrameDropPolicy::BLOCK_PRODUCER:
+            result = "BLOCK_PRODUCER";
+            break;
+        case FrameDropPolicy::DROP_OLDEST:
+            result = "DROP_OLDEST";
+            break;
+        case FrameDropPolicy::DROP_NEWEST:
+            result = "DROP_NEWEST";
+            break;
+        case FrameDropPolicy::KEEP_EVERY_NTH:
+            result = "KEEP_EVERY_NTH";
+            break;
+        default:
+            break;
+        }
+        return result;
+    }
+
+    ScreenCapture::Impl::Impl(std::string configFileName) : configFile(configFileName) {
         // Initialize recording state
         recordingState = ScreenRecordingState::ScreenRecordingNotStarted;
     }
 
     ScreenCapture::Impl::~Impl() {
-        DeleteDC(screenGDIInfoForCapture.hwindowCompatibleDC);
-        ReleaseDC(screenGDIInfoForCapture.hwndDesktop, screenGDIInfoForCapture.hwindowDC);
-        DeleteObject(screenGDIInfoForCapture.hbwindow);
     }
 
     void ScreenCapture::Impl::setupFFMPEGBasedScreenEncode(int width, int height, int fps, 
@@ -110,6 +138,8 @@ namespace CapUtils {
         // Compute source width and height for screen region capture
         srcwidth = screenCaptureParams.bottomRightX2 - screenCaptureParams.topLeftX1;
         srcheight = screenCaptureParams.bottomRightY2 - screenCaptureParams.topLeftY1;
+        grabwidth = srcwidth;
+        grabheight = srcheight;
 
         ffScreenSessionInfo.fps = fps;
         ffScreenSessionInfo.crf = 23;
@@ -208,12 +238,50 @@ namespace CapUtils {
         srcwidth = screenCaptureParams.bottomRightX2 - screenCaptureParams.topLeftX1;
         srcheight = screenCaptureParams.bottomRightY2 - screenCaptureParams.topLeftY1;
 
-        // create a bitmap
-        screenGDIInfoForCapture.hbwindow = CreateCompatibleBitmap(screenGDIInfoForCapture.hwindowDC, screenCaptureParams.resoutionWidth, 
-                                                                  screenCaptureParams.resoutionHeight);
+        // Optional capture source parameters. Synthetic frames are rendered at the size of the screen region
+        if (doc["ScreenRecord"].HasMember("Capture")) {
+            const auto& capture = doc["ScreenRecord"]["Capture"];
+            if (capture.HasMember("source") && !parseCaptureSourceType(capture["source"].GetString(), captureSourceType)) {
+                ALOG(WARNING, "Unknown capture source, using default", NVV(captureSource, getCaptureSourceTypeString(captureSourceType)));
+            }
+            if (captureSourceType == CaptureSourceType::X11) {
+                // X11 capture runs on Linux through X11Record, this recorder grabs Windows desktops only
+                captureSourceType = CaptureSourceType::GDI;
+                ALOG(WARNING, "X11 capture source is not available in this recorder, using GDI");
+            }
+            if (capture.HasMember("syntheticSeed")) {
+                syntheticSeed = static_cast<uint32_t>(std::atoi(capture["syntheticSeed"].GetString()));
+            }
+            if (capture.HasMember("traceFile")) {
+                traceFileName = capture["traceFile"].GetString();
+            }
+            if (capture.HasMember("traceReplay") && !parseTraceReplayMode(capture["traceReplay"].GetString(), traceReplayMode)) {
+                ALOG(WARNING, "Unknown traceReplay, using default", NVV(traceReplay, getTraceReplayModeString(traceReplayMode)));
+            }
+            if (capture.HasMember("recordTraceFile")) {
+                recordTraceFileName = capture["recordTraceFile"].GetString();
+            }
+            if (capture.HasMember("timer") && !parseMediaCallbackType(capture["timer"].GetString(), grabTimerType)) {
+                ALOG(WARNING, "Unknown timer, using default", NVV(timer, capture["timer"].GetString()));
+            }
+            if (capture.HasMember("missedTicks") && !parseMissedTickPolicy(capture["missedTicks"].GetString(), missedGrabPolicy)) {
+                ALOG(WARNING, "Unknown missedTicks, using default", NVV(missedTicks, getMissedTickPolicyString(missedGrabPolicy)));
+            }
+        }
 
-        screenGDIInfoForCapture.bi.biWidth = screenCaptureParams.resoutionWidth;
-        screenGDIInfoForCapture.bi.biHeight = -screenCaptureParams.resoutionHeight;
+        // Region is grabbed at its native size and scaled by the fused scale and color conversion unless
+        // GDI is asked to scale while grabbing
+        if (doc["ScreenRecord"]["Resolution"].HasMember("scaleFilter")) {
+            const std::string scaleFilterName = doc["ScreenRecord"]["Resolution"]["scaleFilter"].GetString();
+            if (scaleFilterName == "gdi" && captureSourceType == CaptureSourceType::GDI) {
+                scaleWhileGrabbing = true;
+            }
+            else if (!parseScaleFilter(scaleFilterName, scaleFilter)) {
+                ALOG(WARNING, "Unknown scaleFilter, using default", NVV(scaleFilter, getScaleFilterString(scaleFilter)));
+            }
+        }
+        grabwidth = scaleWhileGrabbing ? screenCaptureParams.resoutionWidth : srcwidth;
+        grabheight = scaleWhileGrabbing ? screenCaptureParams.resoutionHeight : srcheight;
 
         ffScreenSessionInfo.fps = std::atoi(doc["ScreenRecord"]["fps"].GetString());
         ffScreenSessionInfo.crf = std::atoi(doc["ScreenRecord"]["crf"].GetString());
@@ -226,66 +294,136 @@ namespace CapUtils {
         // Validate crf by checking to see if value lies between 0 and 51 supported by FFMPEG
         ffScreenSessionInfo.crf = (ffScreenSessionInfo.crf <= 51 && ffScreenSessionInfo.crf >= 0) ? ffScreenSessionInfo.crf : 23;
 
+        // Optional encoder parameters. Backends are tried in the configured order until one of them opens
+        if (doc["ScreenRecord"].HasMember("Encoder")) {
+            const auto& encoder = doc["ScreenRecord"]["Encoder"];
+            if (encoder.HasMember("chain") && !parseEncoderBackendChain(encoder["chain"].GetString(), encoderChain)) {
+                if (encoderChain.empty()) {
+                    encoderChain = getDefaultEncoderBackendChain();
+                }
+                ALOG(WARNING, "Unknown encoder in chain, using", NVV(EncoderChain, getEncoderBackendChainString(encoderChain)));
+            }
+            if (encoder.HasMember("threads")) {
+                encoderThreads = std::atoi(encoder["threads"].GetString());
+            }
+            if (encoder.HasMember("parallelEncoders")) {
+                parallelEncoders = std::atoi(encoder["parallelEncoders"].GetString());
+            }
+        }
+        encoderThreads = (encoderThreads < 0) ? 0 : encoderThreads;
+        parallelEncoders = (parallelEncoders <= 0) ? 1 : ((parallelEncoders > kMaxParallelEncoders) ? kMaxParallelEncoders : parallelEncoders);
+
+        captureSource = createCaptureSource();
+        if (!captureSource) {
+            return false;
+        }
+
+        // Trace replays deliver frames of the size they were recorded at
+        grabwidth = captureSource->getWidth();
+        grabheight = captureSource->getHeight();
+
         segmentDuration = std::atoi(doc["ScreenRecord"]["Recording"]["segmentDuration"].GetString());
 
         playListFileName = doc["ScreenRecord"]["Recording"]["fileName"].GetString();
 
+        // Optional pipeline parameters
+        if (doc["ScreenRecord"].HasMember("Pipeline")) {
+            const auto& pipeline = doc["ScreenRecord"]["Pipeline"];
+            if (pipeline.HasMember("frameQueueCapacity")) {
+                frameQueueCapacity = std::atoi(pipeline["frameQueueCapacity"].GetString());
+            }
+            if (pipeline.HasMember("frameDropPolicy") &&
+                !parseFrameDropPolicy(pipeline["frameDropPolicy"].GetString(), frameDropPolicy)) {
+                ALOG(WARNING, "Unknown frameDropPolicy, using default", NVV(frameDropPolicy, getFrameDropPolicyString(frameDropPolicy)));
+            }
+            if (pipeline.HasMember("keepEveryNthFrame")) {
+                keepEveryNthFrame = std::atoi(pipeline["keepEveryNthFrame"].GetString());
+            }
+            if (pipeline.HasMember("convertThreads")) {
+                convertThreads = std::atoi(pipeline["convertThreads"].GetString());
+            }
+            if (pipeline.HasMember("changeDetection")) {
+                detectChanges = std::atoi(pipeline["changeDetection"].GetString()) != 0;
+            }
+            if (pipeline.HasMember("maxStaticFrameIntervalInMs")) {
+                maxStaticFrameIntervalInMs = std::atoi(pipeline["maxStaticFrameIntervalInMs"].GetString());
+            }
+            if (pipeline.HasMember("usageLogIntervalInSeconds")) {
+                usageLogIntervalInSeconds = std::atoi(pipeline["usageLogIntervalInSeconds"].GetString());
+            }
+            if (pipeline.HasMember("adaptiveFrameRate")) {
+                adaptiveFrameRate = std::atoi(pipeline["adaptiveFrameRate"].GetString()) != 0;
+            }
+            if (pipeline.HasMember("frameRateWindowInMs")) {
+                frameRateWindowInMs = std::atoi(pipeline["frameRateWindowInMs"].GetString());
+            }
+            if (pipeline.HasMember("frameRateRaiseAfterWindows")) {
+                frameRateRaiseAfterWindows = std::atoi(pipeline["frameRateRaiseAfterWindows"].GetString());
+            }
+        }
+        usageLogIntervalInSeconds = (usageLogIntervalInSeconds < 0) ? 0 : usageLogIntervalInSeconds;
+        frameRateWindowInMs = (frameRateWindowInMs <= 0) ? kDefaultFrameRateWindowInMs : frameRateWindowInMs;
+        frameRateRaiseAfterWindows = (frameRateRaiseAfterWindows <= 0) ? kDefaultFrameRateRaiseAfterWindows : frameRateRaiseAfterWindows;
+
+        // Replaying as fast as possible is only reproducible if the encoder gets every frame
+        if (captureSourceType == CaptureSourceType::TRACE && traceReplayMode == TraceReplayMode::AS_FAST_AS_POSSIBLE) {
+            frameDropPolicy = FrameDropPolicy::BLOCK_PRODUCER;
+        }
+
+        // Static frames can only be found with change detection
+        maxStaticFrameIntervalInMs = (!detectChanges || maxStaticFrameIntervalInMs < 0) ? 0 : maxStaticFrameIntervalInMs;
+
+        // Keeping every frame is no decimation at all, so the lowest useful value is 2
+        keepEveryNthFrame = (keepEveryNthFrame < 2) ? 2 : keepEveryNthFrame;
+
+        // Zero leaves half of the cores for capture, encoding and everything else running on the box
+        if (convertThreads <= 0) {
+            convertThreads = static_cast<int>(std::thread::hardware_concurrency() / 2);
+        }
+        convertThreads = (convertThreads <= 0) ? 1 : ((convertThreads > kMaxConvertThreads) ? kMaxConvertThreads : convertThreads);
+
+        // Limit frame queue capacity within a range from 1 - kMaxFrameQueueCapacity frames
+        frameQueueCapacity = (frameQueueCapacity <= 0 || frameQueueCapacity > kMaxFrameQueueCapacity) ?
+                              kDefaultFrameQueueCapacity : frameQueueCapacity;
+
         // Log all screen parameters
         {
-            std::string screenParamsToBeLogged = " " + NVV(topLeftX1, screenCaptureParams.topLeftX1) + " " +
+            std::string screenParamsToBeLogged = " " + NVV(captureSource, getCaptureSourceTypeString(captureSourceType)) + " " +
+                NVV(topLeftX1, screenCaptureParams.topLeftX1) + " " +
                 NVV(topLeftY1, screenCaptureParams.topLeftY1) + " " +
                 NVV(bottomRightX2, screenCaptureParams.bottomRightX2) + " " +
                 NVV(bottomRightY2, screenCaptureParams.bottomRightY2)  + " " + 
                 NVV(resoutionWidth, screenCaptureParams.resoutionWidth) + " " +
-                NVV(resoutionHeight, screenCaptureParams.resoutionHeight);
+                NVV(resoutionHeight, screenCaptureParams.resoutionHeight) + " " +
+                NVV(frameQueueCapacity, frameQueueCapacity) + " " +
+                NVV(frameDropPolicy, getFrameDropPolicyString(frameDropPolicy)) + " " +
+                NVV(keepEveryNthFrame, keepEveryNthFrame) + " " +
+                NVV(convertThreads, convertThreads) + " " +
+                NVV(scaleFilter, scaleWhileGrabbing ? std::string("GDI") : getScaleFilterString(scaleFilter)) + " " +
+                NVV(changeDetection, detectChanges) + " " +
+                NVV(maxStaticFrameIntervalInMs, maxStaticFrameIntervalInMs) + " " +
+                NVV(usageLogIntervalInSeconds, usageLogIntervalInSeconds) + " " +
+                NVV(adaptiveFrameRate, adaptiveFrameRate);
+            if (captureSourceType == CaptureSourceType::TRACE) {
+                screenParamsToBeLogged += " " + NVV(traceFile, traceFileName) + " " +
+                    NVV(traceReplay, getTraceReplayModeString(traceReplayMode));
+            }
+            if (!recordTraceFileName.empty()) {
+                screenParamsToBeLogged += " " + NVV(recordTraceFile, recordTraceFileName);
+            }
 
             ALOG(INFO, "Screen params:", screenParamsToBeLogged);
         }
         return true;
     }
 
-    int ScreenCapture::Impl::setHardwareFrameContext() {
-        AVBufferRef* hardwareFramesRef;
-        AVHWFramesContext* framesContext = NULL;
-        int err = 0;
-
-        if (!(hardwareFramesRef = av_hwframe_ctx_alloc(ffScreenSessionInfo.hardwareEncodeDeviceContext))) {
-            ALOG(ERR, "Failed to create CUDA frame context.");
-            return -1;
-        }
-
-        framesContext = (AVHWFramesContext*)(hardwareFramesRef->data);
-        framesContext->format = AV_PIX_FMT_CUDA;
-        framesContext->sw_format = AV_PIX_FMT_YUV420P;
-        framesContext->width = screenCaptureParams.resoutionWidth;
-        framesContext->height = screenCaptureParams.resoutionHeight;
-        framesContext->initial_pool_size = 20;
-
-        if ((err = av_hwframe_ctx_init(hardwareFramesRef)) < 0) {
-            ALOG(ERR, "Failed to initialize CUDA frame context.", NV(err));
-            av_buffer_unref(&hardwareFramesRef);
-            return err;
-        }
-        ffScreenSessionInfo.outputAVCodecContext->hw_frames_ctx = av_buffer_ref(hardwareFramesRef);
-        if (!ffScreenSessionInfo.outputAVCodecContext->hw_frames_ctx)
-            err = AVERROR(ENOMEM);
-
-        av_buffer_unref(&hardwareFramesRef);
-        return err;
-    }
-
     bool ScreenCapture::Impl::setupFFSessionInfo() {
         // String concat for sequence name, output file name and path
         std::string outputFile = outputFilePath + "\\" + playListFileName;
         std::string seq = "fsequence%d.ts";
         std::string path = outputFilePath + "\\" + seq;
 
-        int err = av_hwdevice_ctx_create(&ffScreenSessionInfo.hardwareEncodeDeviceContext, AV_HWDEVICE_TYPE_CUDA, NULL, NULL, 0);
-
-        if (err < 0) {
-            ALOG(ERR, "Failed to initialize CUDA frame context.", NV(err));
-            return false;
-        }
+        int err = 0;
 
         if (!(ffScreenSessionInfo.oformat = av_guess_format(NULL, outputFile.c_str(), NULL)))
         {
@@ -299,67 +437,49 @@ namespace CapUtils {
             return false;
         }
 
-        if (!(ffScreenSessionInfo.codec = avcodec_find_encoder_by_name(CUDA_ENCODER)))
-        {
-            ALOG(ERR, "Failed to find encoder");
-            return false;
-        }
+        // Converted frames are I420, uploaded to the GPU for NVENC and handed over as they are to software encoders
+        EncoderSettings encoderSettings;
+        encoderSettings.width = screenCaptureParams.resoutionWidth;
+        encoderSettings.height = screenCaptureParams.resoutionHeight;
+        encoderSettings.fps = ffScreenSessionInfo.fps;
+        encoderSettings.crf = ffScreenSessionInfo.crf;
+        encoderSettings.outputBitrateInMB = ffScreenSessionInfo.outputBitrateInMB;
+        encoderSettings.threadCount = encoderThreads;
+        encoderSettings.softwareFormat = AV_PIX_FMT_YUV420P;
 
-        if (!(ffScreenSessionInfo.outVideoStream = avformat_new_stream(ffScreenSessionInfo.ofctx, ffScreenSessionInfo.codec)))
-        {
-            ALOG(ERR, "Failed to create new stream");
-            return false;
+        // Parallel encoder instances share the cores, unless threads per encoder are configured
+        if (parallelEncoders > 1 && encoderSettings.threadCount == 0) {
+            const int threadsPerEncoder = static_cast<int>(std::thread::hardware_concurrency()) / parallelEncoders;
+            encoderSettings.threadCount = (threadsPerEncoder > 0) ? threadsPerEncoder : 1;
         }
 
-        if (!(ffScreenSessionInfo.outputAVCodecContext = avcodec_alloc_context3(ffScreenSessionInfo.codec)))
+        if (!openEncoderBackend(ffScreenSessionInfo, encoderChain, encoderSettings))
         {
-            ALOG(ERR, "Failed to allocate codec context");
+            ALOG(ERR, "Failed to open any encoder", NVV(EncoderChain, getEncoderBackendChainString(encoderChain)));
             return false;
         }
 
-        ffScreenSessionInfo.outputAVCodecContext->width = screenCaptureParams.resoutionWidth;
-        ffScreenSessionInfo.outputAVCodecContext->height = screenCaptureParams.resoutionHeight;
-        ffScreenSessionInfo.outputAVCodecContext->time_base = { 1, ffScreenSessionInfo.fps };
-        ffScreenSessionInfo.outputAVCodecContext->framerate = { ffScreenSessionInfo.fps, 1 };
-        ffScreenSessionInfo.outputAVCodecContext->sample_aspect_ratio = { 1, 1 };
-        ffScreenSessionInfo.outputAVCodecContext->pix_fmt = AV_PIX_FMT_CUDA;
-        ffScreenSessionInfo.outputAVCodecContext->max_b_frames = 0;
-        ffScreenSessionInfo.outputAVCodecContext->gop_size = 12;
-
-        ffScreenSessionInfo.outVideoStream->codecpar->codec_id = ffScreenSessionInfo.oformat->video_codec;
-        ffScreenSessionInfo.outVideoStream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-        ffScreenSessionInfo.outVideoStream->codecpar->width = screenCaptureParams.resoutionWidth;
-        ffScreenSessionInfo.outVideoStream->codecpar->height = screenCaptureParams.resoutionHeight;
-        ffScreenSessionInfo.outVideoStream->codecpar->format = AV_PIX_FMT_CUDA;
-        ffScreenSessionInfo.outVideoStream->time_base = { 1, ffScreenSessionInfo.fps };
-
-        if (ffScreenSessionInfo.outputBitrateInMB != 0) {
-            ALOG(INFO, "Setting output bitrate to ", NVV(outputBitrateInMB, ffScreenSessionInfo.outputBitrateInMB), " Mbps");
-            ffScreenSessionInfo.outVideoStream->codecpar->bit_rate = ffScreenSessionInfo.outputBitrateInMB * 1000 * 1000;
-        }
-
-        avcodec_parameters_to_context(ffScreenSessionInfo.outputAVCodecContext, ffScreenSessionInfo.outVideoStream->codecpar);
-
-        // Can change the value of preset to slow, fast or ultrafast
-        if (ffScreenSessionInfo.outVideoStream->codecpar->codec_id == AV_CODEC_ID_H264)
+        // NVENC sessions are a scarce resource of the GPU, so hardware encoders keep to the session encoder
+        if (parallelEncoders > 1 && isHardwareEncoderBackend(ffScreenSessionInfo.encoderBackend))
         {
-            av_opt_set(ffScreenSessionInfo.outputAVCodecContext, "preset", "ultrafast", 0);
-            av_opt_set(ffScreenSessionInfo.outputAVCodecContext, "crf", std::to_string(ffScreenSessionInfo.crf).c_str(), AV_OPT_SEARCH_CHILDREN);
+            ALOG(WARNING, "Parallel encoding needs a software encoder, encoding serially",
+                 NVV(Encoder, getEncoderBackendString(ffScreenSessionInfo.encoderBackend)));
+            parallelEncoders = 1;
         }
 
-        avcodec_parameters_from_context(ffScreenSessionInfo.outVideoStream->codecpar, ffScreenSessionInfo.outputAVCodecContext);
-
-        // Set hardware context for encoder's AVCodecContext
-        if ((err = setHardwareFrameContext()) < 0) {
-            ALOG(ERR, "Failed to set hardware frame context.");
+        if (!(ffScreenSessionInfo.outVideoStream = avformat_new_stream(ffScreenSessionInfo.ofctx, ffScreenSessionInfo.codec)))
+        {
+            ALOG(ERR, "Failed to create new stream");
             return false;
         }
 
-        if ((err = avcodec_open2(ffScreenSessionInfo.outputAVCodecContext, ffScreenSessionInfo.codec, NULL)) < 0)
+        // Stream takes codec, resolution and format of the opened encoder, which may be HEVC
+        if ((err = avcodec_parameters_from_context(ffScreenSessionInfo.outVideoStream->codecpar, ffScreenSessionInfo.outputAVCodecContext)) < 0)
         {
-            ALOG(ERR, "Failed to open codec");
+            ALOG(ERR, "Failed to copy encoder parameters to stream", NV(err));
             return false;
         }
+        ffScreenSessionInfo.outVideoStream->time_base = { 1, ffScreenSessionInfo.fps };
 
         // HLS parameters that define the segment duration, sequence name, start index of filename and playlist type
         av_dict_set(&ffScreenSessionInfo.avDict, "hls_time", std::to_string(segmentDuration).c_str(), 0);
@@ -386,36 +506,6 @@ namespace CapUtils {
         av_dump_format(ffScreenSessionInfo.ofctx, 0, outputFile.c_str(), 1);
         ffScreenSessionInfo.time_counter = 0;
 
-        // Setup software videoFrame
-        ffScreenSessionInfo.softwareVideoFrame = av_frame_alloc();
-        ffScreenSessionInfo.softwareVideoFrame->format = AV_PIX_FMT_YUV420P;
-        ffScreenSessionInfo.softwareVideoFrame->width = ffScreenSessionInfo.outputAVCodecContext->width;
-        ffScreenSessionInfo.softwareVideoFrame->height = ffScreenSessionInfo.outputAVCodecContext->height;
-        ffScreenSessionInfo.outVideoStream->time_base = { 1, ffScreenSessionInfo.fps };
-
-        if ((err = av_frame_get_buffer(ffScreenSessionInfo.softwareVideoFrame, 0)) < 0)
-        {
-            ALOG(ERR, "Failed to allocate picture", NV(err));
-            return false;
-        }
-
-        // Setup hardware video frame
-        ffScreenSessionInfo.hardwareOutputVideoFrame = av_frame_alloc();
-        if ((err = av_hwframe_get_buffer(ffScreenSessionInfo.outputAVCodecContext->hw_frames_ctx, ffScreenSessionInfo.hardwareOutputVideoFrame, 0)) < 0) {
-            ALOG(ERR, "Failed to get hardware frame buffer", NV(err));
-            return false;
-        }
-        if (!ffScreenSessionInfo.outputAVCodecContext->hw_frames_ctx) {
-            err = AVERROR(ENOMEM);
-            return false;
-        }
-
-        // Convert from RGB to YUV
-        ffScreenSessionInfo.swsCtx = sws_getContext(ffScreenSessionInfo.outputAVCodecContext->width, ffScreenSessionInfo.outputAVCodecContext->height, 
-                                                    AV_PIX_FMT_BGR24, ffScreenSessionInfo.outputAVCodecContext->width, 
-                                                    ffScreenSessionInfo.outputAVCodecContext->height, AV_PIX_FMT_YUV420P,
-                                                    SWS_X, 0, 0, 0);
-
         // Log all FFMPEG paramters that we use for screen capture encoding
         {
             std::string ffMPEGParamsToBeLogged = " " + NVV(FrameRate, ffScreenSessionInfo.fps) + " " +
@@ -423,7 +513,11 @@ namespace CapUtils {
                                                         NVV(OutputBitrateInMB, ffScreenSessionInfo.outputBitrateInMB) + " " +
                                                         NVV(SegmentDuration, segmentDuration) + " " +
                                                         NVV(PlayListFileName, playListFileName) + " " +
-                                                        NVV(Encoder, CUDA_ENCODER);
+                                                        NVV(Encoder, getEncoderBackendString(ffScreenSessionInfo.encoderBackend)) + " " +
+                                                        NVV(EncoderChain, getEncoderBackendChainString(encoderChain)) + " " +
+                                                        NVV(EncoderThreads, encoderThreads) + " " +
+                                                        NVV(ParallelEncoders, parallelEncoders) + " " +
+                                                        NVV(ColorConvertIsa, getColorConvertIsaString(getSupportedColorConvertIsa()));
 
             ALOG(INFO, "FFMPEG params:", ffMPEGParamsToBeLogged);
         }
@@ -431,72 +525,225 @@ namespace CapUtils {
         return true;
     }
 
-    cv::Mat ScreenCapture::Impl::windowAsMatrix() {
-        cv::Mat src;
-        src.create(screenCaptureParams.resoutionHeight, screenCaptureParams.resoutionWidth, CV_8UC(8));
+    void ScreenCapture::Impl::setupFrameQueue() {
+        // Besides the queued frames, one frame can be in capture, one in encode and one held back as skipped static frame
+        const std::size_t frameCount = static_cast<std::size_t>(frameQueueCapacity) + 3;
+
+        // Buffers take the layout of the capture source, so it can write its pixels straight into them
+        framePool = std::make_unique<FramePool>(captureSource->getWidth(), captureSource->getHeight(),
+                                                captureSource->getPixelFormat(), captureSource->getRowAlignment(),
+                                                frameCount, frameCount, captureSource->getFrameAllocator());
+
+        // Grabbed region is resampled to the output resolution while being converted to YUV
+        frameScaler.reset();
+        if (grabwidth != screenCaptureParams.resoutionWidth || grabheight != screenCaptureParams.resoutionHeight) {
+            frameScaler = std::make_unique<FrameScaler>(FrameRegion{ 0, 0, grabwidth, grabheight },
+                                                        screenCaptureParams.resoutionWidth,
+                                                        screenCaptureParams.resoutionHeight, scaleFilter, convertThreads);
+        }
+        screenFrameRing = std::make_unique<SPSCRingBuffer<FrameBuffer*>>(frameQueueCapacity);
+        captureTickCount = 0;
+        droppedFrameCount = 0;
+    }
+
+    void ScreenCapture::Impl::recordDroppedFrame(int64_t timestamp, const char* reason) {
+        int64_t droppedFrames = ++droppedFrameCount;
+        ALOG(WARNING, "Dropping frame as encoder fell behind:", reason, NV(timestamp), NV(droppedFrames));
+    }
 
-        //http://msdn.microsoft.com/en-us/library/windows/window/dd183402%28v=vs.85%29.aspx
-        // use the previously created device context with the bitmap
-        SelectObject(screenGDIInfoForCapture.hwindowCompatibleDC, screenGDIInfoForCapture.hbwindow);
-        // copy from the window device context to the bitmap device context
-        //change SRCCOPY to NOTSRCCOPY for wacky colors !
+    void ScreenCapture::Impl::captureAndQueueFrame(ScreenRecordingState state) {
+        // Paused recordings keep ticking without grabbing, so the last frame lasts until grabbing resumes
+        if (recordingPaused) {
+            return;
+        }
 
-        StretchBlt(screenGDIInfoForCapture.hwindowCompatibleDC, 0, 0, screenCaptureParams.resoutionWidth, 
-                   screenCaptureParams.resoutionHeight, screenGDIInfoForCapture.hwindowDC,
-                   screenCaptureParams.topLeftX1, screenCaptureParams.topLeftY1, 
-                   srcwidth, srcheight, SRCCOPY);
+        // Recording ends with the last frame of a source that runs out of frames, as if StopRec was received
+        if (captureSource->isExhausted()) {
+            ScreenRecordingState expectedState = ScreenRecordingState::ScreenRecordingStarted;
+            if (recordingState.compare_exchange_strong(expectedState, ScreenRecordingState::ScreenRecordingAboutToStop)) {
+                ALOG(INFO, "Capture source has no more frames, stopping recording", NVV(grabbedFrames, captureSource->getGrabbedFrameCount()));
+            }
+            return;
+        }
 
-        //copy from hwindowCompatibleDC to hbwindow
-        GetDIBits(screenGDIInfoForCapture.hwindowCompatibleDC, screenGDIInfoForCapture.hbwindow, 0, 
-                  screenCaptureParams.resoutionHeight, src.data, 
-                  (BITMAPINFO*)&screenGDIInfoForCapture.bi, DIB_RGB_COLORS);
+        const int64_t tick = captureTickCount++;
+        const std::size_t queuedFrames = screenFrameRing->size();
+        if (frameRateGovernor) {
+            frameRateGovernor->recordQueueDepth(queuedFrames, screenFrameRing->capacity());
+        }
 
-        return src;
-    }
+        switch (frameDropPolicy) {
+        case FrameDropPolicy::BLOCK_PRODUCER:
+            // Only the encoding thread frees slots, so once a slot is seen free the push below cannot fail.
+            // Conversion stage notifies after each pop and stopping notifies too, the timeout only guards the rest
+            while (screenFrameRing->full()) {
+                if (recordingState != state) {
+                    return;
+                }
+                frameSlotSignal.waitFor(std::chrono::milliseconds(kFrameSlotWaitTimeoutInMs));
+            }
+            break;
+        case FrameDropPolicy::DROP_NEWEST:
+            if (queuedFrames >= screenFrameRing->capacity()) {
+                recordDroppedFrame(av_gettime(), "queue full");
+                return;
+            }
+            break;
+        case FrameDropPolicy::KEEP_EVERY_NTH:
+            if (queuedFrames >= screenFrameRing->capacity()) {
+                recordDroppedFrame(av_gettime(), "queue full");
+                return;
+            }
+            if (queuedFrames * 2 >= screenFrameRing->capacity() && (tick % keepEveryNthFrame) != 0) {
+                recordDroppedFrame(av_gettime(), "decimated");
+                return;
+            }
+            break;
+        default:
+            break;
+        }
 
-    void ScreenCapture::Impl::addFrame(uint8_t* data) {
-        int err;
+        FrameBuffer* frame = framePool->acquire();
+        if (frame == nullptr) {
+            recordDroppedFrame(av_gettime(), "frame pool exhausted");
+            return;
+        }
 
-        int inLinesize[1] = { 3 * ffScreenSessionInfo.outputAVCodecContext->width };
+        const auto grabStartTime = std::chrono::steady_clock::now();
+        if (!captureSource->grab(*frame)) {
+            ALOG(WARNING, "Failed to grab frame", NVV(captureSource, getCaptureSourceTypeString(captureSourceType)), NV(tick));
+            framePool->release(frame);
+            return;
+        }
+        encodePipeline->recordGrab(grabStartTime);
 
-        // Scale function to use uint8 data and line it up with frame context
-        sws_scale(ffScreenSessionInfo.swsCtx, (const uint8_t* const*)&data, inLinesize, 0,
-                  ffScreenSessionInfo.outputAVCodecContext->height, ffScreenSessionInfo.softwareVideoFrame->data,
-                  ffScreenSessionInfo.softwareVideoFrame->linesize);
+        // Usage is logged while recording too, so stalls on loaded machines show up when they happen
+        if (usageLogIntervalInSeconds > 0 && grabStartTime - lastUsageLogTime >= std::chrono::seconds(usageLogIntervalInSeconds)) {
+            lastUsageLogTime = grabStartTime;
+            logPipelineUsage();
+        }
 
-        // Set presentation timestamp for both software and hardware frames
-        int64_t currTime = av_gettime();
-        const AVRational codecContextTimebase = ffScreenSessionInfo.outputAVCodecContext->time_base;
-        int64_t rescaledCurrTime = av_rescale_q(currTime, { 1, 1000000 }, codecContextTimebase);
+        if (traceRecorder && !traceRecorder->recordFrame(*frame)) {
+            ALOG(ERR, "Failed to write capture trace, trace recording stopped", NVV(traceFrames, traceRecorder->getFrameCount()));
+            traceRecorder.reset();
+        }
 
-        ffScreenSessionInfo.softwareVideoFrame->pts = rescaledCurrTime;
-        ffScreenSessionInfo.hardwareOutputVideoFrame->pts = rescaledCurrTime;
+        while (!screenFrameRing->tryPush(frame)) {
+            FrameBuffer* oldestFrame = nullptr;
+            if (frameDropPolicy != FrameDropPolicy::DROP_OLDEST) {
+                // Encoding thread can only free slots, so this happens only if the policy checks above raced
+                recordDroppedFrame(frame->timestamp, "queue full");
+                framePool->release(frame);
+                return;
+            }
+            if (screenFrameRing->tryEvict(oldestFrame)) {
+                recordDroppedFrame(oldestFrame->timestamp, "replaced by newer frame");
+                framePool->release(oldestFrame);
+            }
+        }
+        encodePipeline->notifyFrameQueued();
+    }
 
-        if ((err = av_hwframe_transfer_data(ffScreenSessionInfo.hardwareOutputVideoFrame, ffScreenSessionInfo.softwareVideoFrame, 0)) < 0) {
-            ALOG(ERR, "Failed to transfer hardware frame buffer", NV(err));
-            return;
+    void ScreenCapture::Impl::logPipelineUsage() const {
+        const PipelineOccupancy occupancy = encodePipeline->getOccupancy();
+        std::string occupancyToBeLogged = " " + NVV(peakCaptureQueue, occupancy.peakCaptureQueue) + " " +
+            NVV(peakConvertQueue, occupancy.peakConvertQueue) + " " +
+            NVV(peakUploadQueue, occupancy.peakUploadQueue) + " " +
+            NVV(peakMuxQueue, occupancy.peakMuxQueue);
+        ALOG(INFO, "Pipeline occupancy:", occupancyToBeLogged);
+
+        int64_t framePoolHits = framePool->getHitCount();
+        int64_t framePoolMisses = framePool->getMissCount();
+        int64_t droppedFrames = droppedFrameCount;
+        ALOG(INFO, "Frame pool usage:", NV(framePoolHits), NV(framePoolMisses), NV(droppedFrames));
+
+        const FrameChangeStats changeStats = encodePipeline->getChangeStats();
+        if (changeStats.detectedFrames > 0) {
+            std::string changesToBeLogged = " " + NVV(detectedFrames, changeStats.detectedFrames) + " " +
+                NVV(unchangedFrames, changeStats.unchangedFrames) + " " +
+                NVV(dirtyTiles, changeStats.dirtyTiles) + " " +
+                NVV(detectedTiles, changeStats.detectedTiles) + " " +
+                NVV(skippedFrames, changeStats.skippedFrames) + " " +
+                NVV(rectFrames, changeStats.rectFrames);
+            ALOG(INFO, "Frame changes:", changesToBeLogged);
+        }
+
+        const PipelineLatencyStats latencyStats = encodePipeline->getLatencyStats();
+        const std::pair<const char*, const LatencySummary*> latencies[] = {
+            { "grab", &latencyStats.grab },
+            { "convert", &latencyStats.convert },
+            { "upload", &latencyStats.upload },
+            { "encode", &latencyStats.encode },
+            { "mux", &latencyStats.mux },
+            { "grabInterval", &latencyStats.grabInterval },
+            { "muxInterval", &latencyStats.muxInterval }
+        };
+        for (const auto& latency : latencies) {
+            const LatencySummary& summary = *latency.second;
+            if (summary.count == 0) {
+                continue;
+            }
+            std::string latencyToBeLogged = " " + NVV(stage, latency.first) + " " +
+                NVV(count, summary.count) + " " +
+                NVV(meanInUs, summary.meanInUs) + " " +
+                NVV(p50InUs, summary.p50InUs) + " " +
+                NVV(p99InUs, summary.p99InUs) + " " +
+                NVV(p999InUs, summary.p999InUs) + " " +
+                NVV(maxInUs, summary.maxInUs);
+            ALOG(INFO, "Stage latency:", latencyToBeLogged);
         }
+    }
 
-        if ((err = avcodec_send_frame(ffScreenSessionInfo.outputAVCodecContext, ffScreenSessionInfo.hardwareOutputVideoFrame)) < 0)
-        {
-            ALOG(ERR, "Failed to send frame", NV(err));
-            return;
+    bool ScreenCapture::Impl::updateFrameRate() {
+        const auto now = std::chrono::steady_clock::now();
+        if (!frameRateGovernor->isUpdateDue(now)) {
+            return false;
         }
 
-        AVPacket pkt;
-        av_init_packet(&pkt);
+        // Stages run in parallel, so the rate is limited by the slowest of them rather than by their sum
+        const PipelineLatencyStats latencyStats = encodePipeline->getLatencyStats();
+        const std::vector<GovernedStage> stages = {
+            { "grab", latencyStats.grab, 1 },
+            { "convert", latencyStats.convert, 1 },
+            { "upload", latencyStats.upload, 1 },
+            { "encode", latencyStats.encode, parallelEncoders },
+            { "mux", latencyStats.mux, 1 }
+        };
+
+        const int previousFps = frameRateGovernor->getFramesPerSecond();
+        if (!frameRateGovernor->update(now, droppedFrameCount, stages)) {
+            return false;
+        }
 
-        pkt.stream_index = ffScreenSessionInfo.outVideoStream->index;
+        const FrameRatePressure& pressure = frameRateGovernor->getPressure();
+        std::string pressureToBeLogged = " " + NVV(fromFps, previousFps) + " " +
+            NVV(toFps, frameRateGovernor->getFramesPerSecond()) + " " +
+            NVV(queueFillPercent, static_cast<int>(pressure.queueFill * 100.0)) + " " +
+            NVV(droppedFrames, pressure.droppedFrames) + " " +
+            NVV(stageLoadPercent, static_cast<int>(pressure.stageLoad * 100.0)) + " " +
+            NVV(busiestStage, pressure.busiestStage);
+        ALOG(INFO, "Changing frame rate:", pressureToBeLogged);
+        return true;
+    }
 
-        if (avcodec_receive_packet(ffScreenSessionInfo.outputAVCodecContext, &pkt) == 0)
+    std::unique_ptr<CaptureSource> ScreenCapture::Impl::createCaptureSource() const {
+        switch (captureSourceType) {
+        case CaptureSourceType::SYNTHETIC:
+            return std::make_unique<SyntheticCaptureSource>(grabwidth, grabheight, ffScreenSessionInfo.fps, syntheticSeed);
+        case CaptureSourceType::TRACE:
         {
-            if ((err = av_interleaved_write_frame(ffScreenSessionInfo.ofctx, &pkt)) < 0)
-            {
-                ALOG(ERR, "Failed to mux packet", NV(err));
-                av_packet_unref(&pkt);
-                return;
+            auto traceSource = std::make_unique<TraceCaptureSource>(traceReplayMode);
+            if (!traceSource->open(traceFileName)) {
+                ALOG(ERR, "Failed to open capture trace", NVV(traceFile, traceFileName));
+                return nullptr;
             }
-            av_packet_unref(&pkt);
+            ALOG(INFO, "Replaying capture trace", NVV(traceFrames, traceSource->getTraceFrameCount()));
+            return traceSource;
+        }
+        case CaptureSourceType::GDI:
+        default:
+            return std::make_unique<GdiCaptureSource>(screenCaptureParams.topLeftX1, screenCaptureParams.topLeftY1,
+                                                      srcwidth, srcheight, grabwidth, grabheight);
         }
     }
 
@@ -513,81 +760,71 @@ namespace CapUtils {
         return true;
     }
 
-    void ScreenCapture::Impl::produceSegmentedVideosFromScreenCapture() {
-        TimedMediaGrabber timedGrabber(ffScreenSessionInfo.fps, [&]() -> bool {
-            if (isCaptureSessionRunning() || !screenDataList.empty()) {
-                cv::Mat src;
-                std::lock_guard<std::mutex> lock(recordMutex);
-                if (!screenDataList.empty()) {
-                    src = screenDataList.front();
-                    screenDataList.pop_front();
-                    addFrame(src.data);
-                }
-                return true;
-            }
-
-            return false;
-        });
-
-        timedGrabber.start();
-        timedGrabber.setMediaCallbackType(MediaCallbackType::SYSTEM_SLEEP);
-
-        if (WaitForSingleObject(timedGrabber.getEventHandle(), INFINITE) != WAIT_OBJECT_0) {
-            ALOG(LogLevel::ERR, "WaitForSingleObject failed!", NVV(errorCode, GetLastError()));
-        }
-
-        CloseHandle(timedGrabber.getEventHandle());
-    }
-
     void ScreenCapture::Impl::startScreenRecording() {
         ScreenRecordingState state = recordingState;
 
         const auto screenGrabAndEncodeFrame = [&]() {
             if (recordingState == state) {
-                cv::Mat src = windowAsMatrix();
-                {
-                    std::lock_guard<std::mutex> lock(recordMutex);
-                    screenDataList.emplace_back(std::move(src));
-                }
+                captureAndQueueFrame(state);
                 return true;
             }
 
             return false;
         };
 
-        TimedMediaGrabber timedGrabber(ffScreenSessionInfo.fps, [&]() -> bool {
-            return screenGrabAndEncodeFrame();
-        });
-
-        //timerGrabber.setMediaCallbackType(MediaCallbackType::SYSTEM_SLEEP);
-        timedGrabber.start();
-
-        if (WaitForSingleObject(timedGrabber.getEventHandle(), INFINITE) != WAIT_OBJECT_0) {
-            ALOG(LogLevel::ERR, "WaitForSingleObject failed!", NVV(errorCode, GetLastError()));
+        if (captureSource->isSelfPaced()) {
+            // Source waits for its frames to become due by itself, so frames are grabbed back to back
+            if (adaptiveFrameRate) {
+                ALOG(INFO, "Self paced capture source keeps its own frame rate, adaptive frame rate is off");
+            }
+            while (screenGrabAndEncodeFrame()) {
+            }
         }
+        else {
+            if (adaptiveFrameRate) {
+                frameRateGovernor = std::make_unique<FrameRateGovernor>(ffScreenSessionInfo.fps,
+                                                                        std::chrono::milliseconds(frameRateWindowInMs),
+                                                                        frameRateRaiseAfterWindows);
+                frameRateGovernor->start(std::chrono::steady_clock::now());
+            }
 
-        CloseHandle(timedGrabber.getEventHandle());
+            // Grabber type is deduced from the callback, so the callback reaches the grabber through this instead
+            std::function<void(int)> setGrabRate;
+            TimedMediaGrabber timedGrabber(ffScreenSessionInfo.fps, [&]() -> bool {
+                if (!screenGrabAndEncodeFrame()) {
+                    return false;
+                }
+                // Rate changes from within the callback, so grabs after the next one follow the new rate right away
+                if (frameRateGovernor && !recordingPaused && updateFrameRate()) {
+                    setGrabRate(frameRateGovernor->getFramesPerSecond());
+                    captureSource->setFrameRate(frameRateGovernor->getFramesPerSecond());
+                }
+                return true;
+            });
+            setGrabRate = [&timedGrabber](int fps) {
+                timedGrabber.setFramesPerSecond(fps);
+            };
+
+            timedGrabber.setMediaCallbackType(grabTimerType);
+            timedGrabber.setMissedTickPolicy(missedGrabPolicy);
+            if (!timedGrabber.start()) {
+                ALOG(LogLevel::ERR, "Failed to start grab timer", NVV(timer, timedGrabber.getMediaCallbackType()));
+                return;
+            }
 
-        // FFMPEG seems to hold some of screen frames to its internal buffer. When the session is stopped, we seem to miss 
-        // slightly over a second of screen capture data at the end. To circumvent this issue, we continue to capture an extra 
-        // duration to get back those lost frames that were held by FFMPEG session before the stop command was issued.
-        state = recordingState;
-        TimedMediaGrabber timedGrabberExtraDuartion(ffScreenSessionInfo.fps, [&]() -> bool {
-            return screenGrabAndEncodeFrame();
-        }, kExtraCaptureDuration);
+            timedGrabber.waitForCompletion();
 
-        //timerGrabberExtraDuartion.setMediaCallbackType(MediaCallbackType::SYSTEM_SLEEP);
-        timedGrabberExtraDuartion.start();
-        if (WaitForSingleObject(timedGrabberExtraDuartion.getEventHandle(), INFINITE) != WAIT_OBJECT_0) {
-            ALOG(LogLevel::ERR, "WaitForSingleObject failed!", NVV(errorCode, GetLastError()));
+            // Grabs are due at absolute deadlines, lateness is how long after its deadline a grab fired
+            const TickJitterStats jitterStats = timedGrabber.getJitterStats();
+            ALOG(INFO, "Grab timer stats:", NVV(timer, timedGrabber.getMediaCallbackType()), NVV(fps, timedGrabber.getFramesPerSecond()),
+                 NVV(missedTicks, getMissedTickPolicyString(missedGrabPolicy)), NVV(grabs, jitterStats.ticks),
+                 NVV(missedGrabs, jitterStats.missedTicks), NVV(skippedGrabs, jitterStats.skippedTicks),
+                 NVV(meanLatenessInUs, jitterStats.meanLatenessInUs), NVV(stdDevLatenessInUs, jitterStats.stdDevLatenessInUs),
+                 NVV(maxLatenessInUs, jitterStats.maxLatenessInUs));
         }
-
-        CloseHandle(timedGrabberExtraDuartion.getEventHandle());
-        recordingState = ScreenRecordingState::ScreenRecordingTerminated;
     }
 
     void ScreenCapture::Impl::startCommandProcessing(std::promise<bool>&& pr) {
-        time_t stLocal = 0;
         std::once_flag promiseSet;
 
         int keepaliveFactor = 3;
@@ -625,38 +862,53 @@ namespace CapUtils {
             return true;
         };
 
+        // Commands are picked up as soon as the command file changes. Waits time out regularly for the keepalive check
+        CommandWatcher commandWatcher;
+        if (!commandWatcher.open(commandFileName)) {
+            ALOG(WARNING, "Failed to watch command file, polling it instead", NVV(commandFile, commandFileName));
+        }
+
         // Command thread will loop indefinitely until it responds to "StopRec"
-        while (true) {
-            std::time_t stCurrLocal = getLastWriteTime(commandFileName);
+        bool stopReceived = false;
+        while (!stopReceived) {
             // Check to see if we should continue based on keepAlive mechanism from L300
-            if (maxWaitTime > 0 && !shouldCaptureSessionContinue(stCurrLocal)) {
+            if (maxWaitTime > 0 && !shouldCaptureSessionContinue(getLastWriteTime(commandFileName))) {
                 recordingState = ScreenRecordingState::ScreenRecordingTerminated;
+                frameSlotSignal.notify();
                 break;
             }
 
-            if (stCurrLocal != 0 && stLocal == 0) {
-                stLocal = stCurrLocal;
-            } else if (stCurrLocal == stLocal) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                continue;
-            }
-
-            std::string line;
-            std::ifstream commandFile(commandFileName);
-
-            if (commandFile.is_open())
-            {
-                getline(commandFile, line);
-                commandFile.close();
-
-                if (line == "StartRec") {
+            for (const RecordingCommand& command : commandWatcher.waitForCommands(std::chrono::milliseconds(kCommandWaitTimeoutInMs))) {
+                switch (command.type) {
+                case RecordingCommandType::START_REC:
                     setScreenSessionState(true);
-                }
-                else if (line == "StopRec") {
-                    // We received a command to stop screen recording. Now, we must start extra capture 
-                    // session to get back previous capture buffers held by FFMPEG
-                    ALOG(INFO, "Received StopRec command to stop recording...");
+                    break;
+                case RecordingCommandType::STOP_REC:
+                    // We received a command to stop screen recording. Frames grabbed so far are still encoded
+                    // and the encoder is flushed before the session terminates
+                    ALOG(INFO, "Received StopRec command to stop recording...", NVV(sequence, command.sequence));
                     recordingState = ScreenRecordingState::ScreenRecordingAboutToStop;
+                    frameSlotSignal.notify();
+                    stopReceived = true;
+                    break;
+                case RecordingCommandType::PAUSE:
+                    ALOG(INFO, "Received Pause command to pause grabbing...", NVV(sequence, command.sequence));
+                    recordingPaused = true;
+                    break;
+                case RecordingCommandType::RESUME:
+                    ALOG(INFO, "Received Resume command to resume grabbing...", NVV(sequence, command.sequence));
+                    recordingPaused = false;
+                    break;
+                case RecordingCommandType::MARKER:
+                    // Frames carry the same clock, so the marker can be matched against the recording
+                    ALOG(INFO, "Received marker", NVV(label, command.label), NVV(sequence, command.sequence),
+                         NVV(timestamp, av_gettime()));
+                    break;
+                default:
+                    ALOG(WARNING, "Unknown command", NVV(command, command.line), NVV(sequence, command.sequence));
+                    break;
+                }
+                if (stopReceived) {
                     break;
                 }
             }
@@ -681,14 +933,40 @@ namespace CapUtils {
             if (!setupFFSessionInfo()) {
                 return false;
             }
+            setupFrameQueue();
+
+            if (!recordTraceFileName.empty()) {
+                traceRecorder = std::make_unique<CaptureTraceRecorder>();
+                if (!traceRecorder->open(recordTraceFileName, captureSource->getWidth(), captureSource->getHeight(),
+                                         captureSource->getPixelFormat())) {
+                    ALOG(ERR, "Failed to create capture trace, recording without it", NVV(recordTraceFile, recordTraceFileName));
+                    traceRecorder.reset();
+                }
+            }
 
-            // Create a consumer thread that processes screen frame and dispatches to FFMPEG to create segmented videos
-            std::thread screenThread(&ScreenCapture::Impl::produceSegmentedVideosFromScreenCapture, this);
+            // Start convert, upload, encode and mux stage threads that turn queued screen frames into segmented videos
+            encodePipeline = std::make_unique<EncodePipeline>(ffScreenSessionInfo, *screenFrameRing, frameSlotSignal, *framePool,
+                                                              convertThreads, frameScaler.get(), detectChanges, maxStaticFrameIntervalInMs,
+                                                              parallelEncoders);
+            if (!encodePipeline->start()) {
+                encodePipeline.reset();
+                return false;
+            }
             // Create a producer thread that grabs screen from GDI and pushes it to a queue for FFMPEG to process
+            lastUsageLogTime = std::chrono::steady_clock::now();
             std::thread recordThread(&ScreenCapture::Impl::startScreenRecording, this);
 
             recordThread.join();
-            screenThread.join();
+            if (traceRecorder) {
+                traceRecorder->close();
+                ALOG(INFO, "Capture trace written:", NVV(traceFrames, traceRecorder->getFrameCount()),
+                     NVV(traceBytes, traceRecorder->getWrittenBytes()), NVV(traceDroppedFrames, traceRecorder->getDroppedFrames()));
+                traceRecorder.reset();
+            }
+            // Encode every queued frame and flush the encoder, so the last frame grabbed before stop is in the output
+            encodePipeline->finish();
+            logPipelineUsage();
+            recordingState = ScreenRecordingState::ScreenRecordingTerminated;
         }
 
         return recordingSet;
@@ -697,5 +975,6 @@ namespace CapUtils {
     void ScreenCapture::Impl::stop() {
         ALOG(INFO, "Stopping a timed capture recording...");
         recordingState = ScreenRecordingState::ScreenRecordingAboutToStop;
+        frameSlotSignal.notify();
     }
 }
@@ -2,14 +2,23 @@
 
 #include "ScreenCapture.hpp"
 #include "LogUtil.hpp"
+#include "SPSCRingBuffer.hpp"
+#include "FramePool.hpp"
+#include "FrameScaler.hpp"
+#include "CaptureSource.hpp"
+#include "CaptureTraceRecorder.hpp"
+#include "EncoderBackend.hpp"
+#include "FrameRateGovernor.hpp"
+#include "StageSignal.hpp"
+#include "TraceCaptureSource.hpp"
+#include "TimedMediaGrabber.hpp"
 
 #include <iostream>
 #include <atomic>
 #include <thread>
 #include <future>
-#include <deque>
+#include <vector>
 
-#include <opencv2/opencv.hpp>
 #include <libavcodec/d3d11va.h>
 #include <libavutil/hwcontext_d3d11va.h>
 
@@ -35,6 +44,8 @@ namespace CapUtils {
 
     AVD3D11VAContext* av_d3d11va_alloc_context2(void);
 
+    class EncodePipeline;
+
     /*
     * Datastructure to hold collection of FFMPEG session parameters that are used to generate segmented transport streams.
     */
@@ -53,8 +64,9 @@ namespace CapUtils {
         AVDictionary* avDict = nullptr;
         AVBufferRef* hardwareEncodeDeviceContext = nullptr;
         AVBufferRef* hardwareOutputFramesRef = nullptr;
+        EncoderBackend encoderBackend = EncoderBackend::NVENC; // Backend the codec context was opened with
+        EncoderSettings encoderSettings; // Settings the codec context was opened with
 
-        int64_t prev_pts = 0;
         int64_t time_counter = 0;
         int64_t frameCounter = 0;
         int fps = 30;
@@ -97,30 +109,53 @@ namespace CapUtils {
         int bottomRightY2 = 0;
     };
 
-    /*
-    * Datastructure to hold handles and device context related to GDI for screen capture.
-    */
-    struct ScreenGDIInfoForCapture {
-        HWND hwndDesktop = nullptr;
-        HDC hwindowDC = nullptr;
-        HDC hwindowCompatibleDC = nullptr;
-        HBITMAP hbwindow = nullptr;
-        BITMAPINFOHEADER  bi;
-    };
-
     /*
     * Datastructure to hold different state values for screen recording.
     */
     enum class ScreenRecordingState {
         ScreenRecordingNotStarted, // Uninitailized state for recording
         ScreenRecordingStarted, // We received StartRec command to start the recording
-        ScreenRecordingAboutToStop, // We received StopRec coommand, but we have to do extra recording to recover lost buffers with FFMPEG
+        ScreenRecordingAboutToStop, // We received StopRec coommand, grabbing stops while queued frames are encoded and the encoder is flushed
         ScreenRecordingTerminated // We finally terminate FFMPEG session
     };
 
-    constexpr auto CUDA_ENCODER = "h264_nvenc";
+    /*
+    * Policy applied by the screen recording thread when the encoder cannot keep up and the frame queue is full.
+    */
+    enum class FrameDropPolicy {
+        BLOCK_PRODUCER = 0, // Wait for the encoder to free a slot before grabbing the next frame
+        DROP_OLDEST = 1,    // Replace the oldest queued frame with the newly grabbed one
+        DROP_NEWEST = 2,    // Skip grabbing new frames until a slot is free
+        KEEP_EVERY_NTH = 3  // Once the queue is half full, grab only every Nth frame. Drop newest when full
+    };
 
-    constexpr int kExtraCaptureDuration = 2; // Extra time duration of screen capture to continue upon receiving StopRec command
+    /**
+     * Helper function to parse frame drop policy from its config file name
+     *
+     * @param policyName
+     *     One of "block", "dropOldest", "dropNewest" or "keepEveryNth"
+     *
+     * @param policy
+     *     Receives the parsed policy
+     *
+     * @return  True if policyName is a known policy.
+     */
+    bool parseFrameDropPolicy(const std::string& policyName, FrameDropPolicy& policy);
+
+    /**
+     * Helper function to get frame drop policy in string format to be used for logging purposes
+     */
+    std::string getFrameDropPolicyString(FrameDropPolicy policy);
+
+    constexpr int kDefaultFrameQueueCapacity = 8; // Default number of captured frames that can wait for the encoder
+    constexpr int kMaxFrameQueueCapacity = 256; // Upper limit for the configurable frame queue capacity
+    constexpr int kMaxConvertThreads = 32; // Upper limit for the configurable number of color conversion threads
+    constexpr int kMaxParallelEncoders = 16; // Upper limit for the configurable number of parallel encoder instances
+    constexpr int kDefaultMaxStaticFrameIntervalInMs = 1000; // Longest time a static screen goes without an encoded frame
+    constexpr int kCommandWaitTimeoutInMs = 1000; // Longest wait for a command before the keepalive of the command file is checked
+    constexpr int kFrameSlotWaitTimeoutInMs = 100; // Longest wait of a blocked producer before it checks the recording state again
+    constexpr int kDefaultFrameRateWindowInMs = 1000; // Time over which the frame rate governor judges pipeline pressure
+    constexpr int kDefaultFrameRateRaiseAfterWindows = 5; // Windows with headroom in a row before the frame rate goes up
 
     /*
     * Screen capture implementation class to grab screen region from desktop and store it as a continuous 
@@ -211,23 +246,55 @@ namespace CapUtils {
         bool parseConfigFile();
 
         /**
-         * Internal helper function to grab desktop screen pixels. Called by addFrame method
+         * Internal helper function to create the configured capture source for the grab size
+         *
+         * @return  Capture source delivering frames of grabwidth x grabheight pixels, or of the recorded size for
+         *          trace replays. nullptr if the source cannot be opened.
+         */
+        std::unique_ptr<CaptureSource> createCaptureSource() const;
+
+        /**
+         * Internal helper function to preallocate the frame pool and the ring used to hand frames over
+         * between screen recording thread and FFMPEG encoding thread
+         */
+        void setupFrameQueue();
+
+        /**
+         * Internal helper function to grab a single frame and queue it for FFMPEG encoding thread while
+         * applying the configured frame drop policy. Called by screen recording thread on every tick.
          *
-         * @return  cv::Mat
-         *      dense numerical channel array representing pixels
+         * @param state
+         *     Recording state the grabbing session was started with. Blocking stops once state changes.
          */
-        cv::Mat windowAsMatrix();
+        void captureAndQueueFrame(ScreenRecordingState state);
 
         /**
-         * Add captured screen frame data to a segmented video transport stream through FFMPEG session
+         * Internal helper function to count and log a frame that is dropped because encoder fell behind
          *
-         * @param data
-         *     Screen pixel data captured from desktop.
+         * @param timestamp
+         *     Capture time of the dropped frame in microseconds
+         *
+         * @param reason
+         *     Short description of the drop to be logged
+         */
+        void recordDroppedFrame(int64_t timestamp, const char* reason);
+
+        /**
+         * Internal helper function to log peak stage occupancy of the encode pipeline along with frame pool usage.
+         * Called once the encode pipeline is finished.
+         */
+        void logPipelineUsage() const;
+
+        /**
+         * Internal helper function to let the frame rate governor judge the pipeline once its window is over
+         * and log the change if it picks a different rate. Called by screen recording thread on every tick.
+         *
+         * @return  True if the grab rate has to change to the one of the governor.
          */
-        void addFrame(uint8_t* data);
+        bool updateFrameRate();
 
         /**
-         * Start command processing thread to respond to start/stop of screen capture session
+         * Start command processing thread to respond to start/stop, pause/resume and marker commands of the command file
          *
          * @param pr
          *     promise object to signal caller thread whether or not to start/stop screen capture session.
@@ -248,20 +315,6 @@ namespace CapUtils {
          */
         bool setupFFSessionInfo();
 
-        /**
-         * Internal helper function to hardware context for CUDA based encoding for screen capture
-         *
-         * @return  int
-         *      Return 0 upon successful setting of hardware context; otherwise return error code
-         */
-        int setHardwareFrameContext();
-
-        /**
-         * Dedicated thread function that consumes data from Screen frame buffer queue and
-         * generates segmented mp4 video files along with a master playlist file
-         */
-        void produceSegmentedVideosFromScreenCapture();
-
         std::string configFile;  // Config JSON file that defines screen capture parameters
         std::string playListFileName; // Playlist file to be written for playback
         std::string commandFileName; // Command file to execute start/stop screen video recording
@@ -270,13 +323,46 @@ namespace CapUtils {
 
         int segmentDuration = 10; // Video segment duration that each transport stream should correspond to
         std::atomic<ScreenRecordingState> recordingState; // Atomic state flag to denote recording transition states
+        std::atomic<bool> recordingPaused{ false }; // Set by Pause and cleared by Resume command. Grabbing stops meanwhile
         int srcheight = 0; // Source screen region height
         int srcwidth = 0;  // Source screen region width
+        int grabheight = 0; // Height of grabbed frames. Source height unless GDI scales while grabbing
+        int grabwidth = 0;  // Width of grabbed frames. Source width unless GDI scales while grabbing
+        CaptureSourceType captureSourceType = CaptureSourceType::GDI; // Backend delivering grabbed frames
+        uint32_t syntheticSeed = 1; // Seed of the scene rendered by the synthetic capture source
+        std::string traceFileName; // Capture trace replayed by the trace capture source
+        TraceReplayMode traceReplayMode = TraceReplayMode::ORIGINAL_SPEED; // Pace of the trace replay
+        std::unique_ptr<CaptureSource> captureSource; // Grabs frames on the screen recording thread
+        std::string recordTraceFileName; // Capture trace every grabbed frame is written to. Empty disables recording
+        MediaCallbackType grabTimerType = DEFAULT_MEDIA_CALLBACK_TYPE; // Timer firing grabs of sources that are not self paced
+        MissedTickPolicy missedGrabPolicy = MissedTickPolicy::CATCH_UP; // What to do with grabs that could not fire in time
+        std::unique_ptr<CaptureTraceRecorder> traceRecorder; // Records grabbed frames on a writer thread of its own
 
         FFScreenSessionInfo ffScreenSessionInfo; // FMMPEG session info object to be used to output segmented streams.
         ScreenCaptureParams screenCaptureParams; // Structure to hold various Screen capture coordinates and resolution.
-        ScreenGDIInfoForCapture screenGDIInfoForCapture; // Structure to hold GDI related handles and device contexts.
-        std::deque<cv::Mat> screenDataList; // Screen frame buffer queue. This is guarded by a mutex
-        std::mutex recordMutex; // Mutex to guard Screen frame buffer queue
+        int frameQueueCapacity = kDefaultFrameQueueCapacity; // Maximum number of captured frames waiting for the encoder
+        std::unique_ptr<FramePool> framePool; // Recycled frame buffers sized to the captured pixel format
+        std::unique_ptr<SPSCRingBuffer<FrameBuffer*>> screenFrameRing; // Captured frames from recording thread to encoding thread
+        StageSignal frameSlotSignal; // Notified when a frame left screenFrameRing or recording is stopping. Waited on by BLOCK_PRODUCER
+        FrameDropPolicy frameDropPolicy = FrameDropPolicy::DROP_NEWEST; // What to do when the frame queue is full
+        int keepEveryNthFrame = 2; // Decimation factor used by FrameDropPolicy::KEEP_EVERY_NTH
+        int convertThreads = 1; // Number of threads converting a frame to YUV. Zero picks half of the available cores
+        std::vector<EncoderBackend> encoderChain = getDefaultEncoderBackendChain(); // Encoders tried in order until one opens
+        int encoderThreads = 0; // Threads of software encoders. Zero lets the encoder decide
+        int parallelEncoders = 1; // Software encoder instances encoding GOPs in parallel
+        bool scaleWhileGrabbing = false; // Let GDI StretchBlt scale to the output resolution instead of frameScaler
+        ScaleFilter scaleFilter = ScaleFilter::AREA; // Filter used by frameScaler
+        std::unique_ptr<FrameScaler> frameScaler; // Fused scale and color conversion. nullptr if grabbed frames need no scaling
+        bool detectChanges = true; // Hash tiles of grabbed frames to find what changed since the previous frame
+        int maxStaticFrameIntervalInMs = kDefaultMaxStaticFrameIntervalInMs; // Unchanged frames are skipped within this interval. Zero encodes all
+        int usageLogIntervalInSeconds = 10; // Pipeline usage and stage latencies are logged this often while recording. Zero logs once at the end
+        bool adaptiveFrameRate = false; // Lower the grab rate step by step while the pipeline cannot keep up
+        int frameRateWindowInMs = kDefaultFrameRateWindowInMs; // Time over which the frame rate governor judges pressure
+        int frameRateRaiseAfterWindows = kDefaultFrameRateRaiseAfterWindows; // Windows with headroom before the rate goes up
+        std::unique_ptr<FrameRateGovernor> frameRateGovernor; // Only touched by screen recording thread. nullptr unless adaptive
+        std::chrono::steady_clock::time_point lastUsageLogTime; // Only touched by screen recording thread
+        int64_t captureTickCount = 0; // Number of recording ticks seen by screen recording thread
+        std::atomic<int64_t> droppedFrameCount{ 0 }; // Number of frames that could not be queued because encoder fell behind
+        std::unique_ptr<EncodePipeline> encodePipeline; // Convert, upload, encode and mux stages consuming the frame queue
     };
 }
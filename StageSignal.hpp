@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace CapUtils {
+
+    /*
+    * Sticky wakeup signal for a pipeline stage thread. A notify that arrives while the stage is busy
+    * is remembered, so the stage never sleeps with work pending.
+    */
+    class StageSignal {
+
+    public:
+        void notify() {
+            {
+                std::lock_guard<std::mutex> lock(signalMutex);
+                signalled = true;
+            }
+            signalCondition.notify_one();
+        }
+
+        void waitFor(std::chrono::milliseconds timeout) {
+            std::unique_lock<std::mutex> lock(signalMutex);
+            signalCondition.wait_for(lock, timeout, [this]() { return signalled; });
+            signalled = false;
+        }
+
+    private:
+        std::mutex signalMutex;
+        std::condition_variable signalCondition;
+        bool signalled = false;
+    };
+}
@@ -0,0 +1,312 @@
+#include "SyntheticCaptureSource.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace CapUtils {
+
+    namespace {
+
+        constexpr int kBackgroundBandHeight = 16; // Background rows are equal within a band
+        constexpr int kLineHeight = 16; // Height of a text line in pixels
+        constexpr int kCellWidth = 8; // Width of a glyph cell in pixels, one bit per pixel
+        constexpr int kGlyphRows = 10; // Height of a glyph within its cell
+        constexpr int kGlyphTop = 3; // First row of a glyph within its line
+        constexpr int kGlyphCount = 64; // Glyph 0 is blank
+        constexpr int kPhaseCount = 4;
+
+        // Phases each part of the scene moves in, one bit per phase
+        constexpr int kScrollPhases = 0x3; // All moving, text only
+        constexpr int kWindowPhases = 0x5; // All moving, window and noise
+        constexpr int kNoisePhases = 0x5; // All moving, window and noise
+
+        // Colors as 32 bit BGRA words
+        constexpr uint32_t kPaperColor = 0xFFF4F1EA;
+        constexpr uint32_t kInkColor = 0xFF202830;
+        constexpr uint32_t kWindowBorderColor = 0xFF303030;
+        constexpr uint32_t kWindowTitleColor = 0xFF2060C0;
+        constexpr uint32_t kWindowBodyColor = 0xFFE0E0E0;
+        constexpr int kWindowBorder = 2;
+        constexpr int kWindowTitleHeight = 24;
+
+        inline uint64_t mix(uint64_t value) {
+            value ^= value >> 30;
+            value *= 0xBF58476D1CE4E5B9ull;
+            value ^= value >> 27;
+            value *= 0x94D049BB133111EBull;
+            return value ^ (value >> 31);
+        }
+
+        inline uint32_t* pixelRow(FrameBuffer& frame, int y) {
+            return reinterpret_cast<uint32_t*>(frame.data + static_cast<std::size_t>(y) * frame.stride);
+        }
+
+        inline void fillRect(FrameBuffer& frame, const FrameRect& rect, uint32_t color) {
+            for (int y = rect.top; y < rect.bottom; ++y) {
+                std::fill(pixelRow(frame, y) + rect.left, pixelRow(frame, y) + rect.right, color);
+            }
+        }
+
+        inline bool isEmpty(const FrameRect& rect) {
+            return rect.left >= rect.right || rect.top >= rect.bottom;
+        }
+
+        inline FrameRect intersect(const FrameRect& a, const FrameRect& b) {
+            return { std::max(a.left, b.left), std::max(a.top, b.top), std::min(a.right, b.right), std::min(a.bottom, b.bottom) };
+        }
+
+        inline bool intersects(const FrameRect& a, const FrameRect& b) {
+            return !isEmpty(intersect(a, b));
+        }
+
+        inline bool isSame(const FrameRect& a, const FrameRect& b) {
+            return a.left == b.left && a.top == b.top && a.right == b.right && a.bottom == b.bottom;
+        }
+
+        /*
+        * Position along a segment of length range when moving back and forth across it
+        */
+        inline int bounce(int64_t distance, int range) {
+            if (range <= 0) {
+                return 0;
+            }
+            const int64_t period = 2 * static_cast<int64_t>(range);
+            const int64_t position = distance % period;
+            return static_cast<int>(position <= range ? position : period - position);
+        }
+
+        inline void addDirtyRect(FrameRectMetadata& rects, const FrameRect& rect) {
+            if (!isEmpty(rect)) {
+                rects.dirtyRects.push_back(rect);
+            }
+        }
+    }
+
+    SyntheticCaptureSource::SyntheticCaptureSource(int width, int height, int fps, uint32_t seed) :
+        frameWidth(std::max(1, width)),
+        frameHeight(std::max(1, height)),
+        frameRate(std::max(1, fps)),
+        sceneSeed(seed),
+        phaseLength(static_cast<int64_t>(std::max(1, fps)) * kSyntheticPhaseSeconds) {
+        textPanel = { frameWidth / 16, frameHeight / 8, frameWidth / 16 + frameWidth / 2, frameHeight * 3 / 4 };
+        noisePanel = { frameWidth * 5 / 8, frameHeight / 2, frameWidth * 15 / 16, frameHeight * 7 / 8 };
+        windowWidth = std::max(1, frameWidth / 4);
+        windowHeight = std::max(1, frameHeight / 4);
+
+        // Horizontal gradient with darker grid lines, tinted per band
+        const int bandCount = (frameHeight + kBackgroundBandHeight - 1) / kBackgroundBandHeight;
+        backgroundBands.resize(static_cast<std::size_t>(bandCount) * frameWidth);
+        for (int band = 0; band < bandCount; ++band) {
+            for (int x = 0; x < frameWidth; ++x) {
+                const uint32_t blue = 0x30 + static_cast<uint32_t>(x) * 0x60 / frameWidth;
+                const uint32_t green = 0x40 + static_cast<uint32_t>(band * 3 & 0x3F);
+                const uint32_t red = ((x & 63) == 0 || band % 4 == 0) ? 0x28 : 0x50;
+                backgroundBands[static_cast<std::size_t>(band) * frameWidth + x] = 0xFF000000 | (red << 16) | (green << 8) | blue;
+            }
+        }
+
+        // Random 6 pixel wide shapes centered in their 8 pixel cell
+        glyphRows.assign(static_cast<std::size_t>(kGlyphCount) * kGlyphRows, 0);
+        for (int glyph = 1; glyph < kGlyphCount; ++glyph) {
+            for (int row = 0; row < kGlyphRows; ++row) {
+                glyphRows[static_cast<std::size_t>(glyph) * kGlyphRows + row] =
+                    static_cast<uint8_t>(mix((static_cast<uint64_t>(sceneSeed) << 32) ^ (glyph * kGlyphRows + row)) & 0x7E);
+            }
+        }
+    }
+
+    bool SyntheticCaptureSource::grabFrame(FrameBuffer& frame) {
+        if (frame.width != frameWidth || frame.height != frameHeight || frame.pixelFormat != FramePixelFormat::BGRA) {
+            return false;
+        }
+
+        const SceneState state = getSceneState(frameIndex);
+        renderScene(state, frame);
+
+        frame.rects.valid = true;
+        if (frameIndex == 0) {
+            frame.rects.dirtyRects.push_back({ 0, 0, frameWidth, frameHeight });
+        }
+        else {
+            describeChanges(getSceneState(frameIndex - 1), state, frame.rects);
+        }
+
+        frame.timestamp = rateChangeTimestamp + (frameIndex - rateChangeIndex) * 1000000 / frameRate;
+        ++frameIndex;
+        return true;
+    }
+
+    void SyntheticCaptureSource::setFrameRate(int fps) {
+        // Next frame keeps the timestamp it was due at, the ones after it follow the new rate
+        rateChangeTimestamp += (frameIndex - rateChangeIndex) * 1000000 / frameRate;
+        rateChangeIndex = frameIndex;
+        frameRate = std::max(1, fps);
+    }
+
+    int64_t SyntheticCaptureSource::countActiveFrames(int64_t index, int phaseMask) const {
+        if (index <= 0) {
+            return 0;
+        }
+
+        // Frames [0, index] hold whole cycles of kPhaseCount phases and a partial one
+        const int64_t cycleLength = phaseLength * kPhaseCount;
+        const int64_t wholeCycles = (index + 1) / cycleLength;
+        const int64_t remainder = (index + 1) % cycleLength;
+
+        int64_t count = 0;
+        for (int phase = 0; phase < kPhaseCount; ++phase) {
+            if (phaseMask & (1 << phase)) {
+                count += wholeCycles * phaseLength + std::min(std::max(remainder - phase * phaseLength, int64_t(0)), phaseLength);
+            }
+        }
+
+        // Frame 0 lies in the first phase, but does not move anything
+        return (phaseMask & 1) ? count - 1 : count;
+    }
+
+    SyntheticCaptureSource::SceneState SyntheticCaptureSource::getSceneState(int64_t index) const {
+        SceneState state;
+        state.scrollOffset = countActiveFrames(index, kScrollPhases) * kSyntheticScrollSpeed;
+        state.noiseStep = countActiveFrames(index, kNoisePhases);
+
+        const int64_t windowSteps = countActiveFrames(index, kWindowPhases);
+        const int windowX = bounce(windowSteps * kSyntheticWindowSpeedX, frameWidth - windowWidth);
+        const int windowY = bounce(windowSteps * kSyntheticWindowSpeedY, frameHeight - windowHeight);
+        state.window = { windowX, windowY, windowX + windowWidth, windowY + windowHeight };
+        return state;
+    }
+
+    void SyntheticCaptureSource::renderScene(const SceneState& state, FrameBuffer& frame) const {
+        for (int y = 0; y < frameHeight; ++y) {
+            std::memcpy(pixelRow(frame, y), backgroundBands.data() + static_cast<std::size_t>(y / kBackgroundBandHeight) * frameWidth,
+                        static_cast<std::size_t>(frameWidth) * sizeof(uint32_t));
+        }
+        renderTextPanel(state.scrollOffset, frame);
+        renderNoisePanel(state.noiseStep, frame);
+        renderWindow(state.window, frame);
+    }
+
+    int SyntheticCaptureSource::getGlyph(int64_t line, int column) const {
+        const int columns = (textPanel.right - textPanel.left + kCellWidth - 1) / kCellWidth;
+        const uint64_t lineHash = mix(sceneSeed ^ (static_cast<uint64_t>(line) * 0x9E3779B97F4A7C15ull));
+        if (column >= static_cast<int>(lineHash % static_cast<uint64_t>(columns + 1))) {
+            return 0;
+        }
+        const uint64_t cellHash = mix(lineHash ^ (static_cast<uint64_t>(column) * 0xC2B2AE3D27D4EB4Full));
+        if (cellHash % 7 == 0) {
+            return 0;
+        }
+        return 1 + static_cast<int>((cellHash >> 8) % (kGlyphCount - 1));
+    }
+
+    void SyntheticCaptureSource::renderTextPanel(int64_t scrollOffset, FrameBuffer& frame) const {
+        for (int y = textPanel.top; y < textPanel.bottom; ++y) {
+            const int64_t contentY = scrollOffset + (y - textPanel.top);
+            const int64_t line = contentY / kLineHeight;
+            const int glyphRow = static_cast<int>(contentY % kLineHeight) - kGlyphTop;
+            uint32_t* row = pixelRow(frame, y);
+
+            for (int cellX = textPanel.left, column = 0; cellX < textPanel.right; cellX += kCellWidth, ++column) {
+                const int glyph = (glyphRow >= 0 && glyphRow < kGlyphRows) ? getGlyph(line, column) : 0;
+                const uint8_t bits = glyphRows[static_cast<std::size_t>(glyph) * kGlyphRows + std::max(glyphRow, 0) % kGlyphRows];
+                const int cellRight = std::min(cellX + kCellWidth, textPanel.right);
+                for (int x = cellX; x < cellRight; ++x) {
+                    row[x] = ((bits >> (kCellWidth - 1 - (x - cellX))) & 1) ? kInkColor : kPaperColor;
+                }
+            }
+        }
+    }
+
+    void SyntheticCaptureSource::renderNoisePanel(int64_t noiseStep, FrameBuffer& frame) const {
+        // Slowly drifting gradients with grain on top, like a camera picture
+        const uint32_t drift = static_cast<uint32_t>(noiseStep);
+        for (int y = noisePanel.top; y < noisePanel.bottom; ++y) {
+            uint64_t grain = mix((static_cast<uint64_t>(sceneSeed) << 40) ^ (static_cast<uint64_t>(noiseStep) << 20) ^ static_cast<uint64_t>(y)) | 1;
+            uint32_t* row = pixelRow(frame, y);
+            for (int x = noisePanel.left; x < noisePanel.right; ++x) {
+                grain ^= grain << 13;
+                grain ^= grain >> 7;
+                grain ^= grain << 17;
+                const uint32_t blue = ((x + drift * 3) & 0xBF) + (grain & 0x3F);
+                const uint32_t green = ((y + drift * 2) & 0xBF) + ((grain >> 8) & 0x3F);
+                const uint32_t red = (((x + y) / 2 + drift) & 0xBF) + ((grain >> 16) & 0x3F);
+                row[x] = 0xFF000000 | (red << 16) | (green << 8) | blue;
+            }
+        }
+    }
+
+    void SyntheticCaptureSource::renderWindow(const FrameRect& window, FrameBuffer& frame) const {
+        fillRect(frame, window, kWindowBorderColor);
+
+        const FrameRect inner = { window.left + kWindowBorder, window.top + kWindowBorder,
+                                  window.right - kWindowBorder, window.bottom - kWindowBorder };
+        if (isEmpty(inner)) {
+            return;
+        }
+        const int titleBottom = std::min(inner.top + kWindowTitleHeight, inner.bottom);
+        fillRect(frame, { inner.left, inner.top, inner.right, titleBottom }, kWindowTitleColor);
+        fillRect(frame, { inner.left, titleBottom, inner.right, inner.bottom }, kWindowBodyColor);
+    }
+
+    void SyntheticCaptureSource::describeChanges(const SceneState& previous, const SceneState& current,
+                                                 FrameRectMetadata& rects) const {
+        const FrameRect& before = previous.window;
+        const FrameRect& after = current.window;
+        const bool windowMoved = !isSame(before, after);
+        const bool windowOverText = intersects(before, textPanel) || intersects(after, textPanel);
+        const int64_t scrolled = current.scrollOffset - previous.scrollOffset;
+
+        // Window dragged across the background is a move plus the area it uncovered
+        if (windowMoved && !windowOverText) {
+            FrameMoveRect move;
+            move.sourceX = before.left;
+            move.sourceY = before.top;
+            move.destination = after;
+            rects.moveRects.push_back(move);
+
+            if (!intersects(before, after)) {
+                addDirtyRect(rects, before);
+            }
+            else {
+                const int overlapTop = std::max(before.top, after.top);
+                const int overlapBottom = std::min(before.bottom, after.bottom);
+                addDirtyRect(rects, { before.left, before.top, before.right, overlapTop });
+                addDirtyRect(rects, { before.left, overlapBottom, before.right, before.bottom });
+                addDirtyRect(rects, { before.left, overlapTop, std::min(after.left, before.right), overlapBottom });
+                addDirtyRect(rects, { std::max(after.right, before.left), overlapTop, before.right, overlapBottom });
+            }
+        }
+
+        // Scrolling moves the text up and reveals new lines at the bottom of the panel
+        const int panelHeight = textPanel.bottom - textPanel.top;
+        if (scrolled > 0 && !isEmpty(textPanel)) {
+            if (scrolled < panelHeight) {
+                const int shift = static_cast<int>(scrolled);
+                FrameMoveRect move;
+                move.sourceX = textPanel.left;
+                move.sourceY = textPanel.top + shift;
+                move.destination = { textPanel.left, textPanel.top, textPanel.right, textPanel.bottom - shift };
+                rects.moveRects.push_back(move);
+                addDirtyRect(rects, { textPanel.left, textPanel.bottom - shift, textPanel.right, textPanel.bottom });
+
+                // Parts of the window on top of the text were scrolled along with it
+                if (windowOverText) {
+                    addDirtyRect(rects, intersect({ before.left, before.top - shift, before.right, before.bottom - shift }, textPanel));
+                }
+            }
+            else {
+                addDirtyRect(rects, textPanel);
+            }
+        }
+
+        // Window on top of the text is simply redrawn, its pixels may have been scrolled away
+        if (windowOverText && (windowMoved || scrolled > 0)) {
+            addDirtyRect(rects, before);
+            addDirtyRect(rects, after);
+        }
+
+        if (current.noiseStep != previous.noiseStep) {
+            addDirtyRect(rects, noisePanel);
+        }
+    }
+}
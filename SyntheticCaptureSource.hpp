@@ -0,0 +1,137 @@
+#pragma once
+
+#include "CaptureSource.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace CapUtils {
+
+    constexpr int kSyntheticScrollSpeed = 2; // Pixels the text panel scrolls per active frame
+    constexpr int kSyntheticWindowSpeedX = 5; // Pixels the window moves horizontally per active frame
+    constexpr int kSyntheticWindowSpeedY = 3; // Pixels the window moves vertically per active frame
+    constexpr int kSyntheticPhaseSeconds = 2; // Length of each phase of the scene
+
+    /*
+    * Capture source rendering a deterministic scene instead of grabbing a display, so the encode pipeline can be
+    * benchmarked and regression tested on machines without one. Frames are BGRA and every frame is a pure
+    * function of seed, size and the number of frames grabbed before it.
+    *
+    * The scene holds a scrolling text panel, a window bouncing across the screen and a panel of video like noise.
+    * It cycles through phases of kSyntheticPhaseSeconds: everything moving, only text scrolling, only the window
+    * and the noise moving, and a static screen. Each frame comes with the move and dirty rects that turn the
+    * previous frame into it, the way desktop duplication reports them: scrolls and window drags as moves, the
+    * rest as dirty rects. Timestamps follow the frame rate, starting at zero, independent of the wall clock.
+    * A frame rate change only spaces the timestamps of later frames differently, the scene still moves per frame.
+    */
+    class SyntheticCaptureSource : public CaptureSource {
+
+    public:
+
+        /**
+         * SyntheticCaptureSource constructor
+         *
+         * @param width
+         *     Width of rendered frames. Raised to 1 if smaller.
+         *
+         * @param height
+         *     Height of rendered frames. Raised to 1 if smaller.
+         *
+         * @param fps
+         *     Frame rate that timestamps and phase lengths are derived from. Raised to 1 if smaller.
+         *
+         * @param seed
+         *     Seed of the text, glyph shapes and noise. Equal seeds render equal scenes.
+         */
+        SyntheticCaptureSource(int width, int height, int fps, uint32_t seed = 1);
+
+        CaptureSourceType getType() const override {
+            return CaptureSourceType::SYNTHETIC;
+        }
+
+        int getWidth() const override {
+            return frameWidth;
+        }
+
+        int getHeight() const override {
+            return frameHeight;
+        }
+
+        FramePixelFormat getPixelFormat() const override {
+            return FramePixelFormat::BGRA;
+        }
+
+        int getRowAlignment() const override {
+            return 4;
+        }
+
+        void setFrameRate(int fps) override;
+
+    protected:
+
+        /**
+         * Render the next frame of the scene into frame along with its rects
+         */
+        bool grabFrame(FrameBuffer& frame) override;
+
+    private:
+
+        /*
+        * State of every moving part of the scene at a given frame
+        */
+        struct SceneState {
+            int64_t scrollOffset = 0; // Text panel scroll position in pixels
+            int64_t noiseStep = 0; // Number of noise updates so far
+            FrameRect window; // Window bounds
+        };
+
+        /**
+         * Internal helper function to compute the scene state after frameIndex frames
+         */
+        SceneState getSceneState(int64_t frameIndex) const;
+
+        /**
+         * Internal helper function to count the frames in [1, frameIndex] whose phase is part of phaseMask.
+         * Each of them advances the parts of the scene active in these phases by one step.
+         */
+        int64_t countActiveFrames(int64_t frameIndex, int phaseMask) const;
+
+        /**
+         * Internal helper function to draw the scene state into frame
+         */
+        void renderScene(const SceneState& state, FrameBuffer& frame) const;
+
+        void renderTextPanel(int64_t scrollOffset, FrameBuffer& frame) const;
+
+        void renderNoisePanel(int64_t noiseStep, FrameBuffer& frame) const;
+
+        void renderWindow(const FrameRect& window, FrameBuffer& frame) const;
+
+        /**
+         * Internal helper function to fill in the rects turning the frame of previous into the one of current
+         */
+        void describeChanges(const SceneState& previous, const SceneState& current, FrameRectMetadata& rects) const;
+
+        /**
+         * Internal helper function to get the glyph shown in a cell of a text line. Zero is a blank cell.
+         */
+        int getGlyph(int64_t line, int column) const;
+
+        int frameWidth = 1;
+        int frameHeight = 1;
+        int frameRate = 30;
+        uint32_t sceneSeed = 1;
+        int64_t phaseLength = 1; // Frames per phase
+
+        FrameRect textPanel; // Scrolling text
+        FrameRect noisePanel; // Video like noise
+        int windowWidth = 1;
+        int windowHeight = 1;
+
+        std::vector<uint32_t> backgroundBands; // One background row per band of rows
+        std::vector<uint8_t> glyphRows; // Bit rows of every glyph, kGlyphRows per glyph
+        int64_t frameIndex = 0; // Frame rendered by the next grab
+        int64_t rateChangeIndex = 0; // Frame the current frame rate applies from
+        int64_t rateChangeTimestamp = 0; // Timestamp of rateChangeIndex in microseconds
+    };
+}
@@ -0,0 +1,202 @@
+#include "TileHash.hpp"
+#include "ColorConvert.hpp"
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace CapUtils {
+
+    namespace {
+
+        inline uint64_t load64(const uint8_t* src) {
+            uint64_t value = 0;
+            std::memcpy(&value, src, sizeof(value));
+            return value;
+        }
+
+        inline uint64_t rotateLeft(uint64_t value, int bits) {
+            return (value << bits) | (value >> (64 - bits));
+        }
+
+        inline void accumulateStripe(const uint8_t* src, const uint64_t key[kTileHashLanes], uint64_t* acc) {
+            for (int lane = 0; lane < kTileHashLanes; ++lane) {
+                const uint64_t data = load64(src + lane * 8);
+                const uint64_t keyed = data ^ key[lane];
+                acc[lane] += data + (keyed & 0xFFFFFFFFull) * (keyed >> 32);
+            }
+        }
+
+        void hashSegment(const uint8_t* src, int byteCount, uint64_t* acc) {
+            uint64_t key[kTileHashLanes];
+            std::memcpy(key, kTileHashKeys, sizeof(key));
+
+            const auto advanceKey = [&key]() {
+                for (int lane = 0; lane < kTileHashLanes; ++lane) {
+                    key[lane] += kTileHashKeySteps[lane];
+                }
+            };
+
+            int offset = 0;
+            for (; offset + kTileHashStripeBytes <= byteCount; offset += kTileHashStripeBytes) {
+                accumulateStripe(src + offset, key, acc);
+                advanceKey();
+            }
+            if (offset < byteCount) {
+                // Zero padding is fine, segments at the same position have the same length in every frame
+                uint8_t tail[kTileHashStripeBytes] = { 0 };
+                std::memcpy(tail, src + offset, byteCount - offset);
+                accumulateStripe(tail, key, acc);
+                advanceKey();
+            }
+
+            for (int lane = 0; lane < kTileHashLanes; ++lane) {
+                acc[lane] = (acc[lane] ^ (acc[lane] >> 47) ^ key[lane]) * kTileHashScramble;
+            }
+        }
+
+        void hashTileRowScalar(const uint8_t* row, int rowBytes, int tileBytes, uint64_t* acc) {
+            for (int offset = 0; offset < rowBytes; offset += tileBytes, acc += kTileHashLanes) {
+                hashSegment(row + offset, std::min(tileBytes, rowBytes - offset), acc);
+            }
+        }
+
+        /*
+        * Fold the accumulators of a tile into its final hash
+        */
+        uint64_t finalizeTileHash(const uint64_t* acc) {
+            uint64_t hash = 0;
+            for (int lane = 0; lane < kTileHashLanes; ++lane) {
+                hash = rotateLeft((hash ^ acc[lane]) * kTileHashKeys[0], 31);
+            }
+            hash ^= hash >> 37;
+            hash *= 0x165667919E3779F9ull;
+            return hash ^ (hash >> 32);
+        }
+    }
+
+    TileHashRowFn getScalarTileHashRowFn() {
+        return hashTileRowScalar;
+    }
+
+    TileChangeDetector::TileChangeDetector(int tileSize) :
+        tile((tileSize < 8) ? 8 : ((tileSize + 1) & ~1)),
+        hashRow(getScalarTileHashRowFn()) {
+        if (getSupportedColorConvertIsa() >= ColorConvertIsa::AVX2 && getAVX2TileHashRowFn() != nullptr) {
+            hashRow = getAVX2TileHashRowFn();
+        }
+    }
+
+    int TileChangeDetector::detect(FrameBuffer& frame) {
+        prepare(frame, 1);
+        return finish(frame, hashTileRows(frame, 0, frame.changes.rows, accumulators.data()));
+    }
+
+    int TileChangeDetector::detect(FrameBuffer& frame, WorkerPool& workerPool) {
+        const int tileRows = (frame.height + tile - 1) / tile;
+        const int bandCount = std::max(1, std::min(workerPool.getThreadCount(), tileRows));
+        prepare(frame, bandCount);
+
+        const std::size_t accumulatorsPerBand = static_cast<std::size_t>(frame.changes.columns) * kTileHashLanes;
+        workerPool.run(bandCount, [&](int band) {
+            bandDirtyTileCounts[band] = hashTileRows(frame, band * tileRows / bandCount, (band + 1) * tileRows / bandCount,
+                                                     accumulators.data() + band * accumulatorsPerBand);
+        });
+
+        int dirtyTileCount = 0;
+        for (int band = 0; band < bandCount; ++band) {
+            dirtyTileCount += bandDirtyTileCounts[band];
+        }
+        return finish(frame, dirtyTileCount);
+    }
+
+    int TileChangeDetector::markRects(FrameBuffer& frame) {
+        prepare(frame, 1);
+
+        FrameChangeMap& changes = frame.changes;
+        const auto markTiles = [&](const FrameRect& rect) {
+            const int left = std::max(rect.left, 0);
+            const int top = std::max(rect.top, 0);
+            const int right = std::min(rect.right, width);
+            const int bottom = std::min(rect.bottom, height);
+            if (left >= right || top >= bottom) {
+                return;
+            }
+            for (int ty = top / tile; ty <= (bottom - 1) / tile; ++ty) {
+                std::fill(changes.dirtyTiles.begin() + static_cast<std::size_t>(ty) * changes.columns + left / tile,
+                          changes.dirtyTiles.begin() + static_cast<std::size_t>(ty) * changes.columns + (right - 1) / tile + 1, 1);
+            }
+        };
+        for (const auto& move : frame.rects.moveRects) {
+            markTiles(move.destination);
+        }
+        for (const auto& dirty : frame.rects.dirtyRects) {
+            markTiles(dirty);
+        }
+
+        const int dirtyTileCount = static_cast<int>(std::count(changes.dirtyTiles.begin(), changes.dirtyTiles.end(), 1));
+        changes.dirtyTileCount = dirtyTileCount;
+        changes.unchanged = dirtyTileCount == 0;
+        hasPrevious = false;
+        return dirtyTileCount;
+    }
+
+    void TileChangeDetector::prepare(FrameBuffer& frame, int bandCount) {
+        if (frame.width != width || frame.height != height || frame.pixelFormat != pixelFormat) {
+            width = frame.width;
+            height = frame.height;
+            pixelFormat = frame.pixelFormat;
+            hasPrevious = false;
+        }
+
+        const int columns = (width + tile - 1) / tile;
+        const int rows = (height + tile - 1) / tile;
+        const std::size_t tileCount = static_cast<std::size_t>(columns) * rows;
+
+        previousHashes.resize(tileCount);
+        accumulators.resize(static_cast<std::size_t>(bandCount) * columns * kTileHashLanes);
+        bandDirtyTileCounts.assign(bandCount, 0);
+
+        FrameChangeMap& changes = frame.changes;
+        changes.detected = true;
+        changes.tileSize = tile;
+        changes.columns = columns;
+        changes.rows = rows;
+        changes.dirtyTiles.assign(tileCount, 0);
+    }
+
+    int TileChangeDetector::hashTileRows(FrameBuffer& frame, int tileRowBegin, int tileRowEnd, uint64_t* acc) {
+        const int bytesPerPixel = getBytesPerPixel(frame.pixelFormat);
+        const int columns = frame.changes.columns;
+        uint8_t* dirtyTiles = frame.changes.dirtyTiles.data();
+
+        int dirtyTileCount = 0;
+        for (int ty = tileRowBegin; ty < tileRowEnd; ++ty) {
+            std::fill(acc, acc + static_cast<std::size_t>(columns) * kTileHashLanes, 0);
+
+            const int rowEnd = std::min((ty + 1) * tile, height);
+            for (int y = ty * tile; y < rowEnd; ++y) {
+                hashRow(frame.data + static_cast<std::size_t>(y) * frame.stride, width * bytesPerPixel,
+                        tile * bytesPerPixel, acc);
+            }
+
+            for (int tx = 0; tx < columns; ++tx) {
+                const std::size_t index = static_cast<std::size_t>(ty) * columns + tx;
+                const uint64_t hash = finalizeTileHash(acc + static_cast<std::size_t>(tx) * kTileHashLanes);
+                if (!hasPrevious || hash != previousHashes[index]) {
+                    dirtyTiles[index] = 1;
+                    ++dirtyTileCount;
+                }
+                previousHashes[index] = hash;
+            }
+        }
+        return dirtyTileCount;
+    }
+
+    int TileChangeDetector::finish(FrameBuffer& frame, int dirtyTileCount) {
+        frame.changes.dirtyTileCount = dirtyTileCount;
+        frame.changes.unchanged = hasPrevious && dirtyTileCount == 0;
+        hasPrevious = true;
+        return dirtyTileCount;
+    }
+}
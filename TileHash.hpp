@@ -0,0 +1,128 @@
+#pragma once
+
+#include "FramePool.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace CapUtils {
+
+    class WorkerPool;
+
+    constexpr int kDefaultChangeTileSize = 64; // Tile edge in pixels used to detect changes between frames
+    constexpr int kTileHashLanes = 4; // 64 bit accumulators per tile, one per 8 bytes of a 32 byte stripe
+    constexpr int kTileHashStripeBytes = kTileHashLanes * 8; // Bytes folded into the accumulators at once
+
+    /*
+    * Hash constants shared by all row kernels. Each stripe of a segment is mixed with its own key, starting at
+    * kTileHashKeys and advancing by kTileHashKeySteps, so moving pixels around within a tile changes its hash.
+    */
+    constexpr uint64_t kTileHashKeys[kTileHashLanes] = {
+        0x9E3779B185EBCA87ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x85EBCA77C2B2AE63ull
+    };
+    constexpr uint64_t kTileHashKeySteps[kTileHashLanes] = {
+        0x27D4EB2F165667C5ull, 0x94D049BB133111EBull, 0xBF58476D1CE4E5B9ull, 0xD6E8FEB86659FD93ull
+    };
+    constexpr uint64_t kTileHashScramble = 0x9E3779B1ull; // 32 bit multiplier scrambling accumulators after each segment
+
+    /*
+    * Kernel hashing one pixel row of every tile in a tile row.
+    * The row is split into segments of tileBytes, the last one may be shorter. Each segment is folded into the
+    * kTileHashLanes accumulators of its tile at acc + tileIndex * kTileHashLanes.
+    * Every instruction set must produce the same accumulators as the scalar kernel.
+    */
+    using TileHashRowFn = void(*)(const uint8_t* row, int rowBytes, int tileBytes, uint64_t* acc);
+
+    /*
+    * Row kernels for each instruction set. SIMD kernels return nullptr if they are not part of this build.
+    */
+    TileHashRowFn getScalarTileHashRowFn();
+    TileHashRowFn getAVX2TileHashRowFn();
+
+    /*
+    * Detects which tiles of a frame changed since the previous frame by hashing every tile and comparing the hash
+    * with the one of the previous frame. Meant for capture paths without dirty rect metadata, like GDI.
+    * Hashing reads each pixel once with a multiply accumulate per 8 bytes. With the AVX2 kernel it costs less than a
+    * SIMD color conversion of the frame, the scalar kernel costs about as much as one.
+    * A hash collision would hide a change of a single tile for a single frame.
+    */
+    class TileChangeDetector {
+
+    public:
+        /**
+         * TileChangeDetector constructor
+         *
+         * @param tileSize
+         *     Tile edge in pixels. Values below 8 are raised to 8 and odd values are rounded up.
+         */
+        explicit TileChangeDetector(int tileSize = kDefaultChangeTileSize);
+
+        /**
+         * Hash the tiles of frame, compare them with the previous frame and fill in frame.changes.
+         * The first frame, and every frame after a change of size or pixel format, has every tile marked dirty.
+         *
+         * @param frame
+         *     Frame to be checked. Its change map is resized to the tile grid of the frame.
+         *
+         * @return  Number of dirty tiles.
+         */
+        int detect(FrameBuffer& frame);
+
+        /**
+         * Same as detect, with bands of tile rows hashed in parallel on workerPool
+         */
+        int detect(FrameBuffer& frame, WorkerPool& workerPool);
+
+        /**
+         * Fill in frame.changes from the move and dirty rects the capture source reported for frame, instead of
+         * hashing. Only valid if the rects describe the change since the last frame passed to this detector.
+         * Hashes of earlier frames no longer describe the previous frame afterwards, so the next detect call
+         * reports every tile as dirty.
+         *
+         * @return  Number of dirty tiles.
+         */
+        int markRects(FrameBuffer& frame);
+
+        /*
+        * Forget the previous frame, so the next one is reported as changed everywhere
+        */
+        void reset() {
+            hasPrevious = false;
+        }
+
+        int getTileSize() const {
+            return tile;
+        }
+
+    private:
+
+        /**
+         * Internal helper function to reset the change map of frame and the hash state for the tile grid of frame
+         */
+        void prepare(FrameBuffer& frame, int bandCount);
+
+        /**
+         * Internal helper function to hash tile rows [tileRowBegin, tileRowEnd) and mark the changed tiles
+         *
+         * @return  Number of dirty tiles within these tile rows.
+         */
+        int hashTileRows(FrameBuffer& frame, int tileRowBegin, int tileRowEnd, uint64_t* acc);
+
+        /**
+         * Internal helper function to complete the change map once every tile row is hashed
+         */
+        int finish(FrameBuffer& frame, int dirtyTileCount);
+
+        int tile = kDefaultChangeTileSize;
+        TileHashRowFn hashRow = nullptr; // Best row kernel for this CPU
+
+        int width = 0; // Width of the previous frame
+        int height = 0; // Height of the previous frame
+        FramePixelFormat pixelFormat = FramePixelFormat::BGR24; // Pixel format of the previous frame
+        bool hasPrevious = false; // Previous hashes belong to a frame of the current size and format
+
+        std::vector<uint64_t> previousHashes; // One hash per tile of the previous frame
+        std::vector<uint64_t> accumulators; // Hash state of the tile row being hashed, one set per band
+        std::vector<int> bandDirtyTileCounts; // Dirty tiles found by each band
+    };
+}
@@ -0,0 +1,69 @@
+#include "TileHash.hpp"
+
+// This file must be compiled with AVX2 enabled (/arch:AVX2), otherwise the kernel is left out of the build
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace CapUtils {
+
+    namespace {
+
+        inline __m256i accumulateStripe(__m256i acc, __m256i data, __m256i key) {
+            const __m256i keyed = _mm256_xor_si256(data, key);
+            const __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+            return _mm256_add_epi64(acc, _mm256_add_epi64(data, product));
+        }
+
+        void hashSegment(const uint8_t* src, int byteCount, uint64_t* accOut) {
+            const __m256i keyStep = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(kTileHashKeySteps));
+            __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(kTileHashKeys));
+            __m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(accOut));
+
+            int offset = 0;
+            for (; offset + kTileHashStripeBytes <= byteCount; offset += kTileHashStripeBytes) {
+                acc = accumulateStripe(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + offset)), key);
+                key = _mm256_add_epi64(key, keyStep);
+            }
+            if (offset < byteCount) {
+                uint8_t tail[kTileHashStripeBytes] = { 0 };
+                std::memcpy(tail, src + offset, byteCount - offset);
+                acc = accumulateStripe(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail)), key);
+                key = _mm256_add_epi64(key, keyStep);
+            }
+
+            // 64 bit multiply by a 32 bit constant out of two 32 x 32 bit products
+            acc = _mm256_xor_si256(_mm256_xor_si256(acc, _mm256_srli_epi64(acc, 47)), key);
+            const __m256i scramble = _mm256_set1_epi64x(static_cast<long long>(kTileHashScramble));
+            const __m256i low = _mm256_mul_epu32(acc, scramble);
+            const __m256i high = _mm256_mul_epu32(_mm256_srli_epi64(acc, 32), scramble);
+            acc = _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(accOut), acc);
+        }
+
+        void hashTileRowAVX2(const uint8_t* row, int rowBytes, int tileBytes, uint64_t* acc) {
+            for (int offset = 0; offset < rowBytes; offset += tileBytes, acc += kTileHashLanes) {
+                hashSegment(row + offset, std::min(tileBytes, rowBytes - offset), acc);
+            }
+        }
+    }
+
+    TileHashRowFn getAVX2TileHashRowFn() {
+        return hashTileRowAVX2;
+    }
+}
+
+#else
+
+namespace CapUtils {
+
+    TileHashRowFn getAVX2TileHashRowFn() {
+        return nullptr;
+    }
+}
+
+#endif
@@ -1,10 +1,25 @@
 #pragma once
+#ifdef _WIN32
 #include <Windows.h>
+#endif
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
 
+#include "DeadlineScheduler.hpp"
 #include "LogUtil.hpp"
+#include "TimerService.hpp"
 using namespace LogUtils;
 
+#ifdef _WIN32
+#define TIMER_CALLBACK_CONVENTION _stdcall
+#else
+#define TIMER_CALLBACK_CONVENTION
+#endif
+
 namespace CapUtils {
 
     // Default to 30 frames per second;
@@ -12,20 +27,52 @@ namespace CapUtils {
 
     /*
     * enum class to set calback type for the timed media grabbing session. This needs to be set before starting a session
-    * Multimedia timer type will instatiate windows multimedia timer to fire callbacks at precise intervals
-    * Sleep based callback will default to system sleep in milliseconds based on the frequency
+    * Multimedia timer type will instatiate a windows timer queue timer, rearmed after every callback for the next deadline
+    * Sleep based callback will run a dedicated thread sleeping until each deadline, available on every platform
+    * Shared timer type will register with the process wide TimerService, which wakes up once for all grabbers due together
     */
     enum class MediaCallbackType {
         UNKNOWN_CALLBACK = 0,
         MULTIMEDIA_TIMER = 1,
-        SYSTEM_SLEEP = 2
+        SYSTEM_SLEEP = 2,
+        SHARED_TIMER = 3
     };
 
+    constexpr auto DEFAULT_MEDIA_CALLBACK_TYPE = MediaCallbackType::SHARED_TIMER;
+
+    /**
+     * Helper function to parse callback type from its config file name
+     *
+     * @param callbackTypeName
+     *     One of "shared", "timerQueue" or "sleep"
+     *
+     * @param callbackType
+     *     Receives the parsed callback type
+     *
+     * @return  True if callbackTypeName is a known callback type.
+     */
+    inline bool parseMediaCallbackType(const std::string& callbackTypeName, MediaCallbackType& callbackType) {
+        if (callbackTypeName == "shared") {
+            callbackType = MediaCallbackType::SHARED_TIMER;
+        }
+        else if (callbackTypeName == "timerQueue") {
+            callbackType = MediaCallbackType::MULTIMEDIA_TIMER;
+        }
+        else if (callbackTypeName == "sleep") {
+            callbackType = MediaCallbackType::SYSTEM_SLEEP;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
     /*
     * Templated multimedia timer class to handle  media or screen grabbing in a periodic manner.
     * Custom callback is passed as input parameter to the class object for periodic execution.
     * This calss can be configured to fire updates either through multimedia based timer or
-    * through system sleep.
+    * through system sleep. Either way callbacks fire at the absolute deadlines of a DeadlineScheduler,
+    * so a 30 fps grabber fires exactly 30 times a second however long it runs.
     */
     template<typename Callback>
     class TimedMediaGrabber {
@@ -49,24 +96,49 @@ namespace CapUtils {
          */
         TimedMediaGrabber(int fps, Callback&& callback, int timeDuration = 0, int grabFactor = 1) :
             timerCallback(std::move(callback)),
-            mediaCaptureDurationInSeconds(timeDuration) {
-            int factoredFps = grabFactor * fps;
-            factoredFps = (factoredFps > 0 && factoredFps <= 1000) ? factoredFps : DEFAULT_MEDIA_FPS;
-            frequency = 1000 / factoredFps;
+            mediaCaptureDurationInSeconds(timeDuration),
+            scheduler(((grabFactor * fps) > 0 && (grabFactor * fps) <= 1000) ? grabFactor * fps : DEFAULT_MEDIA_FPS,
+                      MissedTickPolicy::CATCH_UP) {
         }
 
         /**
          * Cleanup of multimedia timer upon scope exit
          */
         ~TimedMediaGrabber() {
-            deleteTimer();
+            timerRunState = false;
+            if (callbackHandlerThread.joinable()) {
+                callbackHandlerThread.join();
+            }
+            if (sharedTimerId != 0) {
+                TimerService::getShared().removeTimer(sharedTimerId);
+            }
+            deleteTimerQueue();
         }
 
         /**
-         * Get the frequency of timed callbacks in milliseconds
+         * Get the frequency of timed callbacks in milliseconds, rounded down. Deadlines themselves are not rounded
          */
         int getFrequency() const {
-            return frequency;
+            return 1000 / scheduler.getTicksPerSecond();
+        }
+
+        int getFramesPerSecond() const {
+            return scheduler.getTicksPerSecond();
+        }
+
+        /**
+         * Change the rate of the callbacks. The next callback fires when it was due anyway, the ones after it at the
+         * new rate. Sessions limited in duration still end on time.
+         * Must be called from the callback itself or before start, as the timer takes the next deadline right after it
+         *
+         * @param  fps
+         *     New callback rate. Values outside 1 - 1000 are clamped
+         */
+        void setFramesPerSecond(int fps) {
+            scheduler.setTicksPerSecond(fps);
+            if (maxTickCount > 0) {
+                maxTickCount = scheduler.getTicksWithin(std::chrono::seconds(mediaCaptureDurationInSeconds) - std::chrono::nanoseconds(1));
+            }
         }
 
         /*
@@ -86,38 +158,50 @@ namespace CapUtils {
          * @return  True if multimedia timer is setup properly.
          */
         bool start() {
-            // Use an event object to track the TimerRoutine execution
-            doneEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-            if (doneEvent == nullptr)
             {
-                ALOG(LogLevel::ERR, "CreateEvent failed!", NVV(errorCode, GetLastError()));
-                return false;
+                std::lock_guard<std::mutex> lock(doneMutex);
+                grabbingDone = false;
             }
 
-            startTimePoint = std::chrono::steady_clock::now();
+            // Callbacks of a limited session stop after exactly fps x duration ticks
+            scheduler.start();
+            maxTickCount = (mediaCaptureDurationInSeconds > 0) ?
+                scheduler.getTicksWithin(std::chrono::seconds(mediaCaptureDurationInSeconds) - std::chrono::nanoseconds(1)) : 0;
 
+            timerRunState = true;
+#ifdef _WIN32
             if (mediaCallbackType == MediaCallbackType::MULTIMEDIA_TIMER) {
-                return setupMultimediaTimer();
-            }
-            else if (mediaCallbackType == MediaCallbackType::SYSTEM_SLEEP) {
-                timerRunState = true;
-                callbackHandlerThread = std::thread{ &runSleepBasedCallback, this };
-
-                if (callbackHandlerThread.joinable()) {
-                    callbackHandlerThread.detach();
+                if (!setupMultimediaTimer()) {
+                    timerRunState = false;
+                    return false;
                 }
+                return true;
             }
-
+#endif
+            if (mediaCallbackType == MediaCallbackType::SHARED_TIMER) {
+                sharedTimerId = TimerService::getShared().addTimer(scheduler, [this]() {
+                    callbackRoutine(this, 1);
+                    return timerRunState.load();
+                });
+                return true;
+            }
+            callbackHandlerThread = std::thread{ &runSleepBasedCallback, this };
             return true;
         }
 
         /**
-         * Signal a client that is waiting on this handle for timer completion
-         *
-         * @return  Handle to the timer event.
+         * Block until the callback asked to stop or the duration of the session is over
          */
-        const HANDLE& getEventHandle() const {
-            return doneEvent;
+        void waitForCompletion() {
+            std::unique_lock<std::mutex> lock(doneMutex);
+            doneCondition.wait(lock, [this]() { return grabbingDone; });
+        }
+
+        /**
+         * Get the timing statistics of the callbacks fired so far. Only meaningful once grabbing is done
+         */
+        TickJitterStats getJitterStats() const {
+            return scheduler.getJitterStats();
         }
 
         /**
@@ -131,6 +215,16 @@ namespace CapUtils {
             mediaCallbackType = callbackType;
         }
 
+        /**
+         * Set what happens to callbacks whose deadline passed while the previous callback was still running
+         *
+         * @param  policy
+         *     Either fire them back to back or drop them. Needs to be set before starting a session
+         */
+        void setMissedTickPolicy(MissedTickPolicy policy) {
+            scheduler.setMissedTickPolicy(policy);
+        }
+
         /**
          * Get the type of timer callback in string format to be used for logging purposes.
          *
@@ -144,6 +238,9 @@ namespace CapUtils {
             else if (mediaCallbackType == MediaCallbackType::SYSTEM_SLEEP) {
                 result = "SYSTEM_SLEEP";
             }
+            else if (mediaCallbackType == MediaCallbackType::SHARED_TIMER) {
+                result = "SHARED_TIMER";
+            }
             return result;
         }
 
@@ -159,29 +256,40 @@ namespace CapUtils {
      *   Internally set by the multimedia timer
         *
         */
-        static void _stdcall callbackRoutine(void* param, BOOLEAN timerOrWait) {
+        static void TIMER_CALLBACK_CONVENTION callbackRoutine(void* param, unsigned char timerOrWait) {
             auto callbackObj = static_cast<TimedMediaGrabber<Callback>*>(param);
-            bool result = callbackObj->timerCallback();
 
-            if (!result) {
-                if (callbackObj->mediaCallbackType == MediaCallbackType::MULTIMEDIA_TIMER) {
-                    callbackObj->deleteTimer();
-                }
-                callbackObj->timerRunState = false;
-                SetEvent(callbackObj->doneEvent);
+            // Callbacks of a grabber must never overlap and always run on a single thread at a time. Timer queue
+            // timers fire once and are only rearmed below, so this merely guards against a tick racing with stop.
+            if (callbackObj->callbackInProgress.exchange(true, std::memory_order_acquire)) {
+                return;
             }
-            else if (callbackObj->mediaCaptureDurationInSeconds > 0) {
-                auto timeDifference = std::chrono::duration_cast<std::chrono::milliseconds>(
-                    std::chrono::steady_clock::now() - callbackObj->startTimePoint).count();
-
-                if (timeDifference >= (callbackObj->mediaCaptureDurationInSeconds * 1000)) {
-                    if (callbackObj->mediaCallbackType == MediaCallbackType::MULTIMEDIA_TIMER) {
-                        callbackObj->deleteTimer();
-                    }
-                    callbackObj->timerRunState = false;
-                    SetEvent(callbackObj->doneEvent);
-                }
+
+            const uint64_t tick = callbackObj->scheduler.takeTick();
+            bool result = callbackObj->timerRunState && callbackObj->timerCallback();
+
+            if (result && callbackObj->maxTickCount > 0) {
+                result = (tick + 1 < callbackObj->maxTickCount);
+            }
+
+#ifdef _WIN32
+            if (result && callbackObj->mediaCallbackType == MediaCallbackType::MULTIMEDIA_TIMER) {
+                result = callbackObj->scheduleNextTimer();
+            }
+#endif
+
+            if (result) {
+                callbackObj->callbackInProgress.store(false, std::memory_order_release);
+                return;
+            }
+
+            // Leave callbackInProgress set so that any tick still pending in the timer queue is skipped
+            callbackObj->timerRunState = false;
+            {
+                std::lock_guard<std::mutex> lock(callbackObj->doneMutex);
+                callbackObj->grabbingDone = true;
             }
+            callbackObj->doneCondition.notify_all();
         }
 
         /*
@@ -191,14 +299,16 @@ namespace CapUtils {
      *   TimedMediaGrabber instance passed as param to this dedicated
         *
         */
-        static void _stdcall runSleepBasedCallback(void* param) {
+        static void runSleepBasedCallback(void* param) {
             const auto callbackObj = static_cast<TimedMediaGrabber<Callback>*>(param);
             while (callbackObj->timerRunState) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(callbackObj->getFrequency()));
+                callbackObj->scheduler.waitForNextTick();
                 callbackRoutine(param, 1);
             }
         }
 
+#ifdef _WIN32
+
         /*
       * Helper function to setup multimedia timer from the OS to start executing periodic callbacks through the timer
         */
@@ -210,48 +320,76 @@ namespace CapUtils {
                 return false;
             }
 
+            return scheduleNextTimer();
+        }
+
+        /*
+        * Helper function to arm a one shot timer for the next deadline. Due times are whole milliseconds, so they are
+        * rounded up and a tick fires less than a millisecond late instead of early. The deadline itself is absolute,
+        * so the rounding never adds up. Called from the callback of the previous timer, which is deleted here.
+        */
+        bool scheduleNextTimer() {
+            const int64_t timeUntilNextTick = scheduler.getTimeUntilNextTick().count();
+            const DWORD dueTime = static_cast<DWORD>((timeUntilNextTick + 999999) / 1000000);
+
+            HANDLE firedTimer = newTimer;
+            newTimer = nullptr;
             if (!CreateTimerQueueTimer(&newTimer, timerQueue, callbackRoutine,
-                this, 0, frequency, 0))
+                this, dueTime, 0, WT_EXECUTEONLYONCE))
             {
                 ALOG(LogLevel::ERR, "CreateTimerQueueTimer failed!", NVV(errorCode, GetLastError()));
-                return false;
+                newTimer = nullptr;
             }
 
-            return true;
+            if (firedTimer != nullptr && !DeleteTimerQueueTimer(timerQueue, firedTimer, NULL)) {
+                DWORD errorCode = GetLastError();
+
+                // Do not flag ERROR_IO_PENDING as error as we get this error while we are running the timer.
+                if (errorCode != ERROR_IO_PENDING) {
+                    ALOG(LogLevel::ERR, "DeleteTimerQueueTimer failed!", NV(errorCode));
+                }
+            }
+
+            return newTimer != nullptr;
         }
+#endif
 
         /*
-      * Helper function to delete the multimedia timer based on application state
+      * Helper function to delete the multimedia timer queue along with its timer. Waits for a running callback
+        * to return, so it must not be called from a callback.
         */
-        void deleteTimer() {
-            if (newTimer != nullptr) {
-                if (!DeleteTimerQueueTimer(timerQueue, newTimer, NULL)) {
-                    DWORD errorCode = GetLastError();
-
-                    // Do not flag ERROR_IO_PENDING as error as we get this error while we are running the timer.
-                    if (errorCode != ERROR_IO_PENDING) {
-                        ALOG(LogLevel::ERR, "DeleteTimerQueue failed!", NV(errorCode));
-                    }
+        void deleteTimerQueue() {
+#ifdef _WIN32
+            if (timerQueue != nullptr) {
+                if (!DeleteTimerQueueEx(timerQueue, INVALID_HANDLE_VALUE)) {
+                    ALOG(LogLevel::ERR, "DeleteTimerQueueEx failed!", NVV(errorCode, GetLastError()));
                 }
                 else {
                     ALOG(LogLevel::TRACE, "Timer deleted");
                 }
-                newTimer = NULL;
-                timerQueue = NULL;
+                newTimer = nullptr;
+                timerQueue = nullptr;
             }
+#endif
         }
 
-        int frequency = 1000 / DEFAULT_MEDIA_FPS; // Frequency of callback computed based on fps passed as input parameter
+#ifdef _WIN32
         HANDLE timerQueue = nullptr; // A pointer to a buffer that receives a handle to the timer-queue timer on return.
         HANDLE newTimer = nullptr; // A handle to the timer queue . Handle is returned by the CreateTimerQueue function.
+#endif
         Callback timerCallback; // Custom callback lambda from the client
         int mediaCaptureDurationInSeconds = 0; // How long we want to run the media grabber timer. Default is zero
                                                // That is we want to run until it is signalled for stop
-        std::chrono::steady_clock::time_point startTimePoint; // Store initial time point for the media grabber
-        HANDLE doneEvent = nullptr; // Event handle to signal after sliced media grabbing session is over
-        MediaCallbackType mediaCallbackType = MediaCallbackType::MULTIMEDIA_TIMER; // Default callback type for 
-                                                                                   // media grabbing session
+        DeadlineScheduler scheduler; // Absolute deadlines of the callbacks
+        uint64_t maxTickCount = 0; // Callbacks fired over the duration of the session. Zero if it runs until stopped
+        std::mutex doneMutex; // Mutex to guard grabbingDone
+        std::condition_variable doneCondition; // Signalled after sliced media grabbing session is over
+        bool grabbingDone = false;
+        MediaCallbackType mediaCallbackType = DEFAULT_MEDIA_CALLBACK_TYPE; // Default callback type for
+                                                                           // media grabbing session
         std::thread callbackHandlerThread; // Secondary thread to be used to fire callbacks using system sleep
+        uint64_t sharedTimerId = 0; // Timer of the shared timer service. Zero unless registered
         std::atomic<bool> timerRunState = false; // Atomic state flag to denote recording transition states
+        std::atomic<bool> callbackInProgress = false; // Set while client callback runs to prevent overlapping callbacks
     };
 } // End of CapUtils namespace
@@ -0,0 +1,151 @@
+#include "TimerService.hpp"
+
+namespace CapUtils {
+
+    TimerService::TimerService(int workerCount, std::chrono::nanoseconds quantum) :
+        timerQuantum((quantum.count() > 0) ? quantum : std::chrono::nanoseconds(1)),
+        serviceStartTime(std::chrono::steady_clock::now()) {
+        const int threadCount = (workerCount > 0) ? workerCount : 1;
+        for (int i = 0; i < threadCount; ++i) {
+            workers.emplace_back(&TimerService::workerLoop, this);
+        }
+        dispatchThread = std::thread(&TimerService::dispatchLoop, this);
+    }
+
+    TimerService::~TimerService() {
+        {
+            std::lock_guard<std::mutex> lock(serviceMutex);
+            stopping = true;
+        }
+        dispatchCondition.notify_all();
+        workCondition.notify_all();
+
+        dispatchThread.join();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    TimerService& TimerService::getShared() {
+        static TimerService sharedService(kSharedTimerWorkerCount, kSharedTimerQuantum);
+        return sharedService;
+    }
+
+    uint64_t TimerService::addTimer(DeadlineScheduler& scheduler, TimerCallback callback) {
+        uint64_t timerId = 0;
+        {
+            std::lock_guard<std::mutex> lock(serviceMutex);
+            Timer timer;
+            timer.id = nextTimerId++;
+            timer.scheduler = &scheduler;
+            timer.callback = std::move(callback);
+            timer.dueTime = std::chrono::steady_clock::now() + scheduler.getTimeUntilNextTick();
+            timerId = timer.id;
+            timers.push_back(std::move(timer));
+        }
+        dispatchCondition.notify_one();
+        return timerId;
+    }
+
+    void TimerService::removeTimer(uint64_t timerId) {
+        std::unique_lock<std::mutex> lock(serviceMutex);
+        idleCondition.wait(lock, [&]() {
+            auto timer = findTimer(timerId);
+            return timer == timers.end() || !timer->running;
+        });
+
+        auto timer = findTimer(timerId);
+        if (timer != timers.end()) {
+            timers.erase(timer);
+        }
+    }
+
+    void TimerService::dispatchLoop() {
+        std::unique_lock<std::mutex> lock(serviceMutex);
+        while (!stopping) {
+            bool anyIdle = false;
+            std::chrono::steady_clock::time_point earliestDueTime;
+            for (const auto& timer : timers) {
+                if (!timer.running && (!anyIdle || timer.dueTime < earliestDueTime)) {
+                    earliestDueTime = timer.dueTime;
+                    anyIdle = true;
+                }
+            }
+            if (!anyIdle) {
+                dispatchCondition.wait(lock);
+                continue;
+            }
+
+            // Everything due by the end of this quantum fires with the earliest timer
+            const auto fireTime = alignToQuantum(earliestDueTime);
+            if (std::chrono::steady_clock::now() < fireTime) {
+                dispatchCondition.wait_until(lock, fireTime);
+                continue;
+            }
+
+            for (auto& timer : timers) {
+                if (!timer.running && timer.dueTime <= fireTime) {
+                    timer.running = true;
+                    dueTimers.push_back(timer.id);
+                }
+            }
+            workCondition.notify_all();
+        }
+    }
+
+    void TimerService::workerLoop() {
+        std::unique_lock<std::mutex> lock(serviceMutex);
+        while (true) {
+            workCondition.wait(lock, [this]() { return stopping || !dueTimers.empty(); });
+            if (stopping) {
+                break;
+            }
+
+            const uint64_t timerId = dueTimers.back();
+            dueTimers.pop_back();
+            auto timer = findTimer(timerId);
+            if (timer == timers.end()) {
+                continue;
+            }
+
+            // Running timers are neither erased nor touched by anyone else, so the callback runs without the lock.
+            // It may add timers though, which moves the vector, so the timer is looked up again afterwards
+            DeadlineScheduler* scheduler = timer->scheduler;
+            TimerCallback callback = std::move(timer->callback);
+            lock.unlock();
+            const bool keepTimer = callback();
+            const auto dueTime = std::chrono::steady_clock::now() + scheduler->getTimeUntilNextTick();
+            lock.lock();
+
+            timer = findTimer(timerId);
+            if (!keepTimer) {
+                timers.erase(timer);
+            }
+            else {
+                timer->callback = std::move(callback);
+                timer->dueTime = dueTime;
+                timer->running = false;
+            }
+            idleCondition.notify_all();
+            dispatchCondition.notify_one();
+        }
+    }
+
+    std::chrono::steady_clock::time_point TimerService::alignToQuantum(std::chrono::steady_clock::time_point time) const {
+        if (time <= serviceStartTime) {
+            return serviceStartTime;
+        }
+        const auto sinceStart = std::chrono::duration_cast<std::chrono::nanoseconds>(time - serviceStartTime);
+        const auto quanta = (sinceStart.count() + timerQuantum.count() - 1) / timerQuantum.count();
+        return serviceStartTime + timerQuantum * quanta;
+    }
+
+    std::vector<TimerService::Timer>::iterator TimerService::findTimer(uint64_t timerId) {
+        for (auto it = timers.begin(); it != timers.end(); ++it) {
+            if (it->id == timerId) {
+                return it;
+            }
+        }
+        return timers.end();
+    }
+}
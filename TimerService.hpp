@@ -0,0 +1,124 @@
+#pragma once
+
+#include "DeadlineScheduler.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CapUtils {
+
+    constexpr int kSharedTimerWorkerCount = 4; // Callbacks of the shared timer service that can run at the same time
+    constexpr auto kSharedTimerQuantum = std::chrono::milliseconds(1); // Wakeup granularity of the shared timer service
+
+    /*
+    * Timer service running periodic callbacks of any number of clients on one dispatcher thread and a few workers.
+    * Deadlines come from a DeadlineScheduler of each client. The dispatcher sleeps until the earliest of them,
+    * rounded up to the next quantum, and hands every timer due by then to the workers. Timers due within the same
+    * quantum therefore fire together, and the process wakes up once for all of them instead of once per timer.
+    * Callbacks of one timer never overlap, callbacks of different timers run in parallel up to the worker count.
+    */
+    class TimerService {
+
+    public:
+        /*
+        * Callback of a timer. Returns false to remove the timer.
+        */
+        using TimerCallback = std::function<bool()>;
+
+        /**
+         * TimerService constructor
+         *
+         * @param workerCount
+         *     Threads running callbacks. Values below 1 are raised to 1
+         *
+         * @param quantum
+         *     Deadlines are rounded up to a multiple of quantum since the service started
+         */
+        TimerService(int workerCount, std::chrono::nanoseconds quantum);
+
+        ~TimerService();
+
+        /*
+        * @name Copy and move
+        *
+        * No copying and moving allowed. Service threads refer back to this object.
+        */
+        TimerService(const TimerService&) = delete;
+        TimerService& operator=(const TimerService&) = delete;
+
+        TimerService(TimerService&&) = delete;
+        TimerService& operator=(TimerService&&) = delete;
+
+        /**
+         * Get the process wide service every grabber registers with. Started on first use.
+         */
+        static TimerService& getShared();
+
+        /**
+         * Add a timer firing whenever the next tick of scheduler is due. The first callback fires as soon as scheduler
+         * says so. The callback has to take the tick from scheduler, which must outlive the timer.
+         *
+         * @return  Id of the new timer, never zero.
+         */
+        uint64_t addTimer(DeadlineScheduler& scheduler, TimerCallback callback);
+
+        /**
+         * Remove a timer, waiting for a running callback of it to return. Timers whose callback returned false are
+         * removed already. Must not be called from a callback of the timer itself.
+         */
+        void removeTimer(uint64_t timerId);
+
+    private:
+
+        /*
+        * Registered timer along with the state shared by dispatcher and workers
+        */
+        struct Timer {
+            uint64_t id = 0;
+            DeadlineScheduler* scheduler = nullptr;
+            TimerCallback callback;
+            std::chrono::steady_clock::time_point dueTime; // Next deadline. Only valid while the timer is idle
+            bool running = false; // Handed to a worker, which owns scheduler and callback until it returns
+        };
+
+        /*
+        * Dispatcher thread function. Sleeps until the next quantum a timer is due in and queues the due timers.
+        */
+        void dispatchLoop();
+
+        /*
+        * Worker thread function. Runs callbacks of queued timers.
+        */
+        void workerLoop();
+
+        /**
+         * Internal helper function to round a time up to the next quantum boundary
+         */
+        std::chrono::steady_clock::time_point alignToQuantum(std::chrono::steady_clock::time_point time) const;
+
+        /**
+         * Internal helper function to find a timer by id. Returns timers.end() if there is none
+         */
+        std::vector<Timer>::iterator findTimer(uint64_t timerId);
+
+        const std::chrono::nanoseconds timerQuantum;
+        const std::chrono::steady_clock::time_point serviceStartTime; // Quantum boundaries are counted from here
+
+        std::mutex serviceMutex; // Mutex to guard every member below
+        std::condition_variable dispatchCondition; // Signalled when timers are added or a callback returned
+        std::condition_variable workCondition; // Signalled when timers are queued or the service is stopping
+        std::condition_variable idleCondition; // Signalled when a callback returned, for removeTimer
+        std::vector<Timer> timers;
+        std::vector<uint64_t> dueTimers; // Timers queued for the workers
+        uint64_t nextTimerId = 1;
+        bool stopping = false;
+
+        std::thread dispatchThread;
+        std::vector<std::thread> workers;
+    };
+}
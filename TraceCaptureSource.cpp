@@ -0,0 +1,87 @@
+#include "TraceCaptureSource.hpp"
+
+#include <cstring>
+#include <thread>
+
+namespace CapUtils {
+
+    bool parseTraceReplayMode(const std::string& modeName, TraceReplayMode& mode) {
+        if (modeName == "original") {
+            mode = TraceReplayMode::ORIGINAL_SPEED;
+        }
+        else if (modeName == "fast") {
+            mode = TraceReplayMode::AS_FAST_AS_POSSIBLE;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    std::string getTraceReplayModeString(TraceReplayMode mode) {
+        std::string result = "";
+        switch (mode) {
+        case TraceReplayMode::ORIGINAL_SPEED:
+            result = "ORIGINAL_SPEED";
+            break;
+        case TraceReplayMode::AS_FAST_AS_POSSIBLE:
+            result = "AS_FAST_AS_POSSIBLE";
+            break;
+        default:
+            break;
+        }
+        return result;
+    }
+
+    TraceCaptureSource::TraceCaptureSource(TraceReplayMode mode) : replayMode(mode) {
+    }
+
+    bool TraceCaptureSource::open(const std::string& fileName) {
+        imagePool.reset();
+        replayedImage = nullptr;
+        nextFrameIndex = 0;
+        if (!traceReader.open(fileName) || traceReader.getFrameCount() == 0) {
+            return false;
+        }
+
+        imagePool = std::make_unique<FramePool>(traceReader.getWidth(), traceReader.getHeight(), traceReader.getPixelFormat(),
+                                                getRowAlignment(), 1, 1);
+        replayedImage = imagePool->acquire();
+        return replayedImage != nullptr;
+    }
+
+    bool TraceCaptureSource::grabFrame(FrameBuffer& frame) {
+        if (replayedImage == nullptr || isExhausted()) {
+            return false;
+        }
+
+        if (replayMode == TraceReplayMode::ORIGINAL_SPEED) {
+            if (nextFrameIndex == 0) {
+                replayStartTime = std::chrono::steady_clock::now();
+            }
+            else {
+                const int64_t offset = traceReader.getTimestamp(nextFrameIndex) - traceReader.getTimestamp(0);
+                std::this_thread::sleep_until(replayStartTime + std::chrono::microseconds(offset));
+            }
+        }
+
+        // A corrupt record leaves the replayed image undefined, so nothing after it can be replayed
+        if (!traceReader.readFrame(nextFrameIndex, *replayedImage)) {
+            nextFrameIndex = traceReader.getFrameCount();
+            return false;
+        }
+        ++nextFrameIndex;
+
+        const std::size_t rowBytes = static_cast<std::size_t>(frame.width) * getBytesPerPixel(frame.pixelFormat);
+        for (int y = 0; y < frame.height; ++y) {
+            std::memcpy(frame.data + static_cast<std::size_t>(y) * frame.stride,
+                        replayedImage->data + static_cast<std::size_t>(y) * replayedImage->stride, rowBytes);
+        }
+        frame.timestamp = replayedImage->timestamp;
+        frame.rects.valid = replayedImage->rects.valid;
+        frame.rects.moveRects = replayedImage->rects.moveRects;
+        frame.rects.dirtyRects = replayedImage->rects.dirtyRects;
+        frame.cursor = replayedImage->cursor;
+        return true;
+    }
+}
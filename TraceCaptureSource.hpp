@@ -0,0 +1,111 @@
+#pragma once
+
+#include "CaptureSource.hpp"
+#include "CaptureTrace.hpp"
+
+#include <chrono>
+#include <string>
+
+namespace CapUtils {
+
+    /*
+    * Pace at which a capture trace is replayed
+    */
+    enum class TraceReplayMode {
+        ORIGINAL_SPEED = 0,     // Every frame is delivered once as much time has passed as when it was recorded
+        AS_FAST_AS_POSSIBLE = 1 // Frames are delivered back to back, so the encode pipeline sets the pace
+    };
+
+    /**
+     * Helper function to parse trace replay mode from its config file name
+     *
+     * @param modeName
+     *     One of "original" or "fast"
+     *
+     * @param mode
+     *     Receives the parsed mode
+     *
+     * @return  True if modeName is a known replay mode.
+     */
+    bool parseTraceReplayMode(const std::string& modeName, TraceReplayMode& mode);
+
+    /**
+     * Helper function to get trace replay mode in string format to be used for logging purposes
+     */
+    std::string getTraceReplayModeString(TraceReplayMode mode);
+
+    /*
+    * Capture source replaying a capture trace recorded by CaptureTraceWriter. Frames carry the pixels, timestamps,
+    * rects and cursor states as recorded, so replaying the same trace feeds the encode pipeline the exact same
+    * input every time. The source is exhausted after the last frame of the trace.
+    */
+    class TraceCaptureSource : public CaptureSource {
+
+    public:
+
+        /**
+         * TraceCaptureSource constructor
+         *
+         * @param mode
+         *     Pace at which frames are delivered
+         */
+        explicit TraceCaptureSource(TraceReplayMode mode);
+
+        /**
+         * Open the trace to be replayed
+         *
+         * @param fileName
+         *     Path of the trace file
+         *
+         * @return  False if the trace cannot be read or holds no frames.
+         */
+        bool open(const std::string& fileName);
+
+        CaptureSourceType getType() const override {
+            return CaptureSourceType::TRACE;
+        }
+
+        int getWidth() const override {
+            return traceReader.getWidth();
+        }
+
+        int getHeight() const override {
+            return traceReader.getHeight();
+        }
+
+        FramePixelFormat getPixelFormat() const override {
+            return traceReader.getPixelFormat();
+        }
+
+        int getRowAlignment() const override {
+            return 4;
+        }
+
+        bool isSelfPaced() const override {
+            return true;
+        }
+
+        bool isExhausted() const override {
+            return nextFrameIndex >= traceReader.getFrameCount();
+        }
+
+        int64_t getTraceFrameCount() const {
+            return traceReader.getFrameCount();
+        }
+
+    protected:
+
+        /**
+         * Decode the next frame of the trace into frame, waiting until it is due in original speed mode
+         */
+        bool grabFrame(FrameBuffer& frame) override;
+
+    private:
+        TraceReplayMode replayMode = TraceReplayMode::ORIGINAL_SPEED;
+        CaptureTraceReader traceReader;
+        std::unique_ptr<FramePool> imagePool; // Owns the memory of replayedImage
+        FrameBuffer* replayedImage = nullptr; // Last decoded frame that the next one is applied to
+        int64_t nextFrameIndex = 0; // Trace frame delivered by the next grab
+        std::chrono::steady_clock::time_point replayStartTime; // Time the first frame was delivered
+    };
+}
@@ -0,0 +1,104 @@
+#include "WorkerPool.hpp"
+
+namespace CapUtils {
+
+    WorkerPool::WorkerPool(int threadCount) {
+        const int workerCount = (threadCount > 1) ? threadCount - 1 : 0;
+        workers.reserve(workerCount);
+        for (int i = 0; i < workerCount; ++i) {
+            workers.emplace_back(&WorkerPool::workerLoop, this);
+        }
+    }
+
+    WorkerPool::~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            stopping = true;
+        }
+        batchAvailable.notify_all();
+
+        for (auto& worker : workers) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+    }
+
+    void WorkerPool::run(int taskCount, const std::function<void(int)>& task) {
+        if (workers.empty() || taskCount <= 1) {
+            for (int i = 0; i < taskCount; ++i) {
+                task(i);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            batchTask = &task;
+            batchTaskCount = taskCount;
+            nextTaskIndex = 0;
+            completedTaskCount = 0;
+            ++batchGeneration;
+        }
+        batchAvailable.notify_all();
+
+        runTasks(task, taskCount);
+
+        // Workers still inside the batch hold a pointer to task, so wait for them to leave as well
+        std::unique_lock<std::mutex> lock(poolMutex);
+        batchDone.wait(lock, [&]() { return completedTaskCount == batchTaskCount && activeWorkerCount == 0; });
+        batchTask = nullptr;
+        batchTaskCount = 0;
+    }
+
+    void WorkerPool::runTasks(const std::function<void(int)>& task, int taskCount) {
+        while (true) {
+            int taskIndex = 0;
+            {
+                std::lock_guard<std::mutex> lock(poolMutex);
+                if (nextTaskIndex >= taskCount) {
+                    return;
+                }
+                taskIndex = nextTaskIndex++;
+            }
+
+            task(taskIndex);
+
+            std::lock_guard<std::mutex> lock(poolMutex);
+            if (++completedTaskCount == taskCount) {
+                batchDone.notify_all();
+            }
+        }
+    }
+
+    void WorkerPool::workerLoop() {
+        uint64_t seenGeneration = 0;
+
+        while (true) {
+            const std::function<void(int)>* task = nullptr;
+            int taskCount = 0;
+            {
+                std::unique_lock<std::mutex> lock(poolMutex);
+                batchAvailable.wait(lock, [&]() { return stopping || batchGeneration != seenGeneration; });
+                if (stopping) {
+                    return;
+                }
+                seenGeneration = batchGeneration;
+                // Batch may already be finished by the time this worker wakes up
+                if (batchTask == nullptr) {
+                    continue;
+                }
+                task = batchTask;
+                taskCount = batchTaskCount;
+                ++activeWorkerCount;
+            }
+
+            runTasks(*task, taskCount);
+
+            std::lock_guard<std::mutex> lock(poolMutex);
+            if (--activeWorkerCount == 0) {
+                batchDone.notify_all();
+            }
+        }
+    }
+}
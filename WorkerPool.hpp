@@ -0,0 +1,83 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CapUtils {
+
+    /*
+    * Persistent pool of worker threads to run a batch of independent tasks in parallel.
+    * Threads are started once and sleep between batches, so splitting per-frame work across them costs a wakeup
+    * rather than a thread creation. The calling thread takes part in every batch.
+    * Batches must be submitted from one thread at a time.
+    */
+    class WorkerPool {
+
+    public:
+        /**
+         * WorkerPool constructor
+         *
+         * @param threadCount
+         *     Total number of threads working on a batch, including the calling thread.
+         *     A pool of one thread runs every batch inline on the caller.
+         */
+        explicit WorkerPool(int threadCount);
+
+        ~WorkerPool();
+
+        /*
+        * @name Copy and move
+        *
+        * No copying and moving allowed. Worker threads refer back to this pool.
+        */
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        WorkerPool(WorkerPool&&) = delete;
+        WorkerPool& operator=(WorkerPool&&) = delete;
+
+        /**
+         * Run task for every index from 0 to taskCount - 1 and block until all of them are done
+         *
+         * @param taskCount
+         *     Number of tasks in this batch
+         *
+         * @param task
+         *     Function called with the task index. Called concurrently from different threads.
+         */
+        void run(int taskCount, const std::function<void(int)>& task);
+
+        int getThreadCount() const {
+            return static_cast<int>(workers.size()) + 1;
+        }
+
+    private:
+
+        /*
+        * Worker thread function. Sleeps until a new batch is submitted or the pool is destroyed.
+        */
+        void workerLoop();
+
+        /**
+         * Internal helper function to claim and run tasks of the current batch until none are left
+         */
+        void runTasks(const std::function<void(int)>& task, int taskCount);
+
+        std::vector<std::thread> workers;
+
+        std::mutex poolMutex; // Mutex to guard the batch state below
+        std::condition_variable batchAvailable; // Signalled when a batch is submitted or the pool is stopping
+        std::condition_variable batchDone; // Signalled when the last task finishes or the last worker leaves a batch
+        const std::function<void(int)>* batchTask = nullptr; // Task of the running batch. nullptr between batches
+        int batchTaskCount = 0;
+        int nextTaskIndex = 0; // Next task index to be claimed
+        int completedTaskCount = 0;
+        int activeWorkerCount = 0; // Workers that are currently inside a batch
+        uint64_t batchGeneration = 0; // Incremented for every batch, so a worker never joins the same batch twice
+        bool stopping = false;
+    };
+}
@@ -0,0 +1,302 @@
+#ifdef __linux__
+
+#include "X11CaptureSource.hpp"
+
+#include <chrono>
+#include <cstring>
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+
+// DAMAGE is optional at build time as well, without it every frame is a full frame for change detection to hash
+#ifdef CAPUTILS_X11_DAMAGE
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+#endif
+
+namespace CapUtils {
+
+    namespace {
+
+        bool shmAttachFailed = false; // Set by handleShmAttachError while a segment is being attached
+
+        int handleShmAttachError(Display*, XErrorEvent*) {
+            shmAttachFailed = true;
+            return 0;
+        }
+    }
+
+    struct X11CaptureSource::ShmBuffer {
+        XShmSegmentInfo segment; // Referenced by image, so it has to stay at the same address
+        XImage* image = nullptr;
+    };
+
+    X11CaptureSource::X11CaptureSource(int regionX, int regionY, int regionWidth, int regionHeight) :
+        srcx(regionX),
+        srcy(regionY),
+        srcwidth(regionWidth),
+        srcheight(regionHeight) {
+    }
+
+    X11CaptureSource::~X11CaptureSource() {
+        close();
+    }
+
+    bool X11CaptureSource::open(const std::string& displayName) {
+        close();
+
+        display = XOpenDisplay(displayName.empty() ? nullptr : displayName.c_str());
+        if (display == nullptr) {
+            return false;
+        }
+        if (!XShmQueryExtension(display)) {
+            close();
+            return false;
+        }
+
+        screenNumber = DefaultScreen(display);
+        rootWindow = RootWindow(display, screenNumber);
+
+        // Pixels have to be laid out as BGRA, i.e. 24 bit TrueColor in 32 bit little endian pixels
+        const Visual* visual = DefaultVisual(display, screenNumber);
+        bool bgraPixels = DefaultDepth(display, screenNumber) == 24 && visual->c_class == TrueColor &&
+                          visual->red_mask == 0xFF0000 && visual->green_mask == 0xFF00 && visual->blue_mask == 0xFF &&
+                          ImageByteOrder(display) == LSBFirst;
+        int formatCount = 0;
+        XPixmapFormatValues* formats = XListPixmapFormats(display, &formatCount);
+        bool paddedPixels = false;
+        for (int i = 0; i < formatCount; ++i) {
+            paddedPixels = paddedPixels || (formats[i].depth == 24 && formats[i].bits_per_pixel == 32);
+        }
+        if (formats != nullptr) {
+            XFree(formats);
+        }
+
+        XWindowAttributes rootAttributes;
+        const bool regionInside = XGetWindowAttributes(display, rootWindow, &rootAttributes) &&
+                                  srcwidth > 0 && srcheight > 0 && srcx >= 0 && srcy >= 0 &&
+                                  srcx + srcwidth <= rootAttributes.width && srcy + srcheight <= rootAttributes.height;
+        if (!bgraPixels || !paddedPixels || !regionInside) {
+            close();
+            return false;
+        }
+
+#ifdef CAPUTILS_X11_DAMAGE
+        // Damage is optional, frames without it are hashed by change detection
+        int damageEventBase = 0;
+        int damageErrorBase = 0;
+        int fixesEventBase = 0;
+        int fixesErrorBase = 0;
+        if (XDamageQueryExtension(display, &damageEventBase, &damageErrorBase) &&
+            XFixesQueryExtension(display, &fixesEventBase, &fixesErrorBase)) {
+            int major = 1;
+            int minor = 1;
+            XDamageQueryVersion(display, &major, &minor);
+            major = 2;
+            minor = 0;
+            XFixesQueryVersion(display, &major, &minor);
+            if (major >= 2) {
+                damage = XDamageCreate(display, rootWindow, XDamageReportNonEmpty);
+                damageRegion = XFixesCreateRegion(display, nullptr, 0);
+            }
+        }
+#endif
+
+        fullFrameDirty = true;
+        return true;
+    }
+
+    void X11CaptureSource::close() {
+        if (display == nullptr) {
+            return;
+        }
+        while (!shmBuffers.empty()) {
+            deallocate(reinterpret_cast<uint8_t*>(shmBuffers.back()->segment.shmaddr));
+        }
+        stagingBuffer = nullptr;
+#ifdef CAPUTILS_X11_DAMAGE
+        if (damage != 0) {
+            XDamageDestroy(display, damage);
+            XFixesDestroyRegion(display, damageRegion);
+        }
+#endif
+        damage = 0;
+        damageRegion = 0;
+        XCloseDisplay(display);
+        display = nullptr;
+    }
+
+    uint8_t* X11CaptureSource::allocate(std::size_t size) {
+        const std::size_t imageSize = static_cast<std::size_t>(srcwidth) * 4 * srcheight;
+        if (display == nullptr || size < imageSize) {
+            return nullptr;
+        }
+
+        auto buffer = std::make_unique<ShmBuffer>();
+        buffer->segment.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+        if (buffer->segment.shmid < 0) {
+            return nullptr;
+        }
+        buffer->segment.shmaddr = static_cast<char*>(shmat(buffer->segment.shmid, nullptr, 0));
+        buffer->segment.readOnly = False;
+        if (buffer->segment.shmaddr == reinterpret_cast<char*>(-1)) {
+            shmctl(buffer->segment.shmid, IPC_RMID, nullptr);
+            return nullptr;
+        }
+
+        // Servers that cannot reach our memory, e.g. remote ones, fail to attach with an error instead of a status
+        XSync(display, False);
+        shmAttachFailed = false;
+        XErrorHandler previousHandler = XSetErrorHandler(handleShmAttachError);
+        const Bool attached = XShmAttach(display, &buffer->segment);
+        XSync(display, False);
+        XSetErrorHandler(previousHandler);
+
+        // Segment is removed as soon as both sides detached, even if we crash
+        shmctl(buffer->segment.shmid, IPC_RMID, nullptr);
+        if (!attached || shmAttachFailed) {
+            shmdt(buffer->segment.shmaddr);
+            return nullptr;
+        }
+
+        buffer->image = XShmCreateImage(display, DefaultVisual(display, screenNumber), 24, ZPixmap,
+                                        buffer->segment.shmaddr, &buffer->segment, srcwidth, srcheight);
+        if (buffer->image == nullptr || buffer->image->bytes_per_line != srcwidth * 4) {
+            if (buffer->image != nullptr) {
+                buffer->image->data = nullptr;
+                XDestroyImage(buffer->image);
+            }
+            XShmDetach(display, &buffer->segment);
+            XSync(display, False);
+            shmdt(buffer->segment.shmaddr);
+            return nullptr;
+        }
+
+        shmBuffers.push_back(std::move(buffer));
+        return reinterpret_cast<uint8_t*>(shmBuffers.back()->segment.shmaddr);
+    }
+
+    void X11CaptureSource::deallocate(uint8_t* data) {
+        for (auto it = shmBuffers.begin(); it != shmBuffers.end(); ++it) {
+            ShmBuffer& buffer = **it;
+            if (reinterpret_cast<uint8_t*>(buffer.segment.shmaddr) != data) {
+                continue;
+            }
+            XShmDetach(display, &buffer.segment);
+            XSync(display, False);
+
+            // Image does not own the shared memory
+            buffer.image->data = nullptr;
+            XDestroyImage(buffer.image);
+            shmdt(buffer.segment.shmaddr);
+            if (stagingBuffer == &buffer) {
+                stagingBuffer = nullptr;
+            }
+            shmBuffers.erase(it);
+            return;
+        }
+    }
+
+    void X11CaptureSource::collectDamage(FrameRectMetadata& rects) {
+#ifdef CAPUTILS_X11_DAMAGE
+        // Notify events only tell that there is damage, the region fetched below holds all of it
+        XEvent event;
+        while (XPending(display) > 0) {
+            XNextEvent(display, &event);
+        }
+
+        XDamageSubtract(display, damage, None, damageRegion);
+        int rectCount = 0;
+        XRectangle* damagedRects = XFixesFetchRegion(display, damageRegion, &rectCount);
+        for (int i = 0; i < rectCount; ++i) {
+            FrameRect rect;
+            rect.left = (damagedRects[i].x > srcx) ? damagedRects[i].x - srcx : 0;
+            rect.top = (damagedRects[i].y > srcy) ? damagedRects[i].y - srcy : 0;
+            rect.right = damagedRects[i].x + damagedRects[i].width - srcx;
+            rect.bottom = damagedRects[i].y + damagedRects[i].height - srcy;
+            rect.right = (rect.right < srcwidth) ? rect.right : srcwidth;
+            rect.bottom = (rect.bottom < srcheight) ? rect.bottom : srcheight;
+            if (rect.left < rect.right && rect.top < rect.bottom) {
+                rects.dirtyRects.push_back(rect);
+            }
+        }
+        if (damagedRects != nullptr) {
+            XFree(damagedRects);
+        }
+        rects.valid = true;
+#else
+        (void)rects;
+#endif
+    }
+
+    bool X11CaptureSource::grabFrame(FrameBuffer& frame) {
+        if (display == nullptr) {
+            return false;
+        }
+
+        ShmBuffer* target = nullptr;
+        for (const auto& buffer : shmBuffers) {
+            if (reinterpret_cast<uint8_t*>(buffer->segment.shmaddr) == frame.data) {
+                target = buffer.get();
+                break;
+            }
+        }
+        if (target == nullptr) {
+            // Frame from elsewhere, grab into a segment of our own and copy
+            if (stagingBuffer == nullptr) {
+                uint8_t* stagingData = allocate(static_cast<std::size_t>(srcwidth) * 4 * srcheight);
+                stagingBuffer = (stagingData != nullptr) ? shmBuffers.back().get() : nullptr;
+            }
+            target = stagingBuffer;
+            if (target == nullptr) {
+                return false;
+            }
+        }
+
+        // Damage is taken before the pixels, so changes racing with the grab show up again in the next frame
+        if (damage != 0) {
+            collectDamage(frame.rects);
+            if (fullFrameDirty) {
+                frame.rects.dirtyRects.assign(1, FrameRect{ 0, 0, srcwidth, srcheight });
+            }
+        }
+
+        if (!XShmGetImage(display, rootWindow, target->image, srcx, srcy, AllPlanes)) {
+            fullFrameDirty = true;
+            return false;
+        }
+        // Microseconds since the epoch, the clock av_gettime reads for the other sources
+        frame.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        fullFrameDirty = false;
+
+        if (target == stagingBuffer) {
+            const std::size_t rowBytes = static_cast<std::size_t>(srcwidth) * 4;
+            for (int y = 0; y < srcheight; ++y) {
+                std::memcpy(frame.data + static_cast<std::size_t>(y) * frame.stride,
+                            target->segment.shmaddr + static_cast<std::size_t>(y) * target->image->bytes_per_line, rowBytes);
+            }
+        }
+
+        Window rootReturn = 0;
+        Window childReturn = 0;
+        int rootX = 0;
+        int rootY = 0;
+        int windowX = 0;
+        int windowY = 0;
+        unsigned int buttonMask = 0;
+        if (XQueryPointer(display, rootWindow, &rootReturn, &childReturn, &rootX, &rootY, &windowX, &windowY, &buttonMask)) {
+            frame.cursor.valid = true;
+            frame.cursor.x = rootX - srcx;
+            frame.cursor.y = rootY - srcy;
+            frame.cursor.visible = frame.cursor.x >= 0 && frame.cursor.y >= 0 && frame.cursor.x < srcwidth && frame.cursor.y < srcheight;
+        }
+        return true;
+    }
+}
+
+#endif
@@ -0,0 +1,138 @@
+#pragma once
+
+#ifdef __linux__
+
+#include "CaptureSource.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+struct _XDisplay;
+
+namespace CapUtils {
+
+    /*
+    * Capture source grabbing a region of the X11 root window through the MIT shared memory extension. Pool buffers
+    * are shared memory segments attached to the X server, so XShmGetImage writes each frame straight into the
+    * buffer it is grabbed into. Frames are BGRA as laid out by 24 bit TrueColor displays, the padding byte is left
+    * as the server writes it. Where the server has the DAMAGE extension and the library was built with libXdamage,
+    * the areas damaged since the previous grab become the dirty rects of a frame. Any server supporting MIT-SHM will
+    * do, Xvfb included.
+    */
+    class X11CaptureSource : public CaptureSource, private FrameMemoryAllocator {
+
+    public:
+
+        /**
+         * X11CaptureSource constructor
+         *
+         * @param regionX
+         *     Left edge of the root window region to grab
+         *
+         * @param regionY
+         *     Top edge of the root window region to grab
+         *
+         * @param regionWidth
+         *     Width of the root window region to grab
+         *
+         * @param regionHeight
+         *     Height of the root window region to grab
+         */
+        X11CaptureSource(int regionX, int regionY, int regionWidth, int regionHeight);
+
+        ~X11CaptureSource() override;
+
+        /**
+         * Connect to the X server and check that the region can be grabbed
+         *
+         * @param displayName
+         *     Display to connect to, e.g. ":99". Empty uses the DISPLAY environment variable
+         *
+         * @return  False if the display cannot be opened, lacks MIT-SHM or a 24 bit TrueColor visual with 32 bit
+         *          pixels, or the region does not lie within the root window.
+         */
+        bool open(const std::string& displayName);
+
+        /*
+        * True if frames come with the dirty rects reported by the DAMAGE extension
+        */
+        bool hasDamage() const {
+            return damage != 0;
+        }
+
+        CaptureSourceType getType() const override {
+            return CaptureSourceType::X11;
+        }
+
+        int getWidth() const override {
+            return srcwidth;
+        }
+
+        int getHeight() const override {
+            return srcheight;
+        }
+
+        FramePixelFormat getPixelFormat() const override {
+            return FramePixelFormat::BGRA;
+        }
+
+        int getRowAlignment() const override {
+            return 4;
+        }
+
+        FrameMemoryAllocator* getFrameAllocator() override {
+            return this;
+        }
+
+    protected:
+
+        /**
+         * Grab root window pixels into frame along with the damage since the previous grab
+         */
+        bool grabFrame(FrameBuffer& frame) override;
+
+    private:
+
+        /*
+        * Shared memory segment attached to the X server along with the image describing it
+        */
+        struct ShmBuffer;
+
+        /**
+         * Create a shared memory segment of size bytes and attach it to the X server
+         */
+        uint8_t* allocate(std::size_t size) override;
+
+        /**
+         * Detach and remove a segment created by allocate
+         */
+        void deallocate(uint8_t* data) override;
+
+        /**
+         * Internal helper function to move the damage accumulated since the previous grab into rects
+         */
+        void collectDamage(FrameRectMetadata& rects);
+
+        /**
+         * Internal helper function to free every X resource and close the display
+         */
+        void close();
+
+        int srcx = 0; // Left edge of the grabbed root window region
+        int srcy = 0; // Top edge of the grabbed root window region
+        int srcwidth = 0; // Width of the grabbed root window region
+        int srcheight = 0; // Height of the grabbed root window region
+
+        _XDisplay* display = nullptr; // Connection to the X server. nullptr until opened
+        int screenNumber = 0;
+        unsigned long rootWindow = 0;
+        unsigned long damage = 0; // Damage object of the root window. Zero if DAMAGE is not available
+        unsigned long damageRegion = 0; // XFixes region receiving the damage of a grab
+        std::vector<std::unique_ptr<ShmBuffer>> shmBuffers; // Every segment allocated, pool buffers and staging
+        ShmBuffer* stagingBuffer = nullptr; // Grab target for frames that were not allocated by this source
+        bool fullFrameDirty = true; // Damage since the previous grab is unknown, e.g. for the first frame
+    };
+}
+
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+namespace CapUtilsBench {
+
+    constexpr int kMinRuns = 5; // Fewest timed runs of a measurement, however long a single run takes
+    constexpr double kMinMeasureTimeInMs = 300.0; // Shortest total time of the timed runs of a measurement
+
+    /*
+    * Result of timing a piece of work several times. The median is what the tables report, the minimum shows
+    * how noisy the machine was.
+    */
+    struct BenchResult {
+        double medianInMs = 0.0;
+        double minInMs = 0.0;
+        int runs = 0;
+    };
+
+    /**
+     * Helper function to time work after one untimed warm up run. Runs until both kMinRuns and kMinMeasureTimeInMs
+     * are reached.
+     *
+     * @param work
+     *     Function doing one run of the measured work.
+     */
+    template<typename Work>
+    BenchResult measure(Work&& work) {
+        work();
+
+        std::vector<double> times;
+        double totalInMs = 0.0;
+        while (static_cast<int>(times.size()) < kMinRuns || totalInMs < kMinMeasureTimeInMs) {
+            const auto startTime = std::chrono::steady_clock::now();
+            work();
+            const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - startTime;
+            times.push_back(elapsed.count());
+            totalInMs += elapsed.count();
+        }
+
+        std::sort(times.begin(), times.end());
+        BenchResult result;
+        result.medianInMs = times[times.size() / 2];
+        result.minInMs = times.front();
+        result.runs = static_cast<int>(times.size());
+        return result;
+    }
+
+    /**
+     * Helper function to print one row of a benchmark table. Speedup is relative to baselineInMs, skipped if zero.
+     */
+    inline void printResult(const char* name, const BenchResult& result, double baselineInMs = 0.0) {
+        std::printf("  %-40s %9.3f ms  (min %9.3f, %4d runs)", name, result.medianInMs, result.minInMs, result.runs);
+        if (baselineInMs > 0.0 && result.medianInMs > 0.0) {
+            std::printf("  %6.2fx", baselineInMs / result.medianInMs);
+        }
+        std::printf("\n");
+    }
+}
@@ -0,0 +1,171 @@
+#include "BenchTimer.hpp"
+#include "ColorConvert.hpp"
+#include "WorkerPool.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef CAPUTILS_BENCH_SWSCALE
+extern "C" {
+    #include <libavutil/pixfmt.h>
+    #include <libswscale/swscale.h>
+}
+#endif
+
+using namespace CapUtils;
+using namespace CapUtilsBench;
+
+namespace {
+
+    /*
+    * Grabbed frame filled with noise, so no kernel gets away with a shortcut on flat areas
+    */
+    struct BenchFrame {
+        BenchFrame(int width, int height, FramePixelFormat pixelFormat) :
+            pixels(static_cast<std::size_t>(((width * getBytesPerPixel(pixelFormat) + 3) / 4) * 4) * height) {
+            std::mt19937 random(5);
+            for (auto& byte : pixels) {
+                byte = static_cast<uint8_t>(random());
+            }
+            frame.data = pixels.data();
+            frame.width = width;
+            frame.height = height;
+            frame.stride = ((width * getBytesPerPixel(pixelFormat) + 3) / 4) * 4;
+            frame.size = pixels.size();
+            frame.pixelFormat = pixelFormat;
+        }
+
+        std::vector<uint8_t> pixels;
+        FrameBuffer frame;
+    };
+
+    /*
+    * I420 and NV12 destination planes of one frame
+    */
+    struct BenchPlanes {
+        BenchPlanes(int width, int height) :
+            lumaStride((width + 63) / 64 * 64),
+            chromaStride(((width + 1) / 2 + 63) / 64 * 64),
+            y(static_cast<std::size_t>(lumaStride) * height),
+            u(static_cast<std::size_t>(chromaStride) * ((height + 1) / 2)),
+            v(static_cast<std::size_t>(chromaStride) * ((height + 1) / 2)),
+            uv(static_cast<std::size_t>(chromaStride) * 2 * ((height + 1) / 2)),
+            i420Planes{ y.data(), u.data(), v.data() },
+            i420Strides{ lumaStride, chromaStride, chromaStride },
+            nv12Planes{ y.data(), uv.data() },
+            nv12Strides{ lumaStride, chromaStride * 2 } {
+        }
+
+        int lumaStride;
+        int chromaStride;
+        std::vector<uint8_t> y;
+        std::vector<uint8_t> u;
+        std::vector<uint8_t> v;
+        std::vector<uint8_t> uv;
+        uint8_t* i420Planes[3];
+        int i420Strides[3];
+        uint8_t* nv12Planes[2];
+        int nv12Strides[2];
+    };
+
+#ifdef CAPUTILS_BENCH_SWSCALE
+    /**
+     * Helper function to time swscale on the same conversion, single threaded and with its default bilinear filter
+     * as used by the encoder setup before the kernels existed
+     *
+     * @return  Median time in milliseconds, zero if swscale could not convert this format.
+     */
+    double benchSwscale(const BenchFrame& source, BenchPlanes& planes, bool nv12) {
+        const AVPixelFormat sourceFormat = (source.frame.pixelFormat == FramePixelFormat::BGRA) ? AV_PIX_FMT_BGRA : AV_PIX_FMT_BGR24;
+        SwsContext* context = sws_getContext(source.frame.width, source.frame.height, sourceFormat,
+                                             source.frame.width, source.frame.height, nv12 ? AV_PIX_FMT_NV12 : AV_PIX_FMT_YUV420P,
+                                             SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if (context == nullptr) {
+            std::printf("  swscale cannot convert this format\n");
+            return 0.0;
+        }
+
+        const uint8_t* const sourcePlanes[1] = { source.frame.data };
+        const int sourceStrides[1] = { source.frame.stride };
+        uint8_t* const* dstPlanes = nv12 ? planes.nv12Planes : planes.i420Planes;
+        const int* dstStrides = nv12 ? planes.nv12Strides : planes.i420Strides;
+        const BenchResult result = measure([&]() {
+            sws_scale(context, sourcePlanes, sourceStrides, 0, source.frame.height, dstPlanes, dstStrides);
+        });
+        sws_freeContext(context);
+
+        printResult("swscale", result);
+        return result.medianInMs;
+    }
+#endif
+
+    /**
+     * Helper function to time every kernel on one frame size, format and output layout.
+     * Speedups are relative to swscale where it was built in, otherwise to the scalar kernel.
+     */
+    void benchConversion(int width, int height, FramePixelFormat pixelFormat, bool nv12, WorkerPool& workerPool) {
+        std::printf("%dx%d %s to %s\n", width, height, (pixelFormat == FramePixelFormat::BGRA) ? "BGRA" : "BGR24",
+                    nv12 ? "NV12" : "I420");
+        const BenchFrame source(width, height, pixelFormat);
+        BenchPlanes planes(width, height);
+
+        double baselineInMs = 0.0;
+#ifdef CAPUTILS_BENCH_SWSCALE
+        baselineInMs = benchSwscale(source, planes, nv12);
+#endif
+
+        const ColorConvertIsa supportedIsa = getSupportedColorConvertIsa();
+        for (ColorConvertIsa isa : { ColorConvertIsa::SCALAR, ColorConvertIsa::SSE41, ColorConvertIsa::AVX2, ColorConvertIsa::AVX512 }) {
+            if (isa > supportedIsa) {
+                break;
+            }
+            const BenchResult result = measure([&]() {
+                if (nv12) {
+                    convertFrameToNV12(source.frame, planes.nv12Planes, planes.nv12Strides, isa);
+                }
+                else {
+                    convertFrameToI420(source.frame, planes.i420Planes, planes.i420Strides, isa);
+                }
+            });
+            if (baselineInMs == 0.0) {
+                baselineInMs = result.medianInMs;
+            }
+            printResult(getColorConvertIsaString(isa).c_str(), result, baselineInMs);
+        }
+
+        if (workerPool.getThreadCount() > 1) {
+            const BenchResult result = measure([&]() {
+                if (nv12) {
+                    convertFrameToNV12(source.frame, planes.nv12Planes, planes.nv12Strides, workerPool);
+                }
+                else {
+                    convertFrameToI420(source.frame, planes.i420Planes, planes.i420Strides, workerPool);
+                }
+            });
+            const std::string name = getColorConvertIsaString(supportedIsa) + " on " + std::to_string(workerPool.getThreadCount()) + " threads";
+            printResult(name.c_str(), result, baselineInMs);
+        }
+    }
+}
+
+int main() {
+    const int hardwareThreads = static_cast<int>(std::thread::hardware_concurrency());
+    WorkerPool workerPool((hardwareThreads > 1) ? hardwareThreads : 1);
+
+#ifndef CAPUTILS_BENCH_SWSCALE
+    std::printf("Built without libswscale, speedups are relative to the scalar kernel\n");
+#endif
+    const int sizes[][2] = { { 1920, 1080 }, { 2560, 1440 }, { 3840, 2160 } };
+    for (const auto& size : sizes) {
+        for (FramePixelFormat pixelFormat : { FramePixelFormat::BGRA, FramePixelFormat::BGR24 }) {
+            for (bool nv12 : { false, true }) {
+                benchConversion(size[0], size[1], pixelFormat, nv12, workerPool);
+            }
+        }
+    }
+    return 0;
+}
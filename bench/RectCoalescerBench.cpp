@@ -0,0 +1,264 @@
+#include "BenchTimer.hpp"
+#include "CaptureTrace.hpp"
+#include "RectCoalescer.hpp"
+#include "SyntheticCaptureSource.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace CapUtils;
+using namespace CapUtilsBench;
+
+namespace {
+
+    constexpr int kTraceWidth = 1920;
+    constexpr int kTraceHeight = 1080;
+    constexpr int kTraceFrames = 600; // Ten seconds at 60 fps
+
+    /*
+    * Dirty rects of consecutive frames of one workload
+    */
+    struct RectTrace {
+        std::string name;
+        int width = kTraceWidth;
+        int height = kTraceHeight;
+        std::vector<std::vector<FrameRect>> frames;
+    };
+
+    /**
+     * Helper function to clip a rect to the frame
+     */
+    FrameRect clipRect(const FrameRect& rect, int width, int height) {
+        FrameRect clipped;
+        clipped.left = (rect.left > 0) ? rect.left : 0;
+        clipped.top = (rect.top > 0) ? rect.top : 0;
+        clipped.right = (rect.right < width) ? rect.right : width;
+        clipped.bottom = (rect.bottom < height) ? rect.bottom : height;
+        return clipped;
+    }
+
+    int64_t getArea(const FrameRect& rect) {
+        return (rect.right > rect.left && rect.bottom > rect.top) ?
+            static_cast<int64_t>(rect.right - rect.left) * (rect.bottom - rect.top) : 0;
+    }
+
+    /*
+    * Typing into an editor: a few glyph cells and the caret change per frame
+    */
+    RectTrace makeTypingTrace() {
+        RectTrace trace;
+        trace.name = "typing";
+        int column = 0;
+        int line = 0;
+        for (int frame = 0; frame < kTraceFrames; ++frame) {
+            std::vector<FrameRect> rects;
+            const int x = 80 + column * 9;
+            const int y = 120 + line * 18;
+            rects.push_back({ x, y, x + 9, y + 18 });
+            rects.push_back({ x + 9, y, x + 11, y + 18 });
+            if (frame % 30 == 0) {
+                // Line and column numbers in the status bar
+                rects.push_back({ 1700, 1050, 1800, 1070 });
+            }
+            if (++column == 150) {
+                column = 0;
+                line = (line + 1) % 50;
+            }
+            trace.frames.push_back(std::move(rects));
+        }
+        return trace;
+    }
+
+    /*
+    * Hundreds of small scattered rects, as toolkits report for animated widgets, spinners and tooltips
+    */
+    RectTrace makeScatteredTrace() {
+        RectTrace trace;
+        trace.name = "scattered";
+        std::mt19937 random(10);
+        for (int frame = 0; frame < kTraceFrames; ++frame) {
+            std::vector<FrameRect> rects;
+            const int count = 100 + static_cast<int>(random() % 200);
+            for (int i = 0; i < count; ++i) {
+                const int x = static_cast<int>(random() % kTraceWidth);
+                const int y = static_cast<int>(random() % kTraceHeight);
+                const int size = 4 + static_cast<int>(random() % 28);
+                rects.push_back({ x, y, x + size, y + size });
+            }
+            trace.frames.push_back(std::move(rects));
+        }
+        return trace;
+    }
+
+    /*
+    * Browser redrawing a page as a grid of small overlapping paint rects
+    */
+    RectTrace makeFragmentedTrace() {
+        RectTrace trace;
+        trace.name = "fragmented redraw";
+        std::mt19937 random(11);
+        for (int frame = 0; frame < kTraceFrames; ++frame) {
+            std::vector<FrameRect> rects;
+            const int top = 100 + static_cast<int>(random() % 200);
+            for (int y = top; y < top + 600; y += 24) {
+                for (int x = 200; x < 1400; x += 40) {
+                    if (random() % 4 != 0) {
+                        rects.push_back({ x, y, x + 44, y + 26 });
+                    }
+                }
+            }
+            trace.frames.push_back(std::move(rects));
+        }
+        return trace;
+    }
+
+    /*
+    * Video playing in a window with its seek bar and subtitles updating around it
+    */
+    RectTrace makeVideoTrace() {
+        RectTrace trace;
+        trace.name = "video window";
+        for (int frame = 0; frame < kTraceFrames; ++frame) {
+            std::vector<FrameRect> rects;
+            rects.push_back({ 320, 180, 1600, 900 });
+            rects.push_back({ 320, 900, 320 + 2 * (frame % 640), 908 });
+            if ((frame / 90) % 2 == 0) {
+                rects.push_back({ 600, 840, 1320, 890 });
+            }
+            trace.frames.push_back(std::move(rects));
+        }
+        return trace;
+    }
+
+    /*
+    * Dirty rects of the synthetic capture source through all phases of its scene
+    */
+    RectTrace makeSyntheticTrace() {
+        RectTrace trace;
+        trace.name = "synthetic source";
+        FramePool framePool(kTraceWidth, kTraceHeight, FramePixelFormat::BGRA, 4, 1, 1);
+        SyntheticCaptureSource source(kTraceWidth, kTraceHeight, 60, 3);
+        FrameBuffer* frame = framePool.acquire();
+        for (int i = 0; i < kTraceFrames && source.grab(*frame); ++i) {
+            trace.frames.push_back(frame->rects.dirtyRects);
+        }
+        framePool.release(frame);
+        return trace;
+    }
+
+    /**
+     * Helper function to read the dirty rects of a capture trace file
+     *
+     * @return  False if the trace cannot be read.
+     */
+    bool readCaptureTrace(const std::string& fileName, RectTrace& trace) {
+        CaptureTraceReader reader;
+        if (!reader.open(fileName)) {
+            return false;
+        }
+        trace.name = fileName;
+        trace.width = reader.getWidth();
+        trace.height = reader.getHeight();
+
+        FramePool framePool(trace.width, trace.height, reader.getPixelFormat(), 4, 1, 1);
+        FrameBuffer* frame = framePool.acquire();
+        for (int64_t i = 0; i < reader.getFrameCount(); ++i) {
+            if (!reader.readFrame(i, *frame)) {
+                break;
+            }
+            if (frame->rects.valid) {
+                trace.frames.push_back(frame->rects.dirtyRects);
+            }
+        }
+        framePool.release(frame);
+        return true;
+    }
+
+    /**
+     * Helper function to coalesce every frame of a trace and print what the copies would cost before and after.
+     * Cost is counted with the default cost model, i.e. area plus a fixed overhead per rect. Pixels of overlapping
+     * input rects are counted once per rect, as copying them rect by rect would.
+     */
+    void benchTrace(const RectTrace& trace) {
+        const RectCostModel costModel;
+        RectCoalescer coalescer(kDefaultCoalesceTileSize, costModel);
+
+        int64_t inputRects = 0;
+        int64_t inputArea = 0;
+        int64_t inputCost = 0;
+        int64_t outputRects = 0;
+        int64_t outputArea = 0;
+        int64_t outputCost = 0;
+        int64_t boundingArea = 0;
+        int64_t boundingCost = 0;
+        int64_t boundingFrames = 0;
+        for (const auto& rects : trace.frames) {
+            FrameRect bounds = { trace.width, trace.height, 0, 0 };
+            for (const FrameRect& rect : rects) {
+                const FrameRect clipped = clipRect(rect, trace.width, trace.height);
+                if (getArea(clipped) == 0) {
+                    continue;
+                }
+                ++inputRects;
+                inputArea += getArea(clipped);
+                inputCost += getArea(clipped) + costModel.rectOverheadInPixels;
+                bounds.left = std::min(bounds.left, clipped.left);
+                bounds.top = std::min(bounds.top, clipped.top);
+                bounds.right = std::max(bounds.right, clipped.right);
+                bounds.bottom = std::max(bounds.bottom, clipped.bottom);
+            }
+            if (getArea(bounds) > 0) {
+                ++boundingFrames;
+                boundingArea += getArea(bounds);
+                boundingCost += getArea(bounds) + costModel.rectOverheadInPixels;
+            }
+
+            outputRects += static_cast<int64_t>(coalescer.coalesce(rects.data(), static_cast<int>(rects.size()), trace.width, trace.height).size());
+            outputArea += coalescer.getCoveredArea();
+            outputCost += coalescer.getCost();
+        }
+
+        const BenchResult result = measure([&]() {
+            for (const auto& rects : trace.frames) {
+                coalescer.coalesce(rects.data(), static_cast<int>(rects.size()), trace.width, trace.height);
+            }
+        });
+
+        const double frameCount = (trace.frames.empty()) ? 1.0 : static_cast<double>(trace.frames.size());
+        std::printf("%s, %zu frames of %dx%d\n", trace.name.c_str(), trace.frames.size(), trace.width, trace.height);
+        std::printf("  %-22s %10s %14s %14s\n", "per frame", "rects", "pixels", "cost");
+        std::printf("  %-22s %10.1f %14.0f %14.0f\n", "input rects", inputRects / frameCount, inputArea / frameCount, inputCost / frameCount);
+        std::printf("  %-22s %10.1f %14.0f %14.0f\n", "bounding rect", boundingFrames / frameCount, boundingArea / frameCount, boundingCost / frameCount);
+        std::printf("  %-22s %10.1f %14.0f %14.0f\n", "coalesced", outputRects / frameCount, outputArea / frameCount, outputCost / frameCount);
+        std::printf("  coalescing takes %.2f us per frame\n", result.medianInMs * 1000.0 / frameCount);
+    }
+}
+
+int main(int argc, char** argv) {
+    std::vector<RectTrace> traces;
+    traces.push_back(makeTypingTrace());
+    traces.push_back(makeScatteredTrace());
+    traces.push_back(makeFragmentedTrace());
+    traces.push_back(makeVideoTrace());
+    traces.push_back(makeSyntheticTrace());
+
+    // Capture traces recorded from real sessions can be added as arguments
+    for (int i = 1; i < argc; ++i) {
+        RectTrace trace;
+        if (!readCaptureTrace(argv[i], trace)) {
+            std::printf("Cannot read capture trace %s\n", argv[i]);
+            continue;
+        }
+        traces.push_back(std::move(trace));
+    }
+
+    for (const RectTrace& trace : traces) {
+        benchTrace(trace);
+    }
+    return 0;
+}
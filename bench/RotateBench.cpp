@@ -0,0 +1,133 @@
+#include "BenchTimer.hpp"
+#include "CpuCompositor.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace CapUtils;
+using namespace CapUtilsBench;
+
+namespace {
+
+    constexpr int kImageWidth = 3840;
+    constexpr int kImageHeight = 2160;
+    constexpr int kBytesPerPixel = 4;
+
+    /*
+    * BGRA frame along with the pixels it points to
+    */
+    struct BenchSurface {
+        BenchSurface(int width, int height) :
+            pixels(static_cast<std::size_t>(width) * kBytesPerPixel * height) {
+            frame.data = pixels.data();
+            frame.width = width;
+            frame.height = height;
+            frame.stride = width * kBytesPerPixel;
+            frame.size = pixels.size();
+            frame.pixelFormat = FramePixelFormat::BGRA;
+        }
+
+        std::vector<uint8_t> pixels;
+        FrameBuffer frame;
+    };
+
+    /**
+     * Helper function to rotate the whole image one pixel at a time, as a compiler sees the plain loop
+     */
+    void rotateNaive(const FrameBuffer& image, SurfaceRotation rotation, FrameBuffer& surface) {
+        for (int y = 0; y < surface.height; ++y) {
+            uint32_t* dst = reinterpret_cast<uint32_t*>(surface.data + static_cast<std::size_t>(y) * surface.stride);
+            for (int x = 0; x < surface.width; ++x) {
+                int imageX = x;
+                int imageY = y;
+                switch (rotation) {
+                case SurfaceRotation::ROTATE90:
+                    imageX = y;
+                    imageY = image.height - 1 - x;
+                    break;
+                case SurfaceRotation::ROTATE180:
+                    imageX = image.width - 1 - x;
+                    imageY = image.height - 1 - y;
+                    break;
+                case SurfaceRotation::ROTATE270:
+                    imageX = image.width - 1 - y;
+                    imageY = x;
+                    break;
+                default:
+                    break;
+                }
+                uint32_t pixel;
+                std::memcpy(&pixel, image.data + static_cast<std::size_t>(imageY) * image.stride +
+                            static_cast<std::size_t>(imageX) * kBytesPerPixel, sizeof(pixel));
+                dst[x] = pixel;
+            }
+        }
+    }
+
+    /**
+     * Helper function to run a rotate kernel over the whole image with the steps the compositor passes it
+     */
+    void rotateWithKernel(RotateBlitFn rotateBlit, const FrameBuffer& image, SurfaceRotation rotation, FrameBuffer& surface) {
+        const std::ptrdiff_t stride = image.stride;
+        const uint8_t* last = image.data + static_cast<std::size_t>(image.height - 1) * image.stride;
+        switch (rotation) {
+        case SurfaceRotation::ROTATE90:
+            rotateBlit(last, -stride, kBytesPerPixel, surface.data, surface.stride, surface.width, surface.height);
+            break;
+        case SurfaceRotation::ROTATE180:
+            rotateBlit(last + static_cast<std::size_t>(image.width - 1) * kBytesPerPixel, -kBytesPerPixel, -stride,
+                       surface.data, surface.stride, surface.width, surface.height);
+            break;
+        case SurfaceRotation::ROTATE270:
+            rotateBlit(image.data + static_cast<std::size_t>(image.width - 1) * kBytesPerPixel, stride, -kBytesPerPixel,
+                       surface.data, surface.stride, surface.width, surface.height);
+            break;
+        default:
+            break;
+        }
+    }
+
+    /**
+     * Helper function to time one rotation with every implementation against the naive loop
+     */
+    void benchRotation(const BenchSurface& image, SurfaceRotation rotation) {
+        const bool swapped = rotation == SurfaceRotation::ROTATE90 || rotation == SurfaceRotation::ROTATE270;
+        BenchSurface expected(swapped ? kImageHeight : kImageWidth, swapped ? kImageWidth : kImageHeight);
+        BenchSurface surface(expected.frame.width, expected.frame.height);
+        std::printf("%dx%d BGRA rotated by %d degrees\n", kImageWidth, kImageHeight, static_cast<int>(rotation) * 90);
+
+        const BenchResult naive = measure([&]() { rotateNaive(image.frame, rotation, expected.frame); });
+        printResult("naive loop", naive);
+
+        // Every implementation is checked against the naive loop once before its timings mean anything
+        auto report = [&](const char* name, const BenchResult& result) {
+            printResult(name, result, naive.medianInMs);
+            if (surface.pixels != expected.pixels) {
+                std::printf("  %s differs from the naive loop\n", name);
+            }
+            std::memset(surface.pixels.data(), 0, surface.pixels.size());
+        };
+
+        report("scalar kernel", measure([&]() { rotateWithKernel(getScalarRotateBlitFn(), image.frame, rotation, surface.frame); }));
+        if (getAVX2RotateBlitFn() != nullptr && getSupportedRotateBlitFn() == getAVX2RotateBlitFn()) {
+            report("AVX2 kernel", measure([&]() { rotateWithKernel(getAVX2RotateBlitFn(), image.frame, rotation, surface.frame); }));
+        }
+        report("CpuCompositor::rotateImage", measure([&]() { CpuCompositor::rotateImage(image.frame, rotation, surface.frame); }));
+    }
+}
+
+int main() {
+    BenchSurface image(kImageWidth, kImageHeight);
+    std::mt19937 random(14);
+    for (auto& byte : image.pixels) {
+        byte = static_cast<uint8_t>(random());
+    }
+
+    for (SurfaceRotation rotation : { SurfaceRotation::ROTATE90, SurfaceRotation::ROTATE180, SurfaceRotation::ROTATE270 }) {
+        benchRotation(image, rotation);
+    }
+    return 0;
+}
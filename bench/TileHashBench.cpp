@@ -0,0 +1,116 @@
+#include "BenchTimer.hpp"
+#include "ColorConvert.hpp"
+#include "TileHash.hpp"
+#include "WorkerPool.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace CapUtils;
+using namespace CapUtilsBench;
+
+namespace {
+
+    /*
+    * Grabbed frame filled with noise, along with NV12 planes to convert it into
+    */
+    struct BenchFrame {
+        BenchFrame(int width, int height, FramePixelFormat pixelFormat) :
+            pixels(static_cast<std::size_t>(((width * getBytesPerPixel(pixelFormat) + 3) / 4) * 4) * height),
+            y(static_cast<std::size_t>(width) * height),
+            uv(static_cast<std::size_t>((width + 1) / 2) * 2 * ((height + 1) / 2)),
+            planes{ y.data(), uv.data() },
+            strides{ width, (width + 1) / 2 * 2 } {
+            std::mt19937 random(6);
+            for (auto& byte : pixels) {
+                byte = static_cast<uint8_t>(random());
+            }
+            frame.data = pixels.data();
+            frame.width = width;
+            frame.height = height;
+            frame.stride = ((width * getBytesPerPixel(pixelFormat) + 3) / 4) * 4;
+            frame.size = pixels.size();
+            frame.pixelFormat = pixelFormat;
+        }
+
+        std::vector<uint8_t> pixels;
+        std::vector<uint8_t> y;
+        std::vector<uint8_t> uv;
+        uint8_t* planes[2];
+        int strides[2];
+        FrameBuffer frame;
+    };
+
+    /**
+     * Helper function to time a row kernel alone over every row of a frame, without the hash comparison of the detector
+     */
+    BenchResult measureRowKernel(TileHashRowFn hashRow, const FrameBuffer& frame, int tileSize) {
+        const int rowBytes = frame.width * getBytesPerPixel(frame.pixelFormat);
+        const int tileBytes = tileSize * getBytesPerPixel(frame.pixelFormat);
+        const int columns = (rowBytes + tileBytes - 1) / tileBytes;
+        std::vector<uint64_t> acc(static_cast<std::size_t>(columns) * kTileHashLanes);
+        return measure([&]() {
+            for (int row = 0; row < frame.height; ++row) {
+                hashRow(frame.data + static_cast<std::size_t>(row) * frame.stride, rowBytes, tileBytes, acc.data());
+            }
+        });
+    }
+
+    /**
+     * Helper function to print one row of the table along with its time as a share of the conversion on one thread
+     */
+    void printShare(const std::string& name, const BenchResult& result, const BenchResult& conversion) {
+        std::printf("  %-40s %9.3f ms  (min %9.3f, %4d runs)  %4.0f%% of conversion\n", name.c_str(),
+                    result.medianInMs, result.minInMs, result.runs, 100.0 * result.medianInMs / conversion.medianInMs);
+    }
+
+    /**
+     * Helper function to time change detection against the NV12 conversion of the same frame
+     */
+    void benchFrame(int width, int height, FramePixelFormat pixelFormat, WorkerPool& workerPool) {
+        std::printf("%dx%d %s\n", width, height, (pixelFormat == FramePixelFormat::BGRA) ? "BGRA" : "BGR24");
+        BenchFrame bench(width, height, pixelFormat);
+
+        const BenchResult conversion = measure([&]() {
+            convertFrameToNV12(bench.frame, bench.planes, bench.strides, getSupportedColorConvertIsa());
+        });
+        printShare("convert to NV12 " + getColorConvertIsaString(getSupportedColorConvertIsa()), conversion, conversion);
+
+        printShare("hash rows scalar", measureRowKernel(getScalarTileHashRowFn(), bench.frame, kDefaultChangeTileSize),
+                   conversion);
+        if (getAVX2TileHashRowFn() != nullptr && getSupportedColorConvertIsa() >= ColorConvertIsa::AVX2) {
+            printShare("hash rows AVX2", measureRowKernel(getAVX2TileHashRowFn(), bench.frame, kDefaultChangeTileSize),
+                       conversion);
+        }
+
+        // Same frame every time, so the detector compares all tiles and finds none changed, as on a static screen
+        TileChangeDetector detector;
+        printShare("detect changes", measure([&]() { detector.detect(bench.frame); }), conversion);
+
+        if (workerPool.getThreadCount() > 1) {
+            const std::string threads = " on " + std::to_string(workerPool.getThreadCount()) + " threads";
+            const BenchResult parallelConversion = measure([&]() {
+                convertFrameToNV12(bench.frame, bench.planes, bench.strides, workerPool);
+            });
+            printShare("convert to NV12" + threads, parallelConversion, conversion);
+            printShare("detect changes" + threads, measure([&]() { detector.detect(bench.frame, workerPool); }), conversion);
+        }
+    }
+}
+
+int main() {
+    const int hardwareThreads = static_cast<int>(std::thread::hardware_concurrency());
+    WorkerPool workerPool((hardwareThreads > 1) ? hardwareThreads : 1);
+
+    const int sizes[][2] = { { 1920, 1080 }, { 2560, 1440 }, { 3840, 2160 } };
+    for (const auto& size : sizes) {
+        for (FramePixelFormat pixelFormat : { FramePixelFormat::BGRA, FramePixelFormat::BGR24 }) {
+            benchFrame(size[0], size[1], pixelFormat, workerPool);
+        }
+    }
+    return 0;
+}
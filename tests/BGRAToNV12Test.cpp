@@ -0,0 +1,97 @@
+#include "IncrementalConvert.hpp"
+#include "TestCheck.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+using namespace CapUtils;
+
+namespace {
+
+    constexpr int kBarWidth = 16; // Even, so every chroma block lies within one bar
+    constexpr int kFrameHeight = 4;
+    constexpr int kRowPadding = 64; // Staging surfaces of desktop duplication are mapped with a row pitch beyond the width
+
+    /*
+    * Color bar along with its BT.601 limited range NV12 samples
+    */
+    struct GoldenBar {
+        uint8_t red;
+        uint8_t green;
+        uint8_t blue;
+        uint8_t y;
+        uint8_t u;
+        uint8_t v;
+    };
+
+    const GoldenBar kGoldenBars[] = {
+        { 255, 255, 255, 235, 128, 128 }, // White
+        { 0, 0, 0, 16, 128, 128 },        // Black
+        { 255, 0, 0, 82, 90, 240 },       // Red
+        { 0, 255, 0, 144, 54, 34 },       // Green
+        { 0, 0, 255, 41, 240, 110 },      // Blue
+        { 128, 128, 128, 126, 128, 128 }, // Gray
+        { 255, 255, 0, 210, 16, 146 },    // Yellow
+        { 0, 255, 255, 169, 166, 16 },    // Cyan
+    };
+}
+
+int main() {
+    const int barCount = static_cast<int>(sizeof(kGoldenBars) / sizeof(kGoldenBars[0]));
+    const int width = barCount * kBarWidth;
+    const int pitch = width * 4 + kRowPadding;
+
+    // Alpha of duplicated desktop frames is undefined and row padding holds whatever the driver left there
+    std::vector<uint8_t> pixels(static_cast<std::size_t>(pitch) * kFrameHeight, 0xEE);
+    for (int y = 0; y < kFrameHeight; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const GoldenBar& bar = kGoldenBars[x / kBarWidth];
+            uint8_t* pixel = pixels.data() + static_cast<std::size_t>(y) * pitch + x * 4;
+            pixel[0] = bar.blue;
+            pixel[1] = bar.green;
+            pixel[2] = bar.red;
+            pixel[3] = static_cast<uint8_t>(x * 37 + y * 11);
+        }
+    }
+
+    FrameBuffer frame;
+    frame.data = pixels.data();
+    frame.width = width;
+    frame.height = kFrameHeight;
+    frame.stride = pitch;
+    frame.size = pixels.size();
+    frame.pixelFormat = FramePixelFormat::BGRA;
+
+    std::vector<uint8_t> lumaPlane(static_cast<std::size_t>(width) * kFrameHeight);
+    std::vector<uint8_t> chromaPlane(static_cast<std::size_t>(width) * kFrameHeight / 2);
+    uint8_t* const planes[2] = { lumaPlane.data(), chromaPlane.data() };
+    const int strides[2] = { width, width };
+
+    // Frames without rects are converted as a whole, as the first frame of every duplication session is
+    IncrementalFrameConverter converter;
+    CHECK(!converter.updateNV12(frame, nullptr, 0, nullptr, 0, planes, strides));
+
+    int wrongSamples = 0;
+    for (int y = 0; y < kFrameHeight; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const GoldenBar& bar = kGoldenBars[x / kBarWidth];
+            wrongSamples += (lumaPlane[y * width + x] != bar.y) ? 1 : 0;
+        }
+    }
+    for (int y = 0; y < kFrameHeight / 2; ++y) {
+        for (int x = 0; x < width / 2; ++x) {
+            const GoldenBar& bar = kGoldenBars[2 * x / kBarWidth];
+            const uint8_t* sample = chromaPlane.data() + y * width + 2 * x;
+            if (sample[0] != bar.u || sample[1] != bar.v) {
+                if (wrongSamples == 0) {
+                    std::printf("  chroma of bar %d is %d %d, expected %d %d\n", 2 * x / kBarWidth, sample[0], sample[1], bar.u, bar.v);
+                }
+                ++wrongSamples;
+            }
+        }
+    }
+    CHECK(wrongSamples == 0);
+
+    return CapUtilsTests::finishTest("BGRAToNV12Test");
+}
@@ -0,0 +1,296 @@
+#include "CaptureTrace.hpp"
+#include "CaptureTraceRecorder.hpp"
+#include "TestCheck.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace CapUtils;
+
+namespace {
+
+    const char* const kTraceFileName = "CaptureTraceTest.trace";
+    const char* const kDamagedTraceFileName = "CaptureTraceTest.damaged.trace";
+
+    /*
+    * Frame as grabbed, kept to compare the replayed frames with
+    */
+    struct RecordedFrame {
+        std::vector<uint8_t> pixels;
+        int64_t timestamp = 0;
+        FrameRectMetadata rects;
+        FrameCursor cursor;
+    };
+
+    /*
+    * Random non empty rect within the frame. Traces only keep rects that lie within the frame
+    */
+    FrameRect getRandomRect(std::mt19937& random, int width, int height) {
+        FrameRect rect;
+        rect.left = static_cast<int>(random() % width);
+        rect.top = static_cast<int>(random() % height);
+        rect.right = rect.left + 1 + static_cast<int>(random() % (width - rect.left));
+        rect.bottom = rect.top + 1 + static_cast<int>(random() % (height - rect.top));
+        return rect;
+    }
+
+    /*
+    * Frames with padded rows of a GDI grab, each changed from the previous one at random spots, with rects
+    * and cursor states of every kind. Frame firstIndex 0 is random all over
+    */
+    std::vector<RecordedFrame> getRandomFrames(std::mt19937& random, FrameBuffer& frame, int firstIndex, int frameCount) {
+        std::vector<RecordedFrame> frames;
+        for (int i = firstIndex; i < firstIndex + frameCount; ++i) {
+            const int changes = (i == 0) ? static_cast<int>(frame.size) : static_cast<int>(random() % 500);
+            for (int change = 0; change < changes; ++change) {
+                frame.data[(i == 0) ? change : random() % frame.size] = static_cast<uint8_t>(random());
+            }
+            frame.timestamp = 1000 * i + random() % 100;
+            frame.sequence = i;
+            // Traces keep no rects along with invalid ones
+            frame.rects.valid = i % 4 != 0;
+            frame.rects.moveRects.assign(frame.rects.valid ? random() % 3 : 0, FrameMoveRect());
+            for (auto& moveRect : frame.rects.moveRects) {
+                moveRect.destination = getRandomRect(random, frame.width, frame.height);
+                moveRect.sourceX = static_cast<int>(random() % (frame.width - (moveRect.destination.right - moveRect.destination.left) + 1));
+                moveRect.sourceY = static_cast<int>(random() % (frame.height - (moveRect.destination.bottom - moveRect.destination.top) + 1));
+            }
+            frame.rects.dirtyRects.resize(frame.rects.valid ? random() % 4 : 0);
+            for (auto& dirtyRect : frame.rects.dirtyRects) {
+                dirtyRect = getRandomRect(random, frame.width, frame.height);
+            }
+            frame.cursor.valid = i % 3 != 0;
+            frame.cursor.visible = (i & 1) != 0;
+            frame.cursor.x = i;
+            frame.cursor.y = -i;
+
+            RecordedFrame recorded;
+            const int rowBytes = frame.width * getBytesPerPixel(frame.pixelFormat);
+            for (int y = 0; y < frame.height; ++y) {
+                const uint8_t* row = frame.data + static_cast<std::size_t>(y) * frame.stride;
+                recorded.pixels.insert(recorded.pixels.end(), row, row + rowBytes);
+            }
+            recorded.timestamp = frame.timestamp;
+            recorded.rects = frame.rects;
+            recorded.cursor = frame.cursor;
+            frames.push_back(recorded);
+        }
+        return frames;
+    }
+
+    bool isSameFrame(const RecordedFrame& recorded, const FrameBuffer& frame) {
+        const int rowBytes = frame.width * getBytesPerPixel(frame.pixelFormat);
+        for (int y = 0; y < frame.height; ++y) {
+            if (std::memcmp(recorded.pixels.data() + static_cast<std::size_t>(y) * rowBytes,
+                            frame.data + static_cast<std::size_t>(y) * frame.stride, rowBytes) != 0) {
+                return false;
+            }
+        }
+        if (recorded.timestamp != frame.timestamp || recorded.rects.valid != frame.rects.valid ||
+            recorded.rects.moveRects.size() != frame.rects.moveRects.size() ||
+            recorded.rects.dirtyRects.size() != frame.rects.dirtyRects.size() || recorded.cursor.valid != frame.cursor.valid) {
+            return false;
+        }
+        for (std::size_t i = 0; i < recorded.rects.moveRects.size(); ++i) {
+            const FrameMoveRect& a = recorded.rects.moveRects[i];
+            const FrameMoveRect& b = frame.rects.moveRects[i];
+            if (a.sourceX != b.sourceX || a.sourceY != b.sourceY || a.destination.left != b.destination.left ||
+                a.destination.top != b.destination.top || a.destination.right != b.destination.right ||
+                a.destination.bottom != b.destination.bottom) {
+                return false;
+            }
+        }
+        for (std::size_t i = 0; i < recorded.rects.dirtyRects.size(); ++i) {
+            const FrameRect& a = recorded.rects.dirtyRects[i];
+            const FrameRect& b = frame.rects.dirtyRects[i];
+            if (a.left != b.left || a.top != b.top || a.right != b.right || a.bottom != b.bottom) {
+                return false;
+            }
+        }
+        return !recorded.cursor.valid ||
+               (recorded.cursor.visible == frame.cursor.visible && recorded.cursor.x == frame.cursor.x && recorded.cursor.y == frame.cursor.y);
+    }
+
+    /*
+    * Every frame written has to be read back as it was, at sizes that leave partial tiles and for both pixel formats
+    */
+    void testRoundTrip() {
+        std::mt19937 random(16);
+        const int sizes[][2] = { { 1, 1 }, { 63, 65 }, { 333, 97 } };
+        for (FramePixelFormat pixelFormat : { FramePixelFormat::BGR24, FramePixelFormat::BGRA }) {
+            for (const auto& size : sizes) {
+                FramePool framePool(size[0], size[1], pixelFormat, 4, 2, 2);
+                FrameBuffer* frame = framePool.acquire();
+                const std::vector<RecordedFrame> frames = getRandomFrames(random, *frame, 0, 40);
+
+                // Frames are generated first, so write them again from the recorded copies
+                CaptureTraceWriter writer;
+                CHECK(writer.open(kTraceFileName, size[0], size[1], pixelFormat));
+                for (const auto& recorded : frames) {
+                    const int rowBytes = size[0] * getBytesPerPixel(pixelFormat);
+                    for (int y = 0; y < size[1]; ++y) {
+                        std::memcpy(frame->data + static_cast<std::size_t>(y) * frame->stride,
+                                    recorded.pixels.data() + static_cast<std::size_t>(y) * rowBytes, rowBytes);
+                    }
+                    frame->timestamp = recorded.timestamp;
+                    frame->rects = recorded.rects;
+                    frame->cursor = recorded.cursor;
+                    CHECK(writer.writeFrame(*frame));
+                }
+                writer.close();
+                CHECK(writer.getFrameCount() == static_cast<int64_t>(frames.size()));
+
+                CaptureTraceReader reader;
+                CHECK(reader.open(kTraceFileName));
+                CHECK(reader.getWidth() == size[0] && reader.getHeight() == size[1] && reader.getPixelFormat() == pixelFormat);
+                CHECK(reader.getFrameCount() == static_cast<int64_t>(frames.size()));
+
+                FrameBuffer* replayed = framePool.acquire();
+                int mismatches = 0;
+                for (int64_t i = 0; i < reader.getFrameCount(); ++i) {
+                    const bool read = reader.readFrame(i, *replayed);
+                    mismatches += (read && reader.getTimestamp(i) == frames[i].timestamp && isSameFrame(frames[i], *replayed)) ? 0 : 1;
+                }
+                if (!CHECK(mismatches == 0)) {
+                    std::printf("  %dx%d, %d bytes per pixel\n", size[0], size[1], getBytesPerPixel(pixelFormat));
+                }
+                reader.close();
+                framePool.release(frame);
+                framePool.release(replayed);
+            }
+        }
+    }
+
+    /*
+    * A trace cut off at any point, as left by a crash, is read up to its last complete record. A trace with damaged
+    * bytes may fail to open or to decode, but must not be read out of bounds
+    */
+    void testDamagedTrace() {
+        std::mt19937 random(17);
+        const int width = 200;
+        const int height = 130;
+        FramePool framePool(width, height, FramePixelFormat::BGRA, 4, 2, 2);
+        FrameBuffer* frame = framePool.acquire();
+
+        CaptureTraceWriter writer;
+        CHECK(writer.open(kTraceFileName, width, height, FramePixelFormat::BGRA));
+        std::vector<RecordedFrame> frames;
+        for (int i = 0; i < 20; ++i) {
+            frames.push_back(getRandomFrames(random, *frame, i, 1).front());
+            CHECK(writer.writeFrame(*frame));
+        }
+        writer.close();
+
+        std::ifstream traceFile(kTraceFileName, std::ios::binary);
+        const std::vector<uint8_t> traceBytes{ std::istreambuf_iterator<char>(traceFile), std::istreambuf_iterator<char>() };
+        traceFile.close();
+
+        FrameBuffer* replayed = framePool.acquire();
+        int wrongPrefixes = 0;
+        for (int i = 0; i < 300; ++i) {
+            std::vector<uint8_t> damaged = traceBytes;
+            const bool truncated = i % 2 == 0;
+            if (truncated) {
+                damaged.resize(random() % damaged.size());
+            }
+            else {
+                for (int flip = 0; flip < 1 + static_cast<int>(random() % 8); ++flip) {
+                    damaged[random() % damaged.size()] ^= static_cast<uint8_t>(1 + random() % 255);
+                }
+            }
+            std::ofstream damagedFile(kDamagedTraceFileName, std::ios::binary | std::ios::trunc);
+            damagedFile.write(reinterpret_cast<const char*>(damaged.data()), static_cast<std::streamsize>(damaged.size()));
+            damagedFile.close();
+
+            CaptureTraceReader reader;
+            if (!reader.open(kDamagedTraceFileName) || reader.getWidth() != width || reader.getHeight() != height ||
+                reader.getPixelFormat() != FramePixelFormat::BGRA) {
+                continue;
+            }
+            for (int64_t index = 0; index < reader.getFrameCount(); ++index) {
+                const bool read = reader.readFrame(index, *replayed);
+                if (truncated && (!read || !isSameFrame(frames[index], *replayed))) {
+                    ++wrongPrefixes;
+                    break;
+                }
+            }
+        }
+        CHECK(wrongPrefixes == 0);
+
+        framePool.release(frame);
+        framePool.release(replayed);
+        std::remove(kDamagedTraceFileName);
+    }
+
+    /*
+    * Frames queued for the writer thread end up in the trace as they were grabbed. Frames dropped while the
+    * writer is behind are counted and the frame after a drop has its rects marked invalid
+    */
+    void testRecorder() {
+        std::mt19937 random(18);
+        const int width = 640;
+        const int height = 360;
+        FramePool framePool(width, height, FramePixelFormat::BGRA, 4, 2, 2);
+        FrameBuffer* frame = framePool.acquire();
+
+        CaptureTraceRecorder recorder;
+        CHECK(recorder.open(kTraceFileName, width, height, FramePixelFormat::BGRA));
+        std::vector<RecordedFrame> recordedFrames;
+        bool dropped = false;
+        for (int i = 0; i < 200; ++i) {
+            RecordedFrame grabbed = getRandomFrames(random, *frame, i, 1).front();
+            const int64_t droppedBefore = recorder.getDroppedFrames();
+            CHECK(recorder.recordFrame(*frame));
+            if (recorder.getDroppedFrames() != droppedBefore) {
+                dropped = true;
+                continue;
+            }
+            if (dropped) {
+                grabbed.rects = FrameRectMetadata();
+                dropped = false;
+            }
+            recordedFrames.push_back(grabbed);
+        }
+        recorder.close();
+        CHECK(!recorder.isOpen());
+        CHECK(recorder.getFrameCount() == static_cast<int64_t>(recordedFrames.size()));
+        CHECK(recorder.getFrameCount() + recorder.getDroppedFrames() == 200);
+        CHECK(!recorder.recordFrame(*frame));
+
+        CaptureTraceReader reader;
+        CHECK(reader.open(kTraceFileName));
+        CHECK(reader.getFrameCount() == static_cast<int64_t>(recordedFrames.size()));
+        FrameBuffer* replayed = framePool.acquire();
+        int mismatches = 0;
+        for (int64_t i = 0; i < reader.getFrameCount(); ++i) {
+            mismatches += (reader.readFrame(i, *replayed) && isSameFrame(recordedFrames[i], *replayed)) ? 0 : 1;
+        }
+        CHECK(mismatches == 0);
+        reader.close();
+
+        // Frames of a different size are refused
+        FramePool otherPool(width / 2, height, FramePixelFormat::BGRA, 4, 1, 1);
+        FrameBuffer* otherFrame = otherPool.acquire();
+        CHECK(recorder.open(kTraceFileName, width, height, FramePixelFormat::BGRA));
+        CHECK(!recorder.recordFrame(*otherFrame));
+        recorder.close();
+
+        otherPool.release(otherFrame);
+        framePool.release(frame);
+        framePool.release(replayed);
+    }
+}
+
+int main() {
+    testRoundTrip();
+    testDamagedTrace();
+    testRecorder();
+    std::remove(kTraceFileName);
+    return CapUtilsTests::finishTest("CaptureTraceTest");
+}
@@ -0,0 +1,160 @@
+#include "ColorConvert.hpp"
+#include "TestCheck.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace CapUtils;
+
+namespace {
+
+    constexpr uint8_t kGuardByte = 0xA5; // Fills destination padding, which no kernel may write
+
+    /*
+    * Converted planes of one frame. Rows are padded, so writes past the width show up as changed padding
+    */
+    struct ConvertedFrame {
+        ConvertedFrame(int width, int height) :
+            lumaStride(width + 16),
+            chromaStride((width + 1) / 2 + 16),
+            chromaHeight((height + 1) / 2),
+            y(static_cast<std::size_t>(lumaStride) * height, kGuardByte),
+            u(static_cast<std::size_t>(chromaStride) * chromaHeight, kGuardByte),
+            v(static_cast<std::size_t>(chromaStride) * chromaHeight, kGuardByte),
+            nv12Y(static_cast<std::size_t>(lumaStride) * height, kGuardByte),
+            nv12UV(static_cast<std::size_t>(chromaStride) * 2 * chromaHeight, kGuardByte) {
+        }
+
+        void convert(const FrameBuffer& frame, ColorConvertIsa isa) {
+            uint8_t* const i420Planes[3] = { y.data(), u.data(), v.data() };
+            const int i420Strides[3] = { lumaStride, chromaStride, chromaStride };
+            convertFrameToI420(frame, i420Planes, i420Strides, isa);
+
+            uint8_t* const nv12Planes[2] = { nv12Y.data(), nv12UV.data() };
+            const int nv12Strides[2] = { lumaStride, chromaStride * 2 };
+            convertFrameToNV12(frame, nv12Planes, nv12Strides, isa);
+        }
+
+        bool operator==(const ConvertedFrame& other) const {
+            return y == other.y && u == other.u && v == other.v && nv12Y == other.nv12Y && nv12UV == other.nv12UV;
+        }
+
+        int lumaStride;
+        int chromaStride;
+        int chromaHeight;
+        std::vector<uint8_t> y;
+        std::vector<uint8_t> u;
+        std::vector<uint8_t> v;
+        std::vector<uint8_t> nv12Y;
+        std::vector<uint8_t> nv12UV;
+    };
+
+    /*
+    * Scalar output against floating point BT.601 limited range, the padding left alone and NV12 matching I420
+    */
+    void checkScalarReference(const FrameBuffer& frame, const ConvertedFrame& converted) {
+        const int bytesPerPixel = getBytesPerPixel(frame.pixelFormat);
+        int lumaErrors = 0;
+        int chromaErrors = 0;
+        int paddingWrites = 0;
+        int layoutErrors = 0;
+
+        for (int y = 0; y < frame.height; ++y) {
+            for (int x = 0; x < frame.width; ++x) {
+                const uint8_t* pixel = frame.data + static_cast<std::size_t>(y) * frame.stride + x * bytesPerPixel;
+                const double luma = 16.0 + (65.738 * pixel[2] + 129.057 * pixel[1] + 25.064 * pixel[0]) / 256.0;
+                lumaErrors += (std::fabs(luma - converted.y[y * converted.lumaStride + x]) > 1.0) ? 1 : 0;
+            }
+            for (int x = frame.width; x < converted.lumaStride; ++x) {
+                paddingWrites += (converted.y[y * converted.lumaStride + x] != kGuardByte) ? 1 : 0;
+            }
+        }
+
+        const int chromaWidth = (frame.width + 1) / 2;
+        for (int y = 0; y < converted.chromaHeight; ++y) {
+            for (int x = 0; x < chromaWidth; ++x) {
+                // Average of the 2x2 block, the last column and row repeated for odd sizes
+                double blue = 0.0;
+                double green = 0.0;
+                double red = 0.0;
+                for (int dy = 0; dy < 2; ++dy) {
+                    for (int dx = 0; dx < 2; ++dx) {
+                        const int sourceX = (2 * x + dx < frame.width) ? 2 * x + dx : frame.width - 1;
+                        const int sourceY = (2 * y + dy < frame.height) ? 2 * y + dy : frame.height - 1;
+                        const uint8_t* pixel = frame.data + static_cast<std::size_t>(sourceY) * frame.stride + sourceX * bytesPerPixel;
+                        blue += pixel[0] / 4.0;
+                        green += pixel[1] / 4.0;
+                        red += pixel[2] / 4.0;
+                    }
+                }
+                const double u = 128.0 + (-37.945 * red - 74.494 * green + 112.439 * blue) / 256.0;
+                const double v = 128.0 + (112.439 * red - 94.154 * green - 18.285 * blue) / 256.0;
+                const int index = y * converted.chromaStride + x;
+                chromaErrors += (std::fabs(u - converted.u[index]) > 2.0 || std::fabs(v - converted.v[index]) > 2.0) ? 1 : 0;
+
+                const int interleavedIndex = y * converted.chromaStride * 2 + 2 * x;
+                layoutErrors += (converted.nv12UV[interleavedIndex] != converted.u[index] ||
+                                 converted.nv12UV[interleavedIndex + 1] != converted.v[index]) ? 1 : 0;
+            }
+            for (int x = chromaWidth; x < converted.chromaStride; ++x) {
+                paddingWrites += (converted.u[y * converted.chromaStride + x] != kGuardByte) ? 1 : 0;
+            }
+        }
+        layoutErrors += (converted.nv12Y != converted.y) ? 1 : 0;
+
+        CHECK(lumaErrors == 0);
+        CHECK(chromaErrors == 0);
+        CHECK(paddingWrites == 0);
+        CHECK(layoutErrors == 0);
+    }
+}
+
+int main() {
+    const ColorConvertIsa supportedIsa = getSupportedColorConvertIsa();
+    std::printf("Kernels up to %s are compared against the scalar reference\n", getColorConvertIsaString(supportedIsa).c_str());
+
+    // Widths around every vector width, so each kernel runs its main loop, its tail and both together
+    const int widths[] = { 1, 2, 3, 5, 15, 16, 17, 31, 32, 33, 47, 63, 64, 65, 66, 97, 130, 1366 };
+    const int heights[] = { 1, 2, 3, 8 };
+    std::mt19937 random(1);
+
+    for (FramePixelFormat pixelFormat : { FramePixelFormat::BGR24, FramePixelFormat::BGRA }) {
+        const int bytesPerPixel = getBytesPerPixel(pixelFormat);
+        for (int width : widths) {
+            for (int height : heights) {
+                // Rows of GDI DIBs are DWORD aligned, which leaves a gap after odd BGR24 widths
+                const int stride = ((width * bytesPerPixel + 3) / 4) * 4;
+                std::vector<uint8_t> pixels(static_cast<std::size_t>(stride) * height);
+                for (auto& byte : pixels) {
+                    byte = static_cast<uint8_t>(random());
+                }
+
+                FrameBuffer frame;
+                frame.data = pixels.data();
+                frame.width = width;
+                frame.height = height;
+                frame.stride = stride;
+                frame.size = pixels.size();
+                frame.pixelFormat = pixelFormat;
+
+                ConvertedFrame reference(width, height);
+                reference.convert(frame, ColorConvertIsa::SCALAR);
+                checkScalarReference(frame, reference);
+
+                for (int isa = static_cast<int>(ColorConvertIsa::SSE41); isa <= static_cast<int>(supportedIsa); ++isa) {
+                    ConvertedFrame converted(width, height);
+                    converted.convert(frame, static_cast<ColorConvertIsa>(isa));
+                    if (!CHECK(converted == reference)) {
+                        std::printf("  %s differs from scalar at %dx%d, %d bytes per pixel\n",
+                                    getColorConvertIsaString(static_cast<ColorConvertIsa>(isa)).c_str(), width, height, bytesPerPixel);
+                    }
+                }
+            }
+        }
+    }
+
+    return CapUtilsTests::finishTest("ColorConvertTest");
+}
@@ -0,0 +1,128 @@
+#include "CommandWatcher.hpp"
+#include "TestCheck.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace CapUtils;
+using namespace std::chrono_literals;
+
+namespace {
+
+    const char* const kCommandDirectory = "CommandWatcherTest.commands";
+
+    constexpr std::chrono::milliseconds kCommandTimeout = 2000ms; // Wait for commands that were written. Returns on the change
+    constexpr std::chrono::milliseconds kIdleTimeout = 150ms; // Wait for nothing to come, longer than the poll interval
+
+    void writeCommandFile(const std::string& fileName, const std::string& text, bool append) {
+        std::ofstream file(fileName, append ? std::ios::app : std::ios::trunc);
+        file << text;
+    }
+
+    void testParse() {
+        RecordingCommand command;
+        CHECK(parseRecordingCommand("7 Marker:intro scene", command));
+        CHECK(command.type == RecordingCommandType::MARKER && command.sequence == 7 && command.label == "intro scene");
+        CHECK(parseRecordingCommand("StartRec", command));
+        CHECK(command.type == RecordingCommandType::START_REC && command.sequence == 0);
+        CHECK(parseRecordingCommand("12 Pause", command));
+        CHECK(command.type == RecordingCommandType::PAUSE && command.sequence == 12);
+        CHECK(!parseRecordingCommand("13 Bogus", command));
+        CHECK(command.type == RecordingCommandType::UNKNOWN_COMMAND);
+        CHECK(!parseRecordingCommand("", command));
+    }
+
+    /*
+    * Single commands overwriting the file, the old protocol, are taken whenever they differ from the last one
+    */
+    void testUnsequencedCommands(const std::string& fileName) {
+        writeCommandFile(fileName, "StartRec", false);
+        CommandWatcher watcher;
+        watcher.open(fileName);
+
+        std::vector<RecordingCommand> commands = watcher.waitForCommands(kCommandTimeout);
+        CHECK(commands.size() == 1 && commands[0].type == RecordingCommandType::START_REC);
+        CHECK(watcher.waitForCommands(kIdleTimeout).empty());
+
+        // Keepalive rewrites of the same command are not repeated
+        writeCommandFile(fileName, "StartRec", false);
+        CHECK(watcher.waitForCommands(kIdleTimeout).empty());
+
+        // Marker lines wait for their newline, as the label could still grow
+        writeCommandFile(fileName, "Marker:xy", false);
+        CHECK(watcher.waitForCommands(kIdleTimeout).empty());
+        writeCommandFile(fileName, "Marker:xyz\n", false);
+        commands = watcher.waitForCommands(kCommandTimeout);
+        CHECK(commands.size() == 1 && commands[0].type == RecordingCommandType::MARKER && commands[0].label == "xyz");
+
+        writeCommandFile(fileName, "StopRec", false);
+        commands = watcher.waitForCommands(kCommandTimeout);
+        CHECK(commands.size() == 1 && commands[0].type == RecordingCommandType::STOP_REC);
+    }
+
+    /*
+    * Sequenced commands are each taken once and in order, however many were written between two reads
+    */
+    void testSequencedCommands(const std::string& fileName) {
+        writeCommandFile(fileName, "1 StartRec\n", false);
+        CommandWatcher watcher;
+        watcher.open(fileName);
+
+        std::vector<RecordingCommand> commands = watcher.waitForCommands(kCommandTimeout);
+        CHECK(commands.size() == 1 && commands[0].sequence == 1);
+
+        writeCommandFile(fileName, "2 Pause\n3 Resume\n4 Bogus\n6 Marker:scene two\n", true);
+        commands = watcher.waitForCommands(kCommandTimeout);
+        // Unknown commands are handed on as well, for the caller to log
+        const bool burstInOrder = commands.size() == 4 && commands[0].type == RecordingCommandType::PAUSE &&
+                                  commands[1].type == RecordingCommandType::RESUME &&
+                                  commands[2].type == RecordingCommandType::UNKNOWN_COMMAND && commands[3].label == "scene two";
+        CHECK(burstInOrder);
+        CHECK(watcher.getLastSequence() == 6);
+
+        // Rewriting the file with the latest commands only returns the new ones
+        writeCommandFile(fileName, "6 Marker:scene two\n7 Marker:scene three\n", false);
+        commands = watcher.waitForCommands(kCommandTimeout);
+        CHECK(commands.size() == 1 && commands[0].sequence == 7);
+
+        // A line cut in the middle of its write is taken once complete
+        writeCommandFile(fileName, "8 Marker:sce", true);
+        CHECK(watcher.waitForCommands(kIdleTimeout).empty());
+        writeCommandFile(fileName, "ne four\n", true);
+        commands = watcher.waitForCommands(kCommandTimeout);
+        CHECK(commands.size() == 1 && commands[0].label == "scene four");
+
+        // Keywords are taken without their newline, so writers of a single keyword keep working
+        writeCommandFile(fileName, "9 StopRec", true);
+        commands = watcher.waitForCommands(kCommandTimeout);
+        CHECK(commands.size() == 1 && commands[0].type == RecordingCommandType::STOP_REC);
+
+        // Other files of the directory do not produce commands
+        writeCommandFile(std::string(kCommandDirectory) + "/Other.txt", "10 StartRec\n", false);
+        CHECK(watcher.waitForCommands(kIdleTimeout).empty());
+
+        // Writers replacing the file by a rename are followed
+        const std::string replacementName = std::string(kCommandDirectory) + "/Replacement.txt";
+        writeCommandFile(replacementName, "10 Pause\n", false);
+        std::filesystem::rename(replacementName, fileName);
+        commands = watcher.waitForCommands(kCommandTimeout);
+        CHECK(commands.size() == 1 && commands[0].sequence == 10);
+    }
+}
+
+int main() {
+    CapUtilsTests::openTestLog("CommandWatcherTest");
+    std::filesystem::remove_all(kCommandDirectory);
+    std::filesystem::create_directories(kCommandDirectory);
+
+    testParse();
+    testUnsequencedCommands(std::string(kCommandDirectory) + "/Unsequenced.txt");
+    testSequencedCommands(std::string(kCommandDirectory) + "/Sequenced.txt");
+
+    std::filesystem::remove_all(kCommandDirectory);
+    return CapUtilsTests::finishTest("CommandWatcherTest");
+}
@@ -0,0 +1,286 @@
+#include "CpuCompositor.hpp"
+#include "TestCheck.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace CapUtils;
+
+namespace {
+
+    /*
+    * BGRA image with padded rows
+    */
+    struct TestImage {
+        TestImage(int width, int height, int paddingPixels) :
+            pixels(static_cast<std::size_t>(width + paddingPixels) * 4 * height) {
+            frame.data = pixels.data();
+            frame.width = width;
+            frame.height = height;
+            frame.stride = (width + paddingPixels) * 4;
+            frame.size = pixels.size();
+            frame.pixelFormat = FramePixelFormat::BGRA;
+        }
+
+        TestImage(const TestImage& other) :
+            pixels(other.pixels),
+            frame(other.frame) {
+            frame.data = pixels.data();
+        }
+
+        uint32_t getPixel(int x, int y) const {
+            uint32_t pixel = 0;
+            std::memcpy(&pixel, pixels.data() + static_cast<std::size_t>(y) * frame.stride + x * 4, 4);
+            return pixel;
+        }
+
+        void setPixel(int x, int y, uint32_t pixel) {
+            std::memcpy(pixels.data() + static_cast<std::size_t>(y) * frame.stride + x * 4, &pixel, 4);
+        }
+
+        void randomize(std::mt19937& random) {
+            for (auto& byte : pixels) {
+                byte = static_cast<uint8_t>(random());
+            }
+        }
+
+        std::vector<uint8_t> pixels;
+        FrameBuffer frame;
+    };
+
+    /*
+    * Desktop position of image pixel x, y, written down per rotation independently of rotateToDesktop
+    */
+    void toDesktop(SurfaceRotation rotation, int imageWidth, int imageHeight, int x, int y, int& desktopX, int& desktopY) {
+        switch (rotation) {
+        case SurfaceRotation::ROTATE90:
+            desktopX = imageHeight - 1 - y;
+            desktopY = x;
+            break;
+        case SurfaceRotation::ROTATE180:
+            desktopX = imageWidth - 1 - x;
+            desktopY = imageHeight - 1 - y;
+            break;
+        case SurfaceRotation::ROTATE270:
+            desktopX = y;
+            desktopY = imageWidth - 1 - x;
+            break;
+        default:
+            desktopX = x;
+            desktopY = y;
+            break;
+        }
+    }
+
+    /*
+    * Place image into surface at origin, rotated pixel by pixel
+    */
+    void placeRotated(const TestImage& image, SurfaceRotation rotation, TestImage& surface, int originX, int originY) {
+        for (int y = 0; y < image.frame.height; ++y) {
+            for (int x = 0; x < image.frame.width; ++x) {
+                int desktopX = 0;
+                int desktopY = 0;
+                toDesktop(rotation, image.frame.width, image.frame.height, x, y, desktopX, desktopY);
+                surface.setPixel(originX + desktopX, originY + desktopY, image.getPixel(x, y));
+            }
+        }
+    }
+
+    /*
+    * Composing moves and dirty rects onto a rotated surface has to give the same surface as applying them to the
+    * unrotated image and rotating the result pixel by pixel. Surface pixels outside the desktop stay untouched
+    */
+    void testCompose() {
+        std::mt19937 random(13);
+        const CpuCompositor compositor;
+        int mismatches = 0;
+        int rejected = 0;
+        int badRectsAccepted = 0;
+
+        for (int i = 0; i < 2000; ++i) {
+            const int width = 1 + static_cast<int>(random() % 90);
+            const int height = 1 + static_cast<int>(random() % 70);
+            const SurfaceRotation rotation = static_cast<SurfaceRotation>(random() % 4);
+            const bool swapped = rotation == SurfaceRotation::ROTATE90 || rotation == SurfaceRotation::ROTATE270;
+            const int originX = static_cast<int>(random() % 5);
+            const int originY = static_cast<int>(random() % 5);
+
+            TestImage previous(width, height, static_cast<int>(random() % 3));
+            TestImage image(width, height, static_cast<int>(random() % 3));
+            TestImage surface((swapped ? height : width) + originX + static_cast<int>(random() % 3),
+                              (swapped ? width : height) + originY + static_cast<int>(random() % 3), static_cast<int>(random() % 3));
+            previous.randomize(random);
+            image.randomize(random);
+            surface.randomize(random);
+            placeRotated(previous, rotation, surface, originX, originY);
+
+            // Apply the rects to a copy of the previous image the plain way
+            TestImage expectedImage(previous);
+            std::vector<FrameMoveRect> moveRects(random() % 3);
+            for (auto& moveRect : moveRects) {
+                const int moveWidth = 1 + static_cast<int>(random() % width);
+                const int moveHeight = 1 + static_cast<int>(random() % height);
+                moveRect.sourceX = static_cast<int>(random() % (width - moveWidth + 1));
+                moveRect.sourceY = static_cast<int>(random() % (height - moveHeight + 1));
+                moveRect.destination.left = static_cast<int>(random() % (width - moveWidth + 1));
+                moveRect.destination.top = static_cast<int>(random() % (height - moveHeight + 1));
+                moveRect.destination.right = moveRect.destination.left + moveWidth;
+                moveRect.destination.bottom = moveRect.destination.top + moveHeight;
+
+                std::vector<uint32_t> block(static_cast<std::size_t>(moveWidth) * moveHeight);
+                for (int y = 0; y < moveHeight; ++y) {
+                    for (int x = 0; x < moveWidth; ++x) {
+                        block[y * moveWidth + x] = expectedImage.getPixel(moveRect.sourceX + x, moveRect.sourceY + y);
+                    }
+                }
+                for (int y = 0; y < moveHeight; ++y) {
+                    for (int x = 0; x < moveWidth; ++x) {
+                        expectedImage.setPixel(moveRect.destination.left + x, moveRect.destination.top + y, block[y * moveWidth + x]);
+                    }
+                }
+            }
+            std::vector<FrameRect> dirtyRects(random() % 6);
+            for (auto& dirtyRect : dirtyRects) {
+                dirtyRect.left = static_cast<int>(random() % width);
+                dirtyRect.top = static_cast<int>(random() % height);
+                dirtyRect.right = dirtyRect.left + static_cast<int>(random() % (width - dirtyRect.left + 1));
+                dirtyRect.bottom = dirtyRect.top + static_cast<int>(random() % (height - dirtyRect.top + 1));
+                for (int y = dirtyRect.top; y < dirtyRect.bottom; ++y) {
+                    for (int x = dirtyRect.left; x < dirtyRect.right; ++x) {
+                        expectedImage.setPixel(x, y, image.getPixel(x, y));
+                    }
+                }
+            }
+            TestImage expectedSurface(surface);
+            placeRotated(expectedImage, rotation, expectedSurface, originX, originY);
+
+            if (!compositor.compose(image.frame, rotation, moveRects.data(), static_cast<int>(moveRects.size()),
+                                    dirtyRects.data(), static_cast<int>(dirtyRects.size()), surface.frame, originX, originY)) {
+                ++rejected;
+                continue;
+            }
+            if (surface.pixels != expectedSurface.pixels && mismatches++ == 0) {
+                std::printf("  %dx%d rotated by %d degrees differs from the reference\n", width, height, static_cast<int>(rotation) * 90);
+            }
+
+            // A rect outside the image is rejected and nothing is written
+            const FrameRect outside = { 0, 0, width + 1, height };
+            const std::vector<uint8_t> before = surface.pixels;
+            badRectsAccepted += (compositor.compose(image.frame, rotation, nullptr, 0, &outside, 1, surface.frame, originX, originY) ||
+                                 surface.pixels != before) ? 1 : 0;
+        }
+
+        CHECK(rejected == 0);
+        CHECK(mismatches == 0);
+        CHECK(badRectsAccepted == 0);
+    }
+
+    /*
+    * Blit kernels of every instruction set have to write what the scalar kernel writes, which in turn has to be
+    * the source pixel at src + x * srcStepX + y * srcStepY, for transposes, mirrored rows and plain copies
+    */
+    void testRotateBlitKernels() {
+        const RotateBlitFn scalarFn = getScalarRotateBlitFn();
+        const RotateBlitFn avx2Fn = getAVX2RotateBlitFn();
+        const bool testAVX2 = avx2Fn != nullptr && getSupportedRotateBlitFn() == avx2Fn;
+        if (!testAVX2) {
+            std::printf("AVX2 blit kernel is not available, only the scalar kernel is tested\n");
+        }
+
+        std::mt19937 random(14);
+        int wrongPixels = 0;
+        int mismatches = 0;
+        for (int i = 0; i < 3000; ++i) {
+            const int width = 1 + static_cast<int>(random() % 80);
+            const int height = 1 + static_cast<int>(random() % 80);
+            const int sourceEdge = ((width > height) ? width : height) + 2;
+            const std::ptrdiff_t sourceStride = static_cast<std::ptrdiff_t>(sourceEdge) * 4;
+            std::vector<uint8_t> source(static_cast<std::size_t>(sourceStride) * sourceEdge);
+            for (auto& byte : source) {
+                byte = static_cast<uint8_t>(random());
+            }
+
+            // Source walks of the four rotations, each starting at the corner that becomes the top left pixel
+            const uint8_t* src = source.data();
+            std::ptrdiff_t srcStepX = 4;
+            std::ptrdiff_t srcStepY = sourceStride;
+            switch (random() % 4) {
+            case 1:
+                src = source.data() + (width - 1) * sourceStride;
+                srcStepX = -sourceStride;
+                srcStepY = 4;
+                break;
+            case 2:
+                src = source.data() + (height - 1) * sourceStride + (width - 1) * 4;
+                srcStepX = -4;
+                srcStepY = -sourceStride;
+                break;
+            case 3:
+                src = source.data() + (height - 1) * 4;
+                srcStepX = sourceStride;
+                srcStepY = -4;
+                break;
+            default:
+                break;
+            }
+
+            const int dstStride = (width + static_cast<int>(random() % 3)) * 4;
+            std::vector<uint8_t> scalarDst(static_cast<std::size_t>(dstStride) * height, 0);
+            std::vector<uint8_t> avx2Dst(scalarDst);
+            scalarFn(src, srcStepX, srcStepY, scalarDst.data(), dstStride, width, height);
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    wrongPixels += (std::memcmp(scalarDst.data() + static_cast<std::size_t>(y) * dstStride + x * 4,
+                                                src + x * srcStepX + y * srcStepY, 4) != 0) ? 1 : 0;
+                }
+            }
+            if (testAVX2) {
+                avx2Fn(src, srcStepX, srcStepY, avx2Dst.data(), dstStride, width, height);
+                if (avx2Dst != scalarDst && mismatches++ == 0) {
+                    std::printf("  AVX2 differs from scalar for %dx%d with steps %td, %td\n", width, height, srcStepX, srcStepY);
+                }
+            }
+        }
+
+        CHECK(wrongPixels == 0);
+        CHECK(mismatches == 0);
+    }
+
+    /*
+    * Turning a whole image upright in one pass has to match placing it pixel by pixel, for sizes that leave
+    * partial kernel tiles at the right and bottom edges
+    */
+    void testRotateImage() {
+        std::mt19937 random(15);
+        int mismatches = 0;
+        for (int rotationIndex = 0; rotationIndex < 4; ++rotationIndex) {
+            const SurfaceRotation rotation = static_cast<SurfaceRotation>(rotationIndex);
+            const bool swapped = rotation == SurfaceRotation::ROTATE90 || rotation == SurfaceRotation::ROTATE270;
+            for (int width : { 1, 7, 8, 9, 33, 250 }) {
+                for (int height : { 1, 8, 13, 97 }) {
+                    TestImage image(width, height, 1);
+                    image.randomize(random);
+                    TestImage surface(swapped ? height : width, swapped ? width : height, 2);
+                    surface.randomize(random);
+                    TestImage expectedSurface(surface);
+                    placeRotated(image, rotation, expectedSurface, 0, 0);
+
+                    const bool rotated = CpuCompositor::rotateImage(image.frame, rotation, surface.frame);
+                    mismatches += (!rotated || surface.pixels != expectedSurface.pixels) ? 1 : 0;
+                }
+            }
+        }
+        CHECK(mismatches == 0);
+    }
+}
+
+int main() {
+    testCompose();
+    testRotateBlitKernels();
+    testRotateImage();
+    return CapUtilsTests::finishTest("CpuCompositorTest");
+}
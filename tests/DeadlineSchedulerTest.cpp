@@ -0,0 +1,113 @@
+#include "DeadlineScheduler.hpp"
+#include "TestCheck.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+using namespace CapUtils;
+using namespace std::chrono_literals;
+
+namespace {
+
+    /*
+    * Deadlines are exact fractions of a second from the start, so no rounding of the period adds up, however
+    * long the schedule runs and whether or not the rate divides a second evenly
+    */
+    void testNoDrift() {
+        int wrongCounts = 0;
+        for (int ticksPerSecond : { 1, 7, 24, 30, 60, 144, 1000 }) {
+            const DeadlineScheduler scheduler(ticksPerSecond, MissedTickPolicy::CATCH_UP);
+            for (int64_t seconds : { 1ll, 3ll, 3600ll, 864000ll }) {
+                const std::chrono::nanoseconds duration = std::chrono::seconds(seconds);
+                const uint64_t expected = static_cast<uint64_t>(seconds) * ticksPerSecond;
+                // Tick 0 is due at the start, so a whole number of seconds ends right on a deadline
+                if (scheduler.getTicksWithin(duration - 1ns) != expected || scheduler.getTicksWithin(duration) != expected + 1) {
+                    if (wrongCounts++ == 0) {
+                        std::printf("  %d ticks per second drift within %lld seconds\n", ticksPerSecond, static_cast<long long>(seconds));
+                    }
+                }
+            }
+        }
+        CHECK(wrongCounts == 0);
+
+        const DeadlineScheduler tooSlow(0, MissedTickPolicy::CATCH_UP);
+        const DeadlineScheduler tooFast(5000, MissedTickPolicy::CATCH_UP);
+        CHECK(tooSlow.getTicksPerSecond() == 1);
+        CHECK(tooFast.getTicksPerSecond() == 1000);
+    }
+
+    /*
+    * A rate change anchors the schedule at the deadline of the next tick. That tick stays due when it was,
+    * the ones after it follow at the new rate and tick indexes keep counting
+    */
+    void testRateChange() {
+        DeadlineScheduler scheduler(1, MissedTickPolicy::CATCH_UP);
+        CHECK(scheduler.takeTick() == 0);
+
+        scheduler.setTicksPerSecond(60);
+        CHECK(scheduler.getTicksPerSecond() == 60);
+        CHECK(scheduler.getTicksWithin(500ms) == 1);
+        CHECK(scheduler.getTicksWithin(1s) == 2);
+        CHECK(scheduler.getTicksWithin(1500ms) == 1 + 30 + 1);
+        CHECK(scheduler.getTicksWithin(2s) == 1 + 60 + 1);
+        CHECK(scheduler.getTimeUntilNextTick() > 500ms);
+
+        // The next tick keeps its index whatever the rate
+        CHECK(scheduler.takeTick() == 1);
+    }
+
+    /*
+    * Catching up takes every missed tick in turn, skipping jumps to the tick due now
+    */
+    void testMissedTicks() {
+        DeadlineScheduler catchingUp(100, MissedTickPolicy::CATCH_UP);
+        DeadlineScheduler skipping(100, MissedTickPolicy::SKIP);
+        CHECK(catchingUp.takeTick() == 0);
+        CHECK(skipping.takeTick() == 0);
+
+        std::this_thread::sleep_for(200ms);
+        CHECK(catchingUp.takeTick() == 1);
+        const uint64_t skippedTo = skipping.takeTick();
+        CHECK(skippedTo >= 20);
+
+        const TickJitterStats catchUpStats = catchingUp.getJitterStats();
+        const TickJitterStats skipStats = skipping.getJitterStats();
+        CHECK(catchUpStats.ticks == 2 && catchUpStats.missedTicks == 1 && catchUpStats.skippedTicks == 0);
+        CHECK(catchUpStats.maxLatenessInUs >= 190000);
+        CHECK(skipStats.ticks == 2 && skipStats.missedTicks == 1 && skipStats.skippedTicks == skippedTo - 1);
+        CHECK(skipStats.maxLatenessInUs < 10000);
+
+        // Start clears the statistics and anchors the schedule anew
+        skipping.start();
+        CHECK(skipping.getJitterStats().ticks == 0);
+        CHECK(skipping.takeTick() == 0);
+    }
+
+    /*
+    * Waiting never returns before the deadline, and ticks taken on time come out in order
+    */
+    void testWaitForNextTick() {
+        DeadlineScheduler scheduler(100, MissedTickPolicy::CATCH_UP);
+        const auto startTime = std::chrono::steady_clock::now();
+        int earlyWakeups = 0;
+        int wrongIndexes = 0;
+        for (uint64_t i = 0; i < 20; ++i) {
+            scheduler.waitForNextTick();
+            earlyWakeups += (scheduler.getTimeUntilNextTick() == 0ns) ? 0 : 1;
+            wrongIndexes += (scheduler.takeTick() == i) ? 0 : 1;
+        }
+        CHECK(earlyWakeups == 0);
+        CHECK(wrongIndexes == 0);
+        CHECK(std::chrono::steady_clock::now() - startTime >= 190ms);
+    }
+}
+
+int main() {
+    testNoDrift();
+    testRateChange();
+    testMissedTicks();
+    testWaitForNextTick();
+    return CapUtilsTests::finishTest("DeadlineSchedulerTest");
+}
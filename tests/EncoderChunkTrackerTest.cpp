@@ -0,0 +1,171 @@
+#include "EncoderChunkTracker.hpp"
+#include "TestCheck.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+using namespace CapUtils;
+
+namespace {
+
+    constexpr int64_t kChunkEnd = -1; // Entry of an instance queue that ends a chunk, as nullptr does in the pipeline
+    constexpr int64_t kFrameDuration = 3000; // Frames are 1/30 s apart in a 90 kHz time base
+
+    /*
+    * Encoder instance of the parallel encode mode without an encoder. Its fake encoder gives back the packet of a
+    * frame after delay more frames were sent, or at the flush, and drops the frames it is told to
+    */
+    struct SimulatedInstance {
+        EncoderChunkTracker chunks;
+        std::deque<int64_t> heldFrames; // Timestamps of frames sent whose packet did not come out yet
+        std::vector<int64_t> queue; // Packets and chunk ends handed to the mux stage, in order
+        int wrongKeyframes = 0;
+
+        void endChunks(int chunkCount) {
+            queue.insert(queue.end(), static_cast<std::size_t>(chunkCount), kChunkEnd);
+        }
+
+        void handOnPacket(int64_t timestamp, const std::vector<bool>& dropped) {
+            if (dropped[static_cast<std::size_t>(timestamp / kFrameDuration)]) {
+                return;
+            }
+            endChunks(chunks.endChunksBefore(timestamp));
+            queue.push_back(timestamp);
+            endChunks(chunks.packetHandedOn());
+        }
+
+        void send(int64_t timestamp, bool chunkStart, std::size_t delay, const std::vector<bool>& dropped) {
+            wrongKeyframes += (chunks.startFrame(timestamp) == chunkStart) ? 0 : 1;
+            chunks.frameSent();
+            heldFrames.push_back(timestamp);
+            while (heldFrames.size() > delay) {
+                const int64_t packetTimestamp = heldFrames.front();
+                heldFrames.pop_front();
+                handOnPacket(packetTimestamp, dropped);
+            }
+        }
+
+        void flush(const std::vector<bool>& dropped) {
+            while (!heldFrames.empty()) {
+                const int64_t packetTimestamp = heldFrames.front();
+                heldFrames.pop_front();
+                handOnPacket(packetTimestamp, dropped);
+            }
+            endChunks(chunks.endAll());
+        }
+    };
+
+    /*
+    * Frames are dispatched in chunks of chunkSize to the instances in turn, chunk N to instance N modulo the instance
+    * count, and the ordered mux takes packets of chunk N from that instance until it reads the end of the chunk.
+    * Every packet the encoders gave back has to come out exactly once and in capture order, and every instance queue
+    * has to be used up, i.e. each instance handed on the end of each of its chunks once and at the right place
+    */
+    void testReorder(int instanceCount, int chunkSize, int frameCount, std::size_t delay, int dropInterval, bool dropChunkStarts) {
+        std::vector<bool> dropped(static_cast<std::size_t>(frameCount), false);
+        for (int i = 0; i < frameCount; ++i) {
+            dropped[static_cast<std::size_t>(i)] = (dropInterval > 0 && i % dropInterval == dropInterval - 1) ||
+                                                   (dropChunkStarts && i % chunkSize == 0 && i > 0);
+        }
+
+        std::vector<SimulatedInstance> instances(static_cast<std::size_t>(instanceCount));
+        for (int i = 0; i < frameCount; ++i) {
+            const int chunk = i / chunkSize;
+            SimulatedInstance& instance = instances[static_cast<std::size_t>(chunk % instanceCount)];
+            instance.send(i * kFrameDuration, i % chunkSize == 0, delay, dropped);
+            if (i % chunkSize == chunkSize - 1 || i == frameCount - 1) {
+                instance.endChunks(instance.chunks.completeChunk());
+            }
+        }
+        int wrongKeyframes = 0;
+        for (SimulatedInstance& instance : instances) {
+            instance.flush(dropped);
+            wrongKeyframes += instance.wrongKeyframes;
+        }
+
+        std::vector<int64_t> muxed;
+        std::vector<std::size_t> readPositions(instances.size(), 0);
+        for (std::size_t chunk = 0; ; ) {
+            const std::size_t instanceIndex = chunk % instances.size();
+            const std::vector<int64_t>& queue = instances[instanceIndex].queue;
+            std::size_t& position = readPositions[instanceIndex];
+            if (position == queue.size()) {
+                break;
+            }
+            const int64_t entry = queue[position++];
+            if (entry == kChunkEnd) {
+                ++chunk;
+            }
+            else {
+                muxed.push_back(entry);
+            }
+        }
+
+        std::vector<int64_t> expected;
+        for (int i = 0; i < frameCount; ++i) {
+            if (!dropped[static_cast<std::size_t>(i)]) {
+                expected.push_back(i * kFrameDuration);
+            }
+        }
+        int unreadEntries = 0;
+        for (std::size_t i = 0; i < instances.size(); ++i) {
+            unreadEntries += static_cast<int>(instances[i].queue.size() - readPositions[i]);
+        }
+
+        const bool passed = CHECK(muxed == expected) && CHECK(unreadEntries == 0) && CHECK(wrongKeyframes == 0);
+        if (!passed) {
+            std::printf("  %d instances, chunks of %d, %d frames, delay %zu, drop interval %d%s: %zu of %zu packets muxed\n",
+                        instanceCount, chunkSize, frameCount, delay, dropInterval, dropChunkStarts ? ", chunk starts dropped" : "",
+                        muxed.size(), expected.size());
+        }
+    }
+
+    /*
+    * A chunk ends right away when completed if each of its frames came out already, and only then
+    */
+    void testCompleteChunk() {
+        EncoderChunkTracker tracker;
+        CHECK(tracker.completeChunk() == 0);
+
+        CHECK(tracker.startFrame(0));
+        tracker.frameSent();
+        CHECK(!tracker.startFrame(kFrameDuration));
+        tracker.frameSent();
+        CHECK(tracker.packetHandedOn() == 0);
+        CHECK(tracker.packetHandedOn() == 0);
+        CHECK(tracker.completeChunk() == 1 && tracker.getOpenChunkCount() == 0);
+
+        // One frame still inside the encoder keeps the chunk open past its completion
+        CHECK(tracker.startFrame(2 * kFrameDuration));
+        tracker.frameSent();
+        CHECK(tracker.completeChunk() == 0 && tracker.getOpenChunkCount() == 1);
+        CHECK(tracker.startFrame(3 * kFrameDuration));
+        tracker.frameSent();
+        CHECK(tracker.packetHandedOn() == 1 && tracker.getOpenChunkCount() == 1);
+
+        // A frame the encoder failed to take is not waited for
+        CHECK(!tracker.startFrame(4 * kFrameDuration));
+        CHECK(tracker.packetHandedOn() == 0);
+        CHECK(tracker.completeChunk() == 1);
+        CHECK(tracker.endAll() == 0);
+    }
+}
+
+int main() {
+    testCompleteChunk();
+    for (int instanceCount = 1; instanceCount <= 4; ++instanceCount) {
+        for (std::size_t delay : { 0, 1, 3, 13 }) {
+            for (int chunkSize : { 4, 12 }) {
+                testReorder(instanceCount, chunkSize, 100, delay, 0, false);
+                testReorder(instanceCount, chunkSize, 97, delay, 0, false);
+                testReorder(instanceCount, chunkSize, 100, delay, 7, false);
+                testReorder(instanceCount, chunkSize, 101, delay, 0, true);
+                testReorder(instanceCount, chunkSize, 3, delay, 0, false);
+            }
+        }
+    }
+    return CapUtilsTests::finishTest("EncoderChunkTrackerTest");
+}
@@ -0,0 +1,164 @@
+#include "FramePool.hpp"
+#include "SPSCRingBuffer.hpp"
+#include "TestCheck.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+using namespace CapUtils;
+
+namespace {
+
+    std::atomic<int64_t> heapAllocationCount{ 0 }; // Number of calls to the replaced global operator new below
+
+    /*
+    * Allocator that takes its memory from the heap and counts what the pool asks for
+    */
+    class CountingAllocator : public FrameMemoryAllocator {
+
+    public:
+        uint8_t* allocate(std::size_t size) override {
+            ++allocateCount;
+            return static_cast<uint8_t*>(::operator new[](size, std::align_val_t(kCacheLineSize)));
+        }
+
+        void deallocate(uint8_t* data) override {
+            ++deallocateCount;
+            ::operator delete[](data, std::align_val_t(kCacheLineSize));
+        }
+
+        int allocateCount = 0;
+        int deallocateCount = 0;
+    };
+
+    /*
+    * Buffers are laid out as GDI expects and aligned to a cache line
+    */
+    void testLayout() {
+        FramePool pool(5, 3, FramePixelFormat::BGR24, 4, 1, 1);
+        FrameBuffer* buffer = pool.acquire();
+        if (!CHECK(buffer != nullptr)) {
+            return;
+        }
+        CHECK(buffer->width == 5 && buffer->height == 3);
+        CHECK(buffer->stride == 16);
+        CHECK(buffer->size == 48 && pool.getBufferSize() == 48);
+        CHECK(buffer->pixelFormat == FramePixelFormat::BGR24);
+        CHECK(reinterpret_cast<std::uintptr_t>(buffer->data) % kCacheLineSize == 0);
+        pool.release(buffer);
+
+        FramePool bgraPool(5, 3, FramePixelFormat::BGRA, 4, 1, 1);
+        CHECK(bgraPool.getBufferSize() == 60);
+    }
+
+    /*
+    * Recording in steady state recycles the preallocated buffers and never goes to the heap
+    */
+    void testSteadyState() {
+        FramePool pool(64, 32, FramePixelFormat::BGRA, 4, 3, 3);
+        const int64_t allocationsBefore = heapAllocationCount;
+        for (int frame = 0; frame < 1000; ++frame) {
+            FrameBuffer* first = pool.acquire();
+            FrameBuffer* second = pool.acquire();
+            FrameBuffer* third = pool.acquire();
+            CHECK(first != nullptr && second != nullptr && third != nullptr);
+            pool.release(second);
+            pool.release(first);
+            pool.release(third);
+        }
+        CHECK(heapAllocationCount == allocationsBefore);
+        CHECK(pool.getHitCount() == 3000);
+        CHECK(pool.getMissCount() == 0);
+    }
+
+    /*
+    * Pool grows on demand up to maxCount, counting every acquire that found no free buffer as a miss
+    */
+    void testGrowthAndLimit() {
+        CountingAllocator allocator;
+        {
+            FramePool pool(16, 16, FramePixelFormat::BGRA, 4, 1, 3, &allocator);
+            CHECK(allocator.allocateCount == 1);
+
+            FrameBuffer* buffers[3] = {};
+            for (auto& buffer : buffers) {
+                buffer = pool.acquire();
+                CHECK(buffer != nullptr);
+            }
+            CHECK(buffers[0] != buffers[1] && buffers[1] != buffers[2] && buffers[0] != buffers[2]);
+            CHECK(pool.getHitCount() == 1 && pool.getMissCount() == 2);
+            CHECK(allocator.allocateCount == 3);
+
+            // Exhausted pool fails instead of growing past its limit
+            CHECK(pool.acquire() == nullptr);
+            CHECK(pool.getMissCount() == 3);
+            CHECK(allocator.allocateCount == 3);
+
+            // Buffers that came back are hits again
+            for (auto* buffer : buffers) {
+                pool.release(buffer);
+            }
+            pool.release(nullptr);
+            for (int i = 0; i < 3; ++i) {
+                CHECK(pool.acquire() != nullptr);
+            }
+            CHECK(pool.getHitCount() == 4 && pool.getMissCount() == 3);
+            CHECK(allocator.allocateCount == 3);
+        }
+        CHECK(allocator.deallocateCount == 3);
+    }
+
+    /*
+    * Debug builds ignore buffers released twice or to the wrong pool, so no buffer ever has two owners
+    */
+    void testForeignRelease() {
+#ifndef NDEBUG
+        FramePool pool(16, 16, FramePixelFormat::BGRA, 4, 2, 2);
+        FramePool otherPool(16, 16, FramePixelFormat::BGRA, 4, 1, 1);
+        FrameBuffer* first = pool.acquire();
+        FrameBuffer* second = pool.acquire();
+        FrameBuffer* foreign = otherPool.acquire();
+
+        pool.release(first);
+        pool.release(first);
+        pool.release(foreign);
+
+        CHECK(pool.acquire() == first);
+        CHECK(pool.acquire() == nullptr);
+        pool.release(first);
+        pool.release(second);
+        otherPool.release(foreign);
+#endif
+    }
+}
+
+/*
+* Global allocation functions replaced to count heap allocations made by the pool
+*/
+void* operator new(std::size_t size) {
+    ++heapAllocationCount;
+    if (void* memory = std::malloc(size != 0 ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+int main() {
+    CapUtilsTests::openTestLog("FramePoolTest");
+    testLayout();
+    testSteadyState();
+    testGrowthAndLimit();
+    testForeignRelease();
+    return CapUtilsTests::finishTest("FramePoolTest");
+}
@@ -0,0 +1,145 @@
+#include "FrameRateGovernor.hpp"
+#include "TestCheck.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+using namespace CapUtils;
+using namespace std::chrono_literals;
+
+namespace {
+
+    /*
+    * Pipeline fed to a governor one window at a time, with an encode stage whose time per frame is set per window
+    */
+    struct TestPipeline {
+        TestPipeline(int maxFramesPerSecond, int raiseAfterWindows) :
+            governor(maxFramesPerSecond, 1000ms, raiseAfterWindows),
+            now(std::chrono::steady_clock::now()) {
+            governor.start(now);
+        }
+
+        /**
+         * Run one window and let the governor judge it
+         *
+         * @return  True if the rate changed.
+         */
+        bool runWindow(int64_t encodeTimeInUs, std::size_t queuedFrames, int64_t newDrops = 0) {
+            const int frames = governor.getFramesPerSecond();
+            for (int i = 0; i < frames; ++i) {
+                governor.recordQueueDepth(queuedFrames, 8);
+            }
+            // Cumulative latency, as the pipeline reports it, so the window mean is the one given
+            for (int i = 0; i < frames; ++i) {
+                encodeLatency.record(encodeTimeInUs);
+            }
+            droppedFrames += newDrops;
+
+            now += 1000ms;
+            const bool due = governor.isUpdateDue(now);
+            return due && governor.update(now, droppedFrames, { GovernedStage{ "encode", encodeLatency.getSummary(), 1 } });
+        }
+
+        FrameRateGovernor governor;
+        std::chrono::steady_clock::time_point now;
+        LatencyHistogram encodeLatency;
+        int64_t droppedFrames = 0;
+    };
+
+    /*
+    * After an hour at 30 fps the cumulative mean truncates away almost a microsecond per frame of the session.
+    * Windows are judged by their exact time per frame anyway, so a stage just below the overload threshold is not
+    * mistaken for an overloaded one
+    */
+    void testLongSession() {
+        TestPipeline pipeline(30, 3);
+
+        // Frames of 2 us but one of 1 us, so the mean of 1.99999 us truncates to 1 us
+        for (int i = 0; i < 30 * 3600 - 1; ++i) {
+            pipeline.encodeLatency.record(2);
+        }
+        pipeline.encodeLatency.record(1);
+        CHECK(!pipeline.runWindow(2, 0));
+
+        // 29 ms per frame is 87% of the frame period. A total rebuilt from the truncated mean made it 97%
+        CHECK(!pipeline.runWindow(29000, 0) && pipeline.governor.getFramesPerSecond() == 30);
+        const double stageLoad = pipeline.governor.getPressure().stageLoad;
+        if (!CHECK(stageLoad > 0.869 && stageLoad < 0.871)) {
+            std::printf("  stage load %.4f\n", stageLoad);
+        }
+    }
+
+    void testSteps() {
+        const FrameRateGovernor normal(30, 1000ms, 3);
+        CHECK(normal.getFramesPerSecond() == 30 && normal.getMaxFramesPerSecond() == 30);
+
+        // Low rates have fewer distinct steps, and every step stays at one frame per second or more
+        TestPipeline slow(2, 1);
+        CHECK(slow.runWindow(0, 8) && slow.governor.getFramesPerSecond() == 1);
+        CHECK(!slow.runWindow(0, 8) && slow.governor.getFramesPerSecond() == 1);
+    }
+
+    /*
+    * Every overloaded window drops one step right away, down to a third of the configured rate
+    */
+    void testOverload() {
+        TestPipeline pipeline(30, 3);
+
+        // Encoding takes 65 ms per frame, which keeps up with nothing above 10 fps
+        CHECK(pipeline.runWindow(65000, 0) && pipeline.governor.getFramesPerSecond() == 20);
+        CHECK(pipeline.governor.getPressure().busiestStage == "encode");
+        CHECK(pipeline.runWindow(65000, 0) && pipeline.governor.getFramesPerSecond() == 15);
+        CHECK(pipeline.runWindow(65000, 0) && pipeline.governor.getFramesPerSecond() == 10);
+        CHECK(!pipeline.runWindow(65000, 0) && pipeline.governor.getFramesPerSecond() == 10);
+
+        // A full queue or dropped frames are overload as well, whatever the stage load
+        TestPipeline queueing(30, 3);
+        CHECK(queueing.runWindow(1000, 6) && queueing.governor.getFramesPerSecond() == 20);
+        TestPipeline dropping(30, 3);
+        CHECK(dropping.runWindow(1000, 0, 1) && dropping.governor.getFramesPerSecond() == 20);
+        CHECK(dropping.governor.getPressure().droppedFrames == 1);
+    }
+
+    /*
+    * Going up takes several windows in a row with headroom at the next higher rate. Windows in between the
+    * thresholds reset the count, so the rate does not flap around the capacity of the machine
+    */
+    void testRaise() {
+        TestPipeline pipeline(30, 3);
+        pipeline.runWindow(0, 8);
+        pipeline.runWindow(0, 8);
+        pipeline.runWindow(0, 8);
+        CHECK(pipeline.governor.getFramesPerSecond() == 10);
+
+        // 40 ms per frame is a load of 0.6 at 15 fps, so 10 fps can go up, but 15 fps cannot
+        CHECK(!pipeline.runWindow(40000, 0));
+        CHECK(!pipeline.runWindow(40000, 0));
+        CHECK(pipeline.runWindow(40000, 0) && pipeline.governor.getFramesPerSecond() == 15);
+        for (int i = 0; i < 5; ++i) {
+            CHECK(!pipeline.runWindow(40000, 0));
+        }
+        CHECK(pipeline.governor.getFramesPerSecond() == 15);
+
+        // Fast frames again, but a window with the queue partly filled starts the count over
+        CHECK(!pipeline.runWindow(1000, 0));
+        CHECK(!pipeline.runWindow(1000, 0));
+        CHECK(!pipeline.runWindow(1000, 3));
+        CHECK(!pipeline.runWindow(1000, 0));
+        CHECK(!pipeline.runWindow(1000, 0));
+        CHECK(pipeline.runWindow(1000, 0) && pipeline.governor.getFramesPerSecond() == 20);
+
+        // Start returns to the highest rate
+        pipeline.governor.start(pipeline.now);
+        CHECK(pipeline.governor.getFramesPerSecond() == 30);
+    }
+}
+
+int main() {
+    testSteps();
+    testOverload();
+    testRaise();
+    testLongSession();
+    return CapUtilsTests::finishTest("FrameRateGovernorTest");
+}
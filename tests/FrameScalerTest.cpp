@@ -0,0 +1,347 @@
+#include "FrameScaler.hpp"
+#include "TestCheck.hpp"
+#include "WorkerPool.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace CapUtils;
+
+namespace {
+
+    constexpr uint8_t kGuardByte = 0xA5; // Fills destination padding, which the scaler may not write
+
+    /*
+    * Source frame with padded rows, as GDI DIBs of odd BGR24 widths have
+    */
+    struct SourceFrame {
+        SourceFrame(int width, int height, FramePixelFormat pixelFormat) :
+            bytesPerPixel(getBytesPerPixel(pixelFormat)),
+            stride(((width * bytesPerPixel + 3) / 4) * 4),
+            pixels(static_cast<std::size_t>(stride) * height) {
+            frame.data = pixels.data();
+            frame.width = width;
+            frame.height = height;
+            frame.stride = stride;
+            frame.size = pixels.size();
+            frame.pixelFormat = pixelFormat;
+        }
+
+        const uint8_t* getPixel(int x, int y) const {
+            return pixels.data() + static_cast<std::size_t>(y) * stride + x * bytesPerPixel;
+        }
+
+        int bytesPerPixel;
+        int stride;
+        std::vector<uint8_t> pixels;
+        FrameBuffer frame;
+    };
+
+    /*
+    * Scaled YUV 4:2:0 planes in both layouts. Rows are padded, so writes past the width show up as changed padding
+    */
+    struct ScaledFrame {
+        ScaledFrame(int width, int height) :
+            width(width),
+            height(height),
+            lumaStride(width + 16),
+            chromaStride((width + 1) / 2 + 16),
+            chromaHeight((height + 1) / 2),
+            y(static_cast<std::size_t>(lumaStride) * height, kGuardByte),
+            u(static_cast<std::size_t>(chromaStride) * chromaHeight, kGuardByte),
+            v(static_cast<std::size_t>(chromaStride) * chromaHeight, kGuardByte),
+            nv12Y(static_cast<std::size_t>(lumaStride) * height, kGuardByte),
+            nv12UV(static_cast<std::size_t>(chromaStride) * 2 * chromaHeight, kGuardByte) {
+        }
+
+        bool scale(FrameScaler& scaler, const FrameBuffer& frame, WorkerPool& workerPool) {
+            uint8_t* const i420Planes[3] = { y.data(), u.data(), v.data() };
+            const int i420Strides[3] = { lumaStride, chromaStride, chromaStride };
+            uint8_t* const nv12Planes[2] = { nv12Y.data(), nv12UV.data() };
+            const int nv12Strides[2] = { lumaStride, chromaStride * 2 };
+            const bool i420Scaled = scaler.convertToI420(frame, i420Planes, i420Strides, workerPool);
+            const bool nv12Scaled = scaler.convertToNV12(frame, nv12Planes, nv12Strides, workerPool);
+            return i420Scaled && nv12Scaled;
+        }
+
+        bool operator==(const ScaledFrame& other) const {
+            return y == other.y && u == other.u && v == other.v && nv12Y == other.nv12Y && nv12UV == other.nv12UV;
+        }
+
+        int width;
+        int height;
+        int lumaStride;
+        int chromaStride;
+        int chromaHeight;
+        std::vector<uint8_t> y;
+        std::vector<uint8_t> u;
+        std::vector<uint8_t> v;
+        std::vector<uint8_t> nv12Y;
+        std::vector<uint8_t> nv12UV;
+    };
+
+    /*
+    * Floating point resampled pixel of the reference
+    */
+    struct ReferencePixel {
+        double blue = 0.0;
+        double green = 0.0;
+        double red = 0.0;
+    };
+
+    /**
+     * Helper function to resample the region of source to width x height in floating point. Bilinear aligns pixel
+     * centers and clamps at the edges, area averages the source pixels from floor(d * S / D) up to floor((d + 1) * S / D),
+     * at least one.
+     */
+    std::vector<ReferencePixel> resampleReference(const SourceFrame& source, const FrameRegion& region, int width, int height,
+                                                  ScaleFilter filter) {
+        std::vector<ReferencePixel> result(static_cast<std::size_t>(width) * height);
+        const auto sample = [&](int x, int y, double weight, ReferencePixel& out) {
+            const uint8_t* pixel = source.getPixel(region.x + x, region.y + y);
+            out.blue += pixel[0] * weight;
+            out.green += pixel[1] * weight;
+            out.red += pixel[2] * weight;
+        };
+
+        for (int dy = 0; dy < height; ++dy) {
+            for (int dx = 0; dx < width; ++dx) {
+                ReferencePixel& out = result[static_cast<std::size_t>(dy) * width + dx];
+                if (filter == ScaleFilter::BILINEAR) {
+                    const auto taps = [](int d, int srcSize, int dstSize, int& tap, double& fraction) {
+                        double position = (d + 0.5) * srcSize / dstSize - 0.5;
+                        position = (position < 0.0) ? 0.0 : position;
+                        tap = static_cast<int>(position);
+                        fraction = position - tap;
+                        if (tap >= srcSize - 1) {
+                            tap = srcSize - 1;
+                            fraction = 0.0;
+                        }
+                    };
+                    int tapX = 0;
+                    int tapY = 0;
+                    double fractionX = 0.0;
+                    double fractionY = 0.0;
+                    taps(dx, region.width, width, tapX, fractionX);
+                    taps(dy, region.height, height, tapY, fractionY);
+                    const int nextX = (tapX + 1 < region.width) ? tapX + 1 : tapX;
+                    const int nextY = (tapY + 1 < region.height) ? tapY + 1 : tapY;
+                    sample(tapX, tapY, (1.0 - fractionX) * (1.0 - fractionY), out);
+                    sample(nextX, tapY, fractionX * (1.0 - fractionY), out);
+                    sample(tapX, nextY, (1.0 - fractionX) * fractionY, out);
+                    sample(nextX, nextY, fractionX * fractionY, out);
+                }
+                else {
+                    const auto span = [](int d, int srcSize, int dstSize, int& begin, int& end) {
+                        begin = static_cast<int>(static_cast<int64_t>(d) * srcSize / dstSize);
+                        end = static_cast<int>((static_cast<int64_t>(d) + 1) * srcSize / dstSize);
+                        end = (end > begin) ? end : begin + 1;
+                    };
+                    int beginX = 0;
+                    int endX = 0;
+                    int beginY = 0;
+                    int endY = 0;
+                    span(dx, region.width, width, beginX, endX);
+                    span(dy, region.height, height, beginY, endY);
+                    const double weight = 1.0 / ((endX - beginX) * (endY - beginY));
+                    for (int sy = beginY; sy < endY; ++sy) {
+                        for (int sx = beginX; sx < endX; ++sx) {
+                            sample(sx, sy, weight, out);
+                        }
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Helper function to compare scaled planes against the reference converted to BT.601 limited range in floating
+     * point, within two steps
+     *
+     * @return  True if every sample is close enough, the padding was left alone and NV12 matches I420.
+     */
+    bool checkAgainstReference(const ScaledFrame& scaled, const std::vector<ReferencePixel>& reference) {
+        int lumaErrors = 0;
+        int chromaErrors = 0;
+        int paddingWrites = 0;
+        double worstError = 0.0;
+
+        for (int y = 0; y < scaled.height; ++y) {
+            for (int x = 0; x < scaled.width; ++x) {
+                const ReferencePixel& pixel = reference[static_cast<std::size_t>(y) * scaled.width + x];
+                const double luma = 16.0 + (65.738 * pixel.red + 129.057 * pixel.green + 25.064 * pixel.blue) / 256.0;
+                const double error = std::fabs(luma - scaled.y[y * scaled.lumaStride + x]);
+                worstError = (error > worstError) ? error : worstError;
+                lumaErrors += (error > 2.0) ? 1 : 0;
+            }
+            for (int x = scaled.width; x < scaled.lumaStride; ++x) {
+                paddingWrites += (scaled.y[y * scaled.lumaStride + x] != kGuardByte) ? 1 : 0;
+            }
+        }
+
+        const int chromaWidth = (scaled.width + 1) / 2;
+        for (int y = 0; y < scaled.chromaHeight; ++y) {
+            for (int x = 0; x < chromaWidth; ++x) {
+                // Average of the 2x2 block, the last column and row repeated for odd sizes
+                ReferencePixel average;
+                for (int dy = 0; dy < 2; ++dy) {
+                    for (int dx = 0; dx < 2; ++dx) {
+                        const int sourceX = (2 * x + dx < scaled.width) ? 2 * x + dx : scaled.width - 1;
+                        const int sourceY = (2 * y + dy < scaled.height) ? 2 * y + dy : scaled.height - 1;
+                        const ReferencePixel& pixel = reference[static_cast<std::size_t>(sourceY) * scaled.width + sourceX];
+                        average.blue += pixel.blue / 4.0;
+                        average.green += pixel.green / 4.0;
+                        average.red += pixel.red / 4.0;
+                    }
+                }
+                const double u = 128.0 + (-37.945 * average.red - 74.494 * average.green + 112.439 * average.blue) / 256.0;
+                const double v = 128.0 + (112.439 * average.red - 94.154 * average.green - 18.285 * average.blue) / 256.0;
+                const int index = y * scaled.chromaStride + x;
+                const double error = std::fmax(std::fabs(u - scaled.u[index]), std::fabs(v - scaled.v[index]));
+                worstError = (error > worstError) ? error : worstError;
+                chromaErrors += (error > 2.0) ? 1 : 0;
+            }
+            for (int x = chromaWidth; x < scaled.chromaStride; ++x) {
+                paddingWrites += (scaled.u[y * scaled.chromaStride + x] != kGuardByte) ? 1 : 0;
+                paddingWrites += (scaled.v[y * scaled.chromaStride + x] != kGuardByte) ? 1 : 0;
+            }
+        }
+
+        // NV12 carries the same samples as I420, with U and V interleaved
+        int layoutErrors = (scaled.nv12Y != scaled.y) ? 1 : 0;
+        for (int y = 0; y < scaled.chromaHeight; ++y) {
+            for (int x = 0; x < chromaWidth; ++x) {
+                const int index = y * scaled.chromaStride + x;
+                const int interleavedIndex = y * scaled.chromaStride * 2 + 2 * x;
+                layoutErrors += (scaled.nv12UV[interleavedIndex] != scaled.u[index] ||
+                                 scaled.nv12UV[interleavedIndex + 1] != scaled.v[index]) ? 1 : 0;
+            }
+        }
+
+        const bool passed = CHECK(lumaErrors == 0) & CHECK(chromaErrors == 0) & CHECK(paddingWrites == 0) & CHECK(layoutErrors == 0);
+        if (!passed) {
+            std::printf("  worst error %.2f\n", worstError);
+        }
+        return passed;
+    }
+
+    /*
+    * Both filters on both source formats, for crops, odd sizes, upscaling and downscaling, against the floating point
+    * reference. Splitting the frame into 1 to 8 bands has to give the same bytes as a single band
+    */
+    void testReference() {
+        struct Geometry {
+            int sourceWidth;
+            int sourceHeight;
+            FrameRegion region;
+            int width;
+            int height;
+        };
+        const Geometry geometries[] = {
+            { 64, 48, { 0, 0, 64, 48 }, 64, 48 },          // Same size
+            { 1366, 768, { 0, 0, 1366, 768 }, 1280, 720 }, // Slight downscale, no span longer than two
+            { 1920, 1080, { 0, 0, 1920, 1080 }, 640, 360 }, // Integer factor
+            { 333, 201, { 7, 3, 301, 187 }, 97, 61 },      // Odd crop, odd sizes
+            { 101, 77, { 50, 40, 51, 37 }, 203, 151 },     // Upscale of the bottom right corner
+            { 17, 9, { 1, 1, 15, 7 }, 1, 1 },              // Single destination pixel
+            { 40, 30, { 0, 0, 40, 30 }, 3, 2 },            // Single chroma row, odd width
+            { 1000, 1000, { 5, 5, 990, 990 }, 7, 5 },      // Long spans in both directions
+        };
+
+        std::mt19937 random(21);
+        for (const Geometry& geometry : geometries) {
+            for (FramePixelFormat pixelFormat : { FramePixelFormat::BGR24, FramePixelFormat::BGRA }) {
+                SourceFrame source(geometry.sourceWidth, geometry.sourceHeight, pixelFormat);
+                for (auto& byte : source.pixels) {
+                    byte = static_cast<uint8_t>(random());
+                }
+
+                for (ScaleFilter filter : { ScaleFilter::BILINEAR, ScaleFilter::AREA }) {
+                    const std::vector<ReferencePixel> reference =
+                        resampleReference(source, geometry.region, geometry.width, geometry.height, filter);
+
+                    FrameScaler singleBandScaler(geometry.region, geometry.width, geometry.height, filter, 1);
+                    WorkerPool singleThread(1);
+                    ScaledFrame singleBand(geometry.width, geometry.height);
+                    CHECK(singleBand.scale(singleBandScaler, source.frame, singleThread));
+                    if (!checkAgainstReference(singleBand, reference)) {
+                        std::printf("  %s %s scaling %dx%d at %d,%d to %dx%d\n", getScaleFilterString(filter).c_str(),
+                                    (pixelFormat == FramePixelFormat::BGRA) ? "BGRA" : "BGR24", geometry.region.width,
+                                    geometry.region.height, geometry.region.x, geometry.region.y, geometry.width, geometry.height);
+                    }
+
+                    int bandMismatches = 0;
+                    for (int bandCount = 2; bandCount <= 8; ++bandCount) {
+                        FrameScaler bandScaler(geometry.region, geometry.width, geometry.height, filter, bandCount);
+                        WorkerPool workerPool(bandCount);
+                        ScaledFrame bands(geometry.width, geometry.height);
+                        CHECK(bands.scale(bandScaler, source.frame, workerPool));
+                        bandMismatches += (bands == singleBand) ? 0 : 1;
+                    }
+                    CHECK(bandMismatches == 0);
+                }
+            }
+        }
+    }
+
+    /*
+    * A flat source has to come out as the same color whatever the spans, including spans long enough for the fixed
+    * point reciprocals of the area filter to drift
+    */
+    void testFlatColor() {
+        const uint8_t colors[][3] = { { 255, 255, 255 }, { 0, 0, 0 }, { 200, 30, 90 } };
+        const FrameRegion region = { 0, 0, 3840, 2160 };
+        const int sizes[][2] = { { 1, 1 }, { 2, 2 }, { 3, 2 }, { 7, 3 }, { 1920, 1080 } };
+        WorkerPool workerPool(1);
+
+        for (const auto& color : colors) {
+            SourceFrame source(region.width, region.height, FramePixelFormat::BGRA);
+            for (std::size_t i = 0; i < source.pixels.size(); i += 4) {
+                source.pixels[i] = color[0];
+                source.pixels[i + 1] = color[1];
+                source.pixels[i + 2] = color[2];
+                source.pixels[i + 3] = 0xFF;
+            }
+            for (const auto& size : sizes) {
+                for (ScaleFilter filter : { ScaleFilter::BILINEAR, ScaleFilter::AREA }) {
+                    FrameScaler scaler(region, size[0], size[1], filter, 1);
+                    ScaledFrame scaled(size[0], size[1]);
+                    CHECK(scaled.scale(scaler, source.frame, workerPool));
+                    std::vector<ReferencePixel> reference(static_cast<std::size_t>(size[0]) * size[1],
+                                                          ReferencePixel{ double(color[0]), double(color[1]), double(color[2]) });
+                    if (!checkAgainstReference(scaled, reference)) {
+                        std::printf("  %s flat color %d,%d,%d to %dx%d\n", getScaleFilterString(filter).c_str(),
+                                    color[0], color[1], color[2], size[0], size[1]);
+                    }
+                }
+            }
+        }
+    }
+
+    /*
+    * Regions that do not fit into the frame are refused and leave the destination alone
+    */
+    void testRegionOutsideFrame() {
+        SourceFrame source(64, 64, FramePixelFormat::BGRA);
+        WorkerPool workerPool(1);
+        const FrameRegion regions[] = { { 1, 0, 64, 64 }, { 0, 1, 64, 64 }, { -1, 0, 32, 32 }, { 0, 0, 0, 32 } };
+        for (const FrameRegion& region : regions) {
+            FrameScaler scaler(region, 16, 16, ScaleFilter::AREA, 1);
+            ScaledFrame scaled(16, 16);
+            const ScaledFrame untouched(16, 16);
+            CHECK(!scaled.scale(scaler, source.frame, workerPool));
+            CHECK(scaled == untouched);
+        }
+    }
+}
+
+int main() {
+    testReference();
+    testFlatColor();
+    testRegionOutsideFrame();
+    return CapUtilsTests::finishTest("FrameScalerTest");
+}
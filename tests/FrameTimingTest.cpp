@@ -0,0 +1,153 @@
+#include "FrameTiming.hpp"
+#include "TestCheck.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+using namespace CapUtils;
+
+namespace {
+
+    constexpr int64_t kWallClockStart = 1760000000000000; // Capture timestamps count microseconds since the epoch
+    constexpr int64_t kMaxStaticFrameInterval = 1000000;
+
+    /**
+     * Helper function to get the timestamp of frame index of a 60 fps capture
+     */
+    int64_t getCaptureTimestamp(int index) {
+        return kWallClockStart + static_cast<int64_t>(index) * 1000000 / 60;
+    }
+
+    /**
+     * Helper function to round a timestamp into a time base the long way, for comparison
+     */
+    int64_t rescaleReference(int64_t timestamp, int numerator, int denominator) {
+        const long double ticks = static_cast<long double>(timestamp) * denominator / (1000000.0L * numerator);
+        return static_cast<int64_t>(ticks + 0.5L);
+    }
+
+    /*
+    * A recording that changes, stays static for four seconds, changes again and stops while static. Unchanged frames
+    * are skipped except once per max interval, the last one is encoded when recording stops, and every frame grabbed
+    * is either encoded or handed back exactly once. Encoded frames get strictly increasing pts at their capture time
+    */
+    void testStaticRecording(int numerator, int denominator) {
+        StaticFrameFilter filter(kMaxStaticFrameInterval);
+        PresentationClock clock;
+        clock.reset(numerator, denominator);
+
+        // Frames 0 to 29 and 270 to 299 change, the rest are static
+        std::vector<FrameBuffer> frames(418);
+        std::vector<int> uses(frames.size(), 0);
+        for (int i = 0; i < static_cast<int>(frames.size()); ++i) {
+            frames[i].timestamp = getCaptureTimestamp(i);
+            frames[i].sequence = i;
+            frames[i].changes.detected = true;
+            frames[i].changes.unchanged = (i >= 30 && i < 270) || i >= 300;
+        }
+
+        std::vector<FrameBuffer*> encoded;
+        for (FrameBuffer& frame : frames) {
+            FrameBuffer* superseded = nullptr;
+            const bool skipped = filter.skip(&frame, superseded);
+            if (superseded) {
+                ++uses[superseded->sequence];
+            }
+            if (!skipped) {
+                encoded.push_back(&frame);
+            }
+        }
+        CHECK(filter.hasHeldFrame());
+        FrameBuffer* lastFrame = filter.takeHeldFrame();
+        CHECK(lastFrame == &frames.back() && !filter.hasHeldFrame());
+        encoded.push_back(lastFrame);
+
+        int64_t previousPts = -1;
+        int wrongPts = 0;
+        int wrongGaps = 0;
+        for (std::size_t i = 0; i < encoded.size(); ++i) {
+            FrameBuffer* frame = encoded[i];
+            ++uses[frame->sequence];
+            const int64_t pts = clock.stamp(frame->timestamp);
+            wrongPts += (pts > previousPts && pts == rescaleReference(frame->timestamp, numerator, denominator)) ? 0 : 1;
+            previousPts = pts;
+
+            // A static stretch is refreshed with the first frame at least the max interval after the last encoded one
+            if (i > 0 && frame->changes.unchanged && frame != lastFrame) {
+                const int64_t gap = frame->timestamp - encoded[i - 1]->timestamp;
+                wrongGaps += (gap >= kMaxStaticFrameInterval && gap < kMaxStaticFrameInterval + 1000000 / 60 + 1) ? 0 : 1;
+            }
+        }
+
+        int wrongUses = 0;
+        for (int count : uses) {
+            wrongUses += (count != 1) ? 1 : 0;
+        }
+
+        // Changed frames, refreshes at frames 89, 149, 209 and 269, changed frames, a refresh at 359 and the last frame
+        const std::size_t expectedEncoded = 30 + 4 + 30 + 1 + 1;
+        if (!CHECK(encoded.size() == expectedEncoded)) {
+            std::printf("  %zu frames encoded in time base %d/%d\n", encoded.size(), numerator, denominator);
+        }
+        CHECK(wrongPts == 0);
+        CHECK(wrongGaps == 0);
+        CHECK(wrongUses == 0);
+    }
+
+    /*
+    * Frames grabbed within the same tick of a coarse time base still get strictly increasing pts, and later frames
+    * go back to their own tick once they are past the bumped ones
+    */
+    void testSameTick() {
+        PresentationClock clock;
+        clock.reset(1, 30);
+        CHECK(clock.stamp(kWallClockStart) == kWallClockStart * 30 / 1000000);
+        const int64_t firstPts = kWallClockStart * 30 / 1000000;
+        CHECK(clock.stamp(kWallClockStart + 1000) == firstPts + 1);
+        CHECK(clock.stamp(kWallClockStart + 2000) == firstPts + 2);
+        CHECK(clock.stamp(kWallClockStart + 1000000) == firstPts + 30);
+
+        // Halfway between two ticks rounds up, as av_rescale_q does
+        clock.reset(1, 30);
+        CHECK(clock.stamp(50000) == 2);
+        CHECK(clock.stamp(49999 + 33334) == 3);
+
+        // Starting over forgets the previous pts
+        clock.reset(1, 90000);
+        CHECK(clock.stamp(0) == 0);
+        CHECK(clock.stamp(0) == 1);
+        clock.reset(1, 90000);
+        CHECK(clock.stamp(0) == 0);
+    }
+
+    /*
+    * Skipping is off without change detection, for changed frames and with a zero max interval
+    */
+    void testFilterOff() {
+        FrameBuffer frame;
+        frame.timestamp = kWallClockStart;
+        frame.changes.detected = true;
+        frame.changes.unchanged = true;
+        FrameBuffer* superseded = nullptr;
+
+        StaticFrameFilter disabled(0);
+        CHECK(!disabled.skip(&frame, superseded) && superseded == nullptr);
+        CHECK(!disabled.skip(&frame, superseded) && !disabled.hasHeldFrame());
+
+        StaticFrameFilter filter(kMaxStaticFrameInterval);
+        CHECK(!filter.skip(&frame, superseded));
+        CHECK(filter.skip(&frame, superseded) && filter.hasHeldFrame());
+        frame.changes.detected = false;
+        CHECK(!filter.skip(&frame, superseded) && superseded == &frame);
+        CHECK(filter.takeHeldFrame() == nullptr);
+    }
+}
+
+int main() {
+    testStaticRecording(1, 60);
+    testStaticRecording(1, 90000);
+    testSameTick();
+    testFilterOff();
+    return CapUtilsTests::finishTest("FrameTimingTest");
+}
@@ -0,0 +1,190 @@
+#include "ColorConvert.hpp"
+#include "IncrementalConvert.hpp"
+#include "TestCheck.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace CapUtils;
+
+namespace {
+
+    constexpr int kFrameCount = 300; // Random frame sizes tested
+    constexpr int kUpdateCount = 10; // Updates with random moves and dirty rects per frame size
+
+    /*
+    * Frame whose pixels are changed the way a duplicated desktop is, along with the planes kept by the
+    * incremental converter and planes converted as a whole for comparison
+    */
+    struct TestFrame {
+        TestFrame(std::mt19937& random, int width, int height, FramePixelFormat pixelFormat, bool nv12) :
+            random(random),
+            bytesPerPixel(getBytesPerPixel(pixelFormat)),
+            stride(((width * bytesPerPixel + 3) / 4) * 4),
+            chromaWidth((width + 1) / 2),
+            nv12(nv12),
+            pixels(static_cast<std::size_t>(stride) * height) {
+            for (auto& byte : pixels) {
+                byte = static_cast<uint8_t>(random());
+            }
+            frame.data = pixels.data();
+            frame.width = width;
+            frame.height = height;
+            frame.stride = stride;
+            frame.size = pixels.size();
+            frame.pixelFormat = pixelFormat;
+
+            const std::size_t lumaSize = static_cast<std::size_t>(width) * height;
+            const std::size_t chromaSize = static_cast<std::size_t>(chromaWidth) * ((height + 1) / 2);
+            y.resize(lumaSize);
+            u.resize(2 * chromaSize);
+            v.resize(chromaSize);
+            fullY.resize(lumaSize);
+            fullU.resize(2 * chromaSize);
+            fullV.resize(chromaSize);
+        }
+
+        int randomBelow(int bound) {
+            return (bound > 0) ? static_cast<int>(random() % static_cast<unsigned>(bound)) : 0;
+        }
+
+        /*
+        * Apply a move to the pixels. Pixels outside of the frame are skipped and pixels moved in from outside of it
+        * get new content, so the converter has to convert them from the frame instead of moving them
+        */
+        void move(const FrameMoveRect& moveRect) {
+            const std::vector<uint8_t> previous = pixels;
+            for (int row = moveRect.destination.top; row < moveRect.destination.bottom; ++row) {
+                for (int column = moveRect.destination.left; column < moveRect.destination.right; ++column) {
+                    if (column < 0 || row < 0 || column >= frame.width || row >= frame.height) {
+                        continue;
+                    }
+                    uint8_t* pixel = pixels.data() + static_cast<std::size_t>(row) * stride + column * bytesPerPixel;
+                    const int sourceX = moveRect.sourceX + column - moveRect.destination.left;
+                    const int sourceY = moveRect.sourceY + row - moveRect.destination.top;
+                    if (sourceX < 0 || sourceY < 0 || sourceX >= frame.width || sourceY >= frame.height) {
+                        redraw(pixel);
+                        continue;
+                    }
+                    std::memcpy(pixel, previous.data() + static_cast<std::size_t>(sourceY) * stride + sourceX * bytesPerPixel, bytesPerPixel);
+                }
+            }
+        }
+
+        void redraw(const FrameRect& rect) {
+            for (int row = rect.top; row < rect.bottom; ++row) {
+                for (int column = rect.left; column < rect.right; ++column) {
+                    if (column >= 0 && row >= 0 && column < frame.width && row < frame.height) {
+                        redraw(pixels.data() + static_cast<std::size_t>(row) * stride + column * bytesPerPixel);
+                    }
+                }
+            }
+        }
+
+        void redraw(uint8_t* pixel) {
+            for (int i = 0; i < bytesPerPixel; ++i) {
+                pixel[i] = static_cast<uint8_t>(random());
+            }
+        }
+
+        /*
+        * Run the incremental update and a full conversion of the same frame
+        *
+        * @return  True if the persistent planes match the full conversion.
+        */
+        bool update(const FrameMoveRect* moveRects, int moveCount, const FrameRect* dirtyRects, int dirtyCount) {
+            if (nv12) {
+                uint8_t* const planes[2] = { y.data(), u.data() };
+                uint8_t* const fullPlanes[2] = { fullY.data(), fullU.data() };
+                const int strides[2] = { frame.width, 2 * chromaWidth };
+                converter.updateNV12(frame, moveRects, moveCount, dirtyRects, dirtyCount, planes, strides);
+                convertFrameToNV12(frame, fullPlanes, strides);
+            } else {
+                uint8_t* const planes[3] = { y.data(), u.data(), v.data() };
+                uint8_t* const fullPlanes[3] = { fullY.data(), fullU.data(), fullV.data() };
+                const int strides[3] = { frame.width, chromaWidth, chromaWidth };
+                converter.updateI420(frame, moveRects, moveCount, dirtyRects, dirtyCount, planes, strides);
+                convertFrameToI420(frame, fullPlanes, strides);
+            }
+            return y == fullY && u == fullU && v == fullV;
+        }
+
+        std::mt19937& random;
+        int bytesPerPixel;
+        int stride;
+        int chromaWidth;
+        bool nv12;
+        std::vector<uint8_t> pixels;
+        FrameBuffer frame;
+        IncrementalFrameConverter converter;
+        std::vector<uint8_t> y;
+        std::vector<uint8_t> u;
+        std::vector<uint8_t> v;
+        std::vector<uint8_t> fullY;
+        std::vector<uint8_t> fullU;
+        std::vector<uint8_t> fullV;
+    };
+}
+
+int main() {
+    std::mt19937 random(9);
+    int64_t movedPixels = 0;
+
+    for (int frameIndex = 0; frameIndex < kFrameCount; ++frameIndex) {
+        const int width = 20 + static_cast<int>(random() % 60);
+        const int height = 20 + static_cast<int>(random() % 60);
+        const FramePixelFormat pixelFormat = (random() % 2 != 0) ? FramePixelFormat::BGRA : FramePixelFormat::BGR24;
+        TestFrame test(random, width, height, pixelFormat, random() % 2 != 0);
+
+        // The first update converts the whole frame
+        CHECK(test.update(nullptr, 0, nullptr, 0));
+
+        for (int updateIndex = 0; updateIndex < kUpdateCount; ++updateIndex) {
+            // Moves at odd offsets, partly off the frame or from beyond it, besides ones aligned to chroma blocks
+            std::vector<FrameMoveRect> moveRects(test.randomBelow(4));
+            for (auto& moveRect : moveRects) {
+                const int moveWidth = 1 + test.randomBelow(width / 2);
+                const int moveHeight = 1 + test.randomBelow(height / 2);
+                moveRect.sourceX = test.randomBelow(width - moveWidth + 1);
+                moveRect.sourceY = test.randomBelow(height - moveHeight + 1);
+                moveRect.destination.left = test.randomBelow(width - moveWidth + 1) - ((test.randomBelow(5) == 0) ? 3 : 0);
+                moveRect.destination.top = test.randomBelow(height - moveHeight + 1);
+                moveRect.destination.right = moveRect.destination.left + moveWidth + ((test.randomBelow(5) == 0) ? 4 : 0);
+                moveRect.destination.bottom = moveRect.destination.top + moveHeight;
+                if (test.randomBelow(2) != 0) {
+                    moveRect.sourceX &= ~1;
+                    moveRect.sourceY &= ~1;
+                    moveRect.destination.left &= ~1;
+                    moveRect.destination.top &= ~1;
+                    moveRect.destination.right = moveRect.destination.left + moveWidth;
+                }
+                test.move(moveRect);
+            }
+
+            std::vector<FrameRect> dirtyRects(test.randomBelow(4));
+            for (auto& dirtyRect : dirtyRects) {
+                dirtyRect.left = test.randomBelow(width) - 1;
+                dirtyRect.top = test.randomBelow(height) - 1;
+                dirtyRect.right = dirtyRect.left + 1 + test.randomBelow(width / 3);
+                dirtyRect.bottom = dirtyRect.top + 1 + test.randomBelow(height / 3);
+                test.redraw(dirtyRect);
+            }
+
+            if (!CHECK(test.update(moveRects.data(), static_cast<int>(moveRects.size()),
+                                   dirtyRects.data(), static_cast<int>(dirtyRects.size())))) {
+                std::printf("  update %d of %dx%d %s differs from a full conversion, %d moves, %d dirty rects\n",
+                            updateIndex, width, height, test.nv12 ? "NV12" : "I420",
+                            static_cast<int>(moveRects.size()), static_cast<int>(dirtyRects.size()));
+            }
+        }
+        movedPixels += test.converter.getMovedPixelCount();
+    }
+
+    // Without moves applied to the planes the test would only cover dirty rect conversion
+    CHECK(movedPixels > 0);
+
+    return CapUtilsTests::finishTest("IncrementalConvertTest");
+}
@@ -0,0 +1,168 @@
+#include "LatencyHistogram.hpp"
+#include "TestCheck.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace CapUtils;
+
+namespace {
+
+    /*
+    * Percentile P of sorted values, the smallest value that at least P per mille of all values are equal to or below
+    */
+    int64_t getPercentile(const std::vector<int64_t>& sortedValues, uint64_t perMille) {
+        const uint64_t rank = (sortedValues.size() * perMille + 999) / 1000;
+        return sortedValues[(rank > 0) ? rank - 1 : 0];
+    }
+
+    /*
+    * Reported percentile has to be at least the true one and within the relative error of the sub buckets above it.
+    * Values below 2^kLatencySubBucketBits are recorded exactly
+    */
+    bool isWithinError(int64_t reported, int64_t actual) {
+        const int64_t error = (actual >> (kLatencySubBucketBits - 1));
+        return reported >= actual && reported <= actual + error;
+    }
+
+    /*
+    * Percentiles of values spread over several orders of magnitude, as frame latencies with the odd stall are
+    */
+    void testPercentiles() {
+        std::mt19937_64 random(22);
+        for (double spread : { 0.5, 1.5, 3.0 }) {
+            std::lognormal_distribution<double> distribution(8.0, spread);
+            LatencyHistogram histogram;
+            std::vector<int64_t> values;
+            uint64_t sum = 0;
+            for (int i = 0; i < 100000; ++i) {
+                const int64_t value = static_cast<int64_t>(distribution(random));
+                values.push_back(value);
+                sum += static_cast<uint64_t>(value);
+                histogram.record(value);
+            }
+            std::sort(values.begin(), values.end());
+
+            const LatencySummary summary = histogram.getSummary();
+            CHECK(summary.count == values.size());
+            CHECK(summary.meanInUs == static_cast<int64_t>(sum / values.size()));
+            CHECK(summary.maxInUs == values.back());
+            const bool percentilesWithinError = isWithinError(summary.p50InUs, getPercentile(values, 500)) &&
+                                                isWithinError(summary.p99InUs, getPercentile(values, 990)) &&
+                                                isWithinError(summary.p999InUs, getPercentile(values, 999));
+            if (!CHECK(percentilesWithinError)) {
+                std::printf("  spread %.1f: p50 %lld of %lld, p99 %lld of %lld, p99.9 %lld of %lld\n", spread,
+                            static_cast<long long>(summary.p50InUs), static_cast<long long>(getPercentile(values, 500)),
+                            static_cast<long long>(summary.p99InUs), static_cast<long long>(getPercentile(values, 990)),
+                            static_cast<long long>(summary.p999InUs), static_cast<long long>(getPercentile(values, 999)));
+            }
+        }
+    }
+
+    void testEdgeValues() {
+        LatencyHistogram empty;
+        const LatencySummary emptySummary = empty.getSummary();
+        CHECK(emptySummary.count == 0 && emptySummary.p50InUs == 0 && emptySummary.maxInUs == 0);
+
+        // Small values are exact, negative ones count as zero
+        LatencyHistogram small;
+        for (int64_t value = -3; value < 128; ++value) {
+            small.record(value);
+        }
+        const LatencySummary smallSummary = small.getSummary();
+        CHECK(smallSummary.count == 131);
+        CHECK(smallSummary.p50InUs == 62);
+        CHECK(smallSummary.maxInUs == 127);
+
+        // Percentiles never exceed the maximum, even for values beyond the last bucket
+        LatencyHistogram huge;
+        huge.record(int64_t(1) << 40);
+        const LatencySummary hugeSummary = huge.getSummary();
+        CHECK(hugeSummary.maxInUs == (int64_t(1) << 40));
+        CHECK(hugeSummary.p50InUs <= hugeSummary.maxInUs && hugeSummary.p999InUs <= hugeSummary.maxInUs);
+
+        LatencyHistogram single;
+        single.record(1000);
+        CHECK(single.getSummary().p999InUs == 1000);
+    }
+
+    /*
+    * Values recorded from several threads at once, then merged into a histogram of their own, are all counted
+    */
+    void testConcurrentRecordAndMerge() {
+        constexpr int kThreadCount = 4;
+        constexpr int kValuesPerThread = 50000;
+        LatencyHistogram shared;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < kThreadCount; ++t) {
+            threads.emplace_back([&shared, t]() {
+                for (int i = 0; i < kValuesPerThread; ++i) {
+                    shared.record((i % 1000) + t);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        const LatencySummary sharedSummary = shared.getSummary();
+        CHECK(sharedSummary.count == kThreadCount * kValuesPerThread);
+        CHECK(sharedSummary.maxInUs == 999 + kThreadCount - 1);
+
+        LatencyHistogram other;
+        other.record(5000000);
+        LatencyHistogram merged;
+        merged.merge(shared);
+        merged.merge(other);
+        const LatencySummary mergedSummary = merged.getSummary();
+        CHECK(mergedSummary.count == sharedSummary.count + 1);
+        CHECK(mergedSummary.maxInUs == 5000000);
+        CHECK(mergedSummary.p50InUs == sharedSummary.p50InUs);
+    }
+
+    /*
+    * Draining a histogram while a thread keeps recording into it moves every value exactly once
+    */
+    void testDrainWhileRecording() {
+        constexpr int kValueCount = 200000;
+        LatencyHistogram local;
+        LatencyHistogram drained;
+        std::atomic<bool> recording{ true };
+        std::thread recorder([&local, &recording]() {
+            for (int i = 0; i < kValueCount; ++i) {
+                local.record(i % 5000);
+            }
+            recording = false;
+        });
+        int drainCount = 0;
+        while (recording) {
+            drained.drain(local);
+            ++drainCount;
+        }
+        recorder.join();
+        drained.drain(local);
+
+        const LatencySummary summary = drained.getSummary();
+        if (!CHECK(summary.count == kValueCount)) {
+            std::printf("  %llu of %d values after %d drains\n", static_cast<unsigned long long>(summary.count), kValueCount, drainCount);
+        }
+        CHECK(summary.totalInUs == int64_t(4999) * 5000 / 2 * 40 && summary.meanInUs == 2499 && summary.maxInUs == 4999);
+        CHECK(local.getSummary().count == 0);
+
+        // A drained histogram starts over, its maximum included
+        local.record(7);
+        CHECK(local.getSummary().count == 1 && local.getSummary().maxInUs == 7);
+    }
+}
+
+int main() {
+    testPercentiles();
+    testEdgeValues();
+    testConcurrentRecordAndMerge();
+    testDrainWhileRecording();
+    return CapUtilsTests::finishTest("LatencyHistogramTest");
+}
@@ -0,0 +1,94 @@
+#include "ColorConvert.hpp"
+#include "TestCheck.hpp"
+#include "WorkerPool.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace CapUtils;
+
+namespace {
+
+    /*
+    * Every task of a batch runs exactly once, and run returns only after all of them finished
+    */
+    void testWorkerPool() {
+        for (int threadCount : { 1, 2, 3, 8 }) {
+            WorkerPool workerPool(threadCount);
+            int wrongRuns = 0;
+            for (int batch = 0; batch < 2000; ++batch) {
+                const int taskCount = batch % 7 + 1;
+                std::vector<std::atomic<int>> runs(taskCount);
+                workerPool.run(taskCount, [&](int task) { ++runs[task]; });
+                for (const auto& count : runs) {
+                    wrongRuns += (count != 1) ? 1 : 0;
+                }
+            }
+            CHECK(wrongRuns == 0);
+        }
+    }
+
+    /*
+    * Conversion split into bands has to match the conversion of the whole frame on one thread, whatever the band
+    * boundaries. Odd heights leave bands of different sizes and a last chroma row made of a single luma row
+    */
+    void testBandConversion() {
+        std::mt19937 random(5);
+        for (int threadCount : { 1, 2, 3, 5, 16 }) {
+            WorkerPool workerPool(threadCount);
+            for (FramePixelFormat pixelFormat : { FramePixelFormat::BGR24, FramePixelFormat::BGRA }) {
+                for (int width : { 1, 17, 64, 1366 }) {
+                    for (int height : { 1, 2, 3, 7, 31, 768 }) {
+                        const int bytesPerPixel = getBytesPerPixel(pixelFormat);
+                        const int stride = ((width * bytesPerPixel + 3) / 4) * 4;
+                        std::vector<uint8_t> pixels(static_cast<std::size_t>(stride) * height);
+                        for (auto& byte : pixels) {
+                            byte = static_cast<uint8_t>(random());
+                        }
+
+                        FrameBuffer frame;
+                        frame.data = pixels.data();
+                        frame.width = width;
+                        frame.height = height;
+                        frame.stride = stride;
+                        frame.size = pixels.size();
+                        frame.pixelFormat = pixelFormat;
+
+                        const int chromaWidth = (width + 1) / 2;
+                        const std::size_t lumaSize = static_cast<std::size_t>(width) * height;
+                        const std::size_t chromaSize = static_cast<std::size_t>(chromaWidth) * ((height + 1) / 2);
+
+                        std::vector<uint8_t> serial(lumaSize + 2 * chromaSize);
+                        std::vector<uint8_t> parallel(lumaSize + 2 * chromaSize);
+                        uint8_t* const serialI420[3] = { serial.data(), serial.data() + lumaSize, serial.data() + lumaSize + chromaSize };
+                        uint8_t* const parallelI420[3] = { parallel.data(), parallel.data() + lumaSize, parallel.data() + lumaSize + chromaSize };
+                        const int i420Strides[3] = { width, chromaWidth, chromaWidth };
+                        convertFrameToI420(frame, serialI420, i420Strides);
+                        convertFrameToI420(frame, parallelI420, i420Strides, workerPool);
+                        const bool i420Equal = serial == parallel;
+
+                        uint8_t* const serialNV12[2] = { serial.data(), serial.data() + lumaSize };
+                        uint8_t* const parallelNV12[2] = { parallel.data(), parallel.data() + lumaSize };
+                        const int nv12Strides[2] = { width, 2 * chromaWidth };
+                        convertFrameToNV12(frame, serialNV12, nv12Strides);
+                        convertFrameToNV12(frame, parallelNV12, nv12Strides, workerPool);
+                        const bool nv12Equal = serial == parallel;
+
+                        if (!CHECK(i420Equal && nv12Equal)) {
+                            std::printf("  %d threads differ from one at %dx%d, %d bytes per pixel\n", threadCount, width, height, bytesPerPixel);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main() {
+    testWorkerPool();
+    testBandConversion();
+    return CapUtilsTests::finishTest("ParallelConvertTest");
+}
@@ -0,0 +1,150 @@
+#include "RectCoalescer.hpp"
+#include "TestCheck.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace CapUtils;
+
+namespace {
+
+    constexpr int kRandomSetCount = 5000; // Random rect sets coalesced by each property test
+
+    /*
+    * Random rects, some of them empty or reaching outside the frame the way rects of several outputs do
+    */
+    std::vector<FrameRect> getRandomRects(std::mt19937& random, int maxCount, int frameWidth, int frameHeight) {
+        std::vector<FrameRect> rects(random() % static_cast<unsigned>(maxCount + 1));
+        for (auto& rect : rects) {
+            rect.left = static_cast<int>(random() % static_cast<unsigned>(frameWidth + 40)) - 20;
+            rect.top = static_cast<int>(random() % static_cast<unsigned>(frameHeight + 40)) - 20;
+            rect.right = rect.left + static_cast<int>(random() % 60);
+            rect.bottom = rect.top + static_cast<int>(random() % 60);
+        }
+        return rects;
+    }
+
+    /*
+    * Count how often each pixel of the frame is covered by the coalesced rects
+    */
+    std::vector<int> getCoverage(const std::vector<FrameRect>& rects, int frameWidth, int frameHeight) {
+        std::vector<int> coverage(static_cast<std::size_t>(frameWidth) * frameHeight, 0);
+        for (const auto& rect : rects) {
+            for (int y = rect.top; y < rect.bottom; ++y) {
+                for (int x = rect.left; x < rect.right; ++x) {
+                    ++coverage[static_cast<std::size_t>(y) * frameWidth + x];
+                }
+            }
+        }
+        return coverage;
+    }
+
+    /*
+    * Every coalesced rect lies within the frame with its edges on the tile grid or the frame edge, and every pixel
+    * of the input rects within the frame is covered, whatever the tile size and cost model
+    */
+    void testBoundsAndCoverage() {
+        std::mt19937 random(10);
+        int badRects = 0;
+        int uncoveredSets = 0;
+
+        for (int set = 0; set < kRandomSetCount; ++set) {
+            const int frameWidth = 1 + static_cast<int>(random() % 500);
+            const int frameHeight = 1 + static_cast<int>(random() % 400);
+            RectCostModel costModel;
+            costModel.rectOverheadInPixels = random() % 5000;
+            RectCoalescer coalescer(static_cast<int>(random() % 70), costModel);
+            const int tile = coalescer.getTileSize();
+            const std::vector<FrameRect> rects = getRandomRects(random, 80, frameWidth, frameHeight);
+
+            const std::vector<FrameRect>& coalesced = coalescer.coalesce(rects.data(), static_cast<int>(rects.size()), frameWidth, frameHeight);
+            for (const auto& rect : coalesced) {
+                const bool withinFrame = rect.left >= 0 && rect.top >= 0 && rect.right <= frameWidth && rect.bottom <= frameHeight &&
+                                         rect.left < rect.right && rect.top < rect.bottom;
+                const bool onGrid = rect.left % tile == 0 && rect.top % tile == 0 &&
+                                    (rect.right % tile == 0 || rect.right == frameWidth) &&
+                                    (rect.bottom % tile == 0 || rect.bottom == frameHeight);
+                badRects += (withinFrame && onGrid) ? 0 : 1;
+            }
+            if (badRects != 0) {
+                break;
+            }
+
+            const std::vector<int> coverage = getCoverage(coalesced, frameWidth, frameHeight);
+            bool covered = true;
+            for (const auto& rect : rects) {
+                for (int y = (rect.top > 0) ? rect.top : 0; y < rect.bottom && y < frameHeight; ++y) {
+                    for (int x = (rect.left > 0) ? rect.left : 0; x < rect.right && x < frameWidth; ++x) {
+                        covered = covered && coverage[static_cast<std::size_t>(y) * frameWidth + x] != 0;
+                    }
+                }
+            }
+            if (!covered && uncoveredSets++ == 0) {
+                std::printf("  set %d of %dx%d leaves pixels uncovered, tile %d\n", set, frameWidth, frameHeight, tile);
+            }
+        }
+
+        CHECK(badRects == 0);
+        CHECK(uncoveredSets == 0);
+    }
+
+    /*
+    * Without a per rect overhead no merge adds pixels, so the coalesced rects have to be disjoint
+    */
+    void testDisjointWithoutOverhead() {
+        std::mt19937 random(11);
+        int overlappingSets = 0;
+
+        for (int set = 0; set < kRandomSetCount; ++set) {
+            const int frameWidth = 1 + static_cast<int>(random() % 300);
+            const int frameHeight = 1 + static_cast<int>(random() % 300);
+            RectCostModel costModel;
+            costModel.rectOverheadInPixels = 0;
+            RectCoalescer coalescer(kDefaultCoalesceTileSize, costModel);
+            const std::vector<FrameRect> rects = getRandomRects(random, 40, frameWidth, frameHeight);
+
+            const std::vector<FrameRect>& coalesced = coalescer.coalesce(rects.data(), static_cast<int>(rects.size()), frameWidth, frameHeight);
+            bool disjoint = true;
+            for (int count : getCoverage(coalesced, frameWidth, frameHeight)) {
+                disjoint = disjoint && count <= 1;
+            }
+            overlappingSets += disjoint ? 0 : 1;
+        }
+
+        CHECK(overlappingSets == 0);
+    }
+
+    void testSimpleSets() {
+        RectCoalescer coalescer;
+
+        // Nothing in, nothing out, and rects entirely off the frame are dropped
+        CHECK(coalescer.coalesce(nullptr, 0, 640, 480).empty());
+        const FrameRect offFrame[] = { { -50, -50, -1, -1 }, { 640, 0, 700, 100 } };
+        CHECK(coalescer.coalesce(offFrame, 2, 640, 480).empty());
+        CHECK(coalescer.coalesce(offFrame, 2, 0, 0).empty());
+
+        // Rects on the grid come out unchanged
+        const FrameRect aligned[] = { { 32, 16, 96, 64 } };
+        const std::vector<FrameRect>& single = coalescer.coalesce(aligned, 1, 640, 480);
+        CHECK(single.size() == 1 && single[0].left == 32 && single[0].top == 16 && single[0].right == 96 && single[0].bottom == 64);
+        CHECK(coalescer.getCoveredArea() == 64 * 48);
+        CHECK(coalescer.getCost() == kDefaultRectOverheadInPixels + 64 * 48);
+
+        // Nearby small rects cost less as one rect than as several
+        const FrameRect nearby[] = { { 0, 0, 4, 4 }, { 20, 2, 24, 6 }, { 40, 0, 44, 4 } };
+        CHECK(coalescer.coalesce(nearby, 3, 640, 480).size() == 1);
+
+        // Far apart rects on a large frame stay apart
+        const FrameRect farApart[] = { { 0, 0, 16, 16 }, { 3000, 2000, 3016, 2016 } };
+        CHECK(coalescer.coalesce(farApart, 2, 3840, 2160).size() == 2);
+    }
+}
+
+int main() {
+    testSimpleSets();
+    testBoundsAndCoverage();
+    testDisjointWithoutOverhead();
+    return CapUtilsTests::finishTest("RectCoalescerTest");
+}
@@ -0,0 +1,151 @@
+#include "SPSCRingBuffer.hpp"
+#include "TestCheck.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using namespace CapUtils;
+
+namespace {
+
+    // Entries pushed through the ring by the threaded tests, as many as frames of a day long recording at 60 fps.
+    // Longer runs take the count as first argument
+    constexpr uint64_t kStressEntryCount = 60ull * 60 * 60 * 24;
+
+    void testSingleThread() {
+        SPSCRingBuffer<int> zeroCapacityRing(0);
+        CHECK(zeroCapacityRing.capacity() == 1);
+
+        SPSCRingBuffer<int> ring(3);
+        int value = 0;
+        CHECK(ring.empty());
+        CHECK(!ring.tryPop(value));
+
+        // Several rounds, so the indices wrap around the slots
+        for (int round = 0; round < 5; ++round) {
+            CHECK(ring.tryPush(round * 10 + 1));
+            CHECK(ring.tryPush(round * 10 + 2));
+            CHECK(ring.tryPush(round * 10 + 3));
+            CHECK(ring.full());
+            CHECK(!ring.tryPush(0));
+            CHECK(ring.size() == 3);
+
+            CHECK(ring.tryPop(value) && value == round * 10 + 1);
+            CHECK(ring.tryPush(round * 10 + 4));
+            CHECK(ring.tryPop(value) && value == round * 10 + 2);
+            CHECK(ring.tryPop(value) && value == round * 10 + 3);
+            CHECK(ring.tryPop(value) && value == round * 10 + 4);
+            CHECK(ring.empty());
+        }
+
+        CHECK(ring.tryPush(7));
+        CHECK(ring.tryPush(8));
+        CHECK(ring.tryEvict(value) && value == 7);
+        CHECK(ring.tryPop(value) && value == 8);
+        CHECK(!ring.tryEvict(value));
+    }
+
+    /*
+    * Producer and consumer on two threads. Every entry has to come out exactly once and in order
+    */
+    void testProducerConsumer(uint64_t entryCount) {
+        SPSCRingBuffer<uint64_t> ring(4);
+        uint64_t outOfOrder = 0;
+
+        std::thread consumer([&]() {
+            uint64_t expected = 0;
+            while (expected < entryCount) {
+                uint64_t value = 0;
+                if (!ring.tryPop(value)) {
+                    // Machines with few cores would otherwise spin away the time slice the producer needs
+                    std::this_thread::yield();
+                    continue;
+                }
+                outOfOrder += (value != expected) ? 1 : 0;
+                expected = value + 1;
+            }
+        });
+
+        for (uint64_t i = 0; i < entryCount;) {
+            if (ring.tryPush(i)) {
+                ++i;
+                continue;
+            }
+            std::this_thread::yield();
+        }
+        consumer.join();
+
+        CHECK(outOfOrder == 0);
+        CHECK(ring.empty());
+    }
+
+    /*
+    * Producer evicts the oldest entry whenever the ring is full, as the drop oldest policy does. Every entry has to
+    * be either popped or evicted, never both, and popped entries have to come out in order
+    */
+    void testEvictingProducer(uint64_t entryCount) {
+        SPSCRingBuffer<uint64_t> ring(4);
+        std::vector<uint8_t> seen(entryCount, 0);
+        std::atomic<bool> producerDone{ false };
+        uint64_t poppedCount = 0;
+        uint64_t outOfOrder = 0;
+
+        std::thread consumer([&]() {
+            uint64_t last = 0;
+            bool first = true;
+            while (true) {
+                const bool done = producerDone;
+                uint64_t value = 0;
+                if (!ring.tryPop(value)) {
+                    if (done) {
+                        break;
+                    }
+                    std::this_thread::yield();
+                    continue;
+                }
+                outOfOrder += (!first && value <= last) ? 1 : 0;
+                first = false;
+                last = value;
+                ++seen[value];
+                ++poppedCount;
+            }
+        });
+
+        uint64_t evictedCount = 0;
+        std::vector<uint64_t> evicted;
+        for (uint64_t i = 0; i < entryCount; ++i) {
+            while (!ring.tryPush(i)) {
+                uint64_t oldest = 0;
+                if (ring.tryEvict(oldest)) {
+                    evicted.push_back(oldest);
+                    ++evictedCount;
+                }
+            }
+        }
+        producerDone = true;
+        consumer.join();
+
+        for (uint64_t value : evicted) {
+            ++seen[value];
+        }
+        uint64_t wrongCount = 0;
+        for (uint8_t count : seen) {
+            wrongCount += (count != 1) ? 1 : 0;
+        }
+
+        CHECK(outOfOrder == 0);
+        CHECK(wrongCount == 0);
+        CHECK(poppedCount + evictedCount == entryCount);
+    }
+}
+
+int main(int argc, char** argv) {
+    const uint64_t entryCount = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : kStressEntryCount;
+    testSingleThread();
+    testProducerConsumer(entryCount);
+    testEvictingProducer(entryCount);
+    return CapUtilsTests::finishTest("SPSCRingBufferTest");
+}
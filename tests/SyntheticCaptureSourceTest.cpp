@@ -0,0 +1,91 @@
+#include "CpuCompositor.hpp"
+#include "SyntheticCaptureSource.hpp"
+#include "TestCheck.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+using namespace CapUtils;
+
+namespace {
+
+    bool isSamePicture(const FrameBuffer& a, const FrameBuffer& b) {
+        for (int y = 0; y < a.height; ++y) {
+            if (std::memcmp(a.data + static_cast<std::size_t>(y) * a.stride, b.data + static_cast<std::size_t>(y) * b.stride,
+                            static_cast<std::size_t>(a.width) * 4) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /*
+    * Frames are deterministic, and the moves and dirty rects of each frame turn the previous frame into it,
+    * through every phase of the scene. Replaying them with the CPU compositor must give the grabbed frame
+    */
+    void testScene(int width, int height, int fps) {
+        FramePool framePool(width, height, FramePixelFormat::BGRA, 4, 3, 3);
+        SyntheticCaptureSource source(width, height, fps, 7);
+        SyntheticCaptureSource twin(width, height, fps, 7);
+        FrameBuffer* previous = framePool.acquire();
+        FrameBuffer* current = framePool.acquire();
+        FrameBuffer* twinFrame = framePool.acquire();
+        const CpuCompositor compositor;
+
+        CHECK(source.grab(*previous) && twin.grab(*twinFrame));
+        CHECK(previous->timestamp == 0 && isSamePicture(*previous, *twinFrame));
+
+        // Two rounds through all four phases
+        const int frameCount = fps * kSyntheticPhaseSeconds * 4 * 2 + 1;
+        int wrongMetadata = 0;
+        int nondeterministic = 0;
+        int wrongReplays = 0;
+        int64_t moveCount = 0;
+        int64_t dirtyCount = 0;
+        int64_t staticFrames = 0;
+        for (int i = 1; i < frameCount; ++i) {
+            if (!CHECK(source.grab(*current) && twin.grab(*twinFrame))) {
+                break;
+            }
+            wrongMetadata += (current->sequence == i && current->rects.valid && current->timestamp > previous->timestamp) ? 0 : 1;
+            nondeterministic += isSamePicture(*current, *twinFrame) ? 0 : 1;
+
+            const FrameRectMetadata& rects = current->rects;
+            moveCount += static_cast<int64_t>(rects.moveRects.size());
+            dirtyCount += static_cast<int64_t>(rects.dirtyRects.size());
+            staticFrames += (rects.moveRects.empty() && rects.dirtyRects.empty()) ? 1 : 0;
+            const bool composed = compositor.compose(*current, SurfaceRotation::IDENTITY,
+                                                     rects.moveRects.data(), static_cast<int>(rects.moveRects.size()),
+                                                     rects.dirtyRects.data(), static_cast<int>(rects.dirtyRects.size()),
+                                                     *previous, 0, 0);
+            if ((!composed || !isSamePicture(*current, *previous)) && wrongReplays++ == 0) {
+                std::printf("  rects of frame %d at %dx%d do not describe the change\n", i, width, height);
+            }
+            std::swap(previous, current);
+        }
+
+        CHECK(wrongMetadata == 0);
+        CHECK(nondeterministic == 0);
+        CHECK(wrongReplays == 0);
+
+        // Frames large enough for the scene have moves, dirty rects and the static phase
+        if (width >= 640 && height >= 360) {
+            CHECK(moveCount > 0 && dirtyCount > 0 && staticFrames > 0);
+        }
+
+        framePool.release(previous);
+        framePool.release(current);
+        framePool.release(twinFrame);
+    }
+}
+
+int main() {
+    testScene(1, 1, 1);
+    testScene(37, 23, 5);
+    testScene(300, 900, 3);
+    testScene(640, 360, 10);
+    testScene(1280, 720, 30);
+    return CapUtilsTests::finishTest("SyntheticCaptureSourceTest");
+}
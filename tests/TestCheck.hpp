@@ -0,0 +1,42 @@
+#pragma once
+
+#include "LogUtil.hpp"
+
+#include <cstdio>
+#include <memory>
+#include <string>
+
+namespace CapUtilsTests {
+
+    inline int failedChecks = 0; // Number of checks that failed in this test program
+
+    /**
+     * Helper function to record the outcome of a check and print it if it failed
+     */
+    inline bool check(bool passed, const char* expression, const char* fileName, int lineNumber) {
+        if (!passed) {
+            ++failedChecks;
+            std::printf("%s:%d: check failed: %s\n", fileName, lineNumber, expression);
+        }
+        return passed;
+    }
+
+    /**
+     * Helper function to let modules that log write to a file of the test instead of a logger that was never created
+     */
+    inline void openTestLog(const std::string& testName) {
+        LogUtils::appLogger = std::make_unique<LogUtils::ALogger>(testName + ".log", LogUtils::LogLevel::INFO);
+    }
+
+    /**
+     * Helper function to print the result of a test program
+     *
+     * @return  Exit code of the test program.
+     */
+    inline int finishTest(const char* testName) {
+        std::printf("%s: %s\n", testName, failedChecks == 0 ? "passed" : "FAILED");
+        return failedChecks == 0 ? 0 : 1;
+    }
+}
+
+#define CHECK(condition) CapUtilsTests::check((condition), #condition, __FILE__, __LINE__)
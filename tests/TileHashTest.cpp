@@ -0,0 +1,163 @@
+#include "ColorConvert.hpp"
+#include "TestCheck.hpp"
+#include "TileHash.hpp"
+#include "WorkerPool.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace CapUtils;
+
+namespace {
+
+    /*
+    * Frame with padded rows, as GDI DIBs of odd BGR24 widths have
+    */
+    struct TestFrame {
+        TestFrame(int width, int height, FramePixelFormat pixelFormat) :
+            bytesPerPixel(getBytesPerPixel(pixelFormat)),
+            pixels(static_cast<std::size_t>(((width * bytesPerPixel + 3) / 4) * 4) * height) {
+            frame.data = pixels.data();
+            frame.width = width;
+            frame.height = height;
+            frame.stride = ((width * bytesPerPixel + 3) / 4) * 4;
+            frame.size = pixels.size();
+            frame.pixelFormat = pixelFormat;
+        }
+
+        uint8_t* getPixel(int x, int y) {
+            return pixels.data() + static_cast<std::size_t>(y) * frame.stride + x * bytesPerPixel;
+        }
+
+        int bytesPerPixel;
+        std::vector<uint8_t> pixels;
+        FrameBuffer frame;
+    };
+
+    /*
+    * Row kernels of every instruction set have to produce the same accumulators as the scalar kernel, for any row
+    * length and tile width, including short last segments and segments not a multiple of a stripe
+    */
+    void testRowKernels() {
+        const TileHashRowFn scalarFn = getScalarTileHashRowFn();
+        const TileHashRowFn avx2Fn = getAVX2TileHashRowFn();
+        if (avx2Fn == nullptr || getSupportedColorConvertIsa() < ColorConvertIsa::AVX2) {
+            std::printf("AVX2 row kernel is not available, only the scalar kernel is tested\n");
+            return;
+        }
+
+        std::mt19937 random(11);
+        int mismatches = 0;
+        for (int i = 0; i < 2000; ++i) {
+            const int rowBytes = 1 + static_cast<int>(random() % 3000);
+            const int tileBytes = 8 + static_cast<int>(random() % 300);
+            const int tileCount = (rowBytes + tileBytes - 1) / tileBytes;
+            std::vector<uint8_t> row(rowBytes);
+            for (auto& byte : row) {
+                byte = static_cast<uint8_t>(random());
+            }
+
+            // Accumulators carry state over from the previous rows of the tile row
+            std::vector<uint64_t> scalarAcc(static_cast<std::size_t>(tileCount) * kTileHashLanes);
+            for (auto& acc : scalarAcc) {
+                acc = (static_cast<uint64_t>(random()) << 32) | random();
+            }
+            std::vector<uint64_t> avx2Acc = scalarAcc;
+
+            scalarFn(row.data(), rowBytes, tileBytes, scalarAcc.data());
+            avx2Fn(row.data(), rowBytes, tileBytes, avx2Acc.data());
+            if (scalarAcc != avx2Acc && mismatches++ == 0) {
+                std::printf("  AVX2 differs from scalar for %d row bytes in tiles of %d bytes\n", rowBytes, tileBytes);
+            }
+        }
+        CHECK(mismatches == 0);
+    }
+
+    void testChangeDetector() {
+        for (FramePixelFormat pixelFormat : { FramePixelFormat::BGR24, FramePixelFormat::BGRA }) {
+            TestFrame test(301, 199, pixelFormat);
+            std::mt19937 random(12);
+            for (auto& byte : test.pixels) {
+                byte = static_cast<uint8_t>(random());
+            }
+
+            TileChangeDetector detector(64);
+            const int tileCount = 5 * 4;
+
+            // First frame is dirty everywhere, the same frame again nowhere
+            CHECK(detector.detect(test.frame) == tileCount);
+            CHECK(test.frame.changes.detected && !test.frame.changes.unchanged);
+            CHECK(test.frame.changes.columns == 5 && test.frame.changes.rows == 4);
+            CHECK(detector.detect(test.frame) == 0);
+            CHECK(test.frame.changes.unchanged);
+
+            // A single changed byte marks its tile only, also in the partial tiles at the right and bottom edges
+            const int points[][2] = { { 0, 0 }, { 130, 70 }, { 300, 198 }, { 256, 0 }, { 0, 192 } };
+            for (const auto& point : points) {
+                test.getPixel(point[0], point[1])[1] ^= 0x10;
+                const bool singleTile = detector.detect(test.frame) == 1;
+                const int index = (point[1] / 64) * 5 + point[0] / 64;
+                if (!CHECK(singleTile && test.frame.changes.dirtyTiles[index] == 1)) {
+                    std::printf("  change at %d,%d is not reported in tile %d alone\n", point[0], point[1], index);
+                }
+            }
+
+            // Swapping two pixels within a tile keeps every byte value but must change the hash
+            uint8_t* first = test.getPixel(10, 10);
+            uint8_t* second = test.getPixel(40, 50);
+            first[0] = 1;
+            second[0] = 2;
+            detector.detect(test.frame);
+            first[0] = 2;
+            second[0] = 1;
+            CHECK(detector.detect(test.frame) == 1);
+
+            // Row padding is not part of the picture
+            if (test.frame.stride > test.frame.width * test.bytesPerPixel) {
+                test.pixels[test.frame.stride - 1] ^= 0xFF;
+                CHECK(detector.detect(test.frame) == 0);
+            }
+
+            // A new size starts over
+            TestFrame smaller(64, 64, pixelFormat);
+            CHECK(detector.detect(smaller.frame) == 1 && !smaller.frame.changes.unchanged);
+
+            // After rects were marked, hashes no longer describe the previous frame
+            smaller.frame.rects.dirtyRects.push_back({ 0, 0, 1, 1 });
+            CHECK(detector.markRects(smaller.frame) == 1);
+            CHECK(detector.detect(smaller.frame) == 1);
+        }
+    }
+
+    /*
+    * Hashing bands of tile rows on a worker pool has to find the same tiles as hashing on one thread
+    */
+    void testParallelDetect() {
+        std::mt19937 random(13);
+        WorkerPool workerPool(3);
+        TileChangeDetector serialDetector(48);
+        TileChangeDetector parallelDetector(48);
+        TestFrame test(1000, 700, FramePixelFormat::BGR24);
+        int mismatches = 0;
+
+        for (int i = 0; i < 50; ++i) {
+            for (int change = 0; change < 5; ++change) {
+                test.pixels[random() % test.pixels.size()] ^= static_cast<uint8_t>(1 + random() % 255);
+            }
+            FrameBuffer parallelFrame = test.frame;
+            const int serialCount = serialDetector.detect(test.frame);
+            const int parallelCount = parallelDetector.detect(parallelFrame, workerPool);
+            mismatches += (serialCount != parallelCount || test.frame.changes.dirtyTiles != parallelFrame.changes.dirtyTiles) ? 1 : 0;
+        }
+        CHECK(mismatches == 0);
+    }
+}
+
+int main() {
+    testRowKernels();
+    testChangeDetector();
+    testParallelDetect();
+    return CapUtilsTests::finishTest("TileHashTest");
+}
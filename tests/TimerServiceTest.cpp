@@ -0,0 +1,207 @@
+#include "DeadlineScheduler.hpp"
+#include "TestCheck.hpp"
+#include "TimerService.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace CapUtils;
+using namespace std::chrono_literals;
+
+namespace {
+
+    /**
+     * Helper function to wait until condition holds, for at most timeout
+     *
+     * @return  False if timeout passed first.
+     */
+    template <typename Condition>
+    bool waitUntil(Condition condition, std::chrono::milliseconds timeout) {
+        const auto endTime = std::chrono::steady_clock::now() + timeout;
+        while (!condition()) {
+            if (std::chrono::steady_clock::now() > endTime) {
+                return false;
+            }
+            std::this_thread::sleep_for(1ms);
+        }
+        return true;
+    }
+
+    /*
+    * Raise peak to value unless it is higher already
+    */
+    void updatePeak(std::atomic<int>& peak, int value) {
+        int current = peak.load();
+        while (value > current && !peak.compare_exchange_weak(current, value)) {
+        }
+    }
+
+    /*
+    * Three timers due 5, 8 and 11 ms after a quantum boundary fire together at the next boundary, every round. None
+    * fires before the last of them is due, and they all fire within a fraction of the quantum, instead of 3 ms apart
+    */
+    void testSameQuantum() {
+        constexpr auto kQuantum = 50ms;
+        constexpr int kRounds = 5;
+        constexpr int kTimerCount = 3;
+
+        const auto serviceCreateTime = std::chrono::steady_clock::now();
+        TimerService service(4, kQuantum);
+
+        // Deadlines are 100 ms apart, two quanta, so each timer keeps its offset to the quantum boundaries
+        std::vector<std::unique_ptr<DeadlineScheduler>> schedulers;
+        std::vector<std::chrono::steady_clock::time_point> startTimes(kTimerCount);
+        std::chrono::steady_clock::time_point fireTimes[kTimerCount][kRounds];
+        std::atomic<int> fireCounts[kTimerCount] = {};
+        std::vector<uint64_t> timerIds;
+        for (int i = 0; i < kTimerCount; ++i) {
+            schedulers.push_back(std::make_unique<DeadlineScheduler>(10, MissedTickPolicy::SKIP));
+            std::this_thread::sleep_until(serviceCreateTime + kQuantum + 5ms + i * 3ms);
+            startTimes[i] = std::chrono::steady_clock::now();
+            schedulers[i]->start();
+            DeadlineScheduler& scheduler = *schedulers[i];
+            auto& times = fireTimes[i];
+            std::atomic<int>& fireCount = fireCounts[i];
+            timerIds.push_back(service.addTimer(scheduler, [&scheduler, &times, &fireCount]() {
+                times[fireCount] = std::chrono::steady_clock::now();
+                scheduler.takeTick();
+                return ++fireCount < kRounds;
+            }));
+        }
+
+        // Quantum boundaries count from the service start, which is just after serviceCreateTime
+        CHECK(startTimes[kTimerCount - 1] < serviceCreateTime + 2 * kQuantum);
+
+        const bool allFired = waitUntil([&]() {
+            return fireCounts[0] == kRounds && fireCounts[1] == kRounds && fireCounts[2] == kRounds;
+        }, 2000ms);
+        CHECK(allFired);
+        for (uint64_t timerId : timerIds) {
+            service.removeTimer(timerId);
+        }
+
+        int earlyFires = 0;
+        int spreadRounds = 0;
+        for (int round = 0; round < kRounds && allFired; ++round) {
+            const auto lastDueTime = startTimes[kTimerCount - 1] + round * 100ms;
+            auto firstFire = fireTimes[0][round];
+            auto lastFire = fireTimes[0][round];
+            for (int i = 0; i < kTimerCount; ++i) {
+                earlyFires += (fireTimes[i][round] >= lastDueTime) ? 0 : 1;
+                firstFire = std::min(firstFire, fireTimes[i][round]);
+                lastFire = std::max(lastFire, fireTimes[i][round]);
+            }
+            if (lastFire - firstFire >= kQuantum / 2) {
+                ++spreadRounds;
+                std::printf("  round %d fired over %lld us\n", round,
+                            static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(lastFire - firstFire).count()));
+            }
+        }
+        CHECK(earlyFires == 0);
+        CHECK(spreadRounds == 0);
+    }
+
+    /*
+    * A timer always due again, as its callback takes longer than its period, never runs its callback twice at once,
+    * while callbacks of two such timers do run at the same time on different workers
+    */
+    void testNoOverlap() {
+        TimerService service(4, 1ms);
+        DeadlineScheduler fastScheduler(1000, MissedTickPolicy::CATCH_UP);
+        DeadlineScheduler otherScheduler(1000, MissedTickPolicy::CATCH_UP);
+        std::atomic<int> fastRunning{ 0 };
+        std::atomic<int> peakFastRunning{ 0 };
+        std::atomic<int> anyRunning{ 0 };
+        std::atomic<int> peakAnyRunning{ 0 };
+        std::atomic<int> fastCalls{ 0 };
+
+        fastScheduler.start();
+        otherScheduler.start();
+        const uint64_t fastTimer = service.addTimer(fastScheduler, [&]() {
+            updatePeak(peakFastRunning, ++fastRunning);
+            updatePeak(peakAnyRunning, ++anyRunning);
+            fastScheduler.takeTick();
+            std::this_thread::sleep_for(3ms);
+            --anyRunning;
+            --fastRunning;
+            ++fastCalls;
+            return true;
+        });
+        const uint64_t otherTimer = service.addTimer(otherScheduler, [&]() {
+            updatePeak(peakAnyRunning, ++anyRunning);
+            otherScheduler.takeTick();
+            std::this_thread::sleep_for(3ms);
+            --anyRunning;
+            return true;
+        });
+
+        CHECK(waitUntil([&]() { return fastCalls >= 50; }, 5000ms));
+        service.removeTimer(fastTimer);
+        service.removeTimer(otherTimer);
+        CHECK(peakFastRunning == 1);
+        CHECK(peakAnyRunning == 2);
+    }
+
+    /*
+    * Removing a timer whose callback is running waits for the callback to return, and it is not called again
+    */
+    void testRemoveWhileRunning() {
+        TimerService service(2, 1ms);
+        DeadlineScheduler scheduler(100, MissedTickPolicy::SKIP);
+        std::atomic<bool> entered{ false };
+        std::atomic<bool> returned{ false };
+        std::atomic<int> calls{ 0 };
+
+        scheduler.start();
+        const uint64_t timerId = service.addTimer(scheduler, [&]() {
+            ++calls;
+            scheduler.takeTick();
+            entered = true;
+            std::this_thread::sleep_for(100ms);
+            returned = true;
+            return true;
+        });
+
+        CHECK(waitUntil([&]() { return entered.load(); }, 2000ms));
+        service.removeTimer(timerId);
+        CHECK(returned);
+        const int callsAtRemoval = calls;
+        std::this_thread::sleep_for(50ms);
+        CHECK(calls == callsAtRemoval);
+    }
+
+    /*
+    * A callback returning false removes its timer. Removing it once more returns right away
+    */
+    void testFalseRemoves() {
+        TimerService service(2, 1ms);
+        DeadlineScheduler scheduler(200, MissedTickPolicy::CATCH_UP);
+        std::atomic<int> calls{ 0 };
+
+        scheduler.start();
+        const uint64_t timerId = service.addTimer(scheduler, [&]() {
+            scheduler.takeTick();
+            return ++calls < 3;
+        });
+
+        CHECK(waitUntil([&]() { return calls >= 3; }, 2000ms));
+        std::this_thread::sleep_for(50ms);
+        CHECK(calls == 3);
+        service.removeTimer(timerId);
+        CHECK(timerId != 0);
+    }
+}
+
+int main() {
+    testSameQuantum();
+    testNoOverlap();
+    testRemoveWhileRunning();
+    testFalseRemoves();
+    return CapUtilsTests::finishTest("TimerServiceTest");
+}
@@ -0,0 +1,241 @@
+#include "TestCheck.hpp"
+#include "X11CaptureSource.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <X11/Xlib.h>
+
+using namespace CapUtils;
+
+namespace {
+
+    constexpr int kRootWidth = 320;
+    constexpr int kRootHeight = 240;
+    constexpr uint32_t kFillColor = 0xFF8040; // Red 0xFF, green 0x80, blue 0x40
+
+    /*
+    * Xvfb server started for the test, on a display number it picks itself
+    */
+    struct VirtualDisplay {
+        pid_t pid = -1;
+        std::string name;
+    };
+
+    /**
+     * Helper function to start Xvfb with a black 24 bit root window
+     *
+     * @return  False if the server did not come up.
+     */
+    bool startVirtualDisplay(const char* xvfbPath, VirtualDisplay& virtualDisplay) {
+        int displayPipe[2];
+        if (pipe(displayPipe) != 0) {
+            return false;
+        }
+        const pid_t pid = fork();
+        if (pid == 0) {
+            close(displayPipe[0]);
+            const std::string displayFd = std::to_string(displayPipe[1]);
+            const std::string screen = std::to_string(kRootWidth) + "x" + std::to_string(kRootHeight) + "x24";
+            execl(xvfbPath, "Xvfb", "-displayfd", displayFd.c_str(), "-screen", "0", screen.c_str(), "-nolisten", "tcp",
+                  "-br", static_cast<char*>(nullptr));
+            _exit(127);
+        }
+        close(displayPipe[1]);
+        if (pid < 0) {
+            close(displayPipe[0]);
+            return false;
+        }
+        virtualDisplay.pid = pid;
+
+        // Xvfb writes its display number once it accepts connections, or closes the pipe when it fails to start
+        std::string number;
+        char digit = 0;
+        while (read(displayPipe[0], &digit, 1) == 1 && digit != '\n') {
+            number += digit;
+        }
+        close(displayPipe[0]);
+        virtualDisplay.name = ":" + number;
+        return !number.empty();
+    }
+
+    void stopVirtualDisplay(VirtualDisplay& virtualDisplay) {
+        if (virtualDisplay.pid > 0) {
+            kill(virtualDisplay.pid, SIGTERM);
+            waitpid(virtualDisplay.pid, nullptr, 0);
+        }
+        virtualDisplay.pid = -1;
+    }
+
+    /**
+     * Helper function to fill a rect of the root window over a connection of its own, as another client would
+     */
+    void fillRootRect(Display* painter, int x, int y, int width, int height) {
+        const Window rootWindow = DefaultRootWindow(painter);
+        GC gc = XCreateGC(painter, rootWindow, 0, nullptr);
+        XSetForeground(painter, gc, kFillColor);
+        XFillRectangle(painter, rootWindow, gc, x, y, static_cast<unsigned int>(width), static_cast<unsigned int>(height));
+        XFreeGC(painter, gc);
+        XSync(painter, False);
+    }
+
+    /**
+     * Helper function to count pixels of frame that differ from the expected picture, i.e. the fill color within the
+     * filled rects given in frame coordinates and black elsewhere. The padding byte is not compared
+     */
+    int countWrongPixels(const FrameBuffer& frame, const FrameRect* filledRects, int filledCount) {
+        int wrongPixels = 0;
+        for (int y = 0; y < frame.height; ++y) {
+            const uint8_t* row = frame.data + static_cast<std::size_t>(y) * frame.stride;
+            for (int x = 0; x < frame.width; ++x) {
+                bool filled = false;
+                for (int i = 0; i < filledCount; ++i) {
+                    filled = filled || (x >= filledRects[i].left && x < filledRects[i].right &&
+                                        y >= filledRects[i].top && y < filledRects[i].bottom);
+                }
+                const uint8_t* pixel = row + static_cast<std::size_t>(x) * 4;
+                const bool expected = filled ? (pixel[0] == 0x40 && pixel[1] == 0x80 && pixel[2] == 0xFF) :
+                                               (pixel[0] == 0 && pixel[1] == 0 && pixel[2] == 0);
+                wrongPixels += expected ? 0 : 1;
+            }
+        }
+        return wrongPixels;
+    }
+
+    /**
+     * Helper function to check that the dirty rects of frame lie within it and cover rect
+     */
+    bool isCoveredByDirtyRects(const FrameBuffer& frame, const FrameRect& rect) {
+        for (const FrameRect& dirtyRect : frame.rects.dirtyRects) {
+            if (dirtyRect.left < 0 || dirtyRect.top < 0 || dirtyRect.right > frame.width || dirtyRect.bottom > frame.height) {
+                return false;
+            }
+        }
+        for (int y = rect.top; y < rect.bottom; ++y) {
+            for (int x = rect.left; x < rect.right; ++x) {
+                bool covered = false;
+                for (const FrameRect& dirtyRect : frame.rects.dirtyRects) {
+                    covered = covered || (x >= dirtyRect.left && x < dirtyRect.right && y >= dirtyRect.top && y < dirtyRect.bottom);
+                }
+                if (!covered) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    int64_t getWallClockTime() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    /*
+    * Regions that do not lie within the root window are refused
+    */
+    void testOpen(const std::string& displayName) {
+        X11CaptureSource inside(0, 0, kRootWidth, kRootHeight);
+        CHECK(inside.open(displayName));
+        X11CaptureSource tooWide(1, 0, kRootWidth, kRootHeight);
+        CHECK(!tooWide.open(displayName));
+        X11CaptureSource negative(-1, 0, 16, 16);
+        CHECK(!negative.open(displayName));
+        X11CaptureSource empty(0, 0, 0, 16);
+        CHECK(!empty.open(displayName));
+    }
+
+    /*
+    * Another client fills rects of the root window between grabs. Frames grabbed into shared memory and, through the
+    * staging segment, into heap frames with a wider stride show exactly those rects in region coordinates, with the
+    * damage covering them where DAMAGE is available, and come with capture timestamps, sequence and cursor
+    */
+    void testGrab(const std::string& displayName) {
+        constexpr int kRegionX = 16;
+        constexpr int kRegionY = 8;
+        constexpr int kRegionWidth = 250; // Rows of 1000 bytes, so heap frames aligned to 64 bytes are padded
+        constexpr int kRegionHeight = 200;
+
+        Display* painter = XOpenDisplay(displayName.c_str());
+        if (!CHECK(painter != nullptr)) {
+            return;
+        }
+        X11CaptureSource source(kRegionX, kRegionY, kRegionWidth, kRegionHeight);
+        if (!CHECK(source.open(displayName))) {
+            XCloseDisplay(painter);
+            return;
+        }
+        std::printf("  DAMAGE %s\n", source.hasDamage() ? "available" : "not available");
+
+        FramePool shmPool(kRegionWidth, kRegionHeight, source.getPixelFormat(), source.getRowAlignment(), 1, 1,
+                          source.getFrameAllocator());
+        FramePool heapPool(kRegionWidth, kRegionHeight, source.getPixelFormat(), 64, 1, 1);
+        FrameBuffer* shmFrame = shmPool.acquire();
+        FrameBuffer* heapFrame = heapPool.acquire();
+        if (!CHECK(shmFrame != nullptr && heapFrame != nullptr && heapFrame->stride == 1024)) {
+            XCloseDisplay(painter);
+            return;
+        }
+
+        // First frame is black and, not knowing what changed before, entirely dirty
+        const int64_t startTime = getWallClockTime();
+        CHECK(source.grab(*shmFrame));
+        CHECK(shmFrame->sequence == 0 && shmFrame->timestamp >= startTime && shmFrame->timestamp <= getWallClockTime());
+        CHECK(countWrongPixels(*shmFrame, nullptr, 0) == 0);
+        if (source.hasDamage()) {
+            CHECK(shmFrame->rects.valid && shmFrame->rects.dirtyRects.size() == 1 &&
+                  isCoveredByDirtyRects(*shmFrame, { 0, 0, kRegionWidth, kRegionHeight }));
+        }
+
+        // One rect well inside the region and one reaching over its top left corner
+        fillRootRect(painter, 40, 30, 64, 48);
+        fillRootRect(painter, 0, 0, 20, 12);
+        const FrameRect filledRects[] = { { 24, 22, 88, 70 }, { 0, 0, 4, 4 } };
+        const int64_t previousTimestamp = shmFrame->timestamp;
+        CHECK(source.grab(*shmFrame));
+        CHECK(shmFrame->sequence == 1 && shmFrame->timestamp >= previousTimestamp);
+        const int wrongPixels = countWrongPixels(*shmFrame, filledRects, 2);
+        if (!CHECK(wrongPixels == 0)) {
+            std::printf("  %d pixels of the shared memory frame differ\n", wrongPixels);
+        }
+        if (source.hasDamage()) {
+            CHECK(shmFrame->rects.valid && isCoveredByDirtyRects(*shmFrame, filledRects[0]) &&
+                  isCoveredByDirtyRects(*shmFrame, filledRects[1]));
+        }
+        CHECK(shmFrame->cursor.valid);
+
+        // Nothing drawn since, so nothing is damaged
+        CHECK(source.grab(*heapFrame));
+        CHECK(heapFrame->sequence == 2 && countWrongPixels(*heapFrame, filledRects, 2) == 0);
+        if (source.hasDamage()) {
+            CHECK(heapFrame->rects.valid && heapFrame->rects.dirtyRects.empty());
+        }
+
+        shmPool.release(shmFrame);
+        heapPool.release(heapFrame);
+        XCloseDisplay(painter);
+    }
+}
+
+/*
+* Runs against an Xvfb server started by the test. Registered with the path of Xvfb as the only argument
+*/
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::printf("Usage: %s <path of Xvfb>\n", argv[0]);
+        return 2;
+    }
+    VirtualDisplay virtualDisplay;
+    if (CHECK(startVirtualDisplay(argv[1], virtualDisplay))) {
+        testOpen(virtualDisplay.name);
+        testGrab(virtualDisplay.name);
+    }
+    stopVirtualDisplay(virtualDisplay);
+    return CapUtilsTests::finishTest("X11CaptureSourceTest");
+}
@@ -0,0 +1,132 @@
+#include "CaptureTraceRecorder.hpp"
+#include "LatencyHistogram.hpp"
+#include "X11CaptureSource.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include <X11/Xlib.h>
+
+using namespace CapUtils;
+
+namespace {
+
+    /**
+     * Helper function to get the size of the root window of a display
+     *
+     * @return  False if the display cannot be opened.
+     */
+    bool getRootSize(const std::string& displayName, int& width, int& height) {
+        Display* display = XOpenDisplay(displayName.empty() ? nullptr : displayName.c_str());
+        if (display == nullptr) {
+            return false;
+        }
+        width = DisplayWidth(display, DefaultScreen(display));
+        height = DisplayHeight(display, DefaultScreen(display));
+        XCloseDisplay(display);
+        return true;
+    }
+}
+
+/*
+* Grabs a region of an X11 display at a fixed frame rate through X11CaptureSource and records the frames to a capture
+* trace, which TraceCaptureSource replays on Windows and RectCoalescerBench reads the dirty rects of. Prints how long
+* grabs took and how much of each frame was damaged.
+*
+* X11Record <trace file> <frame count> <fps> [display] [x y width height]
+*/
+int main(int argc, char** argv) {
+    if (argc != 4 && argc != 5 && argc != 9) {
+        std::printf("Usage: %s <trace file> <frame count> <fps> [display] [x y width height]\n", argv[0]);
+        return 2;
+    }
+    const std::string traceFileName = argv[1];
+    const int frameCount = std::atoi(argv[2]);
+    const int fps = std::atoi(argv[3]);
+    const std::string displayName = (argc >= 5) ? argv[4] : "";
+    if (frameCount <= 0 || fps <= 0) {
+        std::printf("Frame count and fps have to be positive\n");
+        return 2;
+    }
+
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+    if (argc == 9) {
+        x = std::atoi(argv[5]);
+        y = std::atoi(argv[6]);
+        width = std::atoi(argv[7]);
+        height = std::atoi(argv[8]);
+    }
+    else if (!getRootSize(displayName, width, height)) {
+        std::printf("Cannot open display %s\n", displayName.c_str());
+        return 1;
+    }
+
+    X11CaptureSource source(x, y, width, height);
+    if (!source.open(displayName)) {
+        std::printf("Cannot grab %dx%d at %d,%d through MIT-SHM on display %s\n", width, height, x, y, displayName.c_str());
+        return 1;
+    }
+    CaptureTraceRecorder recorder;
+    if (!recorder.open(traceFileName, width, height, source.getPixelFormat())) {
+        std::printf("Cannot create capture trace %s\n", traceFileName.c_str());
+        return 1;
+    }
+    FramePool framePool(width, height, source.getPixelFormat(), source.getRowAlignment(), 1, 1, source.getFrameAllocator());
+    FrameBuffer* frame = framePool.acquire();
+    if (frame == nullptr) {
+        std::printf("Cannot allocate a shared memory frame\n");
+        return 1;
+    }
+
+    LatencyHistogram grabLatency;
+    int failedGrabs = 0;
+    int64_t dirtyRects = 0;
+    int64_t dirtyPixels = 0;
+    const auto framePeriod = std::chrono::microseconds(1000000 / fps);
+    auto dueTime = std::chrono::steady_clock::now();
+    for (int i = 0; i < frameCount; ++i) {
+        std::this_thread::sleep_until(dueTime);
+        dueTime += framePeriod;
+
+        const auto grabStartTime = std::chrono::steady_clock::now();
+        if (!source.grab(*frame)) {
+            ++failedGrabs;
+            continue;
+        }
+        grabLatency.recordSince(grabStartTime);
+        for (const FrameRect& rect : frame->rects.dirtyRects) {
+            dirtyPixels += static_cast<int64_t>(rect.right - rect.left) * (rect.bottom - rect.top);
+        }
+        dirtyRects += static_cast<int64_t>(frame->rects.dirtyRects.size());
+        if (!recorder.recordFrame(*frame)) {
+            std::printf("Cannot write capture trace %s\n", traceFileName.c_str());
+            break;
+        }
+    }
+    framePool.release(frame);
+    recorder.close();
+
+    const LatencySummary grabs = grabLatency.getSummary();
+    const double grabbedFrames = (grabs.count > 0) ? static_cast<double>(grabs.count) : 1.0;
+    std::printf("%llu of %d frames of %dx%d grabbed, %d failed\n", static_cast<unsigned long long>(grabs.count), frameCount,
+                width, height, failedGrabs);
+    std::printf("grab time: mean %lld us, p50 %lld us, p99 %lld us, max %lld us\n", static_cast<long long>(grabs.meanInUs),
+                static_cast<long long>(grabs.p50InUs), static_cast<long long>(grabs.p99InUs), static_cast<long long>(grabs.maxInUs));
+    if (source.hasDamage()) {
+        std::printf("damage per frame: %.1f rects, %.0f pixels\n", dirtyRects / grabbedFrames, dirtyPixels / grabbedFrames);
+    }
+    else {
+        std::printf("no damage rects, the display or the build lacks DAMAGE\n");
+    }
+    std::printf("%lld frames written to %s, %lld dropped, %lld bytes\n", static_cast<long long>(recorder.getFrameCount()),
+                traceFileName.c_str(), static_cast<long long>(recorder.getDroppedFrames()),
+                static_cast<long long>(recorder.getWrittenBytes()));
+    return 0;
+}